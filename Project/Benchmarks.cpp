@@ -0,0 +1,1692 @@
+#include "Benchmarks.h"
+#include "ConstantRing.h"
+#include "StateCache.h"
+#include "CollisionBatch.h"
+#include "SpatialGrid.h"
+#include "JobSystem.h"
+#include "Profiler.h"
+#include "GpuTimer.h"
+#include "RenderDeviceRecording.h"
+#include "RenderDeviceSoftware.h"
+
+#include <iostream>
+#include <string>
+#include <cstring>
+#include <cstdio>
+#include <random>
+#include <algorithm>
+
+using namespace GW;
+using namespace CORE;
+using namespace SYSTEM;
+using namespace GRAPHICS;
+
+// Steps and packs 1k to 100k balloon instances into the instance buffer's layout, against moving
+// each balloon and building its constants the way the per-balloon draws did, with
+// XMMatrixTranslationFromVector(), XMMatrixScaling() and a transpose. Fails if a packed matrix
+// differs from the per-balloon one.
+int RunPackBenchmark()
+{
+	const unsigned int instanceCounts[] = { 1000, 10000, 100000 };
+	const float dt = 1.0f / 60.0f;
+	std::mt19937 random(1234);
+	std::uniform_real_distribution<float> position(-50.0f, 50.0f), unit(0.0f, 1.0f);
+	bool matched = true;
+	for (unsigned int instanceCount : instanceCounts)
+	{
+		InstanceBatch batch;
+		batch.Reserve(instanceCount);
+		std::vector<XMFLOAT4> positions(instanceCount), colors(instanceCount);
+		std::vector<XMFLOAT3> axes(instanceCount);
+		for (unsigned int i = 0; i < instanceCount; i++)
+		{
+			positions[i] = XMFLOAT4(position(random), position(random), position(random), 1.0f);
+			axes[i] = XMFLOAT3(unit(random), unit(random), unit(random));
+			colors[i] = XMFLOAT4(unit(random), unit(random), unit(random), 1.0f);
+			batch.Add(positions[i], axes[i], colors[i]);
+		}
+		std::vector<PerObjectConstants> objects(instanceCount);
+		std::vector<PerMaterialConstants> materials(instanceCount);
+
+		double packSeconds = 0.0, perBalloonSeconds = 0.0;
+		unsigned long long packed = 0;
+		float time = 0.0f;
+		for (unsigned int run = 0; packSeconds < 0.5 || run < 3; run++)
+		{
+			time += dt;
+			Stopwatch stopwatch;
+			batch.Step(time, dt);
+			batch.Pack();
+			packSeconds += stopwatch.Seconds();
+			stopwatch.Restart();
+			float offset = sin(time * 2.0f) * InstanceBatch::BobSpeed * dt;
+			for (unsigned int i = 0; i < instanceCount; i++)
+			{
+				positions[i].x += axes[i].x * offset;
+				positions[i].y += axes[i].y * offset;
+				positions[i].z += axes[i].z * offset;
+				XMMATRIX world = XMMatrixTranslationFromVector(XMLoadFloat4(&positions[i])) * XMMatrixScaling(batch.scale, batch.scale, batch.scale);
+				objects[i].mWorld = XMMatrixTranspose(world);
+				materials[i].vOutputColor = colors[i];
+			}
+			perBalloonSeconds += stopwatch.Seconds();
+			packed += instanceCount;
+		}
+
+		float worst = 0.0f;
+		for (unsigned int i = 0; i < instanceCount; i++)
+		{
+			XMFLOAT4X4 expected;
+			XMStoreFloat4x4(&expected, XMMatrixTranspose(objects[i].mWorld));
+			const float* a = &expected._11;
+			const float* b = &batch.Data()[i].world._11;
+			for (unsigned int e = 0; e < 16; e++)
+			{
+				float difference = fabsf(a[e] - b[e]);
+				worst = difference > worst ? difference : worst;
+			}
+			const XMFLOAT4& color = batch.Data()[i].color;
+			if (memcmp(&color, &materials[i].vOutputColor, sizeof(XMFLOAT4)) != 0)
+				worst = FLT_MAX;
+		}
+		bool same = worst <= 1e-4f;
+		matched = matched && same;
+		std::cout << instanceCount << " instances: step and pack " << packSeconds * 1e9 / packed << " ns each, per balloon "
+			<< perBalloonSeconds * 1e9 / packed << " ns each (" << perBalloonSeconds / packSeconds << "x), "
+			<< (same ? "same" : "DIFFERENT") << " matrices\n";
+	}
+	return matched ? 0 : 1;
+}
+
+// A mapping backend for the constant ring benchmark. A DISCARD map renames the buffer, as the
+// driver does, and the old one stays readable by the frames still using it. The fake GPU finishes
+// each frame 'lag' frames after the CPU ended it, and checks as it does that every constant the
+// frame wrote is still where it was written.
+class FakeRingBackend
+{
+public:
+	FakeRingBackend(uint32_t _size, uint32_t _lag) : size(_size), lag(_lag) {}
+
+	void* Map(bool discard)
+	{
+		if (discard || buffers.empty())
+			buffers.emplace_back(size / sizeof(uint32_t));
+		return buffers.back().data();
+	}
+
+	void Unmap() {}
+	uint64_t InsertFence() { return ++fences; }
+	bool IsFenceComplete(uint64_t fence) { return fence <= completed; }
+
+	// Notes that 'size' bytes of 'value' went to 'offset' of the buffer mapped last.
+	void Track(uint32_t offset, uint32_t bytes, uint32_t value)
+	{
+		recording.push_back({ static_cast<uint32_t>(buffers.size() - 1), offset, bytes, value });
+	}
+
+	// The CPU fenced a frame; the GPU finishes the ones more than 'lag' behind it.
+	void EndFrame()
+	{
+		frames.push_back(recording);
+		recording.clear();
+		while (frames.size() > lag)
+			FinishFrame();
+	}
+
+	void Drain()
+	{
+		while (!frames.empty())
+			FinishFrame();
+	}
+
+	uint64_t GetCorrupted() const { return corrupted; }
+	size_t GetBuffers() const { return buffers.size(); }
+
+private:
+	struct Written
+	{
+		uint32_t buffer, offset, size, value;
+	};
+
+	void FinishFrame()
+	{
+		for (const Written& written : frames.front())
+		{
+			const uint32_t* words = buffers[written.buffer].data() + written.offset / sizeof(uint32_t);
+			for (uint32_t w = 0; w < written.size / sizeof(uint32_t); w++)
+				corrupted += words[w] != written.value ? 1 : 0;
+		}
+		frames.pop_front();
+		completed++;
+	}
+
+	uint32_t size, lag;
+	std::vector<std::vector<uint32_t>> buffers;		// Every name the buffer has had.
+	std::vector<Written> recording;
+	std::deque<std::vector<Written>> frames;
+	uint64_t fences = 0, completed = 0;
+	uint64_t corrupted = 0;
+};
+
+// Writes 40 draws of constants a frame through a 64 KB ring on a fake GPU: two frames behind, which
+// the ring keeps up with by wrapping over space whose fence has passed, and six behind, where it
+// fills and falls back to DISCARD. Fails if a draw's constants are overwritten before the GPU is
+// done with them, an allocation isn't aligned or doesn't fit, the ring wraps or discards other
+// than expected, or an allocation bigger than the ring succeeds. Then reports the time per write.
+int RunConstantRingBenchmark()
+{
+	const uint32_t capacity = 64 * 1024;
+	const uint32_t drawsPerFrame = 40;
+	const uint32_t frameCount = 300;
+	const uint32_t sizes[] = { 64, 192, 256, 320, 512 };
+	struct Case
+	{
+		const char* name;
+		uint32_t lag;
+		bool discards;
+	};
+	const Case cases[] = { { "GPU 2 frames behind", 2, false }, { "GPU 6 frames behind", 6, true } };
+
+	bool passed = true;
+	std::vector<uint32_t> constants(512 / sizeof(uint32_t));
+	for (const Case& test : cases)
+	{
+		FakeRingBackend backend(capacity, test.lag);
+		ConstantRing<FakeRingBackend> ring(backend);
+		ring.Reset(capacity);
+
+		uint32_t value = 0, invalid = 0, misplaced = 0;
+		uint64_t maxInFlight = 0;
+		double seconds = 0.0;
+		for (uint32_t frame = 0; frame < frameCount; frame++)
+		{
+			for (uint32_t draw = 0; draw < drawsPerFrame; draw++)
+			{
+				uint32_t size = sizes[(frame + draw) % 5];
+				value++;
+				std::fill(constants.begin(), constants.begin() + size / sizeof(uint32_t), value);
+				Stopwatch stopwatch;
+				ConstantRing<FakeRingBackend>::Allocation allocation = ring.Write(constants.data(), size);
+				seconds += stopwatch.Seconds();
+				if (!allocation.valid)
+				{
+					invalid++;
+					continue;
+				}
+				misplaced += allocation.offset % ConstantRing<FakeRingBackend>::Alignment != 0 || allocation.offset + allocation.size > capacity ? 1 : 0;
+				maxInFlight = ring.GetBytesInFlight() > maxInFlight ? ring.GetBytesInFlight() : maxInFlight;
+				backend.Track(allocation.offset, size, value);
+			}
+			ring.EndFrame();
+			backend.EndFrame();
+		}
+		backend.Drain();
+
+		const ConstantRing<FakeRingBackend>::Stats& stats = ring.GetStats();
+		// Only the first map discards while the ring keeps up.
+		bool discarded = test.discards ? stats.discards > 1 : stats.discards == 1;
+		bool ok = invalid == 0 && misplaced == 0 && backend.GetCorrupted() == 0 && (test.discards || stats.wraps > 0) && discarded && maxInFlight <= capacity &&
+			backend.GetBuffers() == stats.discards;
+		passed = passed && ok;
+		std::cout << test.name << ": " << stats.allocations << " writes, " << stats.wraps << " wraps, " << stats.discards << " discards, "
+			<< maxInFlight / 1024 << " of " << capacity / 1024 << " KB in flight at most, " << backend.GetCorrupted() << " words overwritten early, "
+			<< invalid + misplaced << " bad allocations, " << seconds * 1e9 / stats.allocations << " ns/write" << (ok ? "" : " FAILED") << "\n";
+	}
+
+	// Nothing bigger than the ring fits, and the ring is still usable after.
+	FakeRingBackend backend(capacity, 0);
+	ConstantRing<FakeRingBackend> ring(backend);
+	ring.Reset(capacity);
+	std::vector<uint8_t> huge(capacity + 1);
+	bool rejected = !ring.Write(huge.data(), capacity + 1).valid && ring.Write(constants.data(), 64).valid;
+	passed = passed && rejected;
+	std::cout << "allocation bigger than the ring: " << (rejected ? "refused" : "NOT REFUSED") << "\n";
+	return passed ? 0 : 1;
+}
+
+// Handle types for the state cache benchmark's fake context; only their addresses matter.
+struct FakeStateTypes
+{
+	enum Topology { TriangleList = 4, LineList = 2 };
+	enum Format { R16 = 57, R32 = 42 };
+	struct InputLayout { char unused; };
+	struct Buffer { char unused; };
+	struct VertexShader { char unused; };
+	struct PixelShader { char unused; };
+	struct GeometryShader { char unused; };
+	struct SamplerState { char unused; };
+	struct ShaderResourceView { char unused; };
+	struct DepthStencilState { char unused; };
+};
+
+// A context for the state cache benchmark that records how many setters reached it and the kind of
+// the last one.
+class FakeStateContext
+{
+public:
+	typedef StateCache<FakeStateContext, FakeStateTypes> Cache;
+
+	void IASetPrimitiveTopology(FakeStateTypes::Topology) { Record(Cache::CAT_TOPOLOGY); }
+	void IASetInputLayout(FakeStateTypes::InputLayout*) { Record(Cache::CAT_INPUT_LAYOUT); }
+	void IASetVertexBuffers(unsigned, unsigned, FakeStateTypes::Buffer* const*, const unsigned*, const unsigned*) { Record(Cache::CAT_VERTEX_BUFFERS); }
+	void IASetIndexBuffer(FakeStateTypes::Buffer*, FakeStateTypes::Format, unsigned) { Record(Cache::CAT_INDEX_BUFFER); }
+	void VSSetShader(FakeStateTypes::VertexShader*, void*, unsigned) { Record(Cache::CAT_SHADERS); }
+	void PSSetShader(FakeStateTypes::PixelShader*, void*, unsigned) { Record(Cache::CAT_SHADERS); }
+	void GSSetShader(FakeStateTypes::GeometryShader*, void*, unsigned) { Record(Cache::CAT_SHADERS); }
+	void VSSetConstantBuffers(unsigned, unsigned, FakeStateTypes::Buffer* const*) { Record(Cache::CAT_CONSTANT_BUFFERS); }
+	void PSSetConstantBuffers(unsigned, unsigned, FakeStateTypes::Buffer* const*) { Record(Cache::CAT_CONSTANT_BUFFERS); }
+	void VSSetConstantBuffers1(unsigned, unsigned, FakeStateTypes::Buffer* const*, const unsigned*, const unsigned*) { Record(Cache::CAT_CONSTANT_BUFFERS); }
+	void PSSetConstantBuffers1(unsigned, unsigned, FakeStateTypes::Buffer* const*, const unsigned*, const unsigned*) { Record(Cache::CAT_CONSTANT_BUFFERS); }
+	void PSSetSamplers(unsigned, unsigned, FakeStateTypes::SamplerState* const*) { Record(Cache::CAT_SAMPLERS); }
+	void PSSetShaderResources(unsigned, unsigned, FakeStateTypes::ShaderResourceView* const*) { Record(Cache::CAT_SHADER_RESOURCES); }
+	void OMSetDepthStencilState(FakeStateTypes::DepthStencilState*, unsigned) { Record(Cache::CAT_DEPTH_STENCIL); }
+
+	uint32_t GetCalls() const { return calls; }
+	int GetLastCategory() const { return lastCategory; }
+
+private:
+	void Record(int category)
+	{
+		calls++;
+		lastCategory = category;
+	}
+
+	uint32_t calls = 0;
+	int lastCategory = -1;
+};
+typedef FakeStateContext::Cache FakeStateCache;
+
+// Makes calls through a state cache and checks each one reached the context, or didn't, as expected,
+// and was counted as issued or filtered under its category and nowhere else.
+class StateCacheCheck
+{
+public:
+	explicit StateCacheCheck(FakeStateCache& _cache) : cache(_cache) {}
+
+	template<class Call>
+	void Expect(const char* what, FakeStateCache::Category category, bool issued, const Call& call)
+	{
+		FakeStateContext& context = *cache.GetContext();
+		FakeStateCache::Stats before = cache.GetStats();
+		uint32_t calls = context.GetCalls();
+		call();
+		const FakeStateCache::Stats& after = cache.GetStats();
+		bool ok = context.GetCalls() == calls + (issued ? 1 : 0) && (!issued || context.GetLastCategory() == category);
+		for (int c = 0; c < FakeStateCache::CAT_COUNT; c++)
+		{
+			ok = ok && after.issued[c] == before.issued[c] + (issued && c == category ? 1 : 0);
+			ok = ok && after.filtered[c] == before.filtered[c] + (!issued && c == category ? 1 : 0);
+		}
+		checked++;
+		if (!ok)
+		{
+			failed++;
+			std::cout << what << ": should have been " << (issued ? "issued" : "filtered") << "\n";
+		}
+	}
+
+	uint32_t GetChecked() const { return checked; }
+	uint32_t GetFailed() const { return failed; }
+
+private:
+	FakeStateCache& cache;
+	uint32_t checked = 0, failed = 0;
+};
+
+// Sends every kind of state call through the state cache to a recording fake context and checks
+// which reach it: repeats are dropped, any changed value, slot, stride, offset, format or stencil
+// reference is issued, ranges past the tracked slots are always issued, and Invalidate() or a new
+// context makes everything issue again. Then times a frame of scene-like draws through the cache.
+int RunStateCacheBenchmark()
+{
+	typedef FakeStateCache Cache;
+	FakeStateContext context, otherContext;
+	FakeStateTypes::InputLayout layouts[2];
+	FakeStateTypes::Buffer buffers[6];
+	FakeStateTypes::VertexShader vertexShaders[2];
+	FakeStateTypes::PixelShader pixelShaders[2];
+	FakeStateTypes::GeometryShader geometryShader;
+	FakeStateTypes::SamplerState samplers[2];
+	FakeStateTypes::ShaderResourceView views[2];
+	FakeStateTypes::DepthStencilState depthStates[2];
+	FakeStateTypes::Buffer* const three[] = { &buffers[0], &buffers[1], &buffers[2] };
+	const unsigned strides[] = { 32, 16 }, offsets[] = { 0, 64 }, zero[] = { 0, 0 };
+	const unsigned first[] = { 0, 16 }, sixteen[] = { 16, 16 };
+
+	Cache cache;
+	cache.SetContext(&context);
+	StateCacheCheck check(cache);
+
+	// Everything starts unknown, so the first call of each kind is issued.
+	check.Expect("first topology", Cache::CAT_TOPOLOGY, true, [&]() { cache.IASetPrimitiveTopology(FakeStateTypes::TriangleList); });
+	check.Expect("same topology", Cache::CAT_TOPOLOGY, false, [&]() { cache.IASetPrimitiveTopology(FakeStateTypes::TriangleList); });
+	check.Expect("new topology", Cache::CAT_TOPOLOGY, true, [&]() { cache.IASetPrimitiveTopology(FakeStateTypes::LineList); });
+	check.Expect("first layout", Cache::CAT_INPUT_LAYOUT, true, [&]() { cache.IASetInputLayout(&layouts[0]); });
+	check.Expect("same layout", Cache::CAT_INPUT_LAYOUT, false, [&]() { cache.IASetInputLayout(&layouts[0]); });
+	check.Expect("no layout", Cache::CAT_INPUT_LAYOUT, true, [&]() { cache.IASetInputLayout(nullptr); });
+
+	FakeStateTypes::Buffer* vertexBuffer[] = { &buffers[0] };
+	check.Expect("first vertex buffer", Cache::CAT_VERTEX_BUFFERS, true, [&]() { cache.IASetVertexBuffers(0, 1, vertexBuffer, strides, offsets); });
+	check.Expect("same vertex buffer", Cache::CAT_VERTEX_BUFFERS, false, [&]() { cache.IASetVertexBuffers(0, 1, vertexBuffer, strides, offsets); });
+	check.Expect("new stride", Cache::CAT_VERTEX_BUFFERS, true, [&]() { cache.IASetVertexBuffers(0, 1, vertexBuffer, strides + 1, offsets); });
+	check.Expect("new offset", Cache::CAT_VERTEX_BUFFERS, true, [&]() { cache.IASetVertexBuffers(0, 1, vertexBuffer, strides + 1, offsets + 1); });
+	check.Expect("second slot", Cache::CAT_VERTEX_BUFFERS, true, [&]() { cache.IASetVertexBuffers(1, 1, three + 1, strides, offsets); });
+	check.Expect("both slots as bound", Cache::CAT_VERTEX_BUFFERS, false, [&]() {
+		FakeStateTypes::Buffer* both[] = { &buffers[0], &buffers[1] };
+		const unsigned bothStrides[] = { 16, 32 }, bothOffsets[] = { 64, 0 };
+		cache.IASetVertexBuffers(0, 2, both, bothStrides, bothOffsets);
+	});
+	check.Expect("slots past the tracked ones", Cache::CAT_VERTEX_BUFFERS, true, [&]() { cache.IASetVertexBuffers(Cache::MaxVertexBuffers - 1, 2, three, strides, offsets); });
+	check.Expect("last tracked slot again", Cache::CAT_VERTEX_BUFFERS, true, [&]() { cache.IASetVertexBuffers(Cache::MaxVertexBuffers - 1, 1, three, strides, offsets); });
+	check.Expect("last tracked slot known", Cache::CAT_VERTEX_BUFFERS, false, [&]() { cache.IASetVertexBuffers(Cache::MaxVertexBuffers - 1, 1, three, strides, offsets); });
+
+	check.Expect("first index buffer", Cache::CAT_INDEX_BUFFER, true, [&]() { cache.IASetIndexBuffer(&buffers[3], FakeStateTypes::R32, 0); });
+	check.Expect("same index buffer", Cache::CAT_INDEX_BUFFER, false, [&]() { cache.IASetIndexBuffer(&buffers[3], FakeStateTypes::R32, 0); });
+	check.Expect("new index format", Cache::CAT_INDEX_BUFFER, true, [&]() { cache.IASetIndexBuffer(&buffers[3], FakeStateTypes::R16, 0); });
+	check.Expect("new index offset", Cache::CAT_INDEX_BUFFER, true, [&]() { cache.IASetIndexBuffer(&buffers[3], FakeStateTypes::R16, 12); });
+
+	check.Expect("first vertex shader", Cache::CAT_SHADERS, true, [&]() { cache.VSSetShader(&vertexShaders[0]); });
+	check.Expect("same vertex shader", Cache::CAT_SHADERS, false, [&]() { cache.VSSetShader(&vertexShaders[0]); });
+	check.Expect("first pixel shader", Cache::CAT_SHADERS, true, [&]() { cache.PSSetShader(&pixelShaders[0]); });
+	check.Expect("new pixel shader", Cache::CAT_SHADERS, true, [&]() { cache.PSSetShader(&pixelShaders[1]); });
+	check.Expect("first geometry shader", Cache::CAT_SHADERS, true, [&]() { cache.GSSetShader(&geometryShader); });
+	check.Expect("no geometry shader", Cache::CAT_SHADERS, true, [&]() { cache.GSSetShader(nullptr); });
+	check.Expect("still no geometry shader", Cache::CAT_SHADERS, false, [&]() { cache.GSSetShader(nullptr); });
+
+	check.Expect("first vertex constants", Cache::CAT_CONSTANT_BUFFERS, true, [&]() { cache.VSSetConstantBuffers(0, 3, three); });
+	check.Expect("same vertex constants", Cache::CAT_CONSTANT_BUFFERS, false, [&]() { cache.VSSetConstantBuffers(0, 3, three); });
+	check.Expect("one of them again", Cache::CAT_CONSTANT_BUFFERS, false, [&]() { cache.VSSetConstantBuffers(1, 1, three + 1); });
+	check.Expect("another in its slot", Cache::CAT_CONSTANT_BUFFERS, true, [&]() { cache.VSSetConstantBuffers(1, 1, three + 2); });
+	check.Expect("pixel slots are their own", Cache::CAT_CONSTANT_BUFFERS, true, [&]() { cache.PSSetConstantBuffers(0, 1, three); });
+	check.Expect("offset bind", Cache::CAT_CONSTANT_BUFFERS, true, [&]() { cache.VSSetConstantBuffers1(&context, 2, 1, three + 2, first, sixteen); });
+	check.Expect("same offset bind", Cache::CAT_CONSTANT_BUFFERS, false, [&]() { cache.VSSetConstantBuffers1(&context, 2, 1, three + 2, first, sixteen); });
+	check.Expect("next offset", Cache::CAT_CONSTANT_BUFFERS, true, [&]() { cache.VSSetConstantBuffers1(&context, 2, 1, three + 2, first + 1, sixteen); });
+	check.Expect("whole buffer after an offset", Cache::CAT_CONSTANT_BUFFERS, true, [&]() { cache.VSSetConstantBuffers(2, 1, three + 2); });
+	check.Expect("pixel offset bind", Cache::CAT_CONSTANT_BUFFERS, true, [&]() { cache.PSSetConstantBuffers1(&context, 0, 1, three, zero, sixteen); });
+
+	check.Expect("first sampler", Cache::CAT_SAMPLERS, true, [&]() { FakeStateTypes::SamplerState* s[] = { &samplers[0] }; cache.PSSetSamplers(0, 1, s); });
+	check.Expect("same sampler", Cache::CAT_SAMPLERS, false, [&]() { FakeStateTypes::SamplerState* s[] = { &samplers[0] }; cache.PSSetSamplers(0, 1, s); });
+	check.Expect("new sampler", Cache::CAT_SAMPLERS, true, [&]() { FakeStateTypes::SamplerState* s[] = { &samplers[1] }; cache.PSSetSamplers(0, 1, s); });
+	check.Expect("first texture", Cache::CAT_SHADER_RESOURCES, true, [&]() { FakeStateTypes::ShaderResourceView* v[] = { &views[0] }; cache.PSSetShaderResources(0, 1, v); });
+	check.Expect("same texture", Cache::CAT_SHADER_RESOURCES, false, [&]() { FakeStateTypes::ShaderResourceView* v[] = { &views[0] }; cache.PSSetShaderResources(0, 1, v); });
+	check.Expect("texture in another slot", Cache::CAT_SHADER_RESOURCES, true, [&]() { FakeStateTypes::ShaderResourceView* v[] = { &views[0] }; cache.PSSetShaderResources(1, 1, v); });
+	check.Expect("first depth state", Cache::CAT_DEPTH_STENCIL, true, [&]() { cache.OMSetDepthStencilState(&depthStates[0], 0); });
+	check.Expect("same depth state", Cache::CAT_DEPTH_STENCIL, false, [&]() { cache.OMSetDepthStencilState(&depthStates[0], 0); });
+	check.Expect("new stencil reference", Cache::CAT_DEPTH_STENCIL, true, [&]() { cache.OMSetDepthStencilState(&depthStates[0], 1); });
+
+	// After Invalidate(), or on a new context, nothing is known to be bound.
+	for (uint32_t pass = 0; pass < 3; pass++)
+	{
+		bool issued = pass != 1;
+		if (pass == 0)
+			cache.Invalidate();
+		else if (pass == 1)
+			cache.SetContext(&context);
+		else
+			cache.SetContext(&otherContext);
+		check.Expect("topology", Cache::CAT_TOPOLOGY, issued, [&]() { cache.IASetPrimitiveTopology(FakeStateTypes::LineList); });
+		check.Expect("layout", Cache::CAT_INPUT_LAYOUT, issued, [&]() { cache.IASetInputLayout(nullptr); });
+		check.Expect("index buffer", Cache::CAT_INDEX_BUFFER, issued, [&]() { cache.IASetIndexBuffer(&buffers[3], FakeStateTypes::R16, 12); });
+		check.Expect("vertex shader", Cache::CAT_SHADERS, issued, [&]() { cache.VSSetShader(&vertexShaders[0]); });
+		check.Expect("constants", Cache::CAT_CONSTANT_BUFFERS, issued, [&]() { cache.VSSetConstantBuffers(0, 2, three); });
+		check.Expect("depth state", Cache::CAT_DEPTH_STENCIL, issued, [&]() { cache.OMSetDepthStencilState(&depthStates[0], 1); });
+	}
+	bool switched = otherContext.GetCalls() == 6;
+	std::cout << check.GetChecked() - check.GetFailed() << " of " << check.GetChecked() << " state calls issued or filtered as expected"
+		<< (switched ? "" : ", the new context didn't get its calls") << "\n";
+
+	// A frame of six draws that share a pipeline and differ in their buffers, constants and texture.
+	const uint32_t frames = 200000;
+	cache.SetContext(&context);
+	cache.ResetStats();
+	Stopwatch stopwatch;
+	for (uint32_t frame = 0; frame < frames; frame++)
+	{
+		for (uint32_t draw = 0; draw < 6; draw++)
+		{
+			uint32_t mesh = draw < 3 ? 0 : 1;
+			FakeStateTypes::Buffer* vertex[] = { &buffers[mesh] };
+			FakeStateTypes::Buffer* constants[] = { &buffers[4], &buffers[5], &buffers[2 + (draw & 1)] };
+			FakeStateTypes::ShaderResourceView* texture[] = { &views[mesh] };
+			FakeStateTypes::SamplerState* sampler[] = { &samplers[0] };
+			cache.IASetPrimitiveTopology(FakeStateTypes::TriangleList);
+			cache.IASetInputLayout(&layouts[0]);
+			cache.IASetVertexBuffers(0, 1, vertex, strides, zero);
+			cache.IASetIndexBuffer(&buffers[3 - mesh], FakeStateTypes::R32, 0);
+			cache.VSSetShader(&vertexShaders[0]);
+			cache.PSSetShader(&pixelShaders[draw == 5 ? 1 : 0]);
+			cache.GSSetShader(nullptr);
+			cache.VSSetConstantBuffers(0, 3, constants);
+			cache.PSSetConstantBuffers(0, 3, constants);
+			cache.PSSetSamplers(0, 1, sampler);
+			cache.PSSetShaderResources(0, 1, texture);
+			cache.OMSetDepthStencilState(&depthStates[0], 0);
+		}
+	}
+	double seconds = stopwatch.Seconds();
+	const Cache::Stats& stats = cache.GetStats();
+	uint64_t calls = static_cast<uint64_t>(stats.TotalIssued()) + stats.TotalFiltered();
+	std::cout << "scene frames: " << (double)stats.TotalIssued() / frames << " of " << (double)calls / frames << " calls a frame issued, "
+		<< seconds * 1e9 / calls << " ns a call\n";
+	return check.GetFailed() == 0 && switched ? 0 : 1;
+}
+
+// Sorts ten thousand and a million draw packets with the draw queue's radix sort and with std::sort,
+// best of a few runs each, reports the radix sort's share of a 60 Hz frame and checks both give the
+// same order. Each packet's object is its submission order, which std::sort breaks ties on to match
+// the radix sort's stability.
+int RunSortBenchmark()
+{
+	const uint32_t packetCounts[] = { 10000, 1000000 };
+	const double frameBudgetMs = 1000.0 / 60.0;
+	const int runs = 5;
+	std::mt19937_64 random(1234);
+	bool matched = true;
+	for (int test = 0; test < 4; test++)
+	{
+		uint32_t packetCount = packetCounts[test / 2];
+		int keys = test % 2;
+		std::vector<DrawPacket> submitted(packetCount);
+		for (uint32_t i = 0; i < packetCount; i++)
+		{
+			uint64_t bits = random();
+			// Scene keys share a few layers, shaders and materials and differ mostly in depth.
+			submitted[i].key = keys == 0 ? DrawKey::Make(bits % 3, (bits >> 2) & 1, (bits >> 3) % 6, (bits >> 6) % 40,
+				static_cast<uint32_t>(bits >> 16) & DrawKey::MaxDepth, i) : bits;
+			submitted[i].object = i;
+			submitted[i].data = 0;
+		}
+
+		DrawQueue queue;
+		queue.Reserve(packetCount);
+		std::vector<DrawPacket> sorted(packetCount);
+		double radixSeconds = 0.0, stdSeconds = 0.0;
+		for (int run = 0; run < runs; run++)
+		{
+			queue.Clear();
+			for (const DrawPacket& packet : submitted)
+				queue.Submit(packet.key, packet.object, packet.data);
+			Stopwatch stopwatch;
+			queue.Sort();
+			double seconds = stopwatch.Seconds();
+			radixSeconds = run == 0 || seconds < radixSeconds ? seconds : radixSeconds;
+
+			sorted = submitted;
+			stopwatch.Restart();
+			std::sort(sorted.begin(), sorted.end(), [](const DrawPacket& a, const DrawPacket& b)
+				{ return a.key != b.key ? a.key < b.key : a.object < b.object; });
+			seconds = stopwatch.Seconds();
+			stdSeconds = run == 0 || seconds < stdSeconds ? seconds : stdSeconds;
+		}
+
+		bool same = queue.Size() == packetCount;
+		for (uint32_t i = 0; same && i < packetCount; i++)
+			same = queue[i].key == sorted[i].key && queue[i].object == sorted[i].object;
+		matched = matched && same;
+		std::cout << packetCount << " packets, " << (keys == 0 ? "scene keys" : "random keys") << ": radix " << radixSeconds * 1000.0 << " ms ("
+			<< radixSeconds * 1000.0 / frameBudgetMs * 100.0 << "% of a " << frameBudgetMs << " ms frame), std::sort "
+			<< stdSeconds * 1000.0 << " ms, " << stdSeconds / radixSeconds << "x" << (same ? "" : ", ORDER DIFFERS") << "\n";
+	}
+	return matched ? 0 : 1;
+}
+
+bool BenchmarkPixelShader(const RasterDraw&, const RasterPixel& pixel, XMVECTOR& color)
+{
+	color = XMVectorSet(pixel.varyings[0], pixel.varyings[1], 0.5f, 1.0f);
+	return true;
+}
+
+uint32_t BenchmarkQuadShader(const RasterDraw&, const RasterQuad& quad, XMVECTOR color[4])
+{
+	color[0] = quad.varyings[0];
+	color[1] = quad.varyings[1];
+	color[2] = XMVectorReplicate(0.5f);
+	color[3] = XMVectorReplicate(1.0f);
+	return quad.mask;
+}
+
+// Rasterizes grids of small, medium and large triangles with every kernel the CPU supports and reports
+// triangles and covered pixels per second. The shader is trivial; the hidden cases clear depth to
+// 0 so every pixel fails the depth test, which leaves setup, binning, coverage and depth.
+int RunRasterBenchmark(bool multithreaded)
+{
+	struct BenchmarkCase
+	{
+		const char* name;
+		float size;			// Legs of the right triangles, in pixels.
+		unsigned int count;	// Triangles per flush.
+		bool hidden;
+	};
+	const BenchmarkCase cases[] = {
+		{ "small (8 px)", 4.0f, 100000, false }, { "small (8 px) hidden", 4.0f, 100000, true }, { "medium (32 px)", 8.0f, 50000, false },
+		{ "large (32k px)", 256.0f, 400, false }, { "large (32k px) hidden", 256.0f, 400, true },
+	};
+	const unsigned int benchWidth = 1280, benchHeight = 768;
+	const RasterKernel kernels[] = { RasterKernel::Scalar, RasterKernel::Sse2, RasterKernel::Avx2 };
+
+	SoftwareRasterizer rasterizer;
+	rasterizer.Resize(benchWidth, benchHeight);
+	rasterizer.SetMultithreaded(multithreaded);
+	for (const BenchmarkCase& bench : cases)
+	{
+		// Clockwise on screen, spread over a grid that wraps and steps towards the camera.
+		std::vector<RasterVertex> vertices(bench.count * 3);
+		unsigned int columns = (unsigned int)((benchWidth - 1) / bench.size);
+		unsigned int rows = (unsigned int)((benchHeight - 1) / bench.size);
+		for (unsigned int i = 0; i < bench.count; i++)
+		{
+			float x = (i % columns) * bench.size, y = ((i / columns) % rows) * bench.size;
+			float z = 1.0f - (i + 1) / (float)(bench.count + 1);
+			const float corners[3][2] = { { x, y }, { x + bench.size, y }, { x, y + bench.size } };
+			for (unsigned int v = 0; v < 3; v++)
+			{
+				RasterVertex& vertex = vertices[i * 3 + v];
+				vertex.position = XMFLOAT4(corners[v][0] / benchWidth * 2.0f - 1.0f, 1.0f - corners[v][1] / benchHeight * 2.0f, z, 1.0f);
+				vertex.varyings[0] = (float)(v == 1);
+				vertex.varyings[1] = (float)(v == 2);
+			}
+		}
+
+		for (RasterKernel kernel : kernels)
+		{
+			if (!rasterizer.SetKernel(kernel))
+				continue;
+
+			RasterDraw draw;
+			draw.pixelShader = BenchmarkPixelShader;
+			draw.quadShader = BenchmarkQuadShader;
+			draw.varyingCount = 2;
+			double seconds = 0.0;
+			unsigned long long triangles = 0, pixels = 0;
+			for (unsigned int run = 0; seconds < 0.5 || run < 3; run++)
+			{
+				rasterizer.ResetStats();
+				rasterizer.Clear(0xff000000, bench.hidden ? 0.0f : 1.0f);
+				Stopwatch stopwatch;
+				uint32_t drawIndex = rasterizer.AddDraw(draw);
+				for (unsigned int i = 0; i < bench.count; i++)
+					rasterizer.SubmitTriangle(drawIndex, vertices[i * 3], vertices[i * 3 + 1], vertices[i * 3 + 2]);
+				rasterizer.Flush();
+				seconds += stopwatch.Seconds();
+				triangles += bench.count;
+				pixels += rasterizer.GetStats().pixelsTested;
+			}
+			std::cout << bench.name << ", " << RasterKernelName(kernel) << ": " << triangles / seconds / 1e6 << " Mtris/s, "
+				<< pixels / seconds / 1e6 << " Mpixels/s\n";
+		}
+	}
+	return 0;
+}
+
+// Culls a million boxes scattered around the camera with every kernel the CPU supports and reports
+// boxes per second.
+int RunCullBenchmark()
+{
+	const unsigned int boxCount = 1000000;
+	FrustumCuller culler;
+	culler.Reserve(boxCount);
+	std::mt19937 random(1234);
+	std::uniform_real_distribution<float> position(-500.0f, 500.0f), size(0.1f, 4.0f);
+	for (unsigned int i = 0; i < boxCount; i++)
+	{
+		XMFLOAT3 boxMin = { position(random), position(random), position(random) };
+		XMFLOAT3 boxMax = { boxMin.x + size(random), boxMin.y + size(random), boxMin.z + size(random) };
+		culler.Add(boxMin, boxMax);
+	}
+
+	XMMATRIX view = XMMatrixLookAtLH(XMVectorSet(0.0f, 3.0f, -8.0f, 0.0f), XMVectorSet(0.0f, 2.0f, 0.0f, 0.0f), XMVectorSet(0.0f, 1.0f, 0.0f, 0.0f));
+	XMMATRIX projection = XMMatrixPerspectiveFovLH(1.309f, 1280.0f / 768.0f, 0.1f, 600.0f);
+	Frustum frustum(XMMatrixMultiply(view, projection));
+
+	const RasterKernel kernels[] = { RasterKernel::Scalar, RasterKernel::Sse2, RasterKernel::Avx2 };
+	std::vector<uint32_t> visible;
+	visible.reserve(boxCount);
+	for (RasterKernel kernel : kernels)
+	{
+		if (!culler.SetKernel(kernel))
+			continue;
+
+		double seconds = 0.0;
+		unsigned long long boxes = 0;
+		for (unsigned int run = 0; seconds < 0.5 || run < 3; run++)
+		{
+			culler.Cull(frustum, visible);
+			seconds += culler.GetStats().ms / 1000.0;
+			boxes += boxCount;
+		}
+		std::cout << RasterKernelName(kernel) << ": " << boxes / seconds / 1e6 << " Mboxes/s, " << seconds * 1000.0 * boxCount / boxes
+			<< " ms per " << boxCount << " (" << visible.size() << " visible)\n";
+	}
+	return 0;
+}
+
+// Builds scene BVHs of 10k to 1M boxes and reports build and refit time and frustum, ray and
+// overlap query throughput. Refitting moves every box the way the balloons bob.
+int RunBvhBenchmark()
+{
+	const unsigned int objectCounts[] = { 10000, 100000, 1000000 };
+	XMMATRIX view = XMMatrixLookAtLH(XMVectorSet(0.0f, 3.0f, -8.0f, 0.0f), XMVectorSet(0.0f, 2.0f, 0.0f, 0.0f), XMVectorSet(0.0f, 1.0f, 0.0f, 0.0f));
+	XMMATRIX projection = XMMatrixPerspectiveFovLH(1.309f, 1280.0f / 768.0f, 0.1f, 600.0f);
+	Frustum frustum(XMMatrixMultiply(view, projection));
+
+	for (unsigned int objectCount : objectCounts)
+	{
+		// The same density at every count.
+		float half = 5.0f * cbrtf((float)objectCount);
+		std::mt19937 random(1234);
+		std::uniform_real_distribution<float> position(-half, half), size(0.1f, 4.0f), unit(-1.0f, 1.0f);
+		std::vector<XMFLOAT3> boxMin(objectCount), boxMax(objectCount);
+		SceneBvh bvh;
+		bvh.Reserve(objectCount);
+		for (unsigned int i = 0; i < objectCount; i++)
+		{
+			boxMin[i] = { position(random), position(random), position(random) };
+			boxMax[i] = { boxMin[i].x + size(random), boxMin[i].y + size(random), boxMin[i].z + size(random) };
+			bvh.Add(boxMin[i], boxMax[i]);
+		}
+		bvh.Build();
+		double buildMs = bvh.GetStats().buildMs;
+
+		double refitMs = 0.0;
+		const unsigned int refits = 10;
+		for (unsigned int frame = 0; frame < refits; frame++)
+		{
+			float offset = sinf(frame * 0.2f * 2.0f) / 10.0f;
+			for (unsigned int i = 0; i < objectCount; i++)
+			{
+				float dy = offset * ((i & 1) ? 1.0f : -1.0f);
+				bvh.Set(i, XMFLOAT3(boxMin[i].x, boxMin[i].y + dy, boxMin[i].z), XMFLOAT3(boxMax[i].x, boxMax[i].y + dy, boxMax[i].z));
+			}
+			bvh.Refit();
+			refitMs += bvh.GetStats().refitMs;
+		}
+
+		std::vector<uint32_t> results;
+		results.reserve(objectCount);
+		Stopwatch stopwatch;
+		unsigned int frustumQueries = 0;
+		for (; frustumQueries < 3 || stopwatch.Milliseconds() < 200.0; frustumQueries++)
+			bvh.QueryFrustum(frustum, results);
+		double frustumMs = stopwatch.Milliseconds() / frustumQueries;
+		size_t inFrustum = results.size();
+
+		// Rays from random points in random directions, each keeping its nearest box.
+		const unsigned int rayCount = 100000;
+		unsigned int rayHits = 0;
+		stopwatch.Restart();
+		for (unsigned int i = 0; i < rayCount; i++)
+		{
+			XMFLOAT3 origin(position(random), position(random), position(random));
+			XMFLOAT3 direction(unit(random), unit(random), unit(random));
+			uint32_t nearest = UINT32_MAX;
+			bvh.QueryRay(origin, direction, FLT_MAX, [&](uint32_t id, float enter, float& maxDistance)
+			{
+				nearest = id;
+				maxDistance = enter;
+			});
+			rayHits += nearest != UINT32_MAX ? 1 : 0;
+		}
+		double raySeconds = stopwatch.Seconds();
+
+		const unsigned int overlapCount = 100000;
+		size_t overlaps = 0;
+		stopwatch.Restart();
+		for (unsigned int i = 0; i < overlapCount; i++)
+		{
+			XMFLOAT3 queryMin(position(random), position(random), position(random));
+			bvh.QueryOverlap(queryMin, XMFLOAT3(queryMin.x + 8.0f, queryMin.y + 8.0f, queryMin.z + 8.0f), results);
+			overlaps += results.size();
+		}
+		double overlapSeconds = stopwatch.Seconds();
+
+		const BvhStats& stats = bvh.GetStats();
+		std::cout << objectCount << " objects: " << stats.nodes << " nodes, depth " << stats.depth << ", SAH cost " << stats.cost << "\n";
+		std::cout << "  build " << buildMs << " ms, refit " << refitMs / refits << " ms\n";
+		std::cout << "  frustum " << frustumMs << " ms/query (" << inFrustum << " visible)\n";
+		std::cout << "  rays " << rayCount / raySeconds / 1e6 << " M/s (" << rayHits * 100.0 / rayCount << "% hit)\n";
+		std::cout << "  overlaps " << overlapCount / overlapSeconds / 1e6 << " M/s (" << (double)overlaps / overlapCount << " found each)\n";
+	}
+	return 0;
+}
+
+// Builds the balloon's triangle BVH and reports nearest hit and line of sight throughput for rays
+// from all around it, aimed inside its bounds. The first rays are checked against every triangle.
+int RunPickBenchmark()
+{
+	Mesh::SimpleMesh balloonMesh;
+	ReadModel("Models/balloon.obj", balloonMesh);
+	if (balloonMesh.indicesList.empty())
+	{
+		std::cout << "Models/balloon.obj didn't load\n";
+		return 1;
+	}
+
+	MeshBvh bvh;
+	Stopwatch stopwatch;
+	bvh.Build(balloonMesh.vertexList.data(), (uint32_t)balloonMesh.vertexList.size(), sizeof(Mesh::SimpleVertex),
+		balloonMesh.indicesList.data(), (uint32_t)balloonMesh.indicesList.size());
+	double buildMs = stopwatch.Milliseconds();
+
+	const BvhNode& root = bvh.GetNodes()[0];
+	XMFLOAT3 center((root.boundsMin.x + root.boundsMax.x) * 0.5f, (root.boundsMin.y + root.boundsMax.y) * 0.5f, (root.boundsMin.z + root.boundsMax.z) * 0.5f);
+	XMFLOAT3 extent(root.boundsMax.x - root.boundsMin.x, root.boundsMax.y - root.boundsMin.y, root.boundsMax.z - root.boundsMin.z);
+	float radius = 2.0f * sqrtf(extent.x * extent.x + extent.y * extent.y + extent.z * extent.z);
+
+	const unsigned int rayCount = 1000000;
+	std::mt19937 random(1234);
+	std::uniform_real_distribution<float> unit(-1.0f, 1.0f), fraction(0.0f, 1.0f);
+	std::vector<MeshRay> rays(rayCount);
+	for (MeshRay& ray : rays)
+	{
+		XMVECTOR around = XMVector3Normalize(XMVectorSet(unit(random), unit(random), unit(random), 0.0f));
+		XMStoreFloat3(&ray.origin, XMVectorAdd(XMLoadFloat3(&center), XMVectorScale(around, radius)));
+		XMVECTOR target = XMVectorSet(root.boundsMin.x + extent.x * fraction(random), root.boundsMin.y + extent.y * fraction(random),
+			root.boundsMin.z + extent.z * fraction(random), 0.0f);
+		XMStoreFloat3(&ray.direction, XMVector3Normalize(XMVectorSubtract(target, XMLoadFloat3(&ray.origin))));
+		ray.maxDistance = FLT_MAX;
+	}
+
+	std::vector<MeshHit> hits(rayCount);
+	stopwatch.Restart();
+	uint32_t hitCount = bvh.IntersectBatch(rays.data(), rayCount, hits.data());
+	double nearestSeconds = stopwatch.Seconds();
+
+	// Line of sight to points on the far side of the mesh.
+	for (MeshRay& ray : rays)
+		ray.maxDistance = 2.0f * radius;
+	std::vector<uint8_t> occluded(rayCount);
+	stopwatch.Restart();
+	uint32_t blocked = bvh.OccludedBatch(rays.data(), rayCount, occluded.data());
+	double anySeconds = stopwatch.Seconds();
+
+	const unsigned int checkCount = 10000;
+	unsigned int mismatches = 0;
+	for (unsigned int i = 0; i < checkCount; i++)
+	{
+		MeshHit nearest;
+		for (size_t t = 0; t + 2 < balloonMesh.indicesList.size(); t += 3)
+		{
+			const XMFLOAT4& a = balloonMesh.vertexList[balloonMesh.indicesList[t]].Pos;
+			const XMFLOAT4& b = balloonMesh.vertexList[balloonMesh.indicesList[t + 1]].Pos;
+			const XMFLOAT4& c = balloonMesh.vertexList[balloonMesh.indicesList[t + 2]].Pos;
+			if (MeshBvh::IntersectTriangle(rays[i].origin, rays[i].direction, XMFLOAT3(a.x, a.y, a.z), XMFLOAT3(b.x, b.y, b.z), XMFLOAT3(c.x, c.y, c.z), nearest.distance, nearest))
+				nearest.triangle = (uint32_t)(t / 3);
+		}
+		mismatches += nearest.distance != hits[i].distance ? 1 : 0;
+	}
+
+	std::cout << bvh.TriangleCount() << " triangles, " << bvh.GetNodes().size() << " nodes, built in " << buildMs << " ms\n";
+	std::cout << "nearest hit: " << rayCount / nearestSeconds / 1e6 << " M rays/s (" << hitCount * 100.0 / rayCount << "% hit)\n";
+	std::cout << "line of sight: " << rayCount / anySeconds / 1e6 << " M rays/s (" << blocked * 100.0 / rayCount << "% blocked)\n";
+	std::cout << mismatches << " of " << checkCount << " nearest hits differ from testing every triangle\n";
+	return mismatches == 0 ? 0 : 1;
+}
+
+// Tests 1000 rays against 1000 spheres and 1000 boxes with each kernel, the million pair tests a
+// frame of projectiles could need, and checks every kernel finds the scalar kernel's hits.
+int RunCollisionBenchmark()
+{
+	const unsigned int rayCount = 1000, targetCount = 1000;
+	std::mt19937 random(1234);
+	std::uniform_real_distribution<float> position(-50.0f, 50.0f), size(0.5f, 2.0f), unit(-1.0f, 1.0f);
+	RayBatch rays;
+	SphereBatch spheres;
+	BoxBatch boxes;
+	for (unsigned int i = 0; i < rayCount; i++)
+	{
+		XMFLOAT3 origin(position(random), position(random), position(random));
+		// Every other ray is a segment, as a projectile's step through a frame would be.
+		if (i & 1)
+			rays.AddSegment(origin, XMFLOAT3(origin.x + 10.0f * unit(random), origin.y + 10.0f * unit(random), origin.z + 10.0f * unit(random)));
+		else
+			rays.Add(origin, XMFLOAT3(unit(random), unit(random), unit(random)));
+	}
+	for (unsigned int i = 0; i < targetCount; i++)
+	{
+		XMFLOAT3 center(position(random), position(random), position(random));
+		float radius = size(random);
+		spheres.Add(center, radius);
+		boxes.Add(XMFLOAT3(center.x - radius, center.y - radius, center.z - radius), XMFLOAT3(center.x + radius, center.y + radius, center.z + radius));
+	}
+
+	// Orders hits so kernels can be compared.
+	auto sortHits = [](std::vector<CollisionHit>& hits)
+	{
+		std::sort(hits.begin(), hits.end(), [](const CollisionHit& a, const CollisionHit& b) { return a.ray != b.ray ? a.ray < b.ray : a.target < b.target; });
+	};
+	auto sameHits = [](const std::vector<CollisionHit>& a, const std::vector<CollisionHit>& b)
+	{
+		if (a.size() != b.size())
+			return false;
+		for (size_t i = 0; i < a.size(); i++)
+		{
+			if (a[i].ray != b[i].ray || a[i].target != b[i].target || a[i].distance != b[i].distance)
+				return false;
+		}
+		return true;
+	};
+
+	const RasterKernel kernels[] = { RasterKernel::Scalar, RasterKernel::Sse2, RasterKernel::Avx2 };
+	CollisionBatch collision;
+	std::vector<CollisionHit> hits, scalarSphereHits, scalarBoxHits;
+	bool matched = true;
+	for (RasterKernel kernel : kernels)
+	{
+		if (!collision.SetKernel(kernel))
+			continue;
+
+		double sphereMs = 0.0, boxMs = 0.0;
+		unsigned int runs = 0;
+		for (; runs < 3 || sphereMs + boxMs < 500.0; runs++)
+		{
+			collision.RaysToSpheres(rays, spheres, hits);
+			sphereMs += collision.GetStats().ms;
+		}
+		sortHits(hits);
+		if (kernel == RasterKernel::Scalar)
+			scalarSphereHits = hits;
+		bool spheresMatch = sameHits(hits, scalarSphereHits);
+		size_t sphereHits = hits.size();
+
+		for (unsigned int run = 0; run < runs; run++)
+		{
+			collision.RaysToBoxes(rays, boxes, hits);
+			boxMs += collision.GetStats().ms;
+		}
+		sortHits(hits);
+		if (kernel == RasterKernel::Scalar)
+			scalarBoxHits = hits;
+		bool boxesMatch = sameHits(hits, scalarBoxHits);
+		matched = matched && spheresMatch && boxesMatch;
+
+		double millions = (double)rayCount * targetCount / 1e6;
+		std::cout << RasterKernelName(kernel) << ": spheres " << sphereMs / runs / millions << " ms per 1M tests (" << sphereHits << " hits"
+			<< (spheresMatch ? "" : ", DIFFERENT") << "), boxes " << boxMs / runs / millions << " ms per 1M tests (" << hits.size() << " hits"
+			<< (boxesMatch ? "" : ", DIFFERENT") << ")\n";
+	}
+	return matched ? 0 : 1;
+}
+
+// Moves 100k spheres for 60 frames, rebuilding the spatial grid each frame on the pool and on one
+// thread, then reports radius and box query throughput. Some queries are checked against testing
+// every object.
+int RunGridBenchmark()
+{
+	const unsigned int objectCount = 100000, frames = 60;
+	const float half = 93.0f, cellSize = 4.0f, step = 1.0f / 60.0f;
+	std::mt19937 random(1234);
+	std::uniform_real_distribution<float> position(-half, half), size(0.25f, 1.0f), speed(-5.0f, 5.0f);
+	std::vector<XMFLOAT3> centers(objectCount), velocities(objectCount);
+	std::vector<float> radii(objectCount);
+	SpatialGrid grid(cellSize), singleGrid(cellSize);
+	singleGrid.SetMultithreaded(false);
+	for (unsigned int i = 0; i < objectCount; i++)
+	{
+		centers[i] = { position(random), position(random), position(random) };
+		velocities[i] = { speed(random), speed(random), speed(random) };
+		radii[i] = size(random);
+		grid.Add(centers[i], radii[i]);
+		singleGrid.Add(centers[i], radii[i]);
+	}
+
+	double buildMs = 0.0, singleMs = 0.0;
+	for (unsigned int frame = 0; frame < frames; frame++)
+	{
+		for (unsigned int i = 0; i < objectCount; i++)
+		{
+			float* p = &centers[i].x;
+			float* v = &velocities[i].x;
+			for (unsigned int a = 0; a < 3; a++)
+			{
+				p[a] += v[a] * step;
+				v[a] = (p[a] < -half && v[a] < 0.0f) || (p[a] > half && v[a] > 0.0f) ? -v[a] : v[a];
+			}
+			grid.Set(i, centers[i], radii[i]);
+			singleGrid.Set(i, centers[i], radii[i]);
+		}
+		grid.Build();
+		singleGrid.Build();
+		buildMs += grid.GetStats().buildMs;
+		singleMs += singleGrid.GetStats().buildMs;
+	}
+
+	const unsigned int queryCount = 100000, checkCount = 500;
+	const float queryRadius = 3.0f;
+	std::vector<uint32_t> found, expected;
+	unsigned int mismatches = 0;
+	std::uniform_int_distribution<unsigned int> anyObject(0, objectCount - 1);
+
+	size_t radiusFound = 0;
+	Stopwatch stopwatch;
+	for (unsigned int q = 0; q < queryCount; q++)
+	{
+		grid.QueryRadius(centers[anyObject(random)], queryRadius, found);
+		radiusFound += found.size();
+	}
+	double radiusSeconds = stopwatch.Seconds();
+
+	size_t boxFound = 0;
+	stopwatch.Restart();
+	for (unsigned int q = 0; q < queryCount; q++)
+	{
+		const XMFLOAT3& c = centers[anyObject(random)];
+		grid.QueryBox(XMFLOAT3(c.x - queryRadius, c.y - queryRadius, c.z - queryRadius), XMFLOAT3(c.x + queryRadius, c.y + queryRadius, c.z + queryRadius), found);
+		boxFound += found.size();
+	}
+	double boxSeconds = stopwatch.Seconds();
+
+	for (unsigned int q = 0; q < checkCount; q++)
+	{
+		XMFLOAT3 c(position(random), position(random), position(random));
+		grid.QueryRadius(c, queryRadius, found);
+		std::sort(found.begin(), found.end());
+		expected.clear();
+		for (unsigned int i = 0; i < objectCount; i++)
+		{
+			float dx = centers[i].x - c.x, dy = centers[i].y - c.y, dz = centers[i].z - c.z;
+			if (dx * dx + dy * dy + dz * dz <= (queryRadius + radii[i]) * (queryRadius + radii[i]))
+				expected.push_back(i);
+		}
+		mismatches += found != expected ? 1 : 0;
+
+		grid.QueryBox(XMFLOAT3(c.x - queryRadius, c.y, c.z), XMFLOAT3(c.x + queryRadius, c.y + 1.0f, c.z + 2.0f * queryRadius), found);
+		std::sort(found.begin(), found.end());
+		expected.clear();
+		for (unsigned int i = 0; i < objectCount; i++)
+		{
+			float dx = centers[i].x < c.x - queryRadius ? c.x - queryRadius - centers[i].x : (centers[i].x > c.x + queryRadius ? centers[i].x - c.x - queryRadius : 0.0f);
+			float dy = centers[i].y < c.y ? c.y - centers[i].y : (centers[i].y > c.y + 1.0f ? centers[i].y - c.y - 1.0f : 0.0f);
+			float dz = centers[i].z < c.z ? c.z - centers[i].z : (centers[i].z > c.z + 2.0f * queryRadius ? centers[i].z - c.z - 2.0f * queryRadius : 0.0f);
+			if (dx * dx + dy * dy + dz * dz <= radii[i] * radii[i])
+				expected.push_back(i);
+		}
+		mismatches += found != expected ? 1 : 0;
+	}
+
+	const GridStats& stats = grid.GetStats();
+	std::cout << objectCount << " objects, " << stats.slots << " slots, " << stats.chunks << " chunks\n";
+	std::cout << "build " << buildMs / frames << " ms/frame, " << singleMs / frames << " ms on one thread\n";
+	std::cout << "radius " << queryCount / radiusSeconds / 1e6 << " M queries/s (" << (double)radiusFound / queryCount << " found each)\n";
+	std::cout << "box " << queryCount / boxSeconds / 1e6 << " M queries/s (" << (double)boxFound / queryCount << " found each)\n";
+	std::cout << mismatches << " of " << checkCount * 2 << " queries differ from testing every object\n";
+	return mismatches == 0 ? 0 : 1;
+}
+
+// Work for the job benchmark's dependent stages: blocks are decoded, then halved, then summed.
+struct JobBenchBlocks
+{
+	static const uint32_t Size = 16384;
+	std::vector<float> decoded, halved;
+	std::vector<double> sums;
+
+	static void Decode(void* data, uint32_t begin, uint32_t end)
+	{
+		JobBenchBlocks* blocks = static_cast<JobBenchBlocks*>(data);
+		for (uint32_t b = begin; b < end; b++)
+		{
+			uint32_t state = b * 2654435761u + 1;
+			for (uint32_t i = 0; i < Size; i++)
+			{
+				state ^= state << 13;
+				state ^= state >> 17;
+				state ^= state << 5;
+				blocks->decoded[b * Size + i] = (state & 0xffff) / 65535.0f;
+			}
+		}
+	}
+
+	static void Halve(void* data, uint32_t begin, uint32_t end)
+	{
+		JobBenchBlocks* blocks = static_cast<JobBenchBlocks*>(data);
+		for (uint32_t b = begin; b < end; b++)
+			for (uint32_t i = 0; i < Size / 2; i++)
+				blocks->halved[b * Size / 2 + i] = (blocks->decoded[b * Size + i * 2] + blocks->decoded[b * Size + i * 2 + 1]) * 0.5f;
+	}
+
+	static void Sum(void* data, uint32_t begin, uint32_t end)
+	{
+		JobBenchBlocks* blocks = static_cast<JobBenchBlocks*>(data);
+		for (uint32_t b = begin; b < end; b++)
+		{
+			double sum = 0.0;
+			for (uint32_t i = 0; i < Size / 2; i++)
+				sum += blocks->halved[b * Size / 2 + i];
+			blocks->sums[b] = sum;
+		}
+	}
+};
+
+// Runs culling, skinning and a chain of dependent jobs on the job system with 1 to N threads,
+// where N is the core count, and checks each against running on this thread alone.
+int RunJobBenchmark()
+{
+	const uint32_t sphereCount = 1000000, vertexCount = 200000, boneCount = 64, blockCount = 256;
+	std::mt19937 random(1234);
+	std::uniform_real_distribution<float> position(-100.0f, 100.0f), size(0.5f, 2.0f), unit(0.0f, 1.0f);
+
+	std::vector<XMFLOAT4> spheres(sphereCount);
+	for (XMFLOAT4& sphere : spheres)
+		sphere = XMFLOAT4(position(random), position(random), position(random), size(random));
+	Frustum frustum(XMMatrixLookAtLH(XMVectorSet(0, 0, -120, 1), XMVectorZero(), XMVectorSet(0, 1, 0, 0)) * XMMatrixPerspectiveFovLH(XM_PIDIV4, 16.0f / 9.0f, 0.1f, 200.0f));
+
+	// Four bones a vertex, like the crossbow would have if it were rigged.
+	std::vector<XMFLOAT4X4> bones(boneCount);
+	for (uint32_t b = 0; b < boneCount; b++)
+		XMStoreFloat4x4(&bones[b], XMMatrixRotationRollPitchYaw(unit(random), unit(random), unit(random)) * XMMatrixTranslation(unit(random), unit(random), unit(random)));
+	std::vector<XMFLOAT3> restPositions(vertexCount);
+	std::vector<XMUINT4> boneIndices(vertexCount);
+	std::vector<XMFLOAT4> boneWeights(vertexCount);
+	std::uniform_int_distribution<uint32_t> anyBone(0, boneCount - 1);
+	for (uint32_t v = 0; v < vertexCount; v++)
+	{
+		restPositions[v] = XMFLOAT3(position(random), position(random), position(random));
+		boneIndices[v] = XMUINT4(anyBone(random), anyBone(random), anyBone(random), anyBone(random));
+		float w[4] = { unit(random), unit(random), unit(random), unit(random) };
+		float total = w[0] + w[1] + w[2] + w[3] + 1e-6f;
+		boneWeights[v] = XMFLOAT4(w[0] / total, w[1] / total, w[2] / total, w[3] / total);
+	}
+
+	std::vector<uint8_t> visible(sphereCount), expectedVisible(sphereCount);
+	std::vector<XMFLOAT3> skinned(vertexCount), expectedSkinned(vertexCount);
+	auto cull = [&](uint32_t begin, uint32_t end)
+	{
+		for (uint32_t i = begin; i < end; i++)
+		{
+			XMVECTOR center = XMLoadFloat4(&spheres[i]);
+			uint8_t inside = 1;
+			for (uint32_t p = 0; p < 6; p++)
+				inside &= XMVectorGetX(XMVector3Dot(XMLoadFloat4(&frustum.planes[p]), center)) + frustum.planes[p].w >= -spheres[i].w ? 1 : 0;
+			visible[i] = inside;
+		}
+	};
+	auto skin = [&](uint32_t begin, uint32_t end)
+	{
+		for (uint32_t v = begin; v < end; v++)
+		{
+			XMVECTOR rest = XMLoadFloat3(&restPositions[v]);
+			const uint32_t* index = &boneIndices[v].x;
+			const float* weight = &boneWeights[v].x;
+			XMVECTOR result = XMVectorZero();
+			for (uint32_t k = 0; k < 4; k++)
+				result = XMVectorMultiplyAdd(XMVector3Transform(rest, XMLoadFloat4x4(&bones[index[k]])), XMVectorReplicate(weight[k]), result);
+			XMStoreFloat3(&skinned[v], result);
+		}
+	};
+
+	JobBenchBlocks blocks;
+	blocks.decoded.resize(blockCount * JobBenchBlocks::Size);
+	blocks.halved.resize(blockCount * JobBenchBlocks::Size / 2);
+	blocks.sums.resize(blockCount);
+
+	cull(0, sphereCount);
+	skin(0, vertexCount);
+	JobBenchBlocks::Decode(&blocks, 0, blockCount);
+	JobBenchBlocks::Halve(&blocks, 0, blockCount);
+	JobBenchBlocks::Sum(&blocks, 0, blockCount);
+	expectedVisible = visible;
+	expectedSkinned = skinned;
+	std::vector<double> expectedSums = blocks.sums;
+	size_t visibleCount = std::count(visible.begin(), visible.end(), 1);
+
+	uint32_t cores = std::thread::hardware_concurrency();
+	cores = cores > 0 ? cores : 1;
+	std::cout << sphereCount << " spheres culled (" << visibleCount << " visible), " << vertexCount << " vertices skinned, "
+		<< blockCount << " blocks decoded, halved and summed as dependent jobs; " << cores << " cores\n";
+
+	const unsigned int runs = 10;
+	double baseCull = 0.0, baseSkin = 0.0, baseBlocks = 0.0;
+	unsigned int mismatches = 0;
+	for (uint32_t threads = 1; threads <= cores; threads = threads < cores && threads * 2 > cores ? cores : threads * 2)
+	{
+		JobSystem jobs(threads);
+		std::fill(visible.begin(), visible.end(), 0);
+		std::fill(blocks.sums.begin(), blocks.sums.end(), 0.0);
+
+		Stopwatch stopwatch;
+		for (unsigned int run = 0; run < runs; run++)
+			jobs.ParallelFor(sphereCount, 0, cull);
+		double cullMs = stopwatch.Milliseconds() / runs;
+
+		stopwatch.Restart();
+		for (unsigned int run = 0; run < runs; run++)
+			jobs.ParallelFor(vertexCount, 0, skin);
+		double skinMs = stopwatch.Milliseconds() / runs;
+
+		// A job a block per stage, each stage held back until the one before it is done.
+		stopwatch.Restart();
+		for (unsigned int run = 0; run < runs; run++)
+		{
+			JobCounter decoded, halved, summed;
+			for (uint32_t b = 0; b < blockCount; b++)
+				jobs.Run(JobBenchBlocks::Decode, &blocks, b, b + 1, decoded);
+			for (uint32_t b = 0; b < blockCount; b++)
+				jobs.Run(JobBenchBlocks::Halve, &blocks, b, b + 1, halved, &decoded);
+			for (uint32_t b = 0; b < blockCount; b++)
+				jobs.Run(JobBenchBlocks::Sum, &blocks, b, b + 1, summed, &halved);
+			jobs.Wait(summed);
+		}
+		double blocksMs = stopwatch.Milliseconds() / runs;
+
+		bool matched = visible == expectedVisible && blocks.sums == expectedSums;
+		for (uint32_t v = 0; v < vertexCount && matched; v++)
+			matched = memcmp(&skinned[v], &expectedSkinned[v], sizeof(XMFLOAT3)) == 0;
+		mismatches += matched ? 0 : 1;
+
+		baseCull = threads == 1 ? cullMs : baseCull;
+		baseSkin = threads == 1 ? skinMs : baseSkin;
+		baseBlocks = threads == 1 ? blocksMs : baseBlocks;
+		JobStats stats = jobs.GetStats();
+		std::cout << threads << " threads: cull " << cullMs << " ms (x" << baseCull / cullMs << "), skin " << skinMs << " ms (x" << baseSkin / skinMs
+			<< "), blocks " << blocksMs << " ms (x" << baseBlocks / blocksMs << "), " << stats.executed << " jobs, " << stats.stolen << " stolen, "
+			<< stats.splits << " splits" << (matched ? "" : ", DIFFERENT") << "\n";
+	}
+	return mismatches == 0 ? 0 : 1;
+}
+
+// A stand-in draw list for the record benchmark: every draw binds its own mesh, shaders, texture
+// and constants, and every part starts by binding what the frame shares.
+void RecordBenchmarkDraws(RenderContext& context, uint32_t begin, uint32_t end, void*)
+{
+	const BufferHandle frameBuffers[] = { 1, 2 };
+	const SamplerHandle sampler = 1;
+	context.SetPrimitiveTopology(PrimitiveTopology::TriangleList);
+	context.SetConstantBuffers(CB_PER_FRAME, ARRAYSIZE(frameBuffers), frameBuffers);
+	context.SetSamplers(0, 1, &sampler);
+	for (uint32_t i = begin; i < end; i++)
+	{
+		const BufferHandle vertexBuffer = 3 + i % 8;
+		const uint32_t stride = sizeof(Mesh::SimpleVertex);
+		const uint32_t offset = 0;
+		const TextureHandle texture = 1 + i % 16;
+		context.SetVertexBuffers(0, 1, &vertexBuffer, &stride, &offset);
+		context.SetIndexBuffer(11 + i % 8, IndexFormat::UInt32, 0);
+		context.SetInputLayout(1 + i % 2);
+		context.SetShader(ShaderStage::Vertex, 1 + i % 4);
+		context.SetShader(ShaderStage::Pixel, 5 + i % 4);
+		context.SetTextures(1, 1, &texture);
+
+		PerObjectConstants object;
+		object.mWorld = XMMatrixTranspose(XMMatrixRotationY(i * 0.01f) * XMMatrixTranslation((float)(i % 100), 0.0f, (float)(i / 100)));
+		context.SetDynamicConstants(CB_PER_OBJECT, &object, sizeof(object));
+		context.DrawIndexed(36 + (i % 5) * 6, 0, 0);
+	}
+}
+
+// Resolves a recorded stream to what each draw ran with; see RecordingResolver.
+bool ResolveStream(const RecordingRenderDevice& device, std::vector<RecordingResolver::Event>& events)
+{
+	RecordingResolver resolver;
+	events.clear();
+	return resolver.Resolve(device.GetStream().data(), device.GetStream().size(), events);
+}
+
+// Records the scene and a list of 20k draws on 1 to N threads through the recording device, N
+// being at least 4 so the split is checked on any machine. Each recording is resolved to the state
+// every draw ran with and has to match recording on one thread, draw for draw and in order.
+int RunRecordBenchmark()
+{
+	Mesh::SimpleMesh crossbowMesh;
+	Mesh::SimpleMesh balloonMesh;
+	if (!LoadModels(crossbowMesh, balloonMesh))
+		return 1;
+
+	uint32_t cores = std::thread::hardware_concurrency();
+	uint32_t maxThreads = cores > 4 ? cores : 4;
+	unsigned int mismatches = 0;
+
+	// The scene, a frame at a time with the simulation on this thread so every run draws the same.
+	const unsigned int sceneFrames = 120;
+	const float clr[] = { 0.2f, 0.2f, 0.4f, 1 };
+	std::vector<RecordingResolver::Event> expected, events;
+	GWindow window;	// never created, like the headless run's
+	for (uint32_t threads = 1; threads <= maxThreads; threads *= 2)
+	{
+		RecordingRenderDevice device(1280, 768);
+		device.SetRecordPayloads(true);
+		device.SetRecordThreads(threads);
+		Mesh scene(device, window, &crossbowMesh, &balloonMesh, L"Textures/LongMattedGrass.dds", L"Textures/lowpoly_crossbow.dds");
+		unsigned long long draws = 0;
+		for (unsigned int frame = 0; frame < sceneFrames; frame++)
+		{
+			scene.Update(1.0 / 60.0);
+			device.BeginFrame();
+			device.Clear(clr, 1.0f);
+			scene.Render();
+			device.EndFrame(false);
+			scene.FramePresented();
+			draws += device.GetStats().draws;
+		}
+
+		bool valid = ResolveStream(device, threads == 1 ? expected : events);
+		bool matched = valid && (threads == 1 || events == expected);
+		mismatches += matched ? 0 : 1;
+		std::cout << "scene, " << threads << " threads: " << sceneFrames << " frames, " << draws << " draws, "
+			<< (threads == 1 ? expected.size() : events.size()) << " resolved commands" << (matched ? "" : ", DIFFERENT") << "\n";
+	}
+
+	const uint32_t drawCount = 20000;
+	const unsigned int runs = 20;
+	double baseMs = 0.0;
+	for (uint32_t threads = 1; threads <= maxThreads; threads *= 2)
+	{
+		RecordingRenderDevice device(1280, 768);
+		device.SetRecordPayloads(true);
+		device.SetRecordThreads(threads);
+		double ms = 0.0;
+		for (unsigned int run = 0; run < runs; run++)
+		{
+			device.ClearStream();
+			device.BeginFrame();
+			Stopwatch stopwatch;
+			device.RecordDraws(drawCount, RecordBenchmarkDraws, nullptr);
+			ms += stopwatch.Milliseconds();
+			device.EndFrame(false);
+		}
+		ms /= runs;
+		baseMs = threads == 1 ? ms : baseMs;
+
+		bool valid = ResolveStream(device, threads == 1 ? expected : events);
+		bool matched = valid && (threads == 1 || events == expected);
+		mismatches += matched ? 0 : 1;
+		std::cout << drawCount << " draws, " << threads << " threads: " << ms << " ms (x" << baseMs / ms << "), "
+			<< device.GetStream().size() / 1024 << " KB stream" << (matched ? "" : ", DIFFERENT") << "\n";
+	}
+	std::cout << cores << " cores\n";
+	return mismatches == 0 ? 0 : 1;
+}
+
+// Writes commands in the stream format described above RecordingRenderDevice, by hand, for the
+// record stream check to compare a recording with.
+class ExpectedStream
+{
+public:
+	ExpectedStream& U8(uint8_t value)
+	{
+		payload.push_back(value);
+		return *this;
+	}
+
+	ExpectedStream& U32(uint32_t value)
+	{
+		for (int i = 0; i < 4; i++)
+			payload.push_back(static_cast<uint8_t>(value >> (i * 8)));
+		return *this;
+	}
+
+	ExpectedStream& Float(float value)
+	{
+		uint32_t bits;
+		memcpy(&bits, &value, sizeof(bits));
+		return U32(bits);
+	}
+
+	// Length-prefixed, like buffer contents and strings.
+	ExpectedStream& Bytes(const void* data, uint32_t size)
+	{
+		U32(size);
+		payload.insert(payload.end(), static_cast<const uint8_t*>(data), static_cast<const uint8_t*>(data) + size);
+		return *this;
+	}
+
+	ExpectedStream& Text(const char* text) { return Bytes(text, static_cast<uint32_t>(strlen(text))); }
+
+	// Ends a command: its op, the payload's size 7 bits at a time, low first, then the payload.
+	void End(RecordOp op)
+	{
+		stream.push_back(static_cast<uint8_t>(op));
+		size_t size = payload.size();
+		for (; size >= 0x80; size >>= 7)
+			stream.push_back(static_cast<uint8_t>(size | 0x80));
+		stream.push_back(static_cast<uint8_t>(size));
+		stream.insert(stream.end(), payload.begin(), payload.end());
+		payload.clear();
+	}
+
+	const std::vector<uint8_t>& Get() const { return stream; }
+
+private:
+	std::vector<uint8_t> stream, payload;
+};
+
+// Ways to record the record stream check's frame. All but OtherTexture and ConstantsTwice draw
+// the same, whatever their streams look like.
+enum class KnownFrame
+{
+	Plain,
+	Redundant,		// Binds everything again, in another order, before the second draw.
+	OtherTexture,	// The second draw samples the first draw's texture.
+	ConstantsTwice,	// The second draw gets the first one's dynamic constants again.
+};
+
+// Two triangles' draws with every kind of resource, state and upload, the second one instanced.
+void RecordKnownFrame(RecordingRenderDevice& device, KnownFrame frame)
+{
+	const float vertices[] = { 0.0f, 1.0f, 0.0f, 1.0f, -1.0f, 0.0f, -1.0f, -1.0f, 0.0f };
+	const uint32_t indices[] = { 0, 1, 2 };
+	const uint32_t stride = 12, offset = 0;
+	const float clr[] = { 0.2f, 0.2f, 0.4f, 1.0f };
+	uint8_t constants[200];
+	for (uint32_t i = 0; i < sizeof(constants); i++)
+		constants[i] = static_cast<uint8_t>(i * 7);
+
+	BufferDesc desc;
+	desc.byteWidth = sizeof(vertices);
+	desc.initialData = vertices;
+	BufferHandle vertexBuffer = device.CreateBuffer(desc);
+	desc.binding = BufferBinding::Index;
+	desc.byteWidth = sizeof(indices);
+	desc.initialData = indices;
+	BufferHandle indexBuffer = device.CreateBuffer(desc);
+	desc.binding = BufferBinding::Constant;
+	desc.usage = BufferUsage::Dynamic;
+	desc.byteWidth = 16;
+	desc.initialData = nullptr;
+	BufferHandle constantBuffer = device.CreateBuffer(desc);
+	TextureHandle textures[] = { device.LoadTexture(L"a.dds"), device.LoadTexture(L"b.dds") };
+	ShaderDesc shader;
+	shader.file = L"Shader.hlsl";
+	shader.entryPoint = "VSMain";
+	shader.profile = "vs_4_0";
+	ShaderHandle vertexShader = device.CreateShader(shader);
+	shader.stage = ShaderStage::Pixel;
+	shader.entryPoint = "PSMain";
+	shader.profile = "ps_4_0";
+	ShaderHandle pixelShader = device.CreateShader(shader);
+	VertexElement element = { "POSITION", 0, VertexFormat::Float3, 0, false };
+	InputLayoutHandle layout = device.CreateInputLayout(vertexShader, &element, 1);
+	SamplerHandle sampler = device.CreateSampler(SamplerDesc());
+	DepthStateHandle depthState = device.CreateDepthState(DepthStateDesc());
+
+	device.BeginFrame();
+	device.Clear(clr, 1.0f);
+	for (int draw = 0; draw < 2; draw++)
+	{
+		if (draw == 0 || frame == KnownFrame::Redundant)
+		{
+			device.SetDepthState(depthState);
+			device.SetTextures(0, 1, &textures[0]);
+			device.SetSamplers(0, 1, &sampler);
+			device.SetConstantBuffers(0, 1, &constantBuffer);
+			device.SetShader(ShaderStage::Pixel, pixelShader);
+			device.SetShader(ShaderStage::Vertex, vertexShader);
+			device.SetIndexBuffer(indexBuffer, IndexFormat::UInt32, 0);
+			device.SetVertexBuffers(0, 1, &vertexBuffer, &stride, &offset);
+			device.SetInputLayout(layout);
+			device.SetPrimitiveTopology(PrimitiveTopology::TriangleList);
+		}
+		if (draw == 0)
+		{
+			float* mapped = static_cast<float*>(device.MapBuffer(constantBuffer, MapMode::WriteDiscard));
+			for (int i = 0; i < 4; i++)
+				mapped[i] = clr[i];
+			device.UnmapBuffer(constantBuffer, 16);
+			device.SetDynamicConstants(1, constants, sizeof(constants));
+			device.DrawIndexed(3, 0, 0);
+			continue;
+		}
+		if (frame != KnownFrame::OtherTexture)
+			device.SetTextures(0, 1, &textures[1]);
+		if (frame == KnownFrame::ConstantsTwice)
+			device.SetDynamicConstants(1, constants, sizeof(constants));
+		device.DrawIndexedInstanced(3, 4, 0, -1, 2);
+	}
+	device.EndFrame(true);
+}
+
+// Records a known frame and checks its stream byte for byte against one written by hand from the
+// format, then replays recordings of it through RecordingResolver: rebinding everything redundantly
+// has to resolve to the same draws, and a changed texture or constants left over from the previous
+// draw to different ones.
+int RunRecordStreamBenchmark()
+{
+	RecordingRenderDevice device(1280, 768);
+	device.SetRecordPayloads(true);
+	RecordKnownFrame(device, KnownFrame::Plain);
+
+	const float vertices[] = { 0.0f, 1.0f, 0.0f, 1.0f, -1.0f, 0.0f, -1.0f, -1.0f, 0.0f };
+	const uint32_t indices[] = { 0, 1, 2 };
+	const float clr[] = { 0.2f, 0.2f, 0.4f, 1.0f };
+	uint8_t constants[200];
+	for (uint32_t i = 0; i < sizeof(constants); i++)
+		constants[i] = static_cast<uint8_t>(i * 7);
+	ExpectedStream expected;
+	expected.U32(1).U8(0).U8(0).U32(sizeof(vertices)).Bytes(vertices, sizeof(vertices)).End(RecordOp::CreateBuffer);
+	expected.U32(2).U8(1).U8(0).U32(sizeof(indices)).Bytes(indices, sizeof(indices)).End(RecordOp::CreateBuffer);
+	expected.U32(3).U8(2).U8(1).U32(16).End(RecordOp::CreateBuffer);
+	expected.U32(1).Text("a.dds").End(RecordOp::LoadTexture);
+	expected.U32(2).Text("b.dds").End(RecordOp::LoadTexture);
+	expected.U32(1).U8(0).Text("Shader.hlsl").Text("VSMain").Text("vs_4_0").End(RecordOp::CreateShader);
+	expected.U32(2).U8(1).Text("Shader.hlsl").Text("PSMain").Text("ps_4_0").End(RecordOp::CreateShader);
+	expected.U32(1).U32(1).U32(1).Text("POSITION").U32(0).U8(1).U32(0).U8(0).End(RecordOp::CreateInputLayout);
+	expected.U32(1).U8(1).U8(0).End(RecordOp::CreateSampler);
+	expected.U32(1).U8(1).U8(1).U8(1).End(RecordOp::CreateDepthState);
+	expected.U32(0).End(RecordOp::BeginFrame);
+	expected.Float(clr[0]).Float(clr[1]).Float(clr[2]).Float(clr[3]).Float(1.0f).End(RecordOp::Clear);
+	expected.U32(1).End(RecordOp::SetDepthState);
+	expected.U32(0).U32(1).U32(1).End(RecordOp::SetTextures);
+	expected.U32(0).U32(1).U32(1).End(RecordOp::SetSamplers);
+	expected.U32(0).U32(1).U32(3).End(RecordOp::SetConstantBuffers);
+	expected.U8(1).U32(2).End(RecordOp::SetShader);
+	expected.U8(0).U32(1).End(RecordOp::SetShader);
+	expected.U32(2).U8(0).U32(0).End(RecordOp::SetIndexBuffer);
+	expected.U32(0).U32(1).U32(1).U32(12).U32(0).End(RecordOp::SetVertexBuffers);
+	expected.U32(1).End(RecordOp::SetInputLayout);
+	expected.U8(0).End(RecordOp::SetPrimitiveTopology);
+	expected.U32(3).U8(0).End(RecordOp::MapBuffer);
+	expected.U32(3).U32(16).Bytes(clr, sizeof(clr)).End(RecordOp::UnmapBuffer);
+	// Over 127 bytes, so its size takes two bytes.
+	expected.U32(1).U32(sizeof(constants)).Bytes(constants, sizeof(constants)).End(RecordOp::SetDynamicConstants);
+	expected.U32(3).U32(0).U32(0).End(RecordOp::DrawIndexed);
+	expected.U32(0).U32(1).U32(2).End(RecordOp::SetTextures);
+	expected.U32(3).U32(4).U32(0).U32(0xFFFFFFFF).U32(2).End(RecordOp::DrawIndexedInstanced);
+	expected.U32(0).U8(1).End(RecordOp::EndFrame);
+
+	const std::vector<uint8_t>& stream = device.GetStream();
+	size_t differs = 0;
+	while (differs < stream.size() && differs < expected.Get().size() && stream[differs] == expected.Get()[differs])
+		differs++;
+	bool matched = stream == expected.Get();
+	const RenderStats& stats = device.GetStats();
+	bool counted = stats.draws == 2 && stats.instances == 5 && stats.triangles == 5 && stats.stateCalls == 11 &&
+		stats.uploads == 2 && stats.bytesUploaded == 16 + sizeof(constants);
+	std::cout << "known frame: " << stream.size() << " bytes, " << (matched ? "as written by hand" : "DIFFERENT")
+		<< (matched ? "" : " from byte " + std::to_string(differs)) << (counted ? "" : ", stats WRONG") << "\n";
+
+	const KnownFrame frames[] = { KnownFrame::Redundant, KnownFrame::OtherTexture, KnownFrame::ConstantsTwice };
+	const char* names[] = { "redundant binds", "other texture", "constants twice" };
+	std::vector<RecordingResolver::Event> plain, events;
+	// Ten creates, the frame's begin, clear, map, unmap, two draws and end; state only shows in the draws.
+	bool replayed = ResolveStream(device, plain) && plain.size() == 17;
+	if (!replayed)
+		std::cout << "known frame resolved to " << plain.size() << " events, not 17\n";
+	for (int i = 0; i < 3; i++)
+	{
+		RecordingRenderDevice other(1280, 768);
+		other.SetRecordPayloads(true);
+		RecordKnownFrame(other, frames[i]);
+		bool same = ResolveStream(other, events) && events == plain;
+		bool passed = same == (frames[i] == KnownFrame::Redundant);
+		replayed = replayed && passed;
+		std::cout << names[i] << ": " << other.GetStream().size() << " bytes, draws " << (same ? "the same" : "differently")
+			<< (passed ? "" : ", WRONG") << "\n";
+	}
+	return matched && counted && replayed ? 0 : 1;
+}
+
+// Scopes nested 'depth' deep, so the benchmark pays for the depth counter like real code.
+void ProfiledScopes(uint32_t depth)
+{
+	PROFILE_SCOPE("BenchScope");
+	if (depth > 1)
+		ProfiledScopes(depth - 1);
+}
+
+// Times millions of profiled scopes, flat and nested four deep, with the profiler on and off. The
+// rings wrap many times over, as they would in a long run. Fails if an enabled scope takes 50 ns
+// or more.
+int RunProfilerBenchmark()
+{
+	const uint32_t scopes = 4000000;
+	const double budgetNs = 50.0;
+	bool passed = true;
+	for (uint32_t run = 0; run < 4; run++)
+	{
+		bool on = run >= 2;
+		uint32_t depth = run % 2 == 0 ? 1 : 4;
+		Profiler::SetEnabled(on);
+		Profiler::Clear();
+		Stopwatch stopwatch;
+		for (uint32_t i = 0; i < scopes; i += depth)
+			ProfiledScopes(depth);
+		double ns = stopwatch.Nanoseconds() / scopes;
+		bool fast = !on || ns < budgetNs;
+		passed = passed && fast;
+		std::cout << (on ? "enabled" : "disabled") << ", " << depth << " deep: " << ns << " ns/scope" << (fast ? "" : ", OVER BUDGET") << "\n";
+	}
+	Profiler::SetEnabled(false);
+
+	std::vector<ProfileStat> stats;
+	Profiler::CollectStats(stats);
+	std::cout << "ring holds " << (stats.empty() ? 0 : stats[0].count) << " scopes per thread, " << Profiler::RingSize << " max\n";
+	return passed ? 0 : 1;
+}
+
+// A GPU for the GPU timer benchmark that finishes each frame 'lag' frames after the CPU submitted
+// it. Pass p takes (p + 1) * PassTicks and the frame ends GapTicks after its last pass; every
+// 'disjointEvery'th frame its clock changes speed.
+class FakeTimerBackend
+{
+public:
+	static const uint32_t MaxSlots = 8;
+	static const uint32_t MaxTimestamps = 64;
+	static const uint64_t Frequency = 1000000;
+	static const uint64_t PassTicks = 100;
+	static const uint64_t GapTicks = 50;
+
+	FakeTimerBackend(uint32_t _lag, uint32_t _disjointEvery) : lag(_lag), disjointEvery(_disjointEvery) {}
+
+	// The CPU moves on to its next frame.
+	void Advance() { cpuFrame++; }
+
+	void BeginFrame(uint32_t slot) { slots[slot].frame = cpuFrame; }
+
+	void Timestamp(uint32_t slot, uint32_t index)
+	{
+		if (index == 1)
+			clock += GapTicks;
+		else if (index >= 3 && index % 2 == 1)
+			clock += ((index - 3) / 2 + 1) * PassTicks;
+		slots[slot].ticks[index] = clock;
+	}
+
+	void EndFrame(uint32_t) {}
+
+	bool ReadFrame(uint32_t slot, uint32_t count, uint64_t* ticks, uint64_t& frequency, bool& disjoint)
+	{
+		const Slot& queries = slots[slot];
+		if (cpuFrame < queries.frame + lag)
+			return false;
+		memcpy(ticks, queries.ticks, count * sizeof(uint64_t));
+		frequency = Frequency;
+		disjoint = disjointEvery > 0 && queries.frame % disjointEvery == 0;
+		return true;
+	}
+
+private:
+	struct Slot
+	{
+		uint64_t frame = 0;
+		uint64_t ticks[MaxTimestamps] = {};
+	};
+
+	uint32_t lag, disjointEvery;
+	uint64_t cpuFrame = 0, clock = 0;
+	Slot slots[MaxSlots];
+};
+
+static_assert(GpuTimer<FakeTimerBackend>::FrameLatency <= FakeTimerBackend::MaxSlots, "FakeTimerBackend needs more slots");
+static_assert(GpuTimer<FakeTimerBackend>::TimestampsPerFrame <= FakeTimerBackend::MaxTimestamps, "FakeTimerBackend needs more timestamps");
+
+// Runs frames of five passes through the GPU timer on a fake backend: with the GPU a little
+// behind, further behind than the timer keeps frames in flight, and with disjoint frames. Every
+// frame has to be timed, skipped, dropped as disjoint or still in flight, and the times summed
+// have to be the fake GPU's, in the timer's stats and in the profiler's. Then times the timer's
+// own cost per pass.
+int RunGpuTimerBenchmark()
+{
+	typedef GpuTimer<FakeTimerBackend> Timer;
+	static const char* passNames[] = { "GPU Pass 0", "GPU Pass 1", "GPU Pass 2", "GPU Pass 3", "GPU Pass 4" };
+	const uint32_t passes = ARRAYSIZE(passNames);
+	const uint32_t frames = 1000;
+	struct Case
+	{
+		uint32_t lag, disjointEvery;
+	};
+	const Case cases[] = { { 2, 0 }, { 2, 10 }, { Timer::FrameLatency + 3, 0 } };
+
+	bool passed = true;
+	for (const Case& test : cases)
+	{
+		FakeTimerBackend backend(test.lag, test.disjointEvery);
+		Timer timer(backend);
+		bool profiled = &test == &cases[0];
+		Profiler::SetEnabled(profiled);
+		Profiler::Clear();
+		for (uint32_t f = 0; f < frames; f++)
+		{
+			backend.Advance();
+			timer.BeginFrame();
+			for (uint32_t p = 0; p < passes; p++)
+			{
+				timer.BeginPass(passNames[p]);
+				timer.EndPass();
+			}
+			timer.EndFrame();
+		}
+		Profiler::SetEnabled(false);
+
+		uint64_t accounted = timer.GetFramesTimed() + timer.GetFramesSkipped() + timer.GetFramesDisjoint() + timer.GetFramesInFlight();
+		bool valid = accounted == frames && timer.GetFramesTimed() > 0 && timer.GetFramesInFlight() <= Timer::FrameLatency &&
+			(timer.GetFramesSkipped() > 0) == (test.lag > Timer::FrameLatency) && (timer.GetFramesDisjoint() > 0) == (test.disjointEvery > 0);
+		const std::vector<ProfileStat>& stats = timer.GetStats();
+		valid = valid && stats.size() == passes + 1;
+		for (size_t i = 0; valid && i < stats.size(); i++)
+		{
+			uint64_t ticks = i == 0 ? passes * (passes + 1) / 2 * FakeTimerBackend::PassTicks + FakeTimerBackend::GapTicks : i * FakeTimerBackend::PassTicks;
+			double ms = ticks * 1000.0 / FakeTimerBackend::Frequency;
+			valid = stats[i].count == timer.GetFramesTimed() && fabs(stats[i].maxMs - ms) < 1e-9 && fabs(stats[i].totalMs - ms * stats[i].count) < 1e-6;
+		}
+		if (valid && profiled)
+		{
+			std::vector<ProfileStat> profile;
+			Profiler::CollectStats(profile);
+			bool found = false;
+			for (const ProfileStat& stat : profile)
+				found = found || (strcmp(stat.name, "GPU Frame") == 0 && stat.count == timer.GetFramesTimed());
+			valid = found;
+		}
+		passed = passed && valid;
+		std::cout << "lag " << test.lag << " frames, disjoint every " << test.disjointEvery << ": " << timer.GetFramesTimed() << " timed, "
+			<< timer.GetFramesSkipped() << " skipped, " << timer.GetFramesDisjoint() << " disjoint, " << timer.GetFramesInFlight() << " in flight"
+			<< (valid ? "" : ", WRONG") << "\n";
+	}
+
+	FakeTimerBackend backend(2, 0);
+	Timer timer(backend);
+	const uint32_t timedFrames = 200000;
+	Stopwatch stopwatch;
+	for (uint32_t f = 0; f < timedFrames; f++)
+	{
+		backend.Advance();
+		timer.BeginFrame();
+		for (uint32_t p = 0; p < passes; p++)
+		{
+			timer.BeginPass(passNames[p]);
+			timer.EndPass();
+		}
+		timer.EndFrame();
+	}
+	double ns = stopwatch.Nanoseconds() / timedFrames;
+	std::cout << ns << " ns/frame of " << passes << " passes, read back included\n";
+	return passed ? 0 : 1;
+}
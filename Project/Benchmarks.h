@@ -0,0 +1,41 @@
+#pragma once
+#include "DrawClass.h"
+#include <chrono>
+#include <string>
+
+// Wall time since construction or the last Restart(), for the --bench-* modes.
+class Stopwatch
+{
+	std::chrono::steady_clock::time_point start;
+
+public:
+	Stopwatch() { Restart(); }
+
+	void Restart() { start = std::chrono::steady_clock::now(); }
+
+	double Seconds() const { return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count(); }
+	double Milliseconds() const { return Seconds() * 1000.0; }
+	double Nanoseconds() const { return Seconds() * 1e9; }
+};
+
+// The --bench-* checks and benchmarks. Each prints its results and returns the process exit
+// code, 1 if one of its checks failed.
+int RunPackBenchmark();
+int RunConstantRingBenchmark();
+int RunStateCacheBenchmark();
+int RunSortBenchmark();
+int RunRasterBenchmark(bool multithreaded);
+int RunCullBenchmark();
+int RunBvhBenchmark();
+int RunPickBenchmark();
+int RunCollisionBenchmark();
+int RunGridBenchmark();
+int RunJobBenchmark();
+int RunRecordBenchmark();
+int RunRecordStreamBenchmark();
+int RunProfilerBenchmark();
+int RunGpuTimerBenchmark();
+
+// The model loading in main.cpp, which the pick and record benchmarks share with the app.
+void ReadModel(std::string pathToModel, Mesh::SimpleMesh& mesh);
+bool LoadModels(Mesh::SimpleMesh& crossbowMesh, Mesh::SimpleMesh& balloonMesh);
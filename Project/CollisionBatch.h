@@ -0,0 +1,391 @@
+#pragma once
+#include "defines.h"
+#include "RasterSimd.h"
+#include <cfloat>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <vector>
+
+// Rays, or segments when 'maxDistance' is their length, stored as arrays. Directions are unit
+// length, which GCollision's ray tests assume too.
+struct RayBatch
+{
+	std::vector<float> originX, originY, originZ;
+	std::vector<float> directionX, directionY, directionZ;
+	std::vector<float> maxDistance;
+
+	uint32_t Add(const XMFLOAT3& origin, const XMFLOAT3& direction, float _maxDistance = FLT_MAX)
+	{
+		float length = sqrtf(direction.x * direction.x + direction.y * direction.y + direction.z * direction.z);
+		float scale = length > 0.0f ? 1.0f / length : 0.0f;
+		originX.push_back(origin.x); originY.push_back(origin.y); originZ.push_back(origin.z);
+		directionX.push_back(direction.x * scale); directionY.push_back(direction.y * scale); directionZ.push_back(direction.z * scale);
+		maxDistance.push_back(_maxDistance);
+		return static_cast<uint32_t>(originX.size() - 1);
+	}
+
+	uint32_t AddSegment(const XMFLOAT3& from, const XMFLOAT3& to)
+	{
+		XMFLOAT3 direction(to.x - from.x, to.y - from.y, to.z - from.z);
+		return Add(from, direction, sqrtf(direction.x * direction.x + direction.y * direction.y + direction.z * direction.z));
+	}
+
+	void Clear()
+	{
+		originX.clear(); originY.clear(); originZ.clear();
+		directionX.clear(); directionY.clear(); directionZ.clear();
+		maxDistance.clear();
+	}
+
+	void Reserve(size_t count)
+	{
+		originX.reserve(count); originY.reserve(count); originZ.reserve(count);
+		directionX.reserve(count); directionY.reserve(count); directionZ.reserve(count);
+		maxDistance.reserve(count);
+	}
+
+	size_t Count() const { return originX.size(); }
+};
+
+struct SphereBatch
+{
+	std::vector<float> centerX, centerY, centerZ, radius;
+
+	uint32_t Add(const XMFLOAT3& center, float _radius)
+	{
+		centerX.push_back(center.x); centerY.push_back(center.y); centerZ.push_back(center.z);
+		radius.push_back(_radius);
+		return static_cast<uint32_t>(centerX.size() - 1);
+	}
+
+	void Clear() { centerX.clear(); centerY.clear(); centerZ.clear(); radius.clear(); }
+	void Reserve(size_t count) { centerX.reserve(count); centerY.reserve(count); centerZ.reserve(count); radius.reserve(count); }
+	size_t Count() const { return centerX.size(); }
+};
+
+struct BoxBatch
+{
+	std::vector<float> minX, minY, minZ;
+	std::vector<float> maxX, maxY, maxZ;
+
+	uint32_t Add(const XMFLOAT3& boundsMin, const XMFLOAT3& boundsMax)
+	{
+		minX.push_back(boundsMin.x); minY.push_back(boundsMin.y); minZ.push_back(boundsMin.z);
+		maxX.push_back(boundsMax.x); maxY.push_back(boundsMax.y); maxZ.push_back(boundsMax.z);
+		return static_cast<uint32_t>(minX.size() - 1);
+	}
+
+	void Clear() { minX.clear(); minY.clear(); minZ.clear(); maxX.clear(); maxY.clear(); maxZ.clear(); }
+
+	void Reserve(size_t count)
+	{
+		minX.reserve(count); minY.reserve(count); minZ.reserve(count);
+		maxX.reserve(count); maxY.reserve(count); maxZ.reserve(count);
+	}
+
+	size_t Count() const { return minX.size(); }
+};
+
+// A ray that hit a target, with GCollision's interval for the pair.
+struct CollisionHit
+{
+	uint32_t ray;
+	uint32_t target;
+	float distance;
+};
+
+// Work done by the last query.
+struct CollisionStats
+{
+	uint64_t tests = 0;
+	uint32_t hits = 0;
+	double ms = 0.0;
+
+	void Reset() { *this = CollisionStats(); }
+};
+
+// Tests every ray of a batch against every sphere or box of another. Each ray is held in
+// registers while the SSE2 and AVX2 kernels test it against 4 or 8 targets at a time, and targets
+// are taken in blocks that stay in the L1 cache while every ray passes over them.
+//
+// The decisions and distances are those of GCollision::IntersectRayToSphereF and
+// IntersectRayToAABBF: a ray starting inside a sphere hits it at 0 and one starting inside a box
+// hits it where it leaves. A hit also has to be within the ray's 'maxDistance'. Square roots are
+// only taken for hits.
+class CollisionBatch
+{
+public:
+	// Targets per block: 16KB of sphere or 24KB of box arrays.
+	static const uint32_t BlockSize = 1024;
+
+	CollisionBatch()
+	{
+		kernel = RasterBestKernel();
+	}
+
+	// The best supported kernel is picked at construction; returns false if 'kernel' can't run here.
+	bool SetKernel(RasterKernel _kernel)
+	{
+		if (!RasterKernelSupported(_kernel))
+			return false;
+		kernel = _kernel;
+		return true;
+	}
+	RasterKernel GetKernel() const { return kernel; }
+
+	// Replaces 'hits' with every ray and sphere pair that intersects, in no particular order.
+	void RaysToSpheres(const RayBatch& rays, const SphereBatch& spheres, std::vector<CollisionHit>& hits)
+	{
+		std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+		hits.clear();
+		uint32_t rayCount = static_cast<uint32_t>(rays.Count()), sphereCount = static_cast<uint32_t>(spheres.Count());
+		for (uint32_t block = 0; block < sphereCount; block += BlockSize)
+		{
+			uint32_t end = block + BlockSize < sphereCount ? block + BlockSize : sphereCount;
+			for (uint32_t r = 0; r < rayCount; r++)
+			{
+				uint32_t first = block;
+#if RASTER_SIMD
+				if (kernel == RasterKernel::Avx2)
+					first = SpheresAvx2(rays, r, spheres, block, end, hits);
+				else if (kernel == RasterKernel::Sse2)
+					first = SpheresSse2(rays, r, spheres, block, end, hits);
+#endif
+				SpheresScalar(rays, r, spheres, first, end, hits);
+			}
+		}
+		Finish(start, static_cast<uint64_t>(rayCount) * sphereCount, hits);
+	}
+
+	// Replaces 'hits' with every ray and box pair that intersects, in no particular order.
+	void RaysToBoxes(const RayBatch& rays, const BoxBatch& boxes, std::vector<CollisionHit>& hits)
+	{
+		std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+		hits.clear();
+		uint32_t rayCount = static_cast<uint32_t>(rays.Count()), boxCount = static_cast<uint32_t>(boxes.Count());
+		for (uint32_t block = 0; block < boxCount; block += BlockSize)
+		{
+			uint32_t end = block + BlockSize < boxCount ? block + BlockSize : boxCount;
+			for (uint32_t r = 0; r < rayCount; r++)
+			{
+				uint32_t first = block;
+#if RASTER_SIMD
+				if (kernel == RasterKernel::Avx2)
+					first = BoxesAvx2(rays, r, boxes, block, end, hits);
+				else if (kernel == RasterKernel::Sse2)
+					first = BoxesSse2(rays, r, boxes, block, end, hits);
+#endif
+				BoxesScalar(rays, r, boxes, first, end, hits);
+			}
+		}
+		Finish(start, static_cast<uint64_t>(rayCount) * boxCount, hits);
+	}
+
+	const CollisionStats& GetStats() const { return stats; }
+
+private:
+	void Finish(std::chrono::steady_clock::time_point start, uint64_t tests, const std::vector<CollisionHit>& hits)
+	{
+		stats.tests = tests;
+		stats.hits = static_cast<uint32_t>(hits.size());
+		stats.ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+	}
+
+	// Zero components get a huge reciprocal instead of infinity, so a ray lying in a slab's plane
+	// gives no 0 * infinity.
+	static float Reciprocal(float value) { return value != 0.0f ? 1.0f / value : 1e30f; }
+
+	// With m = origin - center, b = m.d and c = m.m - r^2, the ray misses when it starts outside
+	// and points away (c > 0, b > 0) or the discriminant b^2 - c is negative. It enters at
+	// -b - sqrt(b^2 - c), 0 from inside, which is within 'maxDistance' when -b - maxDistance is
+	// negative or its square is at most the discriminant.
+	static float SphereDistance(float b, float discriminant)
+	{
+		float t = -b - sqrtf(discriminant);
+		return t > 0.0f ? t : 0.0f;
+	}
+
+	void SpheresScalar(const RayBatch& rays, uint32_t r, const SphereBatch& spheres, uint32_t first, uint32_t end, std::vector<CollisionHit>& hits) const
+	{
+		float ox = rays.originX[r], oy = rays.originY[r], oz = rays.originZ[r];
+		float dx = rays.directionX[r], dy = rays.directionY[r], dz = rays.directionZ[r];
+		float maxDistance = rays.maxDistance[r];
+		for (uint32_t s = first; s < end; s++)
+		{
+			float mx = ox - spheres.centerX[s], my = oy - spheres.centerY[s], mz = oz - spheres.centerZ[s];
+			float b = mx * dx + my * dy + mz * dz;
+			float c = mx * mx + my * my + mz * mz - spheres.radius[s] * spheres.radius[s];
+			float discriminant = b * b - c;
+			float beyond = -b - maxDistance;
+			bool hit = !(c > 0.0f && b > 0.0f) && discriminant >= 0.0f && (beyond <= 0.0f || beyond * beyond <= discriminant);
+			if (hit)
+				hits.push_back({ r, s, SphereDistance(b, discriminant) });
+		}
+	}
+
+	// Slab test. The ray misses when the slabs' overlap is empty, behind it or past 'maxDistance'.
+	void BoxesScalar(const RayBatch& rays, uint32_t r, const BoxBatch& boxes, uint32_t first, uint32_t end, std::vector<CollisionHit>& hits) const
+	{
+		float ox = rays.originX[r], oy = rays.originY[r], oz = rays.originZ[r];
+		float ix = Reciprocal(rays.directionX[r]), iy = Reciprocal(rays.directionY[r]), iz = Reciprocal(rays.directionZ[r]);
+		float maxDistance = rays.maxDistance[r];
+		for (uint32_t b = first; b < end; b++)
+		{
+			float tx0 = (boxes.minX[b] - ox) * ix, tx1 = (boxes.maxX[b] - ox) * ix;
+			float ty0 = (boxes.minY[b] - oy) * iy, ty1 = (boxes.maxY[b] - oy) * iy;
+			float tz0 = (boxes.minZ[b] - oz) * iz, tz1 = (boxes.maxZ[b] - oz) * iz;
+			float tMin = MaxF(MaxF(MinF(tx0, tx1), MinF(ty0, ty1)), MinF(tz0, tz1));
+			float tMax = MinF(MinF(MaxF(tx0, tx1), MaxF(ty0, ty1)), MaxF(tz0, tz1));
+			if (tMax >= 0.0f && tMin <= tMax && tMin <= maxDistance)
+				hits.push_back({ r, b, tMin < 0.0f ? tMax : tMin });
+		}
+	}
+
+	// Same argument order as the SIMD min and max, so every kernel agrees.
+	static float MinF(float a, float b) { return a < b ? a : b; }
+	static float MaxF(float a, float b) { return a > b ? a : b; }
+
+#if RASTER_SIMD
+	// Returns the first sphere left for the scalar loop.
+	uint32_t SpheresSse2(const RayBatch& rays, uint32_t r, const SphereBatch& spheres, uint32_t first, uint32_t end, std::vector<CollisionHit>& hits) const
+	{
+		__m128 ox = _mm_set1_ps(rays.originX[r]), oy = _mm_set1_ps(rays.originY[r]), oz = _mm_set1_ps(rays.originZ[r]);
+		__m128 dx = _mm_set1_ps(rays.directionX[r]), dy = _mm_set1_ps(rays.directionY[r]), dz = _mm_set1_ps(rays.directionZ[r]);
+		__m128 maxDistance = _mm_set1_ps(rays.maxDistance[r]);
+		const __m128 zero = _mm_setzero_ps();
+		uint32_t last = first + ((end - first) & ~3u);
+		for (uint32_t s = first; s < last; s += 4)
+		{
+			__m128 mx = _mm_sub_ps(ox, _mm_loadu_ps(&spheres.centerX[s]));
+			__m128 my = _mm_sub_ps(oy, _mm_loadu_ps(&spheres.centerY[s]));
+			__m128 mz = _mm_sub_ps(oz, _mm_loadu_ps(&spheres.centerZ[s]));
+			__m128 radius = _mm_loadu_ps(&spheres.radius[s]);
+			__m128 b = _mm_add_ps(_mm_add_ps(_mm_mul_ps(mx, dx), _mm_mul_ps(my, dy)), _mm_mul_ps(mz, dz));
+			__m128 c = _mm_sub_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(mx, mx), _mm_mul_ps(my, my)), _mm_mul_ps(mz, mz)), _mm_mul_ps(radius, radius));
+			__m128 discriminant = _mm_sub_ps(_mm_mul_ps(b, b), c);
+			__m128 beyond = _mm_sub_ps(_mm_sub_ps(zero, b), maxDistance);
+			__m128 away = _mm_and_ps(_mm_cmpgt_ps(c, zero), _mm_cmpgt_ps(b, zero));
+			__m128 reaches = _mm_or_ps(_mm_cmple_ps(beyond, zero), _mm_cmple_ps(_mm_mul_ps(beyond, beyond), discriminant));
+			__m128 hit = _mm_andnot_ps(away, _mm_and_ps(_mm_cmpge_ps(discriminant, zero), reaches));
+			uint32_t mask = static_cast<uint32_t>(_mm_movemask_ps(hit));
+			if (mask != 0)
+			{
+				alignas(16) float bLanes[4], discriminantLanes[4];
+				_mm_store_ps(bLanes, b);
+				_mm_store_ps(discriminantLanes, discriminant);
+				AppendSphereHits(mask, r, s, bLanes, discriminantLanes, hits);
+			}
+		}
+		return last;
+	}
+
+	RASTER_TARGET_AVX2 uint32_t SpheresAvx2(const RayBatch& rays, uint32_t r, const SphereBatch& spheres, uint32_t first, uint32_t end, std::vector<CollisionHit>& hits) const
+	{
+		__m256 ox = _mm256_set1_ps(rays.originX[r]), oy = _mm256_set1_ps(rays.originY[r]), oz = _mm256_set1_ps(rays.originZ[r]);
+		__m256 dx = _mm256_set1_ps(rays.directionX[r]), dy = _mm256_set1_ps(rays.directionY[r]), dz = _mm256_set1_ps(rays.directionZ[r]);
+		__m256 maxDistance = _mm256_set1_ps(rays.maxDistance[r]);
+		const __m256 zero = _mm256_setzero_ps();
+		uint32_t last = first + ((end - first) & ~7u);
+		for (uint32_t s = first; s < last; s += 8)
+		{
+			__m256 mx = _mm256_sub_ps(ox, _mm256_loadu_ps(&spheres.centerX[s]));
+			__m256 my = _mm256_sub_ps(oy, _mm256_loadu_ps(&spheres.centerY[s]));
+			__m256 mz = _mm256_sub_ps(oz, _mm256_loadu_ps(&spheres.centerZ[s]));
+			__m256 radius = _mm256_loadu_ps(&spheres.radius[s]);
+			__m256 b = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(mx, dx), _mm256_mul_ps(my, dy)), _mm256_mul_ps(mz, dz));
+			__m256 c = _mm256_sub_ps(_mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(mx, mx), _mm256_mul_ps(my, my)), _mm256_mul_ps(mz, mz)), _mm256_mul_ps(radius, radius));
+			__m256 discriminant = _mm256_sub_ps(_mm256_mul_ps(b, b), c);
+			__m256 beyond = _mm256_sub_ps(_mm256_sub_ps(zero, b), maxDistance);
+			__m256 away = _mm256_and_ps(_mm256_cmp_ps(c, zero, _CMP_GT_OQ), _mm256_cmp_ps(b, zero, _CMP_GT_OQ));
+			__m256 reaches = _mm256_or_ps(_mm256_cmp_ps(beyond, zero, _CMP_LE_OQ), _mm256_cmp_ps(_mm256_mul_ps(beyond, beyond), discriminant, _CMP_LE_OQ));
+			__m256 hit = _mm256_andnot_ps(away, _mm256_and_ps(_mm256_cmp_ps(discriminant, zero, _CMP_GE_OQ), reaches));
+			uint32_t mask = static_cast<uint32_t>(_mm256_movemask_ps(hit));
+			if (mask != 0)
+			{
+				alignas(32) float bLanes[8], discriminantLanes[8];
+				_mm256_store_ps(bLanes, b);
+				_mm256_store_ps(discriminantLanes, discriminant);
+				AppendSphereHits(mask, r, s, bLanes, discriminantLanes, hits);
+			}
+		}
+		return last;
+	}
+
+	static void AppendSphereHits(uint32_t mask, uint32_t r, uint32_t base, const float* b, const float* discriminant, std::vector<CollisionHit>& hits)
+	{
+		for (uint32_t lane = 0; mask != 0; lane++, mask >>= 1)
+		{
+			if (mask & 1)
+				hits.push_back({ r, base + lane, SphereDistance(b[lane], discriminant[lane]) });
+		}
+	}
+
+	// Returns the first box left for the scalar loop.
+	uint32_t BoxesSse2(const RayBatch& rays, uint32_t r, const BoxBatch& boxes, uint32_t first, uint32_t end, std::vector<CollisionHit>& hits) const
+	{
+		__m128 ox = _mm_set1_ps(rays.originX[r]), oy = _mm_set1_ps(rays.originY[r]), oz = _mm_set1_ps(rays.originZ[r]);
+		__m128 ix = _mm_set1_ps(Reciprocal(rays.directionX[r])), iy = _mm_set1_ps(Reciprocal(rays.directionY[r])), iz = _mm_set1_ps(Reciprocal(rays.directionZ[r]));
+		__m128 maxDistance = _mm_set1_ps(rays.maxDistance[r]);
+		const __m128 zero = _mm_setzero_ps();
+		uint32_t last = first + ((end - first) & ~3u);
+		for (uint32_t b = first; b < last; b += 4)
+		{
+			__m128 tx0 = _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(&boxes.minX[b]), ox), ix), tx1 = _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(&boxes.maxX[b]), ox), ix);
+			__m128 ty0 = _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(&boxes.minY[b]), oy), iy), ty1 = _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(&boxes.maxY[b]), oy), iy);
+			__m128 tz0 = _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(&boxes.minZ[b]), oz), iz), tz1 = _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(&boxes.maxZ[b]), oz), iz);
+			__m128 tMin = _mm_max_ps(_mm_max_ps(_mm_min_ps(tx0, tx1), _mm_min_ps(ty0, ty1)), _mm_min_ps(tz0, tz1));
+			__m128 tMax = _mm_min_ps(_mm_min_ps(_mm_max_ps(tx0, tx1), _mm_max_ps(ty0, ty1)), _mm_max_ps(tz0, tz1));
+			__m128 hit = _mm_and_ps(_mm_and_ps(_mm_cmpge_ps(tMax, zero), _mm_cmple_ps(tMin, tMax)), _mm_cmple_ps(tMin, maxDistance));
+			uint32_t mask = static_cast<uint32_t>(_mm_movemask_ps(hit));
+			if (mask != 0)
+			{
+				alignas(16) float minLanes[4], maxLanes[4];
+				_mm_store_ps(minLanes, tMin);
+				_mm_store_ps(maxLanes, tMax);
+				AppendBoxHits(mask, r, b, minLanes, maxLanes, hits);
+			}
+		}
+		return last;
+	}
+
+	RASTER_TARGET_AVX2 uint32_t BoxesAvx2(const RayBatch& rays, uint32_t r, const BoxBatch& boxes, uint32_t first, uint32_t end, std::vector<CollisionHit>& hits) const
+	{
+		__m256 ox = _mm256_set1_ps(rays.originX[r]), oy = _mm256_set1_ps(rays.originY[r]), oz = _mm256_set1_ps(rays.originZ[r]);
+		__m256 ix = _mm256_set1_ps(Reciprocal(rays.directionX[r])), iy = _mm256_set1_ps(Reciprocal(rays.directionY[r])), iz = _mm256_set1_ps(Reciprocal(rays.directionZ[r]));
+		__m256 maxDistance = _mm256_set1_ps(rays.maxDistance[r]);
+		const __m256 zero = _mm256_setzero_ps();
+		uint32_t last = first + ((end - first) & ~7u);
+		for (uint32_t b = first; b < last; b += 8)
+		{
+			__m256 tx0 = _mm256_mul_ps(_mm256_sub_ps(_mm256_loadu_ps(&boxes.minX[b]), ox), ix), tx1 = _mm256_mul_ps(_mm256_sub_ps(_mm256_loadu_ps(&boxes.maxX[b]), ox), ix);
+			__m256 ty0 = _mm256_mul_ps(_mm256_sub_ps(_mm256_loadu_ps(&boxes.minY[b]), oy), iy), ty1 = _mm256_mul_ps(_mm256_sub_ps(_mm256_loadu_ps(&boxes.maxY[b]), oy), iy);
+			__m256 tz0 = _mm256_mul_ps(_mm256_sub_ps(_mm256_loadu_ps(&boxes.minZ[b]), oz), iz), tz1 = _mm256_mul_ps(_mm256_sub_ps(_mm256_loadu_ps(&boxes.maxZ[b]), oz), iz);
+			__m256 tMin = _mm256_max_ps(_mm256_max_ps(_mm256_min_ps(tx0, tx1), _mm256_min_ps(ty0, ty1)), _mm256_min_ps(tz0, tz1));
+			__m256 tMax = _mm256_min_ps(_mm256_min_ps(_mm256_max_ps(tx0, tx1), _mm256_max_ps(ty0, ty1)), _mm256_max_ps(tz0, tz1));
+			__m256 hit = _mm256_and_ps(_mm256_and_ps(_mm256_cmp_ps(tMax, zero, _CMP_GE_OQ), _mm256_cmp_ps(tMin, tMax, _CMP_LE_OQ)), _mm256_cmp_ps(tMin, maxDistance, _CMP_LE_OQ));
+			uint32_t mask = static_cast<uint32_t>(_mm256_movemask_ps(hit));
+			if (mask != 0)
+			{
+				alignas(32) float minLanes[8], maxLanes[8];
+				_mm256_store_ps(minLanes, tMin);
+				_mm256_store_ps(maxLanes, tMax);
+				AppendBoxHits(mask, r, b, minLanes, maxLanes, hits);
+			}
+		}
+		return last;
+	}
+
+	static void AppendBoxHits(uint32_t mask, uint32_t r, uint32_t base, const float* tMin, const float* tMax, std::vector<CollisionHit>& hits)
+	{
+		for (uint32_t lane = 0; mask != 0; lane++, mask >>= 1)
+		{
+			if (mask & 1)
+				hits.push_back({ r, base + lane, tMin[lane] < 0.0f ? tMax[lane] : tMin[lane] });
+		}
+	}
+#endif
+
+	RasterKernel kernel = RasterKernel::Scalar;
+	CollisionStats stats;
+};
@@ -0,0 +1,93 @@
+#pragma once
+#include "defines.h"
+#include "RenderDevice.h"
+#include <cstring>
+
+// Constant buffers split by how often they change. Registers must match shaders.fx.
+
+// b0 - Set once per frame.
+struct PerFrameConstants
+{
+	XMMATRIX mView;
+	XMMATRIX mProjection;
+	XMFLOAT4 lightDir;
+	XMFLOAT4 lightClr;
+	float time;
+	float padding[3];
+};
+
+// b1 - Changes when the material (output color) changes.
+struct PerMaterialConstants
+{
+	XMFLOAT4 vOutputColor;
+};
+
+// b2 - Changes every draw, written with RenderDevice::SetDynamicConstants.
+struct PerObjectConstants
+{
+	XMMATRIX mWorld;
+};
+
+enum ConstantBufferSlot : uint32_t
+{
+	CB_PER_FRAME = 0,
+	CB_PER_MATERIAL = 1,
+	CB_PER_OBJECT = 2,
+	CB_COUNT
+};
+
+// CPU shadow of a constant buffer that is only uploaded when its contents change.
+template<typename T>
+class DirtyConstantBuffer
+{
+	static_assert(sizeof(T) % 16 == 0, "Constant buffers must be a multiple of 16 bytes");
+
+public:
+	bool Create(RenderDevice& device)
+	{
+		BufferDesc desc;
+		desc.binding = BufferBinding::Constant;
+		desc.usage = BufferUsage::Default;
+		desc.byteWidth = sizeof(T);
+		memset(&data, 0, sizeof(T));
+		dirty = true;
+		buffer = device.CreateBuffer(desc);
+		return buffer != InvalidHandle;
+	}
+
+	// Copies 'value' into the shadow and marks it dirty if anything changed.
+	void Set(const T& value)
+	{
+		if (dirty || memcmp(&data, &value, sizeof(T)) != 0)
+		{
+			data = value;
+			dirty = true;
+		}
+	}
+
+	// Uploads the shadow if it is dirty. Returns true when an upload happened.
+	bool Commit(RenderDevice& device)
+	{
+		if (!dirty)
+			return false;
+		device.UpdateBuffer(buffer, &data, sizeof(T));
+		dirty = false;
+		return true;
+	}
+
+	// Set and Commit in one go.
+	bool Update(RenderDevice& device, const T& value)
+	{
+		Set(value);
+		return Commit(device);
+	}
+
+	const T& Get() const { return data; }
+	BufferHandle GetBuffer() const { return buffer; }
+	bool IsDirty() const { return dirty; }
+
+private:
+	T data;
+	bool dirty = true;
+	BufferHandle buffer = InvalidHandle;
+};
@@ -0,0 +1,158 @@
+#pragma once
+#include <cstdint>
+#include <cstring>
+#include <deque>
+
+// Linear ring allocator for per-draw constants in one large dynamic buffer.
+//
+// Allocations are written with NO_OVERWRITE maps; the region behind them is only
+// reused once the fence recorded at the end of the frame that wrote it has passed.
+// If the ring fills before the GPU catches up the buffer is mapped with DISCARD,
+// which renames it, and allocation restarts at offset 0.
+//
+// The backend owns the buffer and the fences and must provide:
+//	void*		Map(bool discard);			// Map the whole buffer, nullptr on failure.
+//	void		Unmap();
+//	uint64_t	InsertFence();				// Called at the end of a frame.
+//	bool		IsFenceComplete(uint64_t fence);
+template<typename Backend>
+class ConstantRing
+{
+public:
+	// D3D11.1 constant buffer offsets are given in units of 16 constants (256 bytes).
+	static const uint32_t Alignment = 256;
+
+	struct Allocation
+	{
+		uint32_t offset = 0;	// Byte offset into the buffer.
+		uint32_t size = 0;		// Aligned size in bytes.
+		bool valid = false;
+	};
+
+	struct Stats
+	{
+		uint64_t bytesWritten = 0;
+		uint32_t allocations = 0;
+		uint32_t wraps = 0;
+		uint32_t discards = 0;
+	};
+
+	explicit ConstantRing(Backend& _backend) : backend(_backend) {}
+
+	// Forget all allocations; the next map will discard.
+	void Reset(uint32_t capacityBytes)
+	{
+		capacity = capacityBytes - capacityBytes % Alignment;
+		writePos = 0;
+		retirePos = 0;
+		needsDiscard = true;
+		frames.clear();
+		stats = Stats();
+	}
+
+	// Copies 'size' bytes into the ring and returns where they landed.
+	Allocation Write(const void* data, uint32_t size)
+	{
+		Allocation alloc;
+		uint32_t aligned = AlignUp(size == 0 ? 1 : size);
+		if (aligned > capacity)
+			return alloc;
+
+		Retire();
+
+		uint32_t offset = 0;
+		if (!Reserve(aligned, offset))
+		{
+			// The GPU still owns the whole ring, rename the buffer and start over.
+			Discard();
+			Reserve(aligned, offset);
+		}
+
+		void* mapped = backend.Map(needsDiscard);
+		if (mapped == nullptr)
+			return alloc;
+		if (needsDiscard)
+			stats.discards++;
+		needsDiscard = false;
+
+		memcpy(static_cast<uint8_t*>(mapped) + offset, data, size);
+		backend.Unmap();
+
+		stats.bytesWritten += size;
+		stats.allocations++;
+
+		alloc.offset = offset;
+		alloc.size = aligned;
+		alloc.valid = true;
+		return alloc;
+	}
+
+	// Fences everything written so far so it can be reclaimed once the GPU is done.
+	void EndFrame()
+	{
+		FrameMarker marker;
+		marker.fence = backend.InsertFence();
+		marker.end = writePos;
+		frames.push_back(marker);
+	}
+
+	// Reclaims the space of every frame whose fence has passed.
+	void Retire()
+	{
+		while (!frames.empty() && backend.IsFenceComplete(frames.front().fence))
+		{
+			retirePos = frames.front().end;
+			frames.pop_front();
+		}
+	}
+
+	uint32_t GetCapacity() const { return capacity; }
+	uint64_t GetBytesInFlight() const { return writePos - retirePos; }
+	size_t GetFramesInFlight() const { return frames.size(); }
+	const Stats& GetStats() const { return stats; }
+	void ResetStats() { stats = Stats(); }
+
+private:
+	struct FrameMarker
+	{
+		uint64_t fence;
+		uint64_t end;
+	};
+
+	static uint32_t AlignUp(uint32_t size) { return (size + Alignment - 1) & ~(Alignment - 1); }
+
+	// Finds room for 'aligned' bytes, skipping the tail of the buffer if the block doesn't fit before it wraps.
+	bool Reserve(uint32_t aligned, uint32_t& outOffset)
+	{
+		uint32_t offset = static_cast<uint32_t>(writePos % capacity);
+		uint64_t skip = offset + aligned > capacity ? capacity - offset : 0;
+		if (GetBytesInFlight() + skip + aligned > capacity)
+			return false;
+
+		if (skip != 0)
+		{
+			stats.wraps++;
+			offset = 0;
+		}
+		writePos += skip + aligned;
+		outOffset = offset;
+		return true;
+	}
+
+	// After a DISCARD map the old contents belong to the renamed buffer, so nothing is in flight.
+	void Discard()
+	{
+		needsDiscard = true;
+		frames.clear();
+		writePos = 0;
+		retirePos = 0;
+	}
+
+	Backend& backend;
+	uint32_t capacity = 0;
+	uint64_t writePos = 0;	// Total bytes handed out, including skipped tails.
+	uint64_t retirePos = 0;	// Total bytes the GPU is known to be done with.
+	bool needsDiscard = true;
+	std::deque<FrameMarker> frames;
+	Stats stats;
+};
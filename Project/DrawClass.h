@@ -1,19 +1,33 @@
 #pragma once
-#include <zmouse.h>
 #include "defines.h"
-#include "DDSTextureLoader.h"
+#include "RenderDevice.h"
+#include "InstanceBatch.h"
+#include "ConstantBuffers.h"
+#include "DrawQueue.h"
+#include "FrameArena.h"
+#include "Profiler.h"
+#include "OcclusionCuller.h"
+#include "FrustumCuller.h"
+#include "SceneBvh.h"
+#include "MeshBvh.h"
+#include "FixedTimestep.h"
+#include "FramePipeline.h"
+#include "InputLog.h"
+#include "InputEvents.h"
+#include <chrono>
+#include <cstring>
+#include <iostream>
+#include <thread>
 
 // Base class for drawing objects
 class DrawClass
 {
 public:
-	DrawClass(GW::GRAPHICS::GDirectX11Surface _d3d11, GW::SYSTEM::GWindow _win)
+	DrawClass(RenderDevice& _device, GW::SYSTEM::GWindow _win) : device(_device)
 	{
 		win = _win;
-		d3d11 = _d3d11;
 
-		+win.GetWidth(width);
-		+win.GetHeight(height);
+		device.GetSize(width, height);
 
 
 		+win.GetClientTopLeft(clientTopLeftX, clientTopLeftY);
@@ -22,44 +36,11 @@ public:
 		+win.GetClientHeight(clientHeight);
 	}
 
-	// Used for compiling shaders
-	static HRESULT CompileShaderFromFile(const WCHAR* szFileName, LPCSTR szEntryPoint, LPCSTR szShaderModel, ID3DBlob** ppBlobOut)
-	{
-		HRESULT hr = S_OK;
-
-		DWORD dwShaderFlags = D3DCOMPILE_ENABLE_STRICTNESS;
-#ifdef _DEBUG
-		// Set the D3DCOMPILE_DEBUG flag to embed debug information in the shaders.
-		// Setting this flag improves the shader debugging experience, but still allows 
-		// the shaders to be optimized and to run exactly the way they will run in 
-		// the release configuration of this program.
-		dwShaderFlags |= D3DCOMPILE_DEBUG;
-
-		// Disable optimizations to further improve shader debugging
-		dwShaderFlags |= D3DCOMPILE_SKIP_OPTIMIZATION;
-#endif
-
-		ID3DBlob* pErrorBlob = nullptr;
-		hr = D3DCompileFromFile(szFileName, nullptr, nullptr, szEntryPoint, szShaderModel,
-			dwShaderFlags, 0, ppBlobOut, &pErrorBlob);
-		if (FAILED(hr))
-		{
-			if (pErrorBlob)
-			{
-				OutputDebugStringA(reinterpret_cast<const char*>(pErrorBlob->GetBufferPointer())); // Print to output window.
-				pErrorBlob->Release();
-			}
-			return hr;
-		}
-		if (pErrorBlob) pErrorBlob->Release();
-
-		return S_OK;
-	}
 protected:
+	RenderDevice& device;
 	GW::SYSTEM::GWindow win;
-	GW::GRAPHICS::GDirectX11Surface d3d11;
 	unsigned int width = 0, height = 0;
-	UINT clientWidth = 0, clientHeight = 0, clientTopLeftX = 0, clientTopLeftY;
+	UINT clientWidth = 0, clientHeight = 0, clientTopLeftX = 0, clientTopLeftY = 0;
 };
 
 class Mesh : DrawClass
@@ -97,54 +78,117 @@ public:
 	};
 
 private:
-	struct ConstantBuffer
+	// Starting size of a snapshot's arena, well past what a frame of this scene takes.
+	static const size_t FrameArenaSize = 64 * 1024;
+
+	// Everything drawing a frame needs, built by the simulation and handed to the renderer whole.
+	// The renderer only reads it, so the simulation can build the next one meanwhile. Lists that
+	// only live for the frame come from its own arena, which is reset when the slot is reused; the
+	// snapshots are triple buffered, so no arena is reset while the renderer still reads it.
+	struct FrameSnapshot
+	{
+		uint64_t frame = 0;
+		XMMATRIX view;							// Camera between the last two steps, not inverted.
+		PerFrameConstants constants;
+		bool planeVisible = true;
+		LinearArena arena{ FrameArenaSize };
+		ArenaVector<InstanceData> visibleBalloons;
+		DrawQueue draws;						// Sorted.
+		uint64_t heapAllocations = 0;			// Made on the heap while building it.
+
+		FrustumStats frustum;
+		OcclusionStats occlusion;
+		TimestepStats sim;
+		double simMs = 0.0, simWaitMs = 0.0;
+		std::chrono::steady_clock::time_point inputTime, published;
+	};
+
+	// What UserInput() has read so far. Mouse movement and clicks are running totals, so the
+	// simulation applies everything since the state it saw last even when it missed some.
+	struct InputState
 	{
-		XMMATRIX mWorld;
-		XMMATRIX mView;
-		XMMATRIX mProjection;
-		XMFLOAT4 lightDir;
-		XMFLOAT4 lightClr;
-		XMFLOAT4 vOutputColor;
-		bool popped[3];
-		float time;
+		int64_t lookX = 0, lookY = 0;		// Mouse pixels moved while looking.
+		uint32_t shots = 0;
+		float moveX = 0.0f, moveZ = 0.0f;	// Held WASD keys, -1 to 1 along the view's x and z.
+		bool walking = false;				// Input drives the camera, which then keeps to eye height.
+		std::chrono::steady_clock::time_point time;
 	};
 
-	Microsoft::WRL::ComPtr<ID3D11RenderTargetView>		renderTargetView = nullptr;
-	Microsoft::WRL::ComPtr<ID3D11InputLayout>			input = nullptr;
-	Microsoft::WRL::ComPtr<ID3D11VertexShader>			vertexshader = nullptr;
-	Microsoft::WRL::ComPtr<ID3D11VertexShader>			vertexshaderwave = nullptr;
-	Microsoft::WRL::ComPtr<ID3D11GeometryShader>		geoshader = nullptr;
-	Microsoft::WRL::ComPtr<ID3D11PixelShader>			PS_MAIN = nullptr;
-	Microsoft::WRL::ComPtr<ID3D11PixelShader>			PS_SPECULAR = nullptr;
-	Microsoft::WRL::ComPtr<ID3D11PixelShader>			PS_NOLIGHTS = nullptr;
-	Microsoft::WRL::ComPtr<ID3D11PixelShader>			PS_CROSSHAIR = nullptr;
-	Microsoft::WRL::ComPtr<ID3D11Buffer>				constantbuffer = nullptr;
-	Microsoft::WRL::ComPtr<ID3D11ShaderResourceView>	planeTextureRV = nullptr;
-	Microsoft::WRL::ComPtr<ID3D11ShaderResourceView>	crossbowTextureRV = nullptr;
-	Microsoft::WRL::ComPtr<ID3D11ShaderResourceView>	crosshairTextureRV = nullptr;
-	Microsoft::WRL::ComPtr<ID3D11SamplerState>			samplerLinear = nullptr;
+	InputLayoutHandle									input = InvalidHandle;
+	ShaderHandle										vertexshader = InvalidHandle;
+	ShaderHandle										vertexshaderwave = InvalidHandle;
+	ShaderHandle										geoshader = InvalidHandle;
+	ShaderHandle										PS_MAIN = InvalidHandle;
+	ShaderHandle										PS_SPECULAR = InvalidHandle;
+	ShaderHandle										PS_NOLIGHTS = InvalidHandle;
+	ShaderHandle										PS_CROSSHAIR = InvalidHandle;
+	DirtyConstantBuffer<PerFrameConstants>				frameConstants;
+	DirtyConstantBuffer<PerMaterialConstants>			materialConstants;
+	TextureHandle										planeTexture = InvalidHandle;
+	TextureHandle										crossbowTexture = InvalidHandle;
+	TextureHandle										crosshairTexture = InvalidHandle;
+	SamplerHandle										samplerLinear = InvalidHandle;
 	XMMATRIX											g_World;
 	XMMATRIX											g_View;
 	XMMATRIX											g_Projection;
 
 	XMFLOAT4 lightDir, lightClr; // Should've used a structure here - Note for 'next' time.
 
+	// Per-object constants go through the context every draw.
+	void SetObjectConstants(RenderContext& context, XMMATRIX world)
+	{
+		PerObjectConstants object;
+		object.mWorld = XMMatrixTranspose(world);
+		context.SetDynamicConstants(CB_PER_OBJECT, &object, sizeof(object));
+	}
+
+	// Creates a buffer with fixed contents. They are all mesh data.
+	BufferHandle CreateStaticBuffer(BufferBinding binding, const void* data, size_t byteWidth)
+	{
+		MemoryTagScope tag(MemoryTag::Meshes);
+		BufferDesc bd;
+		bd.binding = binding;
+		bd.usage = BufferUsage::Default;
+		bd.byteWidth = (uint32_t)byteWidth;
+		bd.initialData = data;
+		return device.CreateBuffer(bd);
+	}
+
+	TextureHandle LoadTexture(const wchar_t* path)
+	{
+		PROFILE_SCOPE("LoadTexture");
+		MemoryTagScope tag(MemoryTag::Textures);
+		return device.LoadTexture(path);
+	}
+
+	// Every shader lives in shaders.fx.
+	ShaderHandle LoadShader(ShaderStage stage, const char* entryPoint, const char* profile)
+	{
+		ShaderDesc desc;
+		desc.stage = stage;
+		desc.file = L"Shaders/shaders.fx";
+		desc.entryPoint = entryPoint;
+		desc.profile = profile;
+		return device.CreateShader(desc);
+	}
+
 	SimpleMesh* crossbowMesh = nullptr;
 	SimpleMesh* balloonMesh = nullptr;
 
 	// -PLANE- //
-	Microsoft::WRL::ComPtr<ID3D11Buffer>				p_vertexbuffer = nullptr;
-	Microsoft::WRL::ComPtr<ID3D11Buffer>				p_indexbuffer = nullptr;
+	BufferHandle										p_vertexbuffer = InvalidHandle;
+	BufferHandle										p_indexbuffer = InvalidHandle;
 
-	// Indicies for Plane
+	// Indicies for Plane, the vertices are kept for occlusion culling.
+	std::vector<SimpleVertex> planeVertices;
 	std::vector<unsigned int> planeIndices;
 	XMFLOAT4 plane_pos = { 0.0f, 0.0f, 0.0f, 0.0f };
 
 	// Plane generation.
-	void CreatePlane(ID3D11Device* dev, ID3D11DeviceContext* con)
+	void CreatePlane()
 	{
-		std::vector<SimpleVertex> verts;
-		
+		std::vector<SimpleVertex>& verts = planeVertices;
+
 		// Generate the simple plane.
 		{
 			verts.push_back({ XMFLOAT4(-1.0f, 0.0f, -1.0f, 1.0f), XMFLOAT3(0.0f, 1.0f, 0.0f), XMFLOAT2(0.0f, 0.0f) });
@@ -154,14 +198,8 @@ private:
 		}
 
 		// Create the vertex buffer for the plane.
-		D3D11_BUFFER_DESC bd = {};
-		bd.Usage = D3D11_USAGE_DEFAULT;
-		bd.ByteWidth = sizeof(SimpleVertex) * verts.size();
-		bd.BindFlags = D3D11_BIND_VERTEX_BUFFER;
-		bd.CPUAccessFlags = 0;
-		D3D11_SUBRESOURCE_DATA InitData = {};
-		InitData.pSysMem = verts.data();
-		if (FAILED(dev->CreateBuffer(&bd, &InitData, p_vertexbuffer.GetAddressOf())))
+		p_vertexbuffer = CreateStaticBuffer(BufferBinding::Vertex, verts.data(), sizeof(SimpleVertex) * verts.size());
+		if (p_vertexbuffer == InvalidHandle)
 		{
 			DebugBreak();
 			return;
@@ -178,61 +216,55 @@ private:
 		}
 
 		// Create the index buffer.
-		bd.Usage = D3D11_USAGE_DEFAULT;
-		bd.ByteWidth = sizeof(unsigned int) * planeIndices.size();
-		bd.BindFlags = D3D11_BIND_INDEX_BUFFER;
-		bd.CPUAccessFlags = 0;
-		InitData.pSysMem = planeIndices.data();
-		if (FAILED(dev->CreateBuffer(&bd, &InitData, p_indexbuffer.GetAddressOf())))
+		p_indexbuffer = CreateStaticBuffer(BufferBinding::Index, planeIndices.data(), sizeof(unsigned int) * planeIndices.size());
+		if (p_indexbuffer == InvalidHandle)
 		{
 			DebugBreak();
 			return;
 		}
 	}
+	XMMATRIX PlaneWorld()
+	{
+		return XMMatrixTranslationFromVector(XMLoadFloat4(&plane_pos)) * XMMatrixScaling(60.0f, 60.0f, 60.0f);
+	}
 	// Render the plane.
-	void RenderPlane(ID3D11DeviceContext* con, ID3D11RenderTargetView* view, ConstantBuffer& cb)
+	void RenderPlane(RenderContext& context)
 	{
 		// Change Topology to Lines
-		con->IASetPrimitiveTopology(D3D11_PRIMITIVE_TOPOLOGY_TRIANGLELIST);
+		context.SetPrimitiveTopology(PrimitiveTopology::TriangleList);
 
 		// Set vertex buffer
 		const UINT stride[] = { sizeof(SimpleVertex) };
 		const UINT offset[] = { 0 };
-		ID3D11Buffer* const buffs[] = { p_vertexbuffer.Get() };
-		con->IASetVertexBuffers(0, ARRAYSIZE(buffs), buffs, stride, offset);
+		const BufferHandle buffs[] = { p_vertexbuffer };
+		context.SetVertexBuffers(0, ARRAYSIZE(buffs), buffs, stride, offset);
 
 		// Set Index Buffer
-		con->IASetIndexBuffer(p_indexbuffer.Get(), DXGI_FORMAT_R32_UINT, 0);
+		context.SetIndexBuffer(p_indexbuffer, IndexFormat::UInt32, 0);
 
 		// Update the world variable to reflect the current light
-		XMMATRIX w_Plane = XMMatrixTranslationFromVector(XMLoadFloat4(&plane_pos)) * XMMatrixScaling(60.0f, 60.0f, 60.0f);
-		cb.mWorld = XMMatrixTranspose(w_Plane);
-		cb.vOutputColor = { 1.0f, 1.0f, 1.0f, 1.0f };
-		con->UpdateSubresource(constantbuffer.Get(), 0, nullptr, &cb, 0, 0);
+		SetObjectConstants(context, PlaneWorld());
 
 		// Update VS and PS
-		con->VSSetShader(vertexshader.Get(), nullptr, 0);
-		con->VSSetConstantBuffers(0, 1, constantbuffer.GetAddressOf());
-		con->PSSetShader(PS_NOLIGHTS.Get(), nullptr, 0);
-		con->PSSetConstantBuffers(0, 1, constantbuffer.GetAddressOf());
-		con->PSSetSamplers(0, 1, samplerLinear.GetAddressOf());
+		context.SetShader(ShaderStage::Vertex, vertexshader);
+		context.SetShader(ShaderStage::Pixel, PS_NOLIGHTS);
+		context.SetSamplers(0, 1, &samplerLinear);
 
-		con->DrawIndexed(planeIndices.size(), 0, 0);
+		context.DrawIndexed((UINT)planeIndices.size(), 0, 0);
 	}
 	// -END OF PLANE- //
 
 	// -INVERTED CUBE | SKYBOX- //
-	Microsoft::WRL::ComPtr<ID3D11Buffer>				c_vertexbuffer = nullptr;
-	Microsoft::WRL::ComPtr<ID3D11Buffer>				c_indexbuffer = nullptr;
+	BufferHandle										c_vertexbuffer = InvalidHandle;
+	BufferHandle										c_indexbuffer = InvalidHandle;
 	// For Skybox Generation
-	Microsoft::WRL::ComPtr<ID3D11VertexShader>			SKBvertexshader = nullptr;
-	Microsoft::WRL::ComPtr<ID3D11PixelShader>			SKBpixelshader = nullptr;
-	Microsoft::WRL::ComPtr<ID3D11Buffer>				SKBvertex_Buffer = nullptr;
-	Microsoft::WRL::ComPtr<ID3D11InputLayout>			SKBinput = nullptr;
-	Microsoft::WRL::ComPtr<ID3D11ShaderResourceView>	SKBtextureRV = nullptr;
-	Microsoft::WRL::ComPtr<ID3D11DepthStencilState>		depthStencilState = nullptr;
+	ShaderHandle										SKBvertexshader = InvalidHandle;
+	ShaderHandle										SKBpixelshader = InvalidHandle;
+	InputLayoutHandle									SKBinput = InvalidHandle;
+	TextureHandle										SKBtexture = InvalidHandle;
+	DepthStateHandle									depthStencilState = InvalidHandle;
 	// Generate a hard-coded inverted cube.
-	void CreateInvertedCube(ID3D11Device* dev, ID3D11DeviceContext* con)
+	void CreateInvertedCube()
 	{
 		// Create vertex buffer
 		SimpleVertex vertices[] =
@@ -267,14 +299,8 @@ private:
 			{ XMFLOAT4(1.0f, 1.0f, 1.0f, 1.0f),		XMFLOAT3(0.0f, 0.0f, 1.0f),		XMFLOAT2(0.0f, 0.0f)},
 			{ XMFLOAT4(-1.0f, 1.0f, 1.0f, 1.0f),	XMFLOAT3(0.0f, 0.0f, 1.0f),		XMFLOAT2(1.0f, 0.0f)},
 		};
-		D3D11_BUFFER_DESC bd = {};
-		bd.Usage = D3D11_USAGE_DEFAULT;
-		bd.ByteWidth = sizeof(SimpleVertex) * 24;
-		bd.BindFlags = D3D11_BIND_VERTEX_BUFFER;
-		bd.CPUAccessFlags = 0;
-		D3D11_SUBRESOURCE_DATA InitData = {};
-		InitData.pSysMem = vertices;
-		if (FAILED(dev->CreateBuffer(&bd, &InitData, c_vertexbuffer.GetAddressOf())))
+		c_vertexbuffer = CreateStaticBuffer(BufferBinding::Vertex, vertices, sizeof(SimpleVertex) * 24);
+		if (c_vertexbuffer == InvalidHandle)
 		{
 			DebugBreak();
 			return;
@@ -300,154 +326,138 @@ private:
 			21,20,22,
 			22,20,23
 		};
-		bd.Usage = D3D11_USAGE_DEFAULT;
-		bd.ByteWidth = sizeof(unsigned int) * 36;        // 36 vertices needed for 12 triangles in a triangle list
-		bd.BindFlags = D3D11_BIND_INDEX_BUFFER;
-		bd.CPUAccessFlags = 0;
-		InitData.pSysMem = indices;
-		if (FAILED(dev->CreateBuffer(&bd, &InitData, c_indexbuffer.GetAddressOf())))
+		// 36 vertices needed for 12 triangles in a triangle list
+		c_indexbuffer = CreateStaticBuffer(BufferBinding::Index, indices, sizeof(unsigned int) * 36);
+		if (c_indexbuffer == InvalidHandle)
 		{
 			DebugBreak();
 			return;
 		}
 	}
 	// Render the skybox out.
-	void RenderSkybox(ID3D11DeviceContext* con, ConstantBuffer& cb)
+	void RenderSkybox(RenderContext& context, const FrameSnapshot& snapshot)
 	{
 		// Set vertex buffer
 		const UINT c_stride[] = { sizeof(SimpleVertex) };
 		const UINT c_offset[] = { 0 };
-		ID3D11Buffer* const c_buffs[] = { c_vertexbuffer.Get() };
-		con->IASetVertexBuffers(0, ARRAYSIZE(c_buffs), c_buffs, c_stride, c_offset);
+		const BufferHandle c_buffs[] = { c_vertexbuffer };
+		context.SetVertexBuffers(0, ARRAYSIZE(c_buffs), c_buffs, c_stride, c_offset);
 
 		// Set Index Buffer
-		con->IASetIndexBuffer(c_indexbuffer.Get(), DXGI_FORMAT_R32_UINT, 0);
+		context.SetIndexBuffer(c_indexbuffer, IndexFormat::UInt32, 0);
 
-		XMVECTOR camPos = g_View.r[3];
+		XMVECTOR camPos = snapshot.view.r[3];
 		XMFLOAT4 skyPos = { XMVectorGetX(camPos), XMVectorGetY(camPos), XMVectorGetZ(camPos), 1.0f };
 		XMMATRIX mSky = XMMatrixTranslationFromVector(XMLoadFloat4(&skyPos));
 		XMMATRIX mScaleSky = XMMatrixScaling(50.0f, 50.0f, 50.0f);
 		mSky = mScaleSky * mSky;
 
 		// Update world variable for skybox
-		cb.mWorld = XMMatrixTranspose(mSky);
-		con->UpdateSubresource(constantbuffer.Get(), 0, nullptr, &cb, 0, 0);
+		SetObjectConstants(context, mSky);
 
 		// Update vertex and pixel shader for skybox.
-		con->VSSetShader(SKBvertexshader.Get(), nullptr, 0);
-		con->VSSetConstantBuffers(0, 1, constantbuffer.GetAddressOf());
-		con->PSSetShader(SKBpixelshader.Get(), nullptr, 0);
-		con->PSSetConstantBuffers(0, 1, constantbuffer.GetAddressOf());
+		context.SetShader(ShaderStage::Vertex, SKBvertexshader);
+		context.SetShader(ShaderStage::Pixel, SKBpixelshader);
 
 		// Set input layout.
-		con->IASetInputLayout(SKBinput.Get());
-		con->OMSetDepthStencilState(depthStencilState.Get(), 0);
-		con->DrawIndexed(36, 0, 0);
-		con->OMSetDepthStencilState(NULL, 0);
+		context.SetInputLayout(SKBinput);
+		context.SetDepthState(depthStencilState);
+		context.DrawIndexed(36, 0, 0);
+		context.SetDepthState(InvalidHandle);
 
 		// Reset the input layout.
-		con->IASetInputLayout(input.Get());
+		context.SetInputLayout(input);
 	}
 	// -END OF INVERTED CUBE | SKYBOX- //
 
 	// -CROSSBOW & BALLON MESH- //
 	// Crossbow Variables
-	Microsoft::WRL::ComPtr<ID3D11Buffer>				vertexbuffer = nullptr;
-	Microsoft::WRL::ComPtr<ID3D11Buffer>				indexbuffer = nullptr;
-	Microsoft::WRL::ComPtr<ID3D11Buffer>				b_vertexbuffer = nullptr;
-	Microsoft::WRL::ComPtr<ID3D11Buffer>				b_indexbuffer = nullptr;
-	Microsoft::WRL::ComPtr<ID3D11DepthStencilState>		depthStencilStateFront = nullptr;
+	BufferHandle										vertexbuffer = InvalidHandle;
+	BufferHandle										indexbuffer = InvalidHandle;
+	BufferHandle										b_vertexbuffer = InvalidHandle;
+	BufferHandle										b_indexbuffer = InvalidHandle;
+	DepthStateHandle									depthStencilStateFront = InvalidHandle;
 
 
-	void CreateMesh(ID3D11Device* dev, ID3D11DeviceContext* con, std::vector<SimpleVertex>* verticies, std::vector<unsigned int>* indicies, Microsoft::WRL::ComPtr<ID3D11Buffer>& _vertexbuffer, Microsoft::WRL::ComPtr<ID3D11Buffer>& _indexbuffer)
+	void CreateMesh(std::vector<SimpleVertex>* verticies, std::vector<unsigned int>* indicies, BufferHandle& _vertexbuffer, BufferHandle& _indexbuffer)
 	{
 		// Create Vertex Buffer
-		D3D11_BUFFER_DESC bd = {};
-		bd.Usage = D3D11_USAGE_DEFAULT;
-		bd.ByteWidth = sizeof(SimpleVertex) * verticies->size();
-		bd.BindFlags = D3D11_BIND_VERTEX_BUFFER;
-		bd.CPUAccessFlags = 0;
-
-		D3D11_SUBRESOURCE_DATA InitData = {};
-		InitData.pSysMem = verticies->data();
-		if (FAILED(dev->CreateBuffer(&bd, &InitData, _vertexbuffer.GetAddressOf())))
+		_vertexbuffer = CreateStaticBuffer(BufferBinding::Vertex, verticies->data(), sizeof(SimpleVertex) * verticies->size());
+		if (_vertexbuffer == InvalidHandle)
 		{
 			DebugBreak();
 			return;
 		}
 
 		// Create Index Buffer
-		bd.Usage = D3D11_USAGE_DEFAULT;
-		bd.ByteWidth = sizeof(int) * indicies->size();
-		bd.BindFlags = D3D11_BIND_INDEX_BUFFER;
-		bd.CPUAccessFlags = 0;
-		InitData.pSysMem = indicies->data();
-		if (FAILED(dev->CreateBuffer(&bd, &InitData, _indexbuffer.GetAddressOf())))
+		_indexbuffer = CreateStaticBuffer(BufferBinding::Index, indicies->data(), sizeof(int) * indicies->size());
+		if (_indexbuffer == InvalidHandle)
 		{
 			DebugBreak();
 			return;
 		}
 	}
-	void RenderMesh(ID3D11DeviceContext* con, ConstantBuffer& cb, SimpleMesh* mesh, Microsoft::WRL::ComPtr<ID3D11ShaderResourceView>* textureResourceView = nullptr, Microsoft::WRL::ComPtr<ID3D11PixelShader>* pixelShader = nullptr)
+	// The crossbow is attached to the camera.
+	XMMATRIX CrossbowWorld(FXMMATRIX view)
+	{
+		XMMATRIX crossWorld = XMMatrixIdentity();
+		crossWorld = XMMatrixMultiply(crossWorld, view);
+		crossWorld = XMMatrixTranslation(0.8f, -0.85f, 1.0f) * crossWorld;
+		crossWorld = XMMatrixRotationY(1.5708f) * crossWorld; // Rotate 90 degrees
+		crossWorld = XMMatrixScaling(0.75f, 0.75f, 0.75f) * crossWorld;
+		return crossWorld;
+	}
+	void RenderMesh(RenderContext& context, SimpleMesh* mesh, const FrameSnapshot& snapshot, TextureHandle texture = InvalidHandle, ShaderHandle pixelShader = InvalidHandle)
 	{
 		// Render the mesh
 		// Set vertex buffer
 		const UINT stride[] = { sizeof(SimpleVertex) };
 		const UINT offset[] = { 0 };
-		ID3D11Buffer* const buffs[] = { vertexbuffer.Get() };
-		con->IASetVertexBuffers(0, ARRAYSIZE(buffs), buffs, stride, offset);
+		const BufferHandle buffs[] = { vertexbuffer };
+		context.SetVertexBuffers(0, ARRAYSIZE(buffs), buffs, stride, offset);
 
 		// If it's the crossbow, attach it to the camera.
 		if (crossbowMesh == mesh)
 		{
-			// World for crossbow
-			XMMATRIX crossWorld = XMMatrixIdentity();
-			crossWorld = XMMatrixMultiply(crossWorld, g_View);
-			crossWorld = XMMatrixTranslation(0.8f, -0.85f, 1.0f) * crossWorld;
-			crossWorld = XMMatrixRotationY(1.5708f) * crossWorld; // Rotate 90 degrees
-			crossWorld = XMMatrixScaling(0.75f, 0.75f, 0.75f) * crossWorld;
-			// Update world variable for skybox
-			cb.mWorld = XMMatrixTranspose(crossWorld);
-			con->UpdateSubresource(constantbuffer.Get(), 0, nullptr, &cb, 0, 0);
-			con->OMSetDepthStencilState(depthStencilStateFront.Get(), 0);
+			// Update world variable for the crossbow
+			SetObjectConstants(context, CrossbowWorld(snapshot.view));
+			context.SetDepthState(depthStencilStateFront);
 		}
 
 		// Set Index Buffer
-		con->IASetIndexBuffer(indexbuffer.Get(), DXGI_FORMAT_R32_UINT, 0);
+		context.SetIndexBuffer(indexbuffer, IndexFormat::UInt32, 0);
 
 		// Set Vertex Shader
-		con->VSSetShader(vertexshader.Get(), nullptr, 0);
-		con->VSSetConstantBuffers(0, 1, constantbuffer.GetAddressOf());
+		context.SetShader(ShaderStage::Vertex, vertexshader);
 
 		// Set Pixel Shader
-		if(pixelShader == nullptr)
-			con->PSSetShader(PS_MAIN.Get(), nullptr, 0);
+		if(pixelShader == InvalidHandle)
+			context.SetShader(ShaderStage::Pixel, PS_MAIN);
 		else
-			con->PSSetShader(pixelShader->Get(), nullptr, 0);
+			context.SetShader(ShaderStage::Pixel, pixelShader);
 
-		if(textureResourceView == nullptr)
-			con->PSSetShaderResources(1, 1, crossbowTextureRV.GetAddressOf());
+		if(texture == InvalidHandle)
+			context.SetTextures(1, 1, &crossbowTexture);
 		else
-			con->PSSetShaderResources(1, 1, textureResourceView->GetAddressOf());
-		con->PSSetConstantBuffers(0, 1, constantbuffer.GetAddressOf());
-		con->PSSetSamplers(0, 1, samplerLinear.GetAddressOf());
+			context.SetTextures(1, 1, &texture);
+		context.SetSamplers(0, 1, &samplerLinear);
 
 		// Draw out the mesh
-		con->DrawIndexed(mesh->indicesList.size(), 0, 0);
-		con->OMSetDepthStencilState(NULL, 0);
-		con->GSSetShader(nullptr, 0, 0);
+		context.DrawIndexed((UINT)mesh->indicesList.size(), 0, 0);
+		context.SetDepthState(InvalidHandle);
+		context.SetShader(ShaderStage::Geometry, InvalidHandle);
 	}
 	// -END OF CROSSBOW MESH- //
 
 	// -CROSSHAIR GENERATION- //
-	Microsoft::WRL::ComPtr<ID3D11Buffer>				cross_vertexbuffer = nullptr;
-	Microsoft::WRL::ComPtr<ID3D11Buffer>				cross_indexbuffer = nullptr;
+	BufferHandle										cross_vertexbuffer = InvalidHandle;
+	BufferHandle										cross_indexbuffer = InvalidHandle;
 
 	// Indicies for Plane
 	std::vector<unsigned int> crossIndices;
 	XMFLOAT4 cross_pos = { 0.0f, 0.0f, 12.0f, 1.0f };
 
-	void CreateNDCPlane(ID3D11Device* dev, ID3D11DeviceContext* con)
+	void CreateNDCPlane()
 	{
 		std::vector<SimpleVertex> verts;
 
@@ -460,14 +470,8 @@ private:
 		}
 
 		// Create the vertex buffer for the plane.
-		D3D11_BUFFER_DESC bd = {};
-		bd.Usage = D3D11_USAGE_DEFAULT;
-		bd.ByteWidth = sizeof(SimpleVertex) * verts.size();
-		bd.BindFlags = D3D11_BIND_VERTEX_BUFFER;
-		bd.CPUAccessFlags = 0;
-		D3D11_SUBRESOURCE_DATA InitData = {};
-		InitData.pSysMem = verts.data();
-		if (FAILED(dev->CreateBuffer(&bd, &InitData, cross_vertexbuffer.GetAddressOf())))
+		cross_vertexbuffer = CreateStaticBuffer(BufferBinding::Vertex, verts.data(), sizeof(SimpleVertex) * verts.size());
+		if (cross_vertexbuffer == InvalidHandle)
 		{
 			DebugBreak();
 			return;
@@ -484,377 +488,697 @@ private:
 		}
 
 		// Create the index buffer.
-		bd.Usage = D3D11_USAGE_DEFAULT;
-		bd.ByteWidth = sizeof(unsigned int) * crossIndices.size();
-		bd.BindFlags = D3D11_BIND_INDEX_BUFFER;
-		bd.CPUAccessFlags = 0;
-		InitData.pSysMem = crossIndices.data();
-		if (FAILED(dev->CreateBuffer(&bd, &InitData, cross_indexbuffer.GetAddressOf())))
+		cross_indexbuffer = CreateStaticBuffer(BufferBinding::Index, crossIndices.data(), sizeof(unsigned int) * crossIndices.size());
+		if (cross_indexbuffer == InvalidHandle)
 		{
 			DebugBreak();
 			return;
 		}
 	}
-	void RenderCrosshair(ID3D11DeviceContext* con, ID3D11RenderTargetView* view, ConstantBuffer& cb)
+	void RenderCrosshair(RenderContext& context)
 	{
 		// Change Topology to Lines
-		con->IASetPrimitiveTopology(D3D11_PRIMITIVE_TOPOLOGY_TRIANGLELIST);
+		context.SetPrimitiveTopology(PrimitiveTopology::TriangleList);
 
 		// Set vertex buffer
 		const UINT stride[] = { sizeof(SimpleVertex) };
 		const UINT offset[] = { 0 };
-		ID3D11Buffer* const buffs[] = { cross_vertexbuffer.Get() };
-		con->IASetVertexBuffers(0, ARRAYSIZE(buffs), buffs, stride, offset);
+		const BufferHandle buffs[] = { cross_vertexbuffer };
+		context.SetVertexBuffers(0, ARRAYSIZE(buffs), buffs, stride, offset);
 
 		// Set Index Buffer
-		con->IASetIndexBuffer(cross_indexbuffer.Get(), DXGI_FORMAT_R32_UINT, 0);
+		context.SetIndexBuffer(cross_indexbuffer, IndexFormat::UInt32, 0);
 
 		// Update the world variable
 		XMMATRIX w_Plane = XMMatrixTranslationFromVector(XMLoadFloat4(&cross_pos)) * XMMatrixScaling(0.1f, 0.1f, 0.1f);
-		cb.mWorld = XMMatrixTranspose(w_Plane);
-		cb.vOutputColor = { 1.0f, 1.0f, 1.0f, 1.0f };
-		con->UpdateSubresource(constantbuffer.Get(), 0, nullptr, &cb, 0, 0);
+		SetObjectConstants(context, w_Plane);
 
 		// Update VS and PS
-		con->VSSetShader(vertexshaderwave.Get(), nullptr, 0);
-		con->VSSetConstantBuffers(0, 1, constantbuffer.GetAddressOf());
-		con->PSSetShader(PS_CROSSHAIR.Get(), nullptr, 0);
-		con->PSSetConstantBuffers(0, 1, constantbuffer.GetAddressOf());
-		con->PSSetSamplers(0, 1, samplerLinear.GetAddressOf());
-		con->OMSetDepthStencilState(depthStencilStateFront.Get(), 0);
-		con->DrawIndexed(crossIndices.size(), 0, 0);
-		con->OMSetDepthStencilState(nullptr, 0);
+		context.SetShader(ShaderStage::Vertex, vertexshaderwave);
+		context.SetShader(ShaderStage::Pixel, PS_CROSSHAIR);
+		context.SetSamplers(0, 1, &samplerLinear);
+		context.SetDepthState(depthStencilStateFront);
+		context.DrawIndexed((UINT)crossIndices.size(), 0, 0);
+		context.SetDepthState(InvalidHandle);
 	}
 	// -END OFCROSSHAIR GENERATION- //
 
 	// -BALLOON RENDERING- //
-	XMFLOAT4 balloonPosOne = { -5.0f, 4.0f, -2.0f, 1.0f };
-	XMFLOAT4 balloonPosTwo = { 0.0f, 4.0f, -2.0f, 1.0f };
-	XMFLOAT4 balloonPosThree = { 5.0f, 4.0f, -2.0f, 1.0f };
-	XMMATRIX b_World[3] = {};
-
-	void RenderBalloons(ID3D11DeviceContext* con, ConstantBuffer& cb, SimpleMesh* mesh, float& time)
+	BufferHandle										b_instancebuffer = InvalidHandle;
+	ShaderHandle										vertexshaderinstanced = InvalidHandle;
+	InputLayoutHandle									instancedinput = InvalidHandle;
+	ShaderHandle										PS_SPECULAR_INSTANCED = InvalidHandle;
+	UINT												b_instanceCapacity = 0;
+	bool												instancesUploaded = false;
+	InstanceBatch										balloons;
+	XMFLOAT3											balloonMeshMin = { 0.0f, 0.0f, 0.0f };
+	XMFLOAT3											balloonMeshMax = { 0.0f, 0.0f, 0.0f };
+
+	// Copies the visible balloons into the dynamic instance buffer, growing it when needed.
+	bool UpdateInstanceBuffer(const ArenaVector<InstanceData>& visibleBalloons)
 	{
-		// Render the mesh
-		// Set vertex buffer
-		const UINT stride[] = { sizeof(SimpleVertex) };
-		const UINT offset[] = { 0 };
-		ID3D11Buffer* const buffs[] = { b_vertexbuffer.Get() };
-		con->IASetVertexBuffers(0, ARRAYSIZE(buffs), buffs, stride, offset);
+		UINT count = (UINT)visibleBalloons.size();
+		if (count > b_instanceCapacity)
+		{
+			// Grow to the next power of two so a growing balloon count doesn't recreate every frame.
+			UINT capacity = b_instanceCapacity == 0 ? 16 : b_instanceCapacity;
+			while (capacity < count)
+				capacity *= 2;
+
+			BufferDesc bd;
+			bd.binding = BufferBinding::Vertex;
+			bd.usage = BufferUsage::Dynamic;
+			bd.byteWidth = sizeof(InstanceData) * capacity;
+			if (b_instancebuffer != InvalidHandle)
+				device.DestroyBuffer(b_instancebuffer);
+			b_instancebuffer = device.CreateBuffer(bd);
+			if (b_instancebuffer == InvalidHandle)
+			{
+				b_instanceCapacity = 0;
+				return false;
+			}
+			b_instanceCapacity = capacity;
+		}
 
-		// Update Position of Balloon One
-		balloonPosOne.x -= sin(time * 2.0f) / 10.0f;
+		void* mapped = device.MapBuffer(b_instancebuffer, MapMode::WriteDiscard);
+		if (mapped == nullptr)
+			return false;
+		memcpy(mapped, visibleBalloons.data(), sizeof(InstanceData) * count);
+		device.UnmapBuffer(b_instancebuffer, (uint32_t)(sizeof(InstanceData) * count));
+		return true;
+	}
 
-		// Update the world variable & color for the balloon
-		b_World[0] = XMMatrixTranslationFromVector(XMLoadFloat4(&balloonPosOne)) * XMMatrixScaling(0.3f, 0.3f, 0.3f);
-		cb.mWorld = XMMatrixTranspose(b_World[0]);
-		cb.vOutputColor = { 1.0f, 0.0f, 0.0f, 1.0f };
-		con->UpdateSubresource(constantbuffer.Get(), 0, nullptr, &cb, 0, 0);
+	void RenderBalloons(RenderContext& context, SimpleMesh* mesh, const FrameSnapshot& snapshot)
+	{
+		// The instance buffer was filled before the draws were recorded.
+		const ArenaVector<InstanceData>& visibleBalloons = snapshot.visibleBalloons;
+		if (visibleBalloons.empty() || !instancesUploaded)
+			return;
+
+		// Slot 0 holds the balloon mesh, slot 1 the per-instance data.
+		const UINT stride[] = { sizeof(SimpleVertex), sizeof(InstanceData) };
+		const UINT offset[] = { 0, 0 };
+		const BufferHandle buffs[] = { b_vertexbuffer, b_instancebuffer };
+		context.SetVertexBuffers(0, ARRAYSIZE(buffs), buffs, stride, offset);
+		context.SetInputLayout(instancedinput);
 
 		// Set Index Buffer
-		con->IASetIndexBuffer(b_indexbuffer.Get(), DXGI_FORMAT_R32_UINT, 0);
+		context.SetIndexBuffer(b_indexbuffer, IndexFormat::UInt32, 0);
 
 		// Set Vertex Shader
-		con->VSSetShader(vertexshader.Get(), nullptr, 0);
-		con->VSSetConstantBuffers(0, 1, constantbuffer.GetAddressOf());
+		context.SetShader(ShaderStage::Vertex, vertexshaderinstanced);
 
 		// Set Pixel Shader
-		con->PSSetShader(PS_SPECULAR.Get(), nullptr, 0);
-		con->PSSetConstantBuffers(0, 1, constantbuffer.GetAddressOf());
-
-		// Draw out the mesh - Balloon One
-		con->DrawIndexed(mesh->indicesList.size(), 0, 0);
-		
-
-		// Update the world variable & color
-		// Update Position of Balloon One
-		balloonPosTwo.y += sin(time * 2.0f) / 10.0f;
-		b_World[1] = XMMatrixTranslationFromVector(XMLoadFloat4(&balloonPosTwo)) * XMMatrixScaling(0.3f, 0.3f, 0.3f);
-		cb.mWorld = XMMatrixTranspose(b_World[1]);
-		cb.vOutputColor = { 0.0f, 1.0f, 0.0f, 1.0f };
-		con->UpdateSubresource(constantbuffer.Get(), 0, nullptr, &cb, 0, 0);
-		// Draw out the mesh - Balloon Two
-		con->DrawIndexed(mesh->indicesList.size(), 0, 0);
-		
-		// Update the world variable & color
-		// Update Position of Balloon One
-		balloonPosThree.x += sin(time * 2.0f) / 10.0f;
-		b_World[2] = XMMatrixTranslationFromVector(XMLoadFloat4(&balloonPosThree)) * XMMatrixScaling(0.3f, 0.3f, 0.3f);
-		cb.mWorld = XMMatrixTranspose(b_World[2]);
-		cb.vOutputColor = { 0.0f, 0.0f, 1.0f, 1.0f };
-		con->UpdateSubresource(constantbuffer.Get(), 0, nullptr, &cb, 0, 0);
-		// Draw out the mesh - Balloon Three
-		con->DrawIndexed(mesh->indicesList.size(), 0, 0);
+		context.SetShader(ShaderStage::Pixel, PS_SPECULAR_INSTANCED);
+
+		// Draw out every balloon at once
+		context.DrawIndexedInstanced((UINT)mesh->indicesList.size(), (UINT)visibleBalloons.size(), 0, 0, 0);
+
+		// Unbind the instance stream and reset the input layout.
+		const BufferHandle nullBuffs[] = { InvalidHandle };
+		const UINT nullStride[] = { 0 };
+		context.SetVertexBuffers(1, 1, nullBuffs, nullStride, offset);
+		context.SetInputLayout(input);
 	}
 	// -END OF BALLOON GENERATION- //
-public:
 
-	Mesh(GW::GRAPHICS::GDirectX11Surface _d3d11, GW::SYSTEM::GWindow _win, SimpleMesh* _mesh, SimpleMesh* _meshtwo, const wchar_t* texturePath, const wchar_t* textureTwoPath) : DrawClass(_d3d11, _win)
+	// -CULLING- //
+	SceneBvh sceneBvh;
+	FrustumCuller frustumCuller;
+	OcclusionCuller occlusion;
+
+	// Object 0 of the frustum culler and the scene BVH is the ground, the balloon instances follow.
+	// The BVH is refit to where they moved.
+	void UpdateBounds()
 	{
-		if (_mesh == nullptr)
+		PROFILE_SCOPE("UpdateBounds");
+		frustumCuller.Resize(1 + balloons.Count());
+		sceneBvh.Resize(1 + balloons.Count());
+
+		XMFLOAT3 pMin, pMax;
+		FrustumCuller::TransformBounds(XMFLOAT3(-1.0f, 0.0f, -1.0f), XMFLOAT3(1.0f, 0.0f, 1.0f), PlaneWorld(), pMin, pMax);
+		frustumCuller.Set(0, pMin, pMax);
+		sceneBvh.Set(0, pMin, pMax);
+
+		// Instances are Translation * Scaling, so the mesh bounds scale and move with them.
+		const InstanceData* instances = balloons.Data();
+		for (size_t i = 0; i < balloons.Count(); i++)
 		{
-			std::cout << "Mesh was nullptr/Invalid\n";
+			const XMFLOAT4X4& m = instances[i].world;
+			XMFLOAT3 bMin = { m._41 + balloonMeshMin.x * m._11, m._42 + balloonMeshMin.y * m._22, m._43 + balloonMeshMin.z * m._33 };
+			XMFLOAT3 bMax = { m._41 + balloonMeshMax.x * m._11, m._42 + balloonMeshMax.y * m._22, m._43 + balloonMeshMax.z * m._33 };
+			frustumCuller.Set((uint32_t)(1 + i), bMin, bMax);
+			sceneBvh.Set((uint32_t)(1 + i), bMin, bMax);
 		}
+		sceneBvh.Refit();
+	}
 
-		crossbowMesh = _mesh;
-		balloonMesh = _meshtwo;
-		ID3D11Device* dev = nullptr;
-		ID3D11DeviceContext* con = nullptr;
-		ID3D11DepthStencilView* depthview = nullptr;
-		+d3d11.GetDevice((void**)&dev);
-		+d3d11.GetImmediateContext((void**)(&con));
-		+d3d11.GetDepthStencilView((void**)&depthview);
-
-		// Back Buffer setup
+	// Keeps what is inside the view frustum, then drops the balloons behind the ground or the
+	// crossbow. The crossbow is drawn over the world, so what it covers is hidden too.
+	void CullObjects(FXMMATRIX viewMatrix, FrameSnapshot& snapshot)
+	{
+		PROFILE_SCOPE("Cull");
+		XMMATRIX viewProjection = XMMatrixMultiply(viewMatrix, g_Projection);
+		UpdateBounds();
+		ArenaVector<uint32_t> frustumVisible(&snapshot.arena);
+		frustumVisible.reserve(1 + balloons.Count());
+		frustumCuller.Cull(Frustum(viewProjection), frustumVisible);
+
+		PROFILE_SCOPE("OcclusionCull");
+		occlusion.Begin(viewProjection);
+		occlusion.RenderOccluder(planeVertices.data(), (uint32_t)planeVertices.size(), sizeof(SimpleVertex),
+			planeIndices.data(), (uint32_t)planeIndices.size(), PlaneWorld());
+		occlusion.RenderOccluder(crossbowMesh->vertexList.data(), (uint32_t)crossbowMesh->vertexList.size(), sizeof(SimpleVertex),
+			crossbowMesh->indicesList.data(), (uint32_t)crossbowMesh->indicesList.size(), CrossbowWorld(snapshot.view));
+		occlusion.BuildHiZ();
+
+		snapshot.planeVisible = false;
+		snapshot.visibleBalloons.reserve(balloons.Count());
+		const InstanceData* instances = balloons.Data();
+		for (uint32_t index : frustumVisible)
 		{
-			IDXGISwapChain* swp = nullptr;
-			+d3d11.GetSwapchain((void**)(&swp));
-			// Create a render target view
-			ID3D11Texture2D* pBackBuffer = nullptr;
-			if (FAILED(swp->GetBuffer(0, __uuidof(ID3D11Texture2D), reinterpret_cast<void**>(&pBackBuffer))))
-				return;
+			if (index == 0)
+			{
+				snapshot.planeVisible = true;
+				continue;
+			}
+			XMFLOAT3 bMin, bMax;
+			frustumCuller.GetBounds(index, bMin, bMax);
+			if (occlusion.TestAABB(bMin, bMax))
+				snapshot.visibleBalloons.push_back(instances[index - 1]);
+		}
+		occlusion.End();
+		snapshot.frustum = frustumCuller.GetStats();
+		snapshot.occlusion = occlusion.GetStats();
+	}
+	// -END OF CULLING- //
 
-			if (FAILED(dev->CreateRenderTargetView(pBackBuffer, nullptr, renderTargetView.GetAddressOf())))
+	// -PICKING- //
+	MeshBvh planeBvh;
+	MeshBvh balloonBvh;
+
+	// Casts a ray from the camera through the crosshair, which sits in the middle of the screen.
+	// The scene BVH finds the boxes it passes through, nearest first, and each object's triangle
+	// BVH is tested with the ray moved into its space. Returns the balloon instance hit first, or
+	// -1 when the ground or nothing is.
+	int PickBalloon()
+	{
+		XMFLOAT3 origin, direction;
+		XMStoreFloat3(&origin, g_View.r[3]);
+		XMStoreFloat3(&direction, XMVector3Normalize(g_View.r[2]));
+
+		int picked = -1;
+		sceneBvh.QueryRay(origin, direction, farPlane, [&](uint32_t id, float, float& maxDistance)
+		{
+			XMVECTOR det;
+			XMMATRIX toLocal = XMMatrixInverse(&det, id == 0 ? PlaneWorld() : balloons.GetWorld(id - 1));
+			XMFLOAT3 localOrigin, localDirection;
+			XMStoreFloat3(&localOrigin, XMVector3TransformCoord(XMLoadFloat3(&origin), toLocal));
+			XMStoreFloat3(&localDirection, XMVector3TransformNormal(XMLoadFloat3(&direction), toLocal));
+			MeshHit hit;
+			if ((id == 0 ? planeBvh : balloonBvh).Intersect(localOrigin, localDirection, maxDistance, hit))
 			{
-				pBackBuffer->Release();
-				return;
+				maxDistance = hit.distance;
+				picked = (int)id - 1;
 			}
-			pBackBuffer->Release();
-			swp->Release();
+		});
+		return picked;
+	}
+
+	// Pops the balloon under the crosshair, once per click.
+	void Fire()
+	{
+		std::cout << "Pew\n";
+		int picked = PickBalloon();
+		if (picked < 0)
+			return;
+		balloons.Remove((size_t)picked);
+		// The last balloon took the popped one's id, so a second shot this frame needs the BVH to know.
+		UpdateBounds();
+	}
+	// -END OF PICKING- //
+
+	// -SIMULATION- //
+	// Camera speed in units per second; 0.05 per frame at the 60 Hz it used to move once a frame.
+	static constexpr float MoveSpeed = 3.0f;
+
+	FixedTimestep timestep;
+	TimestepStats simStats;
+	float simTime = 0.0f;				// Wraps at 2 pi, a whole number of balloon bobs.
+	XMFLOAT4 eyePrevious = { 0.0f, 0.0f, 0.0f, 1.0f };	// Camera position before the last step.
+	std::chrono::steady_clock::time_point simStart;		// Of the frame being simulated.
+	std::chrono::steady_clock::time_point inputTime;	// When its input was read, or simStart without new input.
+
+	// UserInput() fills 'inputSample' from the collector on the window's thread and publishes it;
+	// the simulation applies what changed since 'appliedInput'.
+	InputCollector inputCollector;
+	bool inputCreated = false;
+	InputState inputSample;
+	TripleBuffer<InputState> inputs;
+	InputState appliedInput;
+
+	// Update() applies the replay's frames instead of UserInput()'s, and logs what it applied to
+	// the recording; both belong to whichever thread simulates.
+	InputLog* inputRecording = nullptr;
+	InputLog* inputReplay = nullptr;
+	InputState replayState;
+
+	// Turns the camera by mouse movement in pixels, keeping its x axis level with the horizon.
+	void Look(float diffX, float diffY)
+	{
+		// Create the rotation matrix based on mouse input.
+		XMMATRIX rot = XMMatrixRotationRollPitchYaw(-diffY / 150.0f, -diffX / 150.0f, 0);
+
+		g_View = XMMatrixMultiply(rot, g_View);
+
+		XMVECTOR vExistingZ = g_View.r[2];
+		// Parallel to the world's horizon 
+		XMVECTOR vNewX = XMVector3Cross(g_World.r[1], vExistingZ);
+		XMVECTOR vNewY = XMVector3Cross(vExistingZ, vNewX);
+
+		// The axes replace the rows' xyz, each row keeps its w.
+		XMVECTOR xyz = XMVectorSelectControl(1, 1, 1, 0);
+		g_View.r[0] = XMVectorSelect(g_View.r[0], XMVector3Normalize(vNewX), xyz);
+		g_View.r[1] = XMVectorSelect(g_View.r[1], XMVector3Normalize(vNewY), xyz);
+		g_View.r[2] = XMVectorSelect(g_View.r[2], XMVector3Normalize(vExistingZ), xyz);
+	}
 
-			con->OMSetRenderTargets(1, renderTargetView.GetAddressOf(), depthview);
-			depthview->Release();
+	// Looks and fires for what UserInput() read since the last call. Held keys are applied by the
+	// steps.
+	void ApplyInput(const InputState& input)
+	{
+		PROFILE_SCOPE("ApplyInput");
+		int64_t diffX = input.lookX - appliedInput.lookX, diffY = input.lookY - appliedInput.lookY;
+		if (diffX != 0 || diffY != 0)
+			Look((float)diffX, (float)diffY);
+		for (uint32_t shot = appliedInput.shots; shot != input.shots; shot++)
+			Fire();
+		appliedInput = input;
+	}
+
+	// One fixed step of 'dt' seconds: walks the camera by the held keys and moves the balloons.
+	void Simulate(float dt)
+	{
+		PROFILE_SCOPE("Simulate");
+		XMStoreFloat4(&eyePrevious, g_View.r[3]);
+		if (appliedInput.moveX != 0.0f || appliedInput.moveZ != 0.0f)
+		{
+			// The view matrix isn't inverted until it is drawn, so moving along its x and z rows
+			// moves the camera. Their w is 0 and leaves the position's alone.
+			g_View.r[3] = XMVectorMultiplyAdd(XMVectorReplicate(appliedInput.moveX * MoveSpeed * dt), g_View.r[0], g_View.r[3]);
+			g_View.r[3] = XMVectorMultiplyAdd(XMVectorReplicate(appliedInput.moveZ * MoveSpeed * dt), g_View.r[2], g_View.r[3]);
 		}
+		if (appliedInput.walking)
+			g_View.r[3] = XMVectorSetY(g_View.r[3], 1.0f);
 
-		// Creation of DEPTH stencil desc
-		D3D11_DEPTH_STENCIL_DESC desc;
-		ZeroMemory(&desc, sizeof(D3D11_DEPTH_STENCIL_DESC));
-		desc.DepthEnable = true;
-		desc.DepthWriteMask = D3D11_DEPTH_WRITE_MASK_ALL;
-		desc.DepthFunc = D3D11_COMPARISON_LESS_EQUAL;
+		simTime += dt;
+		simTime = simTime >= XM_2PI ? simTime - XM_2PI : simTime;
+		balloons.Step(simTime, dt);
+	}
+
+	// Snapshots built before the frame path has to stay off the heap: every buffer has grown to
+	// fit by then.
+	static const uint32_t HeapWarmupFrames = 8;
+	uint64_t preparedFrames = 0;
 
-		if (FAILED(dev->CreateDepthStencilState(&desc, depthStencilState.GetAddressOf())))
+	// Fills 'snapshot' with the state between the last two steps: camera, frame constants, the
+	// balloons that survive culling and the sorted draw list.
+	void PrepareFrame(FrameSnapshot& snapshot)
+	{
+		PROFILE_SCOPE("PrepareFrame");
+		FrameHeap::NoHeapScope noHeap(++preparedFrames > HeapWarmupFrames);
+		uint64_t heapAllocations = FrameHeap::GetAllocations();
+
+		// What the slot held was drawn frames ago; its lists go with the arena.
+		snapshot.arena.Reset();
+		snapshot.visibleBalloons = ArenaVector<InstanceData>(&snapshot.arena);
+		snapshot.draws.SetArena(&snapshot.arena);
+
+		float alpha = timestep.GetAlpha();
+		float time = simTime - (1.0f - alpha) * (float)timestep.GetStep();
+		time = time < 0.0f ? time + XM_2PI : time;
+		snapshot.view = g_View;
+		snapshot.view.r[3] = XMVectorLerp(XMLoadFloat4(&eyePrevious), g_View.r[3], alpha);
+
+		// Per-frame values shared by every draw
+		PerFrameConstants& frame = snapshot.constants;
+		XMVECTOR det;
+		XMMATRIX viewMatrix = XMMatrixInverse(&det, snapshot.view);
+		frame.mView = XMMatrixTranspose(viewMatrix);
+		frame.mProjection = XMMatrixTranspose(g_Projection);
+		// Directional Light [0]
+		frame.lightDir = lightDir;
+		frame.lightClr = lightClr;
+		frame.time = time;
+		frame.padding[0] = frame.padding[1] = frame.padding[2] = 0.0f;
+
+		// Pack the balloons' world matrices and colors.
+		balloons.Pack(alpha);
+
+		// Drop what is off screen or hidden behind the ground or the crossbow.
+		CullObjects(viewMatrix, snapshot);
+
+		// Build and sort the frame's draws.
+		SubmitDraws(viewMatrix, snapshot);
+
+		snapshot.sim = simStats;
+		snapshot.inputTime = inputTime;
+		snapshot.heapAllocations = FrameHeap::GetAllocations() - heapAllocations;
+		snapshot.simMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - simStart).count();
+	}
+	// -END OF SIMULATION- //
+
+	// -PIPELINE- //
+	// Snapshots go from the simulation to the renderer through 'snapshots'. In the pipeline the
+	// simulation runs on 'simulation' and stays one snapshot ahead: it builds frame k while the
+	// renderer draws k - 1, so a frame takes about as long as the slower of the two. It is a thread
+	// of its own rather than a Gateware job; a job that never ends would hold a pool thread the
+	// rasterizer and the BVH rebuild wait on.
+	TripleBuffer<FrameSnapshot> snapshots;
+	std::thread simulation;
+	std::atomic<bool> pipelineRunning{ false };
+	std::atomic<uint64_t> published{ 0 }, taken{ 0 };
+	uint64_t frameLimit = 0;
+	double fixedFrameSeconds = 0.0;
+	std::chrono::steady_clock::time_point takenTime;
+	PipelineStats pipelineStats;
+
+	// Runs on 'simulation' until StopPipeline() or 'frameLimit' snapshots.
+	void SimulationLoop()
+	{
+		Profiler::SetThreadName("simulation");
+		std::chrono::steady_clock::time_point last = std::chrono::steady_clock::now();
+		for (uint64_t frame = published.load(std::memory_order_relaxed) + 1; frame <= frameLimit; frame++)
 		{
-			DebugBreak();
-			return;
+			std::chrono::steady_clock::time_point waitStart = std::chrono::steady_clock::now();
+			WaitUntil([&]() { return taken.load(std::memory_order_acquire) + 1 >= frame || !pipelineRunning.load(std::memory_order_relaxed); });
+			if (!pipelineRunning.load(std::memory_order_relaxed))
+				return;
+
+			std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+			double frameSeconds = fixedFrameSeconds > 0.0 ? fixedFrameSeconds : std::chrono::duration<double>(now - last).count();
+			last = now;
+			Update(frameSeconds);
+
+			FrameSnapshot& snapshot = snapshots.Back();
+			PrepareFrame(snapshot);
+			snapshot.frame = frame;
+			snapshot.simWaitMs = std::chrono::duration<double, std::milli>(simStart - waitStart).count();
+			snapshot.published = std::chrono::steady_clock::now();
+			snapshots.Publish();
+			published.store(frame, std::memory_order_release);
 		}
+	}
+
+	// Takes the snapshot just published and draws it.
+	void ExecuteFrame()
+	{
+		PROFILE_SCOPE("ExecuteFrame");
+		snapshots.Acquire();
+		const FrameSnapshot& snapshot = snapshots.Front();
+		takenTime = std::chrono::steady_clock::now();
+		taken.store(snapshot.frame, std::memory_order_release);
+		pipelineStats.queueMs = std::chrono::duration<double, std::milli>(takenTime - snapshot.published).count();
+
+		frameConstants.Update(device, snapshot.constants);
+		PerMaterialConstants material;
+		material.vOutputColor = XMFLOAT4(1.0f, 1.0f, 1.0f, 1.0f);
+		materialConstants.Update(device, material);
+		// Buffers are written before the draws, which may be recorded on other threads.
+		instancesUploaded = !snapshot.visibleBalloons.empty() && UpdateInstanceBuffer(snapshot.visibleBalloons);
+
+		ExecuteDraws(snapshot);
+	}
+	// -END OF PIPELINE- //
+
+	// -DRAW SUBMISSION- //
+	enum DrawObject : uint32_t
+	{
+		DRAW_PLANE,
+		DRAW_BALLOONS,
+		DRAW_SKYBOX,
+		DRAW_CROSSBOW,
+		DRAW_CROSSHAIR,
+	};
+
+	// Shader program ids for the sort key, one per VS/PS pair.
+	enum DrawShader : uint32_t
+	{
+		SHADER_SOLID_TEXTURE,
+		SHADER_SPECULAR_INSTANCED,
+		SHADER_SKYBOX,
+		SHADER_LIT_TEXTURE,
+		SHADER_CROSSHAIR,
+	};
+
+	float nearPlane = 0.1f, farPlane = 600.0f;
+
+	// Quantized view-space depth of a world position.
+	uint32_t ViewDepth(XMFLOAT3 worldPos, FXMMATRIX viewMatrix)
+	{
+		XMVECTOR viewPos = XMVector3TransformCoord(XMLoadFloat3(&worldPos), viewMatrix);
+		return DrawKey::QuantizeDepth(XMVectorGetZ(viewPos), nearPlane, farPlane);
+	}
 
-		desc.DepthEnable = true;
-		desc.DepthFunc = D3D11_COMPARISON_ALWAYS;
-		if (FAILED(dev->CreateDepthStencilState(&desc, depthStencilStateFront.GetAddressOf())))
+	// Every object submits a packet; sorting decides the draw order.
+	// World opaque draws go front to back, then the sky at max depth, then the overlay.
+	void SubmitDraws(FXMMATRIX viewMatrix, FrameSnapshot& snapshot)
+	{
+		PROFILE_SCOPE("SubmitDraws");
+		using namespace DrawKey;
+		DrawQueue& drawQueue = snapshot.draws;
+		drawQueue.Clear();
+
+		if (snapshot.planeVisible)
 		{
-			DebugBreak();
-			return;
+			XMFLOAT3 planeCenter = { plane_pos.x, plane_pos.y, plane_pos.z };
+			drawQueue.Submit(Make(LAYER_WORLD, PASS_OPAQUE, SHADER_SOLID_TEXTURE, 0, ViewDepth(planeCenter, viewMatrix)), DRAW_PLANE);
 		}
 
-		// -VERTEX SHADERS- //
-#pragma region VERTSHADERS
-		// Compile the vertex shader
-		ID3DBlob* pVSBlob = nullptr;
-		if (FAILED(DrawClass::CompileShaderFromFile(L"Shaders\\shaders.fx", "VS", "vs_4_0", &pVSBlob)))
+		if (!snapshot.visibleBalloons.empty())
 		{
-			DebugBreak();
-			return;
+			// One instanced draw, sorted by its nearest visible balloon.
+			uint32_t nearest = MaxDepth;
+			for (const InstanceData& balloon : snapshot.visibleBalloons)
+			{
+				uint32_t depth = ViewDepth(XMFLOAT3(balloon.world._41, balloon.world._42, balloon.world._43), viewMatrix);
+				nearest = depth < nearest ? depth : nearest;
+			}
+			drawQueue.Submit(Make(LAYER_WORLD, PASS_OPAQUE, SHADER_SPECULAR_INSTANCED, 0, nearest), DRAW_BALLOONS, (uint32_t)snapshot.visibleBalloons.size());
 		}
 
-		// Create the vertex shader
-		if (FAILED(dev->CreateVertexShader(pVSBlob->GetBufferPointer(), pVSBlob->GetBufferSize(), nullptr, vertexshader.GetAddressOf())))
+		drawQueue.Submit(Make(LAYER_SKY, PASS_OPAQUE, SHADER_SKYBOX, 0, MaxDepth), DRAW_SKYBOX);
+
+		// Overlay draws ignore depth; the alpha tested crosshair goes over the crossbow.
+		drawQueue.Submit(Make(LAYER_OVERLAY, PASS_OPAQUE, SHADER_LIT_TEXTURE, 0, 0), DRAW_CROSSBOW);
+		drawQueue.Submit(Make(LAYER_OVERLAY, PASS_ALPHA_TESTED, SHADER_CROSSHAIR, 0, 0), DRAW_CROSSHAIR);
+
+		drawQueue.Sort();
+	}
+
+	struct DrawRecording
+	{
+		Mesh* scene;
+		const FrameSnapshot* snapshot;
+	};
+
+	// The device may split the sorted draws across threads, so every part starts by binding the
+	// state the whole frame shares.
+	void ExecuteDraws(const FrameSnapshot& snapshot)
+	{
+		DrawRecording recording = { this, &snapshot };
+		device.RecordDraws(static_cast<uint32_t>(snapshot.draws.Size()), RecordDrawsJob, &recording);
+	}
+
+	static void RecordDrawsJob(RenderContext& context, uint32_t begin, uint32_t end, void* user)
+	{
+		PROFILE_SCOPE("RecordDraws");
+		DrawRecording* recording = static_cast<DrawRecording*>(user);
+		recording->scene->BindFrameState(context);
+		for (uint32_t i = begin; i < end; i++)
+			recording->scene->ExecuteDraw(context, recording->snapshot->draws[i], *recording->snapshot);
+	}
+
+	void BindFrameState(RenderContext& context)
+	{
+		context.SetPrimitiveTopology(PrimitiveTopology::TriangleList);
+		context.SetInputLayout(input);
+
+		// The frame and material buffers are updated before recording; draws only set per-object constants.
+		const BufferHandle cbuffers[] = { frameConstants.GetBuffer(), materialConstants.GetBuffer() };
+		context.SetConstantBuffers(CB_PER_FRAME, ARRAYSIZE(cbuffers), cbuffers);
+
+		// No geometry shader is used by any draw.
+		context.SetShader(ShaderStage::Geometry, InvalidHandle);
+
+		// Textures that don't change, the crossbow's included since only its draw sets it.
+		const TextureHandle textures[] = { planeTexture, crossbowTexture, SKBtexture, crosshairTexture };
+		context.SetTextures(0, ARRAYSIZE(textures), textures);
+		context.SetSamplers(0, 1, &samplerLinear);
+	}
+
+	void ExecuteDraw(RenderContext& context, const DrawPacket& packet, const FrameSnapshot& snapshot)
+	{
+		// Each object is a pass of its own on the GPU timeline.
+		static const char* passNames[] = { "GPU Plane", "GPU Balloons", "GPU Skybox", "GPU Crossbow", "GPU Crosshair" };
+		context.BeginPass(packet.object < ARRAYSIZE(passNames) ? passNames[packet.object] : "GPU Draw");
+		switch (packet.object)
+		{
+		case DRAW_PLANE:
+			RenderPlane(context);
+			break;
+		case DRAW_BALLOONS:
+			RenderBalloons(context, balloonMesh, snapshot);
+			break;
+		case DRAW_SKYBOX:
+			RenderSkybox(context, snapshot);
+			break;
+		case DRAW_CROSSBOW:
+			RenderMesh(context, crossbowMesh, snapshot);
+			break;
+		case DRAW_CROSSHAIR:
+			RenderCrosshair(context);
+			break;
+		}
+		context.EndPass();
+	}
+	// -END OF DRAW SUBMISSION- //
+public:
+
+	Mesh(RenderDevice& _device, GW::SYSTEM::GWindow _win, SimpleMesh* _mesh, SimpleMesh* _meshtwo, const wchar_t* texturePath, const wchar_t* textureTwoPath) : DrawClass(_device, _win)
+	{
+		PROFILE_SCOPE("LoadScene");
+		if (_mesh == nullptr)
+		{
+			std::cout << "Mesh was nullptr/Invalid\n";
+		}
+
+		crossbowMesh = _mesh;
+		balloonMesh = _meshtwo;
+
+		// Creation of DEPTH stencil desc
+		DepthStateDesc desc;
+		desc.depthEnable = true;
+		desc.depthWrite = true;
+		desc.depthFunc = CompareFunc::LessEqual;
+		depthStencilState = device.CreateDepthState(desc);
+		if (depthStencilState == InvalidHandle)
 		{
 			DebugBreak();
-			pVSBlob->Release();
 			return;
 		}
 
-		// Compile the vertex shader for the wave.
-		pVSBlob = nullptr;
-		if (FAILED(DrawClass::CompileShaderFromFile(L"Shaders\\shaders.fx", "VSWave", "vs_4_0", &pVSBlob)))
+		desc.depthEnable = true;
+		desc.depthFunc = CompareFunc::AlwaysPass;
+		depthStencilStateFront = device.CreateDepthState(desc);
+		if (depthStencilStateFront == InvalidHandle)
 		{
 			DebugBreak();
 			return;
 		}
 
-		// Create the vertex shader for the wave.
-		if (FAILED(dev->CreateVertexShader(pVSBlob->GetBufferPointer(), pVSBlob->GetBufferSize(), nullptr, vertexshaderwave.GetAddressOf())))
+		// -VERTEX SHADERS- //
+#pragma region VERTSHADERS
+		// Compile and create the vertex shaders
+		vertexshader = LoadShader(ShaderStage::Vertex, "VS", "vs_4_0");
+		vertexshaderwave = LoadShader(ShaderStage::Vertex, "VSWave", "vs_4_0");
+		vertexshaderinstanced = LoadShader(ShaderStage::Vertex, "VS_Instanced", "vs_4_0");
+		SKBvertexshader = LoadShader(ShaderStage::Vertex, "SKYBOX_VS", "vs_4_0");
+		if (vertexshader == InvalidHandle || vertexshaderwave == InvalidHandle ||
+			vertexshaderinstanced == InvalidHandle || SKBvertexshader == InvalidHandle)
 		{
 			DebugBreak();
-			pVSBlob->Release();
 			return;
 		}
 
 		// Define the input layout
-		D3D11_INPUT_ELEMENT_DESC layout[] =
+		const VertexElement layout[] =
 		{
-			{ "POSITION", 0, DXGI_FORMAT_R32G32B32A32_FLOAT, 0, D3D11_APPEND_ALIGNED_ELEMENT, D3D11_INPUT_PER_VERTEX_DATA, 0 },
-			{ "NORMAL", 0, DXGI_FORMAT_R32G32B32_FLOAT, 0, D3D11_APPEND_ALIGNED_ELEMENT, D3D11_INPUT_PER_VERTEX_DATA, 0 },
-			{ "TEXCOORD", 0, DXGI_FORMAT_R32G32_FLOAT, 0, D3D11_APPEND_ALIGNED_ELEMENT, D3D11_INPUT_PER_VERTEX_DATA, 0 },
+			{ "POSITION", 0, VertexFormat::Float4, 0, false },
+			{ "NORMAL", 0, VertexFormat::Float3, 0, false },
+			{ "TEXCOORD", 0, VertexFormat::Float2, 0, false },
 		};
-		UINT numElements = ARRAYSIZE(layout);
 
 		// Create the input layout
-		if (FAILED(dev->CreateInputLayout(layout, numElements, pVSBlob->GetBufferPointer(), pVSBlob->GetBufferSize(), input.GetAddressOf())))
+		input = device.CreateInputLayout(vertexshaderwave, layout, ARRAYSIZE(layout));
+		if (input == InvalidHandle)
 		{
 			DebugBreak();
-			pVSBlob->Release();
 			return;
 		}
 
-		// Skybox VS
-		// Compile the Skybox vertex shader
-		pVSBlob = nullptr;
-		if (FAILED(DrawClass::CompileShaderFromFile(L"Shaders\\shaders.fx", "SKYBOX_VS", "vs_4_0", &pVSBlob)))
+		// Per-vertex data in slot 0, one world matrix and color per instance in slot 1.
+		const VertexElement instancedLayout[] =
 		{
-			DebugBreak();
-			return;
-		}
+			{ "POSITION", 0, VertexFormat::Float4, 0, false },
+			{ "NORMAL", 0, VertexFormat::Float3, 0, false },
+			{ "TEXCOORD", 0, VertexFormat::Float2, 0, false },
+			{ "INSTANCEWORLD", 0, VertexFormat::Float4, 1, true },
+			{ "INSTANCEWORLD", 1, VertexFormat::Float4, 1, true },
+			{ "INSTANCEWORLD", 2, VertexFormat::Float4, 1, true },
+			{ "INSTANCEWORLD", 3, VertexFormat::Float4, 1, true },
+			{ "INSTANCECOLOR", 0, VertexFormat::Float4, 1, true },
+		};
 
-		// Create the Skybox vertex shader
-		if (FAILED(dev->CreateVertexShader(pVSBlob->GetBufferPointer(), pVSBlob->GetBufferSize(), nullptr, SKBvertexshader.GetAddressOf())))
+		// Create the instanced input layout
+		instancedinput = device.CreateInputLayout(vertexshaderinstanced, instancedLayout, ARRAYSIZE(instancedLayout));
+		if (instancedinput == InvalidHandle)
 		{
 			DebugBreak();
-			pVSBlob->Release();
 			return;
 		}
 
 		// Define the input layout
-		D3D11_INPUT_ELEMENT_DESC SKBlayout[] =
+		const VertexElement SKBlayout[] =
 		{
-			{ "SV_POSITION", 0, DXGI_FORMAT_R32G32B32A32_FLOAT, 0, D3D11_APPEND_ALIGNED_ELEMENT, D3D11_INPUT_PER_VERTEX_DATA, 0 },
-			{ "NORMAL", 0, DXGI_FORMAT_R32G32B32_FLOAT, 0, D3D11_APPEND_ALIGNED_ELEMENT, D3D11_INPUT_PER_VERTEX_DATA, 0 },
-			{ "TEXCOORD", 2, DXGI_FORMAT_R32G32_FLOAT, 0, D3D11_APPEND_ALIGNED_ELEMENT, D3D11_INPUT_PER_VERTEX_DATA, 0 },
+			{ "SV_POSITION", 0, VertexFormat::Float4, 0, false },
+			{ "NORMAL", 0, VertexFormat::Float3, 0, false },
+			{ "TEXCOORD", 2, VertexFormat::Float2, 0, false },
 		};
-		numElements = ARRAYSIZE(SKBlayout);
 
 		// Create the input layout
-		if (FAILED(dev->CreateInputLayout(SKBlayout, numElements, pVSBlob->GetBufferPointer(), pVSBlob->GetBufferSize(), SKBinput.GetAddressOf())))
+		SKBinput = device.CreateInputLayout(SKBvertexshader, SKBlayout, ARRAYSIZE(SKBlayout));
+		if (SKBinput == InvalidHandle)
 		{
 			DebugBreak();
-			pVSBlob->Release();
 			return;
 		}
-
-		pVSBlob->Release();
 #pragma endregion
 		// - END OF VERTEX SHADERS- //
 
 		// -GEOMETRY SHADERS- //
 #pragma region GEOSHADERS
 		// Create the Base Geometry Shader
-		ID3DBlob* pGSBlob = nullptr;
-
-		if (FAILED(DrawClass::CompileShaderFromFile(L"Shaders\\shaders.fx", "GS", "gs_4_0", &pGSBlob)))
+		geoshader = LoadShader(ShaderStage::Geometry, "GS", "gs_4_0");
+		if (geoshader == InvalidHandle)
 		{
 			DebugBreak();
-			pGSBlob->Release();
 			return;
 		}
-
-		if (FAILED(dev->CreateGeometryShader(pGSBlob->GetBufferPointer(), pGSBlob->GetBufferSize(), NULL, &geoshader)))
-		{
-			DebugBreak();
-			pGSBlob->Release();
-			return;
-		}
-
-		pGSBlob->Release();
 #pragma endregion
 		// -END OF GEOMETRY SHADERS- //
 
 		// -PIXEL SHADERS- //
 #pragma region PIXELSHADERS
-		// Compile the pixel shaders
-		ID3DBlob* pPSBlob = nullptr;
-		if (FAILED(DrawClass::CompileShaderFromFile(L"Shaders\\shaders.fx", "PS", "ps_4_0", &pPSBlob)))
-		{
-			MessageBox(nullptr,
-				L"The FX file cannot be compiled.  Please run this executable from the directory that contains the FX file.", L"Error", MB_OK);
-			return;
-		}
-
-		// Create the pixel shader
-		if (FAILED(dev->CreatePixelShader(pPSBlob->GetBufferPointer(), pPSBlob->GetBufferSize(), nullptr, PS_MAIN.GetAddressOf())))
-		{
-			pPSBlob->Release();
-			return;
-		}
-
-		// Compile the lighting pixel shader
-		pPSBlob = nullptr;
-		if (FAILED(DrawClass::CompileShaderFromFile(L"Shaders\\shaders.fx", "PS_Specular", "ps_4_0", &pPSBlob)))
-		{
-			MessageBox(nullptr,
-				L"The FX file cannot be compiled.  Please run this executable from the directory that contains the FX file.", L"Error", MB_OK);
-			return;
-		}
-
-		// Create the pixel shader
-		if (FAILED(dev->CreatePixelShader(pPSBlob->GetBufferPointer(), pPSBlob->GetBufferSize(), nullptr, PS_SPECULAR.GetAddressOf())))
+		// Compile and create the pixel shaders
+		PS_MAIN = LoadShader(ShaderStage::Pixel, "PS", "ps_4_0");
+		PS_SPECULAR = LoadShader(ShaderStage::Pixel, "PS_Specular", "ps_4_0");
+		PS_SPECULAR_INSTANCED = LoadShader(ShaderStage::Pixel, "PS_SpecularInstanced", "ps_4_0");
+		PS_NOLIGHTS = LoadShader(ShaderStage::Pixel, "PS_SolidTexture", "ps_4_0");
+		SKBpixelshader = LoadShader(ShaderStage::Pixel, "SKYBOX_PS", "ps_4_0");
+		PS_CROSSHAIR = LoadShader(ShaderStage::Pixel, "PS_Crosshair", "ps_4_0");
+		if (PS_MAIN == InvalidHandle || PS_SPECULAR == InvalidHandle || PS_SPECULAR_INSTANCED == InvalidHandle ||
+			PS_NOLIGHTS == InvalidHandle || SKBpixelshader == InvalidHandle || PS_CROSSHAIR == InvalidHandle)
 		{
-			pPSBlob->Release();
-			return;
-		}
-
-		// Compile the solidtexture pixel shader
-		pPSBlob = nullptr;
-		if (FAILED(DrawClass::CompileShaderFromFile(L"Shaders\\shaders.fx", "PS_SolidTexture", "ps_4_0", &pPSBlob)))
-		{
-			MessageBox(nullptr,
-				L"The FX file cannot be compiled.  Please run this executable from the directory that contains the FX file.", L"Error", MB_OK);
-			DebugBreak();
-			return;
-		}
-
-		// Create the solidtexture pixel shader
-		if (FAILED(dev->CreatePixelShader(pPSBlob->GetBufferPointer(), pPSBlob->GetBufferSize(), nullptr, PS_NOLIGHTS.GetAddressOf())))
-		{
-			pPSBlob->Release();
-			DebugBreak();
-			return;
-		}
-
-		//Compile skybox pixel shader
-		pPSBlob = nullptr;
-		if (FAILED(DrawClass::CompileShaderFromFile(L"Shaders\\shaders.fx", "SKYBOX_PS", "ps_4_0", &pPSBlob)))
-		{
-			MessageBox(nullptr,
-				L"The FX file cannot be compiled.  Please run this executable from the directory that contains the FX file.", L"Error", MB_OK);
-			DebugBreak();
-			return;
-		}
-		// Create skybox pixel shader
-		if (FAILED(dev->CreatePixelShader(pPSBlob->GetBufferPointer(), pPSBlob->GetBufferSize(), nullptr, SKBpixelshader.GetAddressOf())))
-		{
-			pPSBlob->Release();
 			DebugBreak();
 			return;
 		}
-
-		// Compile crosshair pixel shader
-		pPSBlob = nullptr;
-		if (FAILED(DrawClass::CompileShaderFromFile(L"Shaders\\shaders.fx", "PS_Crosshair", "ps_4_0", &pPSBlob)))
-		{
-			MessageBox(nullptr,
-				L"The FX file cannot be compiled.  Please run this executable from the directory that contains the FX file.", L"Error", MB_OK);
-			DebugBreak();
-			return;
-		}
-		// Create skybox pixel shader
-		if (FAILED(dev->CreatePixelShader(pPSBlob->GetBufferPointer(), pPSBlob->GetBufferSize(), nullptr, PS_CROSSHAIR.GetAddressOf())))
-		{
-			pPSBlob->Release();
-			DebugBreak();
-			return;
-		}
-		pPSBlob->Release();
 #pragma endregion
 		// -END OF PIXEL SHADERS- //
 
-		// Create the constant buffer
-		D3D11_BUFFER_DESC bd = {};
-		bd.Usage = D3D11_USAGE_DEFAULT;
-		bd.ByteWidth = sizeof(ConstantBuffer);
-		bd.BindFlags = D3D11_BIND_CONSTANT_BUFFER;
-		bd.CPUAccessFlags = 0;
-		if (FAILED(dev->CreateBuffer(&bd, nullptr, constantbuffer.GetAddressOf())))
+		// Create the constant buffers
+		if (!frameConstants.Create(device) ||
+			!materialConstants.Create(device))
 		{
 			DebugBreak();
 			return;
@@ -862,60 +1186,55 @@ public:
 
 		// CREATION OF OBJECTS //
 		// Create the plane.
-		CreatePlane(dev, con);
+		CreatePlane();
 		// Create the cube for the skybox.
-		CreateInvertedCube(dev, con);
+		CreateInvertedCube();
 		// Create the crossbow mesh.
-		CreateMesh(dev, con, &crossbowMesh->vertexList, &crossbowMesh->indicesList, vertexbuffer, indexbuffer);
+		CreateMesh(&crossbowMesh->vertexList, &crossbowMesh->indicesList, vertexbuffer, indexbuffer);
 		// Create the crosshair
-		CreateNDCPlane(dev, con);
+		CreateNDCPlane();
 		// Create Ballon Mesh;
-		CreateMesh(dev, con, &balloonMesh->vertexList, &balloonMesh->indicesList, b_vertexbuffer, b_indexbuffer);
+		CreateMesh(&balloonMesh->vertexList, &balloonMesh->indicesList, b_vertexbuffer, b_indexbuffer);
 
 		// TEXTURE LOADING //
 		// Load the grass texture
-		if (FAILED(CreateDDSTextureFromFile(dev, texturePath, nullptr, planeTextureRV.GetAddressOf())))
+		planeTexture = LoadTexture(texturePath);
+		if (planeTexture == InvalidHandle)
 		{
 			DebugBreak();
 			return;
 		}
 
 		// Load Mesh Texture
-		if (FAILED(CreateDDSTextureFromFile(dev, textureTwoPath, nullptr, crossbowTextureRV.GetAddressOf())))
+		crossbowTexture = LoadTexture(textureTwoPath);
+		if (crossbowTexture == InvalidHandle)
 		{
 			DebugBreak();
 			return;
 		}
 
 		// SKYBOX Texture
-		if (FAILED(CreateDDSTextureFromFile(dev, L"Textures\\LostValley.dds", nullptr, SKBtextureRV.GetAddressOf())))
+		SKBtexture = LoadTexture(L"Textures/LostValley.dds");
+		if (SKBtexture == InvalidHandle)
 		{
 			DebugBreak();
 			return;
 		}
 
 		// Load Crosshair Texture
-		if (FAILED(CreateDDSTextureFromFile(dev, L"Textures\\crosshair.dds", nullptr, crosshairTextureRV.GetAddressOf())))
+		crosshairTexture = LoadTexture(L"Textures/crosshair.dds");
+		if (crosshairTexture == InvalidHandle)
 		{
 			DebugBreak();
 			return;
 		}
 
-		// Set the textures that won't change.
-		con->PSSetShaderResources(0, 1, planeTextureRV.GetAddressOf());
-		con->PSSetShaderResources(2, 1, SKBtextureRV.GetAddressOf());
-		con->PSSetShaderResources(3, 1, crosshairTextureRV.GetAddressOf());
-
 		// Create the sample state
-		D3D11_SAMPLER_DESC sampDesc = {};
-		sampDesc.Filter = D3D11_FILTER_MIN_MAG_MIP_LINEAR;
-		sampDesc.AddressU = D3D11_TEXTURE_ADDRESS_WRAP;
-		sampDesc.AddressV = D3D11_TEXTURE_ADDRESS_WRAP;
-		sampDesc.AddressW = D3D11_TEXTURE_ADDRESS_WRAP;
-		sampDesc.ComparisonFunc = D3D11_COMPARISON_NEVER;
-		sampDesc.MinLOD = 0;
-		sampDesc.MaxLOD = D3D11_FLOAT32_MAX;
-		if (FAILED(dev->CreateSamplerState(&sampDesc, samplerLinear.GetAddressOf())))
+		SamplerDesc sampDesc;
+		sampDesc.filter = SamplerFilter::Linear;
+		sampDesc.address = SamplerAddress::Wrap;
+		samplerLinear = device.CreateSampler(sampDesc);
+		if (samplerLinear == InvalidHandle)
 			return;
 
 		// ~~~~~~~~~~~ //
@@ -932,9 +1251,33 @@ public:
 		// Invert the view matrix so we can do user input.
 		XMVECTOR det;
 		g_View = XMMatrixInverse(&det, g_View);
+		// Nothing has moved before the first step.
+		XMStoreFloat4(&eyePrevious, g_View.r[3]);
 
 		// Initialize the projection matrix
-		g_Projection = XMMatrixPerspectiveFovLH(1.309f, DrawClass::width / (FLOAT)DrawClass::height, 0.1f, 600.0f);
+		g_Projection = XMMatrixPerspectiveFovLH(1.309f, DrawClass::width / (FLOAT)DrawClass::height, nearPlane, farPlane);
+
+		// Place the three balloons: red bobs left, green bobs up, blue bobs right.
+		balloons.Add({ -5.0f, 4.0f, -2.0f, 1.0f }, { -1.0f, 0.0f, 0.0f }, { 1.0f, 0.0f, 0.0f, 1.0f });
+		balloons.Add({ 0.0f, 4.0f, -2.0f, 1.0f }, { 0.0f, 1.0f, 0.0f }, { 0.0f, 1.0f, 0.0f, 1.0f });
+		balloons.Add({ 5.0f, 4.0f, -2.0f, 1.0f }, { 1.0f, 0.0f, 0.0f }, { 0.0f, 0.0f, 1.0f, 1.0f });
+		frustumCuller.Reserve(1 + balloons.Count());
+		// Bounds are filled in every frame; the first refit builds the tree.
+		sceneBvh.Resize(1 + balloons.Count());
+
+		// Object space bounds of the balloon mesh for culling its instances.
+		balloonMeshMin = { FLT_MAX, FLT_MAX, FLT_MAX };
+		balloonMeshMax = { -FLT_MAX, -FLT_MAX, -FLT_MAX };
+		for (const SimpleVertex& v : balloonMesh->vertexList)
+		{
+			balloonMeshMin = { fminf(balloonMeshMin.x, v.Pos.x), fminf(balloonMeshMin.y, v.Pos.y), fminf(balloonMeshMin.z, v.Pos.z) };
+			balloonMeshMax = { fmaxf(balloonMeshMax.x, v.Pos.x), fmaxf(balloonMeshMax.y, v.Pos.y), fmaxf(balloonMeshMax.z, v.Pos.z) };
+		}
+
+		// Triangle BVHs for shooting at the ground and the balloons.
+		planeBvh.Build(planeVertices.data(), (uint32_t)planeVertices.size(), sizeof(SimpleVertex), planeIndices.data(), (uint32_t)planeIndices.size());
+		balloonBvh.Build(balloonMesh->vertexList.data(), (uint32_t)balloonMesh->vertexList.size(), sizeof(SimpleVertex),
+			balloonMesh->indicesList.data(), (uint32_t)balloonMesh->indicesList.size());
 
 		// Set-up Lighting Variables
 		{
@@ -943,241 +1286,182 @@ public:
 			lightClr = { 1.0f, 1.0f, 1.0f, 1.0f };
 		}
 
-		con->Release();
-		dev->Release();
 		return;
 	}
 
-	void ResetDeviceContext(ID3D11DeviceContext* con)
+	~Mesh()
 	{
-		con->VSSetShader(nullptr, nullptr, 0);
-		con->VSSetConstantBuffers(0, 1, nullptr);
-		con->PSSetShader(nullptr , nullptr, 0);
-		con->PSSetConstantBuffers(0, 1, nullptr);
+		StopPipeline();
 	}
 
-	void Render(UINT flag = 1)
+	// Applies the latest input, then runs the simulation steps that 'frameSeconds' of real time
+	// adds up to. Render() then draws the state between the last two. The pipeline calls this
+	// itself.
+	void Update(double frameSeconds)
 	{
-		if (crossbowMesh == nullptr)
-			return;
-
-		// Update time
-		static float time = 0.0f;
-
-		static ULONGLONG timePerFrame = 0, timeStart = 0;
-
-		ULONGLONG timeCur = GetTickCount64();
-		if (timePerFrame == 0)
-			timePerFrame = timeCur;
-		if (timeStart == 0)
-			timeStart = timeCur;
-		time = (timeCur - timeStart) / 1000.0f;
-
-		if (time > 6.28)
+		PROFILE_SCOPE("Update");
+		simStart = std::chrono::steady_clock::now();
+		inputTime = simStart;
+		InputState before = appliedInput;
+		if (inputReplay != nullptr)
 		{
-			timeStart = timeCur;
+			// A replayed frame brings its frame time too, so the steps are the recorded ones.
+			InputFrame frame;
+			bool replayed = inputReplay->Next(frame);
+			replayState.lookX += frame.lookX;
+			replayState.lookY += frame.lookY;
+			replayState.shots += frame.shots;
+			replayState.moveX = frame.moveX;
+			replayState.moveZ = frame.moveZ;
+			replayState.walking = replayed ? frame.walking : replayState.walking;
+			frameSeconds = replayed ? frame.seconds : frameSeconds;
+			ApplyInput(replayState);
 		}
-
-		// Grab the context and view.
-		ID3D11DeviceContext* con;
-		ID3D11RenderTargetView* view;
-		d3d11.GetImmediateContext((void**)&con);
-		d3d11.GetRenderTargetView((void**)&view);
-
-		// Set Primitive Topology
-		con->IASetPrimitiveTopology(D3D11_PRIMITIVE_TOPOLOGY_TRIANGLELIST);
-		con->IASetInputLayout(input.Get());
-
-		// Constant Buffer to communicate with the shader's values on the GPU
-		ConstantBuffer cb;
-		cb.mWorld = XMMatrixTranspose(g_World);
-		XMVECTOR det;
-		cb.mView = XMMatrixTranspose(XMMatrixInverse(&det, g_View));
-		cb.mProjection = XMMatrixTranspose(g_Projection);
-		// Directional Light [0]
-		cb.lightDir = lightDir;
-		cb.lightClr = lightClr;
-		cb.vOutputColor = XMFLOAT4(1.0f, 1.0f, 1.0f, 1.0f);
-		cb.time = time;
-
-		con->UpdateSubresource(constantbuffer.Get(), 0, nullptr, &cb, 0, 0);
-
-		// Render the plane
-		RenderPlane(con, view, cb);
-
-		// Render the balloons
-		RenderBalloons(con, cb, balloonMesh, time);
-
-		// Reset Geometry Shader so it doesn't affect everything else.
-		con->GSSetShader(nullptr, 0, 0);
-
-		// Render the Skybox
+		else if (inputs.Acquire())
 		{
-			RenderSkybox(con, cb);
+			ApplyInput(inputs.Front());
+			inputTime = inputs.Front().time;
 		}
-
-		// Render the crossbow
-		RenderMesh(con, cb, crossbowMesh);
-
-		// Render the crosshair
-		RenderCrosshair(con, view, cb);
-
-
-		timePerFrame = timeCur;
-
-		con->Release();
-		view->Release();
-	}
-
-	void UserInput()
-	{
-		if ((GetKeyState(VK_LBUTTON) & 0x100) != 0)
+		if (inputRecording != nullptr)
 		{
-			std::cout << "Pew\n";
-
-			//XMMATRIX w_One = XMMatrixTranslationFromVector(XMLoadFloat4(&balloonPosOne)) * g_View;
-
-			//XMMATRIX w_Two = XMMatrixTranslationFromVector(XMLoadFloat4(&balloonPosTwo));
-			//w_One = XMMatrixMultiply(XMMatrixMultiply(w_Two, g_View),g_Projection);
-			//XMMATRIX w_Three = XMMatrixTranslationFromVector(XMLoadFloat4(&balloonPosThree)) * XMMatrixScaling(0.3f, 0.3f, 0.3f);
-
-			//float ndcX = ((width / 2.0f)) / (float)(width * 0.5f) - 1.0f;
-			//float ndcY = ((height / 2.0f) / (float) (height * 0.5f)) + 1.0f;
-
-			//std::cout << ndcX << " || " << ndcY << '\n';
-
-			//XMFLOAT4 f = (XMFLOAT4&)XMVector4Transform(XMLoadFloat4(&balloonPosOne), b_World[0]);
-
-			//std::cout << f.x << " || " << f.y << '\n';
-
-			//std::cout << XMVectorGetX(w_One.r[0]) << " || " << XMVectorGetX(w_One.r[3]) << "\n";
-
-			//float xNDCB1 = (balloonPosOne.x) / (float)(width * 0.5f) - 1.0f;
-			//float yNDCB1 = (balloonPosOne.y) / (float)(height * 0.5f) + 1.0f;
-			//float xNDCB2 = (XMVectorGetX(w_Two.r[3])) / (float)(width * 0.5f) - clientTopLeftX - 1;
-			//float xNDCB3 = (XMVectorGetX(w_Three.r[3])) / (float)(width * 0.5f) - clientTopLeftX - 1;
-
-			//float distanceX1 = sqrt(pow((xNDCB1 - ndcX), 2) + pow((yNDCB1 - ndcY), 2));
-			//float distanceX2 = -xNDCB2 - ndcX;
-			//float distanceX3 = distanceX1 + distanceX2;
-
-			//float distanceX1 = sqrt(pow((XMVectorGetX(w_One.r[3]) - XMVectorGetX(g_View.r[3])), 2) + pow((XMVectorGetY(w_One.r[3]) - XMVectorGetY(g_View.r[3])), 2));
-
-			//if (distanceX1 < 0.75f)
-			//{
-			//	std::cout << "POP 1\n";
-			//}
-
-			//if (distanceX2 < -33.65 && distanceX2 > -33.75)
-			//{
-			//	std::cout << "POP 2\n";
-			//}
-
-			//if (distanceX3 < -33.75 && distanceX3 > -33.90)
-			//{
-			//	std::cout << "POP 3\n";
-			//}
-
-			//std::cout << distanceX1 << " && " << "c" << "\n";
+			InputFrame frame;
+			frame.lookX = static_cast<int32_t>(appliedInput.lookX - before.lookX);
+			frame.lookY = static_cast<int32_t>(appliedInput.lookY - before.lookY);
+			frame.shots = appliedInput.shots - before.shots;
+			frame.moveX = appliedInput.moveX;
+			frame.moveZ = appliedInput.moveZ;
+			frame.walking = appliedInput.walking;
+			frame.seconds = frameSeconds;
+			inputRecording->Append(frame);
 		}
+		simStats.steps = timestep.Advance(frameSeconds);
+		for (uint32_t i = 0; i < simStats.steps; i++)
+			Simulate((float)timestep.GetStep());
+		simStats.ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - simStart).count();
+	}
 
-		// Look around movement
-		if ((GetKeyState(VK_RBUTTON) & 0x100) != 0)
-		{
-			POINT cursorPos;
-			GetCursorPos(&cursorPos);
-
-			unsigned int clientPosX, clientPosY;
-			win.GetX(clientPosX);
-			win.GetY(clientPosY);
-			unsigned int cosX = clientPosX + (width / 2);
-			unsigned int cosY = clientPosY + (height / 2);
+	// Builds the frame from the state Update() left and records its draws on the device, all on
+	// this thread. The caller brackets it with BeginFrame/EndFrame, then calls FramePresented().
+	void Render(UINT flag = 1)
+	{
+		if (crossbowMesh == nullptr || pipelineRunning.load(std::memory_order_relaxed))
+			return;
 
-			int diffX = (cosX - cursorPos.x);
-			int diffY = (cosY - cursorPos.y);
+		FrameSnapshot& snapshot = snapshots.Back();
+		PrepareFrame(snapshot);
+		snapshot.frame = published.load(std::memory_order_relaxed) + 1;
+		snapshot.simWaitMs = 0.0;
+		snapshot.published = std::chrono::steady_clock::now();
+		snapshots.Publish();
+		published.store(snapshot.frame, std::memory_order_relaxed);
+		pipelineStats.renderWaitMs = 0.0;
+		ExecuteFrame();
+	}
 
-			// Block input outside of 125 pixels away from center.
-			if (abs(diffX) < 125 && abs(diffY) < 125)
-			{
-				// Create the rotation matrix based on mouse input.
-				XMMATRIX rot = XMMatrixRotationRollPitchYaw(-diffY / 150.0f, -diffX / 150.0f, 0);
-
-				g_View = XMMatrixMultiply(rot, g_View);
-
-				XMVECTOR vExistingZ = g_View.r[2];
-				// Parallel to the world's horizon 
-				XMVECTOR vNewX = XMVector3Cross(g_World.r[1], vExistingZ);
-				XMVECTOR vNewY = XMVector3Cross(vExistingZ, vNewX);
-				vExistingZ = XMVector3Normalize(vExistingZ);
-				vNewY = XMVector3Normalize(vNewY);
-				vNewX = XMVector3Normalize(vNewX);
-
-				XMMATRIX newView = {
-					XMVectorGetX(vNewX), XMVectorGetY(vNewX), XMVectorGetZ(vNewX), XMVectorGetW(g_View.r[0]),
-					XMVectorGetX(vNewY), XMVectorGetY(vNewY), XMVectorGetZ(vNewY), XMVectorGetW(g_View.r[1]),
-					XMVectorGetX(vExistingZ), XMVectorGetY(vExistingZ), XMVectorGetZ(vExistingZ), XMVectorGetW(g_View.r[2]),
-					XMVectorGetX(g_View.r[3]), XMVectorGetY(g_View.r[3]), XMVectorGetZ(g_View.r[3]), XMVectorGetW(g_View.r[3])
-				};
-
-				g_View = newView;
-			}
+	// Moves the simulation to its own thread. Frames are 'frameSeconds' apart, or as far apart
+	// as they really are for 0, and it stops after 'frames' more snapshots. Update() and Render()
+	// are not to be called until StopPipeline().
+	void StartPipeline(double frameSeconds = 0.0, uint64_t frames = UINT64_MAX)
+	{
+		if (crossbowMesh == nullptr || pipelineRunning.load(std::memory_order_relaxed))
+			return;
+		fixedFrameSeconds = frameSeconds;
+		uint64_t first = published.load(std::memory_order_relaxed);
+		frameLimit = frames > UINT64_MAX - first ? UINT64_MAX : first + frames;
+		pipelineRunning.store(true, std::memory_order_relaxed);
+		simulation = std::thread([this]() { SimulationLoop(); });
+	}
 
-			//Set it back to the center
-			SetCursorPos(cosX, cosY);
-		}
+	void StopPipeline()
+	{
+		pipelineRunning.store(false, std::memory_order_relaxed);
+		if (simulation.joinable())
+			simulation.join();
+	}
 
-		// Since the view matrix is yet to be transposed until it is rendered, I can use it for moving the camera.
-		if (GetAsyncKeyState('W'))
-		{
-			XMMATRIX translate = {
-			1, 0, 0, 0,
-			0, 1, 0, 0,
-			0, 0, 1, 0,
-			0, 0, 0.05f, 1
-			};
-			g_View = XMMatrixMultiply(translate, g_View);
-		}
+	// Waits for the simulation's next snapshot and records its draws. Returns false once the
+	// pipeline has stopped or made all its frames.
+	bool RenderPipelined()
+	{
+		std::chrono::steady_clock::time_point waitStart = std::chrono::steady_clock::now();
+		uint64_t next = taken.load(std::memory_order_relaxed) + 1;
+		if (next > frameLimit)
+			return false;
+		WaitUntil([&]() { return published.load(std::memory_order_acquire) >= next || !pipelineRunning.load(std::memory_order_relaxed); });
+		if (published.load(std::memory_order_acquire) < next)
+			return false;
+		pipelineStats.renderWaitMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - waitStart).count();
+		ExecuteFrame();
+		return true;
+	}
 
-		if (GetAsyncKeyState('S'))
-		{
-			XMMATRIX translate = {
-			1, 0, 0, 0,
-			0, 1, 0, 0,
-			0, 0, 1, 0,
-			0, 0, -0.05f, 1
-			};
-			g_View = XMMatrixMultiply(translate, g_View);
-		}
+	// Completes the stats of the frame drawn last, once the caller has presented it.
+	void FramePresented()
+	{
+		std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+		const FrameSnapshot& snapshot = snapshots.Front();
+		pipelineStats.frame = snapshot.frame;
+		pipelineStats.simMs = snapshot.simMs;
+		pipelineStats.simWaitMs = snapshot.simWaitMs;
+		pipelineStats.renderMs = std::chrono::duration<double, std::milli>(now - takenTime).count();
+		pipelineStats.latencyMs = std::chrono::duration<double, std::milli>(now - snapshot.inputTime).count();
+	}
+	const PipelineStats& GetPipelineStats() const { return pipelineStats; }
+
+	// Simulation and culling of the frame drawn last.
+	const TimestepStats& GetSimStats() const { return snapshots.Front().sim; }
+	const FrustumStats& GetFrustumStats() const { return snapshots.Front().frustum; }
+	const OcclusionStats& GetOcclusionStats() const { return snapshots.Front().occlusion; }
+	// Arena use and heap allocations building the frame drawn last.
+	const ArenaStats& GetArenaStats() const { return snapshots.Front().arena.GetStats(); }
+	uint64_t GetFrameHeapAllocations() const { return snapshots.Front().heapAllocations; }
+
+	// Simulation state, to compare runs. Not while the pipeline runs.
+	const FixedTimestep& GetTimestep() const { return timestep; }
+	size_t GetBalloonCount() const { return balloons.Count(); }
+	XMFLOAT4 GetBalloonPosition(size_t index) const { return balloons.GetPosition(index); }
+	XMFLOAT4 GetCameraPosition() const
+	{
+		XMFLOAT4 eye;
+		XMStoreFloat4(&eye, g_View.r[3]);
+		return eye;
+	}
 
-		if (GetAsyncKeyState('A'))
-		{
-			XMMATRIX translate = {
-			1, 0, 0, 0,
-			0, 1, 0, 0,
-			0, 0, 1, 0,
-			-0.05f, 0, 0, 1
-			};
-			g_View = XMMatrixMultiply(translate, g_View);
-		}
+	// Every simulated frame's input and frame time is appended to 'recording'. With a 'replay'
+	// the simulation takes its input and frame times from it instead, frame by frame, and has no
+	// input once it runs out. nullptr stops either. Not while the pipeline runs.
+	void SetInputRecording(InputLog* recording) { inputRecording = recording; }
+	void SetInputReplay(InputLog* replay)
+	{
+		inputReplay = replay;
+		replayState = appliedInput;
+		replayState.moveX = replayState.moveZ = 0.0f;
+	}
 
-		if (GetAsyncKeyState('D'))
+	// Hands the simulation what the mouse and keyboard did since the last call. The window's
+	// input is made on the first call; headless runs only have replayed input.
+	void UserInput()
+	{
+		PROFILE_SCOPE("UserInput");
+		if (!inputCreated)
 		{
-			XMMATRIX translate = {
-			1, 0, 0, 0,
-			0, 1, 0, 0,
-			0, 0, 1, 0,
-			0.05f, 0, 0, 1
-			};
-			g_View = XMMatrixMultiply(translate, g_View);
+			inputCreated = true;
+			if (!inputCollector.Create(win))
+				std::cout << "No mouse and keyboard input on this platform\n";
 		}
+		if (!inputCollector.IsCreated())
+			return;
 
-		XMMATRIX newView = {
-			XMVectorGetX(g_View.r[0]), XMVectorGetY(g_View.r[0]), XMVectorGetZ(g_View.r[0]), XMVectorGetW(g_View.r[0]),
-			XMVectorGetX(g_View.r[1]), XMVectorGetY(g_View.r[1]), XMVectorGetZ(g_View.r[1]), XMVectorGetW(g_View.r[1]),
-			XMVectorGetX(g_View.r[2]), XMVectorGetY(g_View.r[2]), XMVectorGetZ(g_View.r[2]), XMVectorGetW(g_View.r[2]),
-			XMVectorGetX(g_View.r[3]), 1.0f, XMVectorGetZ(g_View.r[3]), XMVectorGetW(g_View.r[3])
-		};
-
-		g_View = newView;
+		FrameInputs frame = inputCollector.Collect();
+		inputSample.lookX += frame.lookX;
+		inputSample.lookY += frame.lookY;
+		inputSample.shots += frame.shots;
+		// Movement is applied by the simulation steps at a fixed rate.
+		inputSample.moveX = frame.moveX;
+		inputSample.moveZ = frame.moveZ;
+		inputSample.walking = true;
+		inputSample.time = std::chrono::steady_clock::now();
+		inputs.Back() = inputSample;
+		inputs.Publish();
 	}
-};
\ No newline at end of file
+};
@@ -0,0 +1,173 @@
+#pragma once
+#include "FrameArena.h"
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+// 64-bit draw sort key. Fields from most to least significant:
+//	[63..60] layer		- world, sky, overlay
+//	[59..56] pass		- opaque before alpha tested
+//	[55..48] shader		- program id, groups draws that share shaders
+//	[47..32] material	- groups draws that share textures/constants
+//	[31..8]  depth		- 24-bit quantized view depth, front to back
+//	[7..0]   sequence	- submission order tie breaker
+namespace DrawKey
+{
+	enum Layer : uint64_t
+	{
+		LAYER_WORLD = 0,
+		LAYER_SKY = 1,
+		LAYER_OVERLAY = 2,
+	};
+
+	enum Pass : uint64_t
+	{
+		PASS_OPAQUE = 0,
+		PASS_ALPHA_TESTED = 1,
+	};
+
+	static const uint32_t MaxDepth = 0xFFFFFF;
+
+	inline uint64_t Make(uint64_t layer, uint64_t pass, uint64_t shader, uint64_t material, uint32_t depth, uint32_t sequence = 0)
+	{
+		return ((layer & 0xF) << 60) |
+			((pass & 0xF) << 56) |
+			((shader & 0xFF) << 48) |
+			((material & 0xFFFF) << 32) |
+			(static_cast<uint64_t>(depth & MaxDepth) << 8) |
+			(sequence & 0xFF);
+	}
+
+	// Maps a view-space depth in [nearZ, farZ] to 24 bits, nearest first.
+	inline uint32_t QuantizeDepth(float viewDepth, float nearZ, float farZ)
+	{
+		float t = (viewDepth - nearZ) / (farZ - nearZ);
+		if (!(t > 0.0f))
+			return 0;
+		if (t >= 1.0f)
+			return MaxDepth;
+		return static_cast<uint32_t>(t * MaxDepth);
+	}
+
+	inline uint32_t GetLayer(uint64_t key) { return static_cast<uint32_t>(key >> 60); }
+	inline uint32_t GetDepth(uint64_t key) { return static_cast<uint32_t>(key >> 8) & MaxDepth; }
+}
+
+// A sort key plus enough payload to issue the draw.
+struct DrawPacket
+{
+	uint64_t key;
+	uint32_t object;	// What to draw, interpreted by the submitter.
+	uint32_t data;		// Free for the submitter (instance count, sub-mesh, ...).
+};
+
+// Collects draw packets for a frame and sorts them by key with an LSD radix sort.
+class DrawQueue
+{
+public:
+	// Packets go to 'arena' from now on, or the heap for nullptr. Whatever was queued is dropped;
+	// call it again after resetting the arena.
+	void SetArena(LinearArena* arena)
+	{
+		packets = ArenaVector<DrawPacket>(ArenaAllocator<DrawPacket>(arena));
+		scratch = ArenaVector<DrawPacket>(ArenaAllocator<DrawPacket>(arena));
+		histograms = ArenaVector<uint32_t>(ArenaAllocator<uint32_t>(arena));
+	}
+
+	void Reserve(size_t count)
+	{
+		packets.reserve(count);
+		scratch.reserve(count);
+	}
+
+	void Clear() { packets.clear(); }
+
+	void Submit(uint64_t key, uint32_t object, uint32_t data = 0)
+	{
+		DrawPacket packet;
+		packet.key = key;
+		packet.object = object;
+		packet.data = data;
+		packets.push_back(packet);
+	}
+
+	// Stable sort on the full 64-bit key. Wider digits mean fewer passes but bigger histograms to
+	// clear and sum, so the digit width grows with the packet count.
+	void Sort()
+	{
+		size_t count = packets.size();
+		if (count < 2)
+			return;
+		if (count < MediumSortCount)
+			RadixSort<8>();
+		else if (count < LargeSortCount)
+			RadixSort<11>();
+		else
+			RadixSort<16>();
+	}
+
+	const DrawPacket* begin() const { return packets.data(); }
+	const DrawPacket* end() const { return packets.data() + packets.size(); }
+	size_t Size() const { return packets.size(); }
+	const DrawPacket& operator[](size_t index) const { return packets[index]; }
+
+private:
+	// Packet counts where 11 and then 16 bit digits start to beat 8 bit ones.
+	static const size_t MediumSortCount = 4096;
+	static const size_t LargeSortCount = 262144;
+
+	ArenaVector<DrawPacket> packets;
+	ArenaVector<DrawPacket> scratch;
+	ArenaVector<uint32_t> histograms;	// The 16 bit digits' are 1 MB.
+
+	// LSD radix sort with Bits wide digits. All the histograms are built in a single read and
+	// passes where every key shares the same digit are skipped.
+	template<int Bits>
+	void RadixSort()
+	{
+		const int passes = (64 + Bits - 1) / Bits;
+		const uint32_t buckets = 1u << Bits;
+		const uint64_t mask = buckets - 1;
+		size_t count = packets.size();
+
+		histograms.assign(static_cast<size_t>(passes) * buckets, 0);
+		for (size_t i = 0; i < count; i++)
+		{
+			uint64_t key = packets[i].key;
+			for (int pass = 0; pass < passes; pass++)
+				histograms[pass * buckets + ((key >> (pass * Bits)) & mask)]++;
+		}
+
+		scratch.resize(count);
+		DrawPacket* src = packets.data();
+		DrawPacket* dst = scratch.data();
+		for (int pass = 0; pass < passes; pass++)
+		{
+			uint32_t* offsets = &histograms[pass * buckets];
+			int shift = pass * Bits;
+
+			// Every key lands in one bucket, this digit doesn't change the order.
+			if (offsets[(src[0].key >> shift) & mask] == count)
+				continue;
+
+			uint32_t sum = 0;
+			for (uint32_t b = 0; b < buckets; b++)
+			{
+				uint32_t size = offsets[b];
+				offsets[b] = sum;
+				sum += size;
+			}
+
+			for (size_t i = 0; i < count; i++)
+				dst[offsets[(src[i].key >> shift) & mask]++] = src[i];
+
+			DrawPacket* swap = src;
+			src = dst;
+			dst = swap;
+		}
+
+		// An odd number of passes leaves the result in the scratch buffer.
+		if (src != packets.data())
+			packets.swap(scratch);
+	}
+};
@@ -0,0 +1,77 @@
+#pragma once
+#include <cmath>
+#include <cstdint>
+
+// Simulation work done by the last Mesh::Update().
+struct TimestepStats
+{
+	uint32_t steps = 0;
+	double ms = 0.0;
+};
+
+// Fixed rate simulation clock. Each frame adds its real duration, whole steps are simulated until
+// less than one is left, and rendering blends the last two steps by what is left over. Motion then
+// depends on the number of steps run and not on how they were spread over frames, so it is the same
+// at 30, 60 or 240 Hz.
+class FixedTimestep
+{
+public:
+	// A frame can run at most 'maxSteps' steps. When simulating falls behind, the time past that is
+	// dropped rather than making the next frame slower still.
+	explicit FixedTimestep(double _step = 1.0 / 60.0, uint32_t _maxSteps = 8)
+	{
+		SetStep(_step);
+		maxSteps = _maxSteps > 0 ? _maxSteps : 1;
+	}
+
+	void SetStep(double _step) { step = _step > 0.0 ? _step : 1.0 / 60.0; }
+	double GetStep() const { return step; }
+
+	// Adds a frame's duration and returns how many steps to simulate for it.
+	uint32_t Advance(double frameSeconds)
+	{
+		accumulator += frameSeconds > 0.0 ? frameSeconds : 0.0;
+		uint32_t steps = 0;
+		// Frames that add up to a step, like four at 240 Hz, can come out a rounding error short.
+		while (accumulator + Slack >= step && steps < maxSteps)
+		{
+			accumulator -= step;
+			steps++;
+		}
+		if (accumulator >= step)
+		{
+			double behind = floor(accumulator / step) * step;
+			droppedSeconds += behind;
+			accumulator -= behind;
+		}
+		accumulator = accumulator < 0.0 ? 0.0 : accumulator;
+		stepCount += steps;
+		return steps;
+	}
+
+	// Where the drawn state sits between the previous step (0) and the last one (1).
+	float GetAlpha() const
+	{
+		double alpha = accumulator / step;
+		return alpha < 1.0 ? static_cast<float>(alpha) : 1.0f;
+	}
+
+	uint64_t GetStepCount() const { return stepCount; }
+	double GetDroppedSeconds() const { return droppedSeconds; }
+
+	void Reset()
+	{
+		accumulator = 0.0;
+		droppedSeconds = 0.0;
+		stepCount = 0;
+	}
+
+private:
+	static constexpr double Slack = 1e-9;
+
+	double step = 1.0 / 60.0;
+	uint32_t maxSteps = 8;
+	double accumulator = 0.0;
+	double droppedSeconds = 0.0;
+	uint64_t stepCount = 0;
+};
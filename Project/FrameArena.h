@@ -0,0 +1,208 @@
+#pragma once
+#include "defines.h"
+#include "MemoryTracker.h"
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <sstream>
+#include <type_traits>
+#include <vector>
+
+// What a linear arena handed out since its last Reset(), and the most it ever held.
+struct ArenaStats
+{
+	uint32_t allocations = 0;
+	size_t bytes = 0;			// Alignment padding included.
+	size_t highWater = 0;		// Most bytes between two resets.
+	uint32_t overflows = 0;		// Times the block was full and another one was taken from the heap.
+};
+
+// Bump allocator for data that only lives until the next Reset(), like everything built for one
+// frame. Allocating moves a pointer and freeing does nothing; Reset() drops it all at once. When
+// the block fills, another twice as big is taken from the heap, and the next Reset() trades them
+// all for one block that holds everything, so a frame only goes to the heap until the arena has
+// seen its largest one. Its blocks are tracked under 'tag'.
+class LinearArena
+{
+public:
+	explicit LinearArena(size_t _capacity = 0, MemoryTag _tag = MemoryTag::Transient) : tag(_tag)
+	{
+		if (_capacity > 0)
+			AddBlock(_capacity);
+	}
+
+	LinearArena(const LinearArena&) = delete;
+	LinearArena& operator=(const LinearArena&) = delete;
+
+	// 'alignment' is a power of two. The memory is valid until Reset().
+	void* Allocate(size_t bytes, size_t alignment = alignof(std::max_align_t))
+	{
+		uintptr_t start = AlignUp(top, alignment);
+		if (blocks.empty() || start + bytes > end)
+		{
+			size_t capacity = blocks.empty() ? 0 : blocks.back().size;
+			size_t needed = bytes + alignment;
+			AddBlock(capacity * 2 > needed ? capacity * 2 : needed);
+			stats.overflows += blocks.size() > 1 ? 1 : 0;
+			start = AlignUp(top, alignment);
+		}
+		stats.bytes += start + bytes - top;
+		stats.allocations++;
+		stats.highWater = stats.bytes > stats.highWater ? stats.bytes : stats.highWater;
+		top = start + bytes;
+		return reinterpret_cast<void*>(start);
+	}
+
+	template<typename T>
+	T* Allocate(size_t count = 1) { return static_cast<T*>(Allocate(sizeof(T) * count, alignof(T))); }
+
+	// Forgets every allocation. After an overflow the blocks are merged into one.
+	void Reset()
+	{
+		if (blocks.size() > 1)
+		{
+			size_t total = 0;
+			for (const Block& block : blocks)
+				total += block.size;
+			blocks.clear();
+			AddBlock(total);
+		}
+		top = blocks.empty() ? 0 : reinterpret_cast<uintptr_t>(blocks.back().data.get());
+		stats.allocations = 0;
+		stats.bytes = 0;
+		stats.overflows = 0;
+	}
+
+	size_t GetCapacity() const { return blocks.empty() ? 0 : blocks.back().size; }
+	const ArenaStats& GetStats() const { return stats; }
+
+private:
+	struct Block
+	{
+		std::unique_ptr<uint8_t[]> data;
+		size_t size;
+	};
+
+	static uintptr_t AlignUp(uintptr_t address, size_t alignment)
+	{
+		return (address + alignment - 1) & ~static_cast<uintptr_t>(alignment - 1);
+	}
+
+	void AddBlock(size_t size)
+	{
+		MemoryTagScope tagScope(tag);
+		blocks.push_back({ std::unique_ptr<uint8_t[]>(new uint8_t[size]), size });
+		top = reinterpret_cast<uintptr_t>(blocks.back().data.get());
+		end = top + size;
+	}
+
+	std::vector<Block> blocks;		// The last one is being filled.
+	uintptr_t top = 0, end = 0;
+	ArenaStats stats;
+	MemoryTag tag;
+};
+
+// STL allocator that takes from a LinearArena, or from the heap without one. Containers on an
+// arena must be rebuilt after it is Reset(): assigning a fresh one on the same or another arena
+// adopts it, since the allocator travels with the contents.
+template<typename T>
+class ArenaAllocator
+{
+public:
+	typedef T value_type;
+	typedef std::true_type propagate_on_container_copy_assignment;
+	typedef std::true_type propagate_on_container_move_assignment;
+	typedef std::true_type propagate_on_container_swap;
+
+	ArenaAllocator(LinearArena* _arena = nullptr) : arena(_arena) {}
+	template<typename U>
+	ArenaAllocator(const ArenaAllocator<U>& other) : arena(other.GetArena()) {}
+
+	T* allocate(size_t count)
+	{
+		if (arena == nullptr)
+			return static_cast<T*>(::operator new(sizeof(T) * count));
+		return arena->Allocate<T>(count);
+	}
+
+	void deallocate(T* pointer, size_t)
+	{
+		if (arena == nullptr)
+			::operator delete(pointer);
+	}
+
+	LinearArena* GetArena() const { return arena; }
+
+	template<typename U>
+	bool operator==(const ArenaAllocator<U>& other) const { return arena == other.GetArena(); }
+	template<typename U>
+	bool operator!=(const ArenaAllocator<U>& other) const { return arena != other.GetArena(); }
+
+private:
+	LinearArena* arena;
+};
+
+template<typename T>
+using ArenaVector = std::vector<T, ArenaAllocator<T>>;
+typedef std::basic_string<char, std::char_traits<char>, ArenaAllocator<char>> ArenaString;
+typedef std::basic_istringstream<char, std::char_traits<char>, ArenaAllocator<char>> ArenaStringStream;
+
+// Debug check that the steady-state frame path stays off the general heap. main.cpp routes
+// operator new through OnAllocate(), which counts every allocation a thread makes and breaks into
+// the debugger while the thread is inside a NoHeapScope.
+#ifndef FRAME_HEAP_CHECK
+#ifdef NDEBUG
+#define FRAME_HEAP_CHECK 0
+#else
+#define FRAME_HEAP_CHECK 1
+#endif
+#endif
+
+namespace FrameHeap
+{
+	struct ThreadCounts
+	{
+		uint64_t allocations = 0;
+		uint32_t forbidden = 0;		// NoHeapScopes open on this thread.
+	};
+
+	inline ThreadCounts& Thread()
+	{
+		static thread_local ThreadCounts counts;
+		return counts;
+	}
+
+	inline void OnAllocate()
+	{
+		ThreadCounts& counts = Thread();
+		counts.allocations++;
+#if FRAME_HEAP_CHECK
+		if (counts.forbidden > 0)
+			DebugBreak();
+#endif
+	}
+
+	// Heap allocations made on this thread so far.
+	inline uint64_t GetAllocations() { return Thread().allocations; }
+
+	// Heap allocations on this thread are a bug while one is open and 'enabled'.
+	class NoHeapScope
+	{
+	public:
+		explicit NoHeapScope(bool _enabled = true) : enabled(_enabled)
+		{
+			Thread().forbidden += enabled ? 1 : 0;
+		}
+		~NoHeapScope()
+		{
+			Thread().forbidden -= enabled ? 1 : 0;
+		}
+
+		NoHeapScope(const NoHeapScope&) = delete;
+		NoHeapScope& operator=(const NoHeapScope&) = delete;
+
+	private:
+		bool enabled;
+	};
+}
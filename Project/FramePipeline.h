@@ -0,0 +1,72 @@
+#pragma once
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <thread>
+
+// Where the time of one presented frame went. The simulation side is measured on its own thread
+// and travels with the snapshot it built.
+struct PipelineStats
+{
+	uint64_t frame = 0;
+	double simMs = 0.0;			// Input, fixed steps, culling and the draw list of the snapshot.
+	double simWaitMs = 0.0;		// Simulation waiting for the renderer to take the snapshot before.
+	double queueMs = 0.0;		// Snapshot published until the renderer took it.
+	double renderWaitMs = 0.0;	// Renderer waiting for the snapshot.
+	double renderMs = 0.0;		// Snapshot taken until presented.
+	double latencyMs = 0.0;		// Input read, or the simulation starting without any, until presented.
+};
+
+// Waits until 'ready()' for a hand-off that is at most about a frame away: yields at first, then
+// naps, so a thread waiting out the other's vsync doesn't hold a core.
+template<typename Ready>
+inline void WaitUntil(Ready ready)
+{
+	for (uint32_t tries = 0; !ready(); tries++)
+	{
+		if (tries < 64)
+			std::this_thread::yield();
+		else
+			std::this_thread::sleep_for(std::chrono::microseconds(200));
+	}
+}
+
+// Lock-free hand-off of the latest value from one writer thread to one reader thread. The writer
+// fills its own slot and swaps it for the shared middle one; the reader swaps its slot for the
+// middle one when something was published since it last looked. Neither ever waits on the other
+// and the reader always gets the newest complete value; older ones it missed are reused.
+template<typename T>
+class TripleBuffer
+{
+public:
+	// The writer's slot. Whatever it held last time it was published is still there.
+	T& Back() { return slots[back]; }
+
+	// Makes the back slot the newest value and takes the middle one as the next back.
+	void Publish()
+	{
+		back = middle.exchange(back | Fresh, std::memory_order_acq_rel) & IndexMask;
+	}
+
+	// Takes the newest published value, if there is one the reader hasn't had. Returns whether
+	// Front() changed.
+	bool Acquire()
+	{
+		if ((middle.load(std::memory_order_relaxed) & Fresh) == 0)
+			return false;
+		front = middle.exchange(front, std::memory_order_acq_rel) & IndexMask;
+		return true;
+	}
+
+	// The reader's slot, stable until its next Acquire().
+	const T& Front() const { return slots[front]; }
+
+private:
+	static const uint32_t IndexMask = 3, Fresh = 4;
+
+	T slots[3];
+	// Each side's index on its own cache line.
+	alignas(64) uint32_t back = 0;
+	alignas(64) uint32_t front = 1;
+	alignas(64) std::atomic<uint32_t> middle{ 2 };
+};
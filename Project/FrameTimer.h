@@ -0,0 +1,224 @@
+#pragma once
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <vector>
+
+// Frame time distribution: the mean hides the long frames people notice, so the percentiles and
+// the worst frame come with it.
+struct FrameTimeStats
+{
+	uint32_t frames = 0;
+	double meanMs = 0.0;
+	double p50Ms = 0.0;
+	double p95Ms = 0.0;
+	double p99Ms = 0.0;
+	double maxMs = 0.0;
+	uint32_t stutters = 0;
+};
+
+// Shows the rolling statistics somewhere, like a HUD or the title bar. Called whenever they are
+// brought up to date, with the time of the frame that did it.
+typedef void (*FrameTimeOverlay)(double frameMs, const FrameTimeStats& rolling, void* user);
+
+// Times frames on steady_clock, which is monotonic where high_resolution_clock need not be.
+// Statistics roll over the last 'window' frames; a frame is a stutter when it takes 'stutterFactor'
+// times the rolling median or more. With recording on every frame is also kept for the whole run,
+// for its statistics and for dumping them to CSV or JSON.
+class FrameTimer
+{
+public:
+	explicit FrameTimer(uint32_t _window = 600, double _stutterFactor = 2.0)
+	{
+		window.resize(_window > 0 ? _window : 1);
+		sorted.reserve(window.size());
+		stutterFactor = _stutterFactor > 1.0 ? _stutterFactor : 2.0;
+	}
+
+	// Keeps every frame from now on; 'expectedFrames' reserves room for them up front.
+	void SetRecording(bool record, size_t expectedFrames = 0)
+	{
+		recording = record;
+		history.reserve(expectedFrames);
+	}
+
+	void SetOverlay(FrameTimeOverlay _overlay, void* _user)
+	{
+		overlay = _overlay;
+		overlayUser = _user;
+	}
+
+	// Ends a frame where the previous Tick() did. The first only starts the clock.
+	void Tick()
+	{
+		std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+		if (ticked)
+			AddFrame(std::chrono::duration<double, std::milli>(now - lastTick).count());
+		lastTick = now;
+		ticked = true;
+	}
+
+	// Adds a frame measured elsewhere.
+	void AddFrame(double ms)
+	{
+		// Judged against the frames before it, so one long frame can't hide itself.
+		bool stutter = medianFrames >= MinMedianFrames && ms >= median * stutterFactor;
+		stutters += stutter ? 1 : 0;
+
+		window[head] = ms;
+		head = head + 1 < window.size() ? head + 1 : 0;
+		count = count < window.size() ? count + 1 : count;
+		if (recording)
+			history.push_back({ static_cast<float>(ms), stutter });
+
+		// The median moves slowly, so the statistics it comes from are only brought up to date now
+		// and then, and the overlay with them.
+		lastMs = ms;
+		if (++sinceRefresh >= RefreshInterval || medianFrames < MinMedianFrames)
+		{
+			Refresh();
+			if (overlay != nullptr)
+				overlay(ms, rolling, overlayUser);
+		}
+	}
+
+	double GetLastMs() const { return lastMs; }
+
+	// Over the last 'window' frames.
+	const FrameTimeStats& GetRollingStats()
+	{
+		if (sinceRefresh > 0)
+			Refresh();
+		return rolling;
+	}
+
+	// Over every recorded frame.
+	FrameTimeStats GetRunStats() const
+	{
+		std::vector<double> times;
+		times.reserve(history.size());
+		uint32_t runStutters = 0;
+		for (const Frame& frame : history)
+		{
+			times.push_back(frame.ms);
+			runStutters += frame.stutter ? 1 : 0;
+		}
+		FrameTimeStats stats;
+		SummarizeSorted(times, stats);
+		stats.stutters = runStutters;
+		return stats;
+	}
+
+	// One line per recorded frame: its index, time and whether it stuttered.
+	bool WriteCsv(const char* path) const
+	{
+		std::ofstream out(path);
+		if (!out.is_open())
+			return false;
+		out << "frame,ms,stutter\n";
+		for (size_t i = 0; i < history.size(); i++)
+			out << i << "," << history[i].ms << "," << (history[i].stutter ? 1 : 0) << "\n";
+		return out.good();
+	}
+
+	// The run's statistics, then every recorded frame's time and the indices of the stutters.
+	bool WriteJson(const char* path) const
+	{
+		std::ofstream out(path);
+		if (!out.is_open())
+			return false;
+		FrameTimeStats stats = GetRunStats();
+		out << "{\n\t\"frames\": " << stats.frames << ",\n\t\"meanMs\": " << stats.meanMs << ",\n\t\"p50Ms\": " << stats.p50Ms
+			<< ",\n\t\"p95Ms\": " << stats.p95Ms << ",\n\t\"p99Ms\": " << stats.p99Ms << ",\n\t\"maxMs\": " << stats.maxMs
+			<< ",\n\t\"stutters\": " << stats.stutters << ",\n\t\"stutterFactor\": " << stutterFactor << ",\n\t\"frameMs\": [";
+		for (size_t i = 0; i < history.size(); i++)
+			out << (i > 0 ? ", " : "") << history[i].ms;
+		out << "],\n\t\"stutterFrames\": [";
+		bool first = true;
+		for (size_t i = 0; i < history.size(); i++)
+		{
+			if (!history[i].stutter)
+				continue;
+			out << (first ? "" : ", ") << i;
+			first = false;
+		}
+		out << "]\n}\n";
+		return out.good();
+	}
+
+	// CSV, or JSON for a path ending in .json.
+	bool Write(const char* path) const
+	{
+		size_t length = strlen(path);
+		bool json = length >= 5 && strcmp(path + length - 5, ".json") == 0;
+		return json ? WriteJson(path) : WriteCsv(path);
+	}
+
+private:
+	// Frames the median needs before it is trusted, and how many frames the statistics stay unchanged.
+	static const uint32_t MinMedianFrames = 10;
+	static const uint32_t RefreshInterval = 30;
+
+	struct Frame
+	{
+		float ms;
+		bool stutter;
+	};
+
+	void Refresh()
+	{
+		sorted.assign(window.begin(), window.begin() + count);
+		SummarizeSorted(sorted, rolling);
+		rolling.stutters = stutters;
+		median = rolling.p50Ms;
+		medianFrames = count;
+		sinceRefresh = 0;
+	}
+
+	// Nearest rank of 'fraction' in sorted 'times'.
+	static double Percentile(const std::vector<double>& times, double fraction)
+	{
+		if (times.empty())
+			return 0.0;
+		size_t rank = static_cast<size_t>(fraction * times.size() + 0.999999);
+		rank = rank < 1 ? 1 : (rank > times.size() ? times.size() : rank);
+		return times[rank - 1];
+	}
+
+	// Sorts 'times' in place.
+	static void SummarizeSorted(std::vector<double>& times, FrameTimeStats& stats)
+	{
+		std::sort(times.begin(), times.end());
+		double sum = 0.0;
+		for (double ms : times)
+			sum += ms;
+		stats.frames = static_cast<uint32_t>(times.size());
+		stats.meanMs = times.empty() ? 0.0 : sum / times.size();
+		stats.p50Ms = Percentile(times, 0.50);
+		stats.p95Ms = Percentile(times, 0.95);
+		stats.p99Ms = Percentile(times, 0.99);
+		stats.maxMs = times.empty() ? 0.0 : times.back();
+	}
+
+	std::vector<double> window;		// Ring of the last frames.
+	std::vector<double> sorted;
+	size_t head = 0, count = 0;
+	double stutterFactor = 2.0;
+	double median = 0.0;
+	size_t medianFrames = 0;
+	uint32_t sinceRefresh = 0;
+	uint32_t stutters = 0;
+	double lastMs = 0.0;
+	FrameTimeStats rolling;
+
+	bool recording = false;
+	std::vector<Frame> history;
+
+	bool ticked = false;
+	std::chrono::steady_clock::time_point lastTick;
+
+	FrameTimeOverlay overlay = nullptr;
+	void* overlayUser = nullptr;
+};
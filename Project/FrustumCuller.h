@@ -0,0 +1,255 @@
+#pragma once
+#include "defines.h"
+#include "RasterSimd.h"
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <vector>
+
+// The six planes of a view frustum, normals pointing inside, (a, b, c, d) with ax + by + cz + d >= 0 inside.
+struct Frustum
+{
+	XMFLOAT4 planes[6];
+
+	Frustum() {}
+	// Planes of a row vector view * projection matrix with D3D's 0..1 depth.
+	explicit Frustum(FXMMATRIX viewProjection)
+	{
+		XMFLOAT4X4 m;
+		XMStoreFloat4x4(&m, viewProjection);
+		// Clip space x = dot(v, column 0) and so on; a plane is a sum of columns.
+		planes[0] = XMFLOAT4(m._14 + m._11, m._24 + m._21, m._34 + m._31, m._44 + m._41);	// Left
+		planes[1] = XMFLOAT4(m._14 - m._11, m._24 - m._21, m._34 - m._31, m._44 - m._41);	// Right
+		planes[2] = XMFLOAT4(m._14 + m._12, m._24 + m._22, m._34 + m._32, m._44 + m._42);	// Bottom
+		planes[3] = XMFLOAT4(m._14 - m._12, m._24 - m._22, m._34 - m._32, m._44 - m._42);	// Top
+		planes[4] = XMFLOAT4(m._13, m._23, m._33, m._43);									// Near
+		planes[5] = XMFLOAT4(m._14 - m._13, m._24 - m._23, m._34 - m._33, m._44 - m._43);	// Far
+		for (XMFLOAT4& plane : planes)
+		{
+			float length = sqrtf(plane.x * plane.x + plane.y * plane.y + plane.z * plane.z);
+			float invLength = length > 0.0f ? 1.0f / length : 0.0f;
+			plane = XMFLOAT4(plane.x * invLength, plane.y * invLength, plane.z * invLength, plane.w * invLength);
+		}
+	}
+};
+
+// Work done by the last Cull().
+struct FrustumStats
+{
+	uint32_t tested = 0;
+	uint32_t culled = 0;
+	double ms = 0.0;
+
+	void Reset() { *this = FrustumStats(); }
+};
+
+// Axis aligned boxes stored as center and extent arrays, so the SSE2 and AVX2 kernels test 4 or 8
+// boxes against a plane with a few multiplies. Cull() writes the indices of the boxes that are
+// inside or crossing the frustum, in index order.
+class FrustumCuller
+{
+public:
+	FrustumCuller()
+	{
+		kernel = RasterBestKernel();
+	}
+
+	void Clear()
+	{
+		centerX.clear(); centerY.clear(); centerZ.clear();
+		extentX.clear(); extentY.clear(); extentZ.clear();
+	}
+
+	void Reserve(size_t count)
+	{
+		centerX.reserve(count); centerY.reserve(count); centerZ.reserve(count);
+		extentX.reserve(count); extentY.reserve(count); extentZ.reserve(count);
+	}
+
+	// Grows or shrinks to 'count' boxes; new boxes are empty at the origin.
+	void Resize(size_t count)
+	{
+		centerX.resize(count); centerY.resize(count); centerZ.resize(count);
+		extentX.resize(count); extentY.resize(count); extentZ.resize(count);
+	}
+
+	uint32_t Add(const XMFLOAT3& boundsMin, const XMFLOAT3& boundsMax)
+	{
+		Resize(centerX.size() + 1);
+		uint32_t index = static_cast<uint32_t>(centerX.size() - 1);
+		Set(index, boundsMin, boundsMax);
+		return index;
+	}
+
+	void Set(uint32_t index, const XMFLOAT3& boundsMin, const XMFLOAT3& boundsMax)
+	{
+		centerX[index] = (boundsMin.x + boundsMax.x) * 0.5f;
+		centerY[index] = (boundsMin.y + boundsMax.y) * 0.5f;
+		centerZ[index] = (boundsMin.z + boundsMax.z) * 0.5f;
+		extentX[index] = (boundsMax.x - boundsMin.x) * 0.5f;
+		extentY[index] = (boundsMax.y - boundsMin.y) * 0.5f;
+		extentZ[index] = (boundsMax.z - boundsMin.z) * 0.5f;
+	}
+
+	size_t Count() const { return centerX.size(); }
+
+	void GetBounds(uint32_t index, XMFLOAT3& boundsMin, XMFLOAT3& boundsMax) const
+	{
+		boundsMin = XMFLOAT3(centerX[index] - extentX[index], centerY[index] - extentY[index], centerZ[index] - extentZ[index]);
+		boundsMax = XMFLOAT3(centerX[index] + extentX[index], centerY[index] + extentY[index], centerZ[index] + extentZ[index]);
+	}
+
+	// The best supported kernel is picked at construction; returns false if 'kernel' can't run here.
+	bool SetKernel(RasterKernel _kernel)
+	{
+		if (!RasterKernelSupported(_kernel))
+			return false;
+		kernel = _kernel;
+		return true;
+	}
+	RasterKernel GetKernel() const { return kernel; }
+
+	// Replaces 'visible' with the indices of the boxes not entirely outside one of the planes.
+	// Boxes that straddle the corner of two planes are kept, like any plane/box test. 'visible' is
+	// a vector of uint32_t with any allocator.
+	template<typename Indices>
+	void Cull(const Frustum& frustum, Indices& visible)
+	{
+		std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+		uint32_t count = static_cast<uint32_t>(centerX.size());
+		// Indices are written ahead of the output count but never past the box being tested.
+		visible.resize(count);
+		uint32_t* out = visible.data();
+		uint32_t first = 0;
+#if RASTER_SIMD
+		if (kernel == RasterKernel::Avx2)
+			first = CullAvx2(frustum, out);
+		else if (kernel == RasterKernel::Sse2)
+			first = CullSse2(frustum, out);
+#endif
+		CullScalar(frustum, first, count, out);
+		visible.resize(out - visible.data());
+
+		stats.tested = count;
+		stats.culled = count - static_cast<uint32_t>(visible.size());
+		stats.ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+	}
+
+	const FrustumStats& GetStats() const { return stats; }
+
+	// World space bounds of an object space box under 'world' (Arvo's method).
+	static void TransformBounds(const XMFLOAT3& boundsMin, const XMFLOAT3& boundsMax, FXMMATRIX world, XMFLOAT3& outMin, XMFLOAT3& outMax)
+	{
+		XMFLOAT4X4 m;
+		XMStoreFloat4x4(&m, world);
+		float c[3] = { (boundsMin.x + boundsMax.x) * 0.5f, (boundsMin.y + boundsMax.y) * 0.5f, (boundsMin.z + boundsMax.z) * 0.5f };
+		float e[3] = { (boundsMax.x - boundsMin.x) * 0.5f, (boundsMax.y - boundsMin.y) * 0.5f, (boundsMax.z - boundsMin.z) * 0.5f };
+		float rows[3][3] = { { m._11, m._12, m._13 }, { m._21, m._22, m._23 }, { m._31, m._32, m._33 } };
+		float center[3] = { m._41, m._42, m._43 }, extent[3] = { 0.0f, 0.0f, 0.0f };
+		for (uint32_t i = 0; i < 3; i++)
+		{
+			for (uint32_t j = 0; j < 3; j++)
+			{
+				center[j] += c[i] * rows[i][j];
+				extent[j] += e[i] * fabsf(rows[i][j]);
+			}
+		}
+		outMin = XMFLOAT3(center[0] - extent[0], center[1] - extent[1], center[2] - extent[2]);
+		outMax = XMFLOAT3(center[0] + extent[0], center[1] + extent[1], center[2] + extent[2]);
+	}
+
+private:
+	// A box is outside a plane when its center is farther behind it than the box reaches.
+	void CullScalar(const Frustum& frustum, uint32_t first, uint32_t count, uint32_t*& out) const
+	{
+		for (uint32_t i = first; i < count; i++)
+		{
+			bool inside = true;
+			for (const XMFLOAT4& p : frustum.planes)
+			{
+				float distance = p.x * centerX[i] + p.y * centerY[i] + p.z * centerZ[i] + p.w;
+				float radius = fabsf(p.x) * extentX[i] + fabsf(p.y) * extentY[i] + fabsf(p.z) * extentZ[i];
+				inside = inside && distance + radius >= 0.0f;
+			}
+			*out = i;
+			out += inside ? 1 : 0;
+		}
+	}
+
+#if RASTER_SIMD
+	// Returns the first box left for the scalar loop.
+	uint32_t CullSse2(const Frustum& frustum, uint32_t*& out) const
+	{
+		__m128 plane[6][4], radius[6][3];
+		const __m128 signMask = _mm_set1_ps(-0.0f);
+		for (uint32_t p = 0; p < 6; p++)
+		{
+			const XMFLOAT4& f = frustum.planes[p];
+			plane[p][0] = _mm_set1_ps(f.x); plane[p][1] = _mm_set1_ps(f.y); plane[p][2] = _mm_set1_ps(f.z); plane[p][3] = _mm_set1_ps(f.w);
+			for (uint32_t a = 0; a < 3; a++)
+				radius[p][a] = _mm_andnot_ps(signMask, plane[p][a]);
+		}
+
+		uint32_t count = static_cast<uint32_t>(centerX.size()) & ~3u;
+		for (uint32_t i = 0; i < count; i += 4)
+		{
+			__m128 cx = _mm_loadu_ps(&centerX[i]), cy = _mm_loadu_ps(&centerY[i]), cz = _mm_loadu_ps(&centerZ[i]);
+			__m128 ex = _mm_loadu_ps(&extentX[i]), ey = _mm_loadu_ps(&extentY[i]), ez = _mm_loadu_ps(&extentZ[i]);
+			__m128 inside = _mm_castsi128_ps(_mm_set1_epi32(-1));
+			for (uint32_t p = 0; p < 6; p++)
+			{
+				__m128 distance = _mm_add_ps(_mm_add_ps(_mm_mul_ps(plane[p][0], cx), _mm_mul_ps(plane[p][1], cy)), _mm_add_ps(_mm_mul_ps(plane[p][2], cz), plane[p][3]));
+				__m128 reach = _mm_add_ps(_mm_add_ps(_mm_mul_ps(radius[p][0], ex), _mm_mul_ps(radius[p][1], ey)), _mm_mul_ps(radius[p][2], ez));
+				inside = _mm_and_ps(inside, _mm_cmpge_ps(_mm_add_ps(distance, reach), _mm_setzero_ps()));
+			}
+			Compact(static_cast<uint32_t>(_mm_movemask_ps(inside)), 4, i, out);
+		}
+		return count;
+	}
+
+	RASTER_TARGET_AVX2 uint32_t CullAvx2(const Frustum& frustum, uint32_t*& out) const
+	{
+		__m256 plane[6][4], radius[6][3];
+		const __m256 signMask = _mm256_set1_ps(-0.0f);
+		for (uint32_t p = 0; p < 6; p++)
+		{
+			const XMFLOAT4& f = frustum.planes[p];
+			plane[p][0] = _mm256_set1_ps(f.x); plane[p][1] = _mm256_set1_ps(f.y); plane[p][2] = _mm256_set1_ps(f.z); plane[p][3] = _mm256_set1_ps(f.w);
+			for (uint32_t a = 0; a < 3; a++)
+				radius[p][a] = _mm256_andnot_ps(signMask, plane[p][a]);
+		}
+
+		uint32_t count = static_cast<uint32_t>(centerX.size()) & ~7u;
+		for (uint32_t i = 0; i < count; i += 8)
+		{
+			__m256 cx = _mm256_loadu_ps(&centerX[i]), cy = _mm256_loadu_ps(&centerY[i]), cz = _mm256_loadu_ps(&centerZ[i]);
+			__m256 ex = _mm256_loadu_ps(&extentX[i]), ey = _mm256_loadu_ps(&extentY[i]), ez = _mm256_loadu_ps(&extentZ[i]);
+			__m256 inside = _mm256_castsi256_ps(_mm256_set1_epi32(-1));
+			for (uint32_t p = 0; p < 6; p++)
+			{
+				__m256 distance = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(plane[p][0], cx), _mm256_mul_ps(plane[p][1], cy)), _mm256_add_ps(_mm256_mul_ps(plane[p][2], cz), plane[p][3]));
+				__m256 reach = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(radius[p][0], ex), _mm256_mul_ps(radius[p][1], ey)), _mm256_mul_ps(radius[p][2], ez));
+				inside = _mm256_and_ps(inside, _mm256_cmp_ps(_mm256_add_ps(distance, reach), _mm256_setzero_ps(), _CMP_GE_OQ));
+			}
+			Compact(static_cast<uint32_t>(_mm256_movemask_ps(inside)), 8, i, out);
+		}
+		return count;
+	}
+
+	// Appends base + lane for each set bit without branching on it.
+	static RASTER_FORCE_INLINE void Compact(uint32_t mask, uint32_t lanes, uint32_t base, uint32_t*& out)
+	{
+		for (uint32_t lane = 0; lane < lanes; lane++)
+		{
+			*out = base + lane;
+			out += (mask >> lane) & 1;
+		}
+	}
+#endif
+
+	std::vector<float> centerX, centerY, centerZ;
+	std::vector<float> extentX, extentY, extentZ;
+	RasterKernel kernel = RasterKernel::Scalar;
+	FrustumStats stats;
+};
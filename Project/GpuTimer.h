@@ -0,0 +1,196 @@
+#pragma once
+#include "Profiler.h"
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+// GPU time of each frame and of the passes in it, from timestamp queries.
+//
+// A frame's timestamps are only read once the GPU has got to them, which is usually a frame or
+// two later. Each frame in flight has a slot of its own; the oldest are read back at the start of
+// every frame without waiting, and a frame that would need a slot still in flight is not timed,
+// so timing never stalls the CPU on the GPU. Frames the GPU's clock changed speed in are
+// dropped too.
+//
+// Results are summed by name into ProfileStats, like Profiler::CollectStats(). While the profiler
+// is enabled they also go to a "gpu" ring of their own, placed on the CPU timeline from when their
+// frame began, so they show up in its traces and stats.
+//
+// The backend owns the queries and must provide:
+//	void	BeginFrame(uint32_t slot);						// Starts the slot's disjoint query.
+//	void	Timestamp(uint32_t slot, uint32_t index);		// Ends timestamp query 'index' of the slot.
+//	void	EndFrame(uint32_t slot);
+//	bool	ReadFrame(uint32_t slot, uint32_t count, uint64_t* ticks, uint64_t& frequency, bool& disjoint);
+//			// The slot's first 'count' timestamps and its ticks per second; false, without
+//			// waiting, while the GPU hasn't finished with them.
+template<typename Backend>
+class GpuTimer
+{
+public:
+	static const uint32_t FrameLatency = 4;		// Frames in flight before one goes untimed.
+	static const uint32_t MaxPasses = 16;		// Per frame; later ones go untimed.
+	static const uint32_t TimestampsPerFrame = 2 + 2 * MaxPasses;
+
+	explicit GpuTimer(Backend& _backend) : backend(_backend) {}
+
+	// Reads back what the GPU has finished, then starts timing a frame if a slot is free.
+	void BeginFrame()
+	{
+		Resolve();
+		timing = written - read < FrameLatency;
+		if (!timing)
+		{
+			framesSkipped++;
+			return;
+		}
+		uint32_t slotIndex = static_cast<uint32_t>(written % FrameLatency);
+		Slot& slot = slots[slotIndex];
+		slot.passes = 0;
+		slot.cpuBegin = Profiler::Now();
+		passOpen = false;
+		backend.BeginFrame(slotIndex);
+		backend.Timestamp(slotIndex, 0);
+	}
+
+	// 'name' has to outlive the timer, like a literal. Passes don't nest.
+	void BeginPass(const char* name)
+	{
+		if (!timing || passOpen)
+			return;
+		uint32_t slotIndex = static_cast<uint32_t>(written % FrameLatency);
+		Slot& slot = slots[slotIndex];
+		if (slot.passes >= MaxPasses)
+			return;
+		slot.names[slot.passes] = name;
+		backend.Timestamp(slotIndex, 2 + 2 * slot.passes);
+		passOpen = true;
+	}
+
+	void EndPass()
+	{
+		if (!timing || !passOpen)
+			return;
+		uint32_t slotIndex = static_cast<uint32_t>(written % FrameLatency);
+		Slot& slot = slots[slotIndex];
+		backend.Timestamp(slotIndex, 3 + 2 * slot.passes);
+		slot.passes++;
+		passOpen = false;
+	}
+
+	void EndFrame()
+	{
+		if (!timing)
+			return;
+		EndPass();
+		uint32_t slotIndex = static_cast<uint32_t>(written % FrameLatency);
+		backend.Timestamp(slotIndex, 1);
+		backend.EndFrame(slotIndex);
+		written++;
+		timing = false;
+	}
+
+	// Reads back every finished frame, oldest first, and stops at the first that isn't.
+	void Resolve()
+	{
+		while (read < written)
+		{
+			uint32_t slotIndex = static_cast<uint32_t>(read % FrameLatency);
+			const Slot& slot = slots[slotIndex];
+			uint64_t ticks[TimestampsPerFrame];
+			uint64_t frequency = 0;
+			bool disjoint = false;
+			if (!backend.ReadFrame(slotIndex, 2 + 2 * slot.passes, ticks, frequency, disjoint))
+				return;
+			read++;
+			if (disjoint || frequency == 0)
+			{
+				framesDisjoint++;
+				continue;
+			}
+			framesTimed++;
+			Add(slot, ticks, frequency);
+		}
+	}
+
+	// Summed by name in the order each was first seen; "GPU Frame" is whole frames.
+	const std::vector<ProfileStat>& GetStats() const { return stats; }
+	uint64_t GetFramesTimed() const { return framesTimed; }
+	uint64_t GetFramesSkipped() const { return framesSkipped; }		// Every slot was in flight.
+	uint64_t GetFramesDisjoint() const { return framesDisjoint; }
+	uint64_t GetFramesInFlight() const { return written - read; }
+
+	void ResetStats()
+	{
+		stats.clear();
+		framesTimed = framesSkipped = framesDisjoint = 0;
+	}
+
+private:
+	struct Slot
+	{
+		const char* names[MaxPasses];
+		uint32_t passes = 0;
+		uint64_t cpuBegin = 0;		// Profiler::Now() when the frame began.
+	};
+
+	void Add(const Slot& slot, const uint64_t* ticks, uint64_t frequency)
+	{
+		double msPerTick = 1000.0 / frequency;
+		Profiler::ThreadRing* ring = nullptr;
+		double cpuPerGpuTick = 0.0;
+		if (Profiler::IsEnabled())
+		{
+			ring = profileRing != nullptr ? profileRing : (profileRing = Profiler::AddRing("gpu"));
+			cpuPerGpuTick = Profiler::TicksPerNs() * 1e9 / frequency;
+		}
+
+		Count(FrameName, ticks[0], ticks[1], 0, msPerTick, slot.cpuBegin, ticks[0], cpuPerGpuTick, ring);
+		for (uint32_t p = 0; p < slot.passes; p++)
+			Count(slot.names[p], ticks[2 + 2 * p], ticks[3 + 2 * p], 1, msPerTick, slot.cpuBegin, ticks[0], cpuPerGpuTick, ring);
+	}
+
+	void Count(const char* name, uint64_t begin, uint64_t end, uint32_t depth, double msPerTick, uint64_t cpuBegin, uint64_t gpuBegin,
+		double cpuPerGpuTick, Profiler::ThreadRing* ring)
+	{
+		// A pass the GPU reordered or cut short counts as taking no time.
+		uint64_t ticks = end > begin ? end - begin : 0;
+		double ms = ticks * msPerTick;
+		ProfileStat* stat = nullptr;
+		for (ProfileStat& candidate : stats)
+		{
+			if (candidate.name == name || strcmp(candidate.name, name) == 0)
+			{
+				stat = &candidate;
+				break;
+			}
+		}
+		if (stat == nullptr)
+		{
+			stats.push_back(ProfileStat());
+			stat = &stats.back();
+			stat->name = name;
+		}
+		stat->count++;
+		stat->totalMs += ms;
+		stat->maxMs = ms > stat->maxMs ? ms : stat->maxMs;
+
+		if (ring != nullptr)
+		{
+			uint64_t offset = begin > gpuBegin ? begin - gpuBegin : 0;
+			uint64_t cpuStart = cpuBegin + static_cast<uint64_t>(offset * cpuPerGpuTick);
+			Profiler::Write(*ring, name, cpuStart, cpuStart + static_cast<uint64_t>(ticks * cpuPerGpuTick), depth);
+		}
+	}
+
+	static constexpr const char* FrameName = "GPU Frame";
+
+	Backend& backend;
+	Slot slots[FrameLatency];
+	uint64_t written = 0, read = 0;		// Frames ended and frames read back.
+	bool timing = false;
+	bool passOpen = false;
+
+	std::vector<ProfileStat> stats;
+	uint64_t framesTimed = 0, framesSkipped = 0, framesDisjoint = 0;
+	Profiler::ThreadRing* profileRing = nullptr;
+};
@@ -0,0 +1,157 @@
+#pragma once
+#include "defines.h"
+#include <cstdint>
+#include <mutex>
+
+// What the player did during one frame.
+struct FrameInputs
+{
+	int32_t lookX = 0, lookY = 0;		// Mouse pixels moved with the right button held.
+	uint32_t shots = 0;					// Left button presses.
+	float moveX = 0.0f, moveZ = 0.0f;	// WASD, -1 to 1 along the view's x and z.
+};
+
+// Keyboard and mouse on any platform Gateware has input for. GBufferedInput's key and button
+// events are folded into one state as they arrive, on whichever thread sends them, and Collect()
+// takes what a frame adds up to: a key held or tapped at any time during the frame moves, every
+// click fires. Looking sums GInput's mouse deltas while the right button is down, so the view keeps
+// turning when the cursor reaches the screen's edge. Where GInput never reports a new delta
+// (Gateware's Linux and macOS input) it sums how far the cursor moved instead.
+class InputCollector
+{
+public:
+	// False where there is no window or no input for the platform.
+	bool Create(GW::SYSTEM::GWindow _window)
+	{
+		if (-input.Create(_window) || -bufferedInput.Create(_window))
+			return false;
+		created = +events.Create(bufferedInput, [this]() { Drain(); });
+		return created;
+	}
+
+	bool IsCreated() const { return created; }
+
+	// What happened since the last call.
+	FrameInputs Collect()
+	{
+		// The mouse moves without sending events, so pick up what it did since the last one.
+		Drain();
+
+		FrameInputs frame;
+		uint32_t keys;
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			keys = held | tapped;
+			tapped = 0;
+			frame.shots = clicks;
+			clicks = 0;
+			frame.lookX = lookX;
+			frame.lookY = lookY;
+			lookX = lookY = 0;
+			lookTapped = false;
+		}
+
+		frame.moveX = (keys & KeyD ? 1.0f : 0.0f) - (keys & KeyA ? 1.0f : 0.0f);
+		frame.moveZ = (keys & KeyW ? 1.0f : 0.0f) - (keys & KeyS ? 1.0f : 0.0f);
+		return frame;
+	}
+
+private:
+	enum : uint32_t
+	{
+		KeyW = 1 << 0,
+		KeyA = 1 << 1,
+		KeyS = 1 << 2,
+		KeyD = 1 << 3,
+	};
+
+	static uint32_t KeyBit(int key)
+	{
+		switch (key)
+		{
+		case G_KEY_W: return KeyW;
+		case G_KEY_A: return KeyA;
+		case G_KEY_S: return KeyS;
+		case G_KEY_D: return KeyD;
+		}
+		return 0;
+	}
+
+	void Drain()
+	{
+		GW::GEvent event;
+		while (+events.Pop(event))
+		{
+			GW::INPUT::GBufferedInput::Events type;
+			GW::INPUT::GBufferedInput::EVENT_DATA data;
+			if (-event.Read(type, data))
+				continue;
+
+			std::lock_guard<std::mutex> lock(mutex);
+			AddMouseMove();
+			switch (type)
+			{
+			case GW::INPUT::GBufferedInput::Events::KEYPRESSED:
+				held |= KeyBit(data.data);
+				tapped |= KeyBit(data.data);
+				break;
+			case GW::INPUT::GBufferedInput::Events::KEYRELEASED:
+				held &= ~KeyBit(data.data);
+				break;
+			case GW::INPUT::GBufferedInput::Events::BUTTONPRESSED:
+				clicks += data.data == G_BUTTON_LEFT ? 1 : 0;
+				lookHeld = lookHeld || data.data == G_BUTTON_RIGHT;
+				lookTapped = lookTapped || data.data == G_BUTTON_RIGHT;
+				break;
+			case GW::INPUT::GBufferedInput::Events::BUTTONRELEASED:
+				lookHeld = lookHeld && data.data != G_BUTTON_RIGHT;
+				break;
+			default:
+				break;
+			}
+		}
+
+		std::lock_guard<std::mutex> lock(mutex);
+		AddMouseMove();
+	}
+
+	// Adds the mouse's movement since the last call to the look while the right button is down.
+	// Positive is left and up, as the cursor moving from where it was towards where it is now
+	// measures it. Called with the mutex held.
+	void AddMouseMove()
+	{
+		float deltaX = 0.0f, deltaY = 0.0f, cursorX = 0.0f, cursorY = 0.0f;
+		bool looking = lookHeld || lookTapped;
+		if (input.GetMouseDelta(deltaX, deltaY) == GW::GReturn::SUCCESS)
+		{
+			// Raw input, positive right and down.
+			deltas = true;
+			lookX -= looking ? static_cast<int32_t>(deltaX) : 0;
+			lookY -= looking ? static_cast<int32_t>(deltaY) : 0;
+		}
+		else if (!deltas && +input.GetMousePosition(cursorX, cursorY))
+		{
+			int32_t x = static_cast<int32_t>(cursorX), y = static_cast<int32_t>(cursorY);
+			lookX += looking && hasCursor ? lastX - x : 0;
+			lookY += looking && hasCursor ? lastY - y : 0;
+			lastX = x;
+			lastY = y;
+			hasCursor = true;
+		}
+	}
+
+	GW::INPUT::GInput input;
+	GW::INPUT::GBufferedInput bufferedInput;
+	GW::CORE::GEventReceiver events;
+	bool created = false;
+
+	// Written by the events, taken by Collect().
+	std::mutex mutex;
+	uint32_t held = 0, tapped = 0;		// Keys down now, and pressed since the last frame.
+	uint32_t clicks = 0;
+	bool lookHeld = false, lookTapped = false;
+	int32_t lookX = 0, lookY = 0;		// Summed since the last frame.
+	bool deltas = false;				// GInput has reported a mouse delta.
+	int32_t lastX = 0, lastY = 0;		// The cursor at the last call, without deltas.
+	bool hasCursor = false;
+};
@@ -0,0 +1,193 @@
+#pragma once
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <vector>
+
+// The input one simulated frame applied, and the real time it advanced the simulation by.
+struct InputFrame
+{
+	int32_t lookX = 0, lookY = 0;		// Mouse pixels looked this frame.
+	uint32_t shots = 0;					// Shots fired this frame.
+	float moveX = 0.0f, moveZ = 0.0f;	// Held movement, -1 to 1 along the view's x and z.
+	bool walking = false;
+	double seconds = 0.0;
+};
+
+// Binary log of InputFrames, to run the simulation through the same input again. Each frame is
+// a byte of flags followed by only what it has: zigzag varints for looks and shots, and the
+// movement and frame time as raw floats when they differ from the frame before. A frame that
+// repeats the last one's keys and time is one byte.
+//
+//	uint32	magic, version, frame count
+//	frames
+class InputLog
+{
+public:
+	static const uint32_t FileMagic = 0x54504E49; // "INPT"
+	static const uint32_t FileVersion = 1;
+
+	void Clear()
+	{
+		bytes.clear();
+		frames = 0;
+		readPos = 0;
+		readFrames = 0;
+		written = InputFrame();
+		read = InputFrame();
+	}
+
+	void Append(const InputFrame& frame)
+	{
+		uint8_t flags = (frame.lookX != 0 || frame.lookY != 0 ? LookFlag : 0) | (frame.shots != 0 ? ShotsFlag : 0) |
+			(frame.moveX != written.moveX || frame.moveZ != written.moveZ ? MoveFlag : 0) | (frame.walking ? WalkingFlag : 0) |
+			(frame.seconds != written.seconds ? SecondsFlag : 0);
+		bytes.push_back(flags);
+		if (flags & LookFlag)
+		{
+			WriteVarint(Zigzag(frame.lookX));
+			WriteVarint(Zigzag(frame.lookY));
+		}
+		if (flags & ShotsFlag)
+			WriteVarint(frame.shots);
+		if (flags & MoveFlag)
+		{
+			WriteRaw(&frame.moveX, sizeof(float));
+			WriteRaw(&frame.moveZ, sizeof(float));
+		}
+		if (flags & SecondsFlag)
+			WriteRaw(&frame.seconds, sizeof(double));
+		written = frame;
+		frames++;
+	}
+
+	// The next frame from the start, or after the last one read. False at the end or on a
+	// damaged log.
+	bool Next(InputFrame& frame)
+	{
+		if (readFrames >= frames || readPos >= bytes.size())
+			return false;
+		uint8_t flags = bytes[readPos++];
+		InputFrame next;
+		next.moveX = read.moveX;
+		next.moveZ = read.moveZ;
+		next.seconds = read.seconds;
+		next.walking = (flags & WalkingFlag) != 0;
+		uint32_t lookX = 0, lookY = 0;
+		bool valid = (flags & ~AllFlags) == 0;
+		if (flags & LookFlag)
+			valid = valid && ReadVarint(lookX) && ReadVarint(lookY);
+		if (flags & ShotsFlag)
+			valid = valid && ReadVarint(next.shots);
+		if (flags & MoveFlag)
+			valid = valid && ReadRaw(&next.moveX, sizeof(float)) && ReadRaw(&next.moveZ, sizeof(float));
+		if (flags & SecondsFlag)
+			valid = valid && ReadRaw(&next.seconds, sizeof(double));
+		if (!valid)
+		{
+			readFrames = frames;
+			return false;
+		}
+		next.lookX = Unzigzag(lookX);
+		next.lookY = Unzigzag(lookY);
+		read = next;
+		readFrames++;
+		frame = next;
+		return true;
+	}
+
+	// Reading starts over from the first frame.
+	void Rewind()
+	{
+		readPos = 0;
+		readFrames = 0;
+		read = InputFrame();
+	}
+
+	uint32_t GetFrameCount() const { return frames; }
+	size_t GetSize() const { return bytes.size(); }
+
+	bool Save(const char* path) const
+	{
+		std::ofstream out(path, std::ios::binary);
+		if (!out.is_open())
+			return false;
+		uint32_t header[3] = { FileMagic, FileVersion, frames };
+		out.write(reinterpret_cast<const char*>(header), sizeof(header));
+		out.write(reinterpret_cast<const char*>(bytes.data()), bytes.size());
+		return out.good();
+	}
+
+	// False if the file isn't a log this version can read.
+	bool Load(const char* path)
+	{
+		Clear();
+		std::ifstream in(path, std::ios::binary);
+		uint32_t header[3] = {};
+		if (!in.read(reinterpret_cast<char*>(header), sizeof(header)) || header[0] != FileMagic || header[1] != FileVersion)
+			return false;
+		bytes.assign(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+		frames = header[2];
+		return true;
+	}
+
+private:
+	enum : uint8_t
+	{
+		LookFlag = 1 << 0,
+		ShotsFlag = 1 << 1,
+		MoveFlag = 1 << 2,
+		WalkingFlag = 1 << 3,
+		SecondsFlag = 1 << 4,
+		AllFlags = (1 << 5) - 1,
+	};
+
+	static uint32_t Zigzag(int32_t value) { return (static_cast<uint32_t>(value) << 1) ^ static_cast<uint32_t>(value >> 31); }
+	static int32_t Unzigzag(uint32_t value) { return static_cast<int32_t>(value >> 1) ^ -static_cast<int32_t>(value & 1); }
+
+	void WriteVarint(uint32_t value)
+	{
+		while (value >= 0x80)
+		{
+			bytes.push_back(static_cast<uint8_t>(value | 0x80));
+			value >>= 7;
+		}
+		bytes.push_back(static_cast<uint8_t>(value));
+	}
+
+	bool ReadVarint(uint32_t& value)
+	{
+		value = 0;
+		for (uint32_t shift = 0; shift < 35 && readPos < bytes.size(); shift += 7)
+		{
+			uint8_t byte = bytes[readPos++];
+			value |= static_cast<uint32_t>(byte & 0x7F) << shift;
+			if ((byte & 0x80) == 0)
+				return true;
+		}
+		return false;
+	}
+
+	void WriteRaw(const void* data, size_t size)
+	{
+		const uint8_t* raw = static_cast<const uint8_t*>(data);
+		bytes.insert(bytes.end(), raw, raw + size);
+	}
+
+	bool ReadRaw(void* data, size_t size)
+	{
+		if (bytes.size() - readPos < size)
+			return false;
+		memcpy(data, bytes.data() + readPos, size);
+		readPos += size;
+		return true;
+	}
+
+	std::vector<uint8_t> bytes;
+	uint32_t frames = 0;
+	InputFrame written;		// The last frame appended, and the last read.
+	InputFrame read;
+	size_t readPos = 0;
+	uint32_t readFrames = 0;
+};
@@ -0,0 +1,132 @@
+#pragma once
+#include <DirectXMath.h>
+#include <vector>
+#include <cmath>
+#include <cfloat>
+
+// Per-instance data streamed to the GPU in vertex buffer slot 1.
+// Layout must match VS_INSTANCED_INPUT in shaders.fx.
+struct InstanceData
+{
+	DirectX::XMFLOAT4X4 world; // Row-major world matrix (not transposed).
+	DirectX::XMFLOAT4 color;
+};
+
+// CPU side of the instanced balloons. Holds the simulation state as arrays so the
+// update and packing loop can be run (and timed) without a device.
+class InstanceBatch
+{
+public:
+	// Bobbing speed along the axis, in units per second at the peak of sin(time * 2).
+	// 0.1 per frame at the 60 Hz the balloons used to move once a frame.
+	static constexpr float BobSpeed = 6.0f;
+
+	// Adds an instance at 'position' that bobs along 'axis' every step.
+	size_t Add(DirectX::XMFLOAT4 position, DirectX::XMFLOAT3 axis, DirectX::XMFLOAT4 color)
+	{
+		positions.push_back(position);
+		previous.push_back(position);
+		axes.push_back(axis);
+		colors.push_back(color);
+		instances.push_back({});
+		return positions.size() - 1;
+	}
+
+	// Moves the last instance into 'index', so indices past it aren't stable.
+	void Remove(size_t index)
+	{
+		positions[index] = positions.back();
+		previous[index] = previous.back();
+		axes[index] = axes.back();
+		colors[index] = colors.back();
+		instances[index] = instances.back();
+		positions.pop_back();
+		previous.pop_back();
+		axes.pop_back();
+		colors.pop_back();
+		instances.pop_back();
+	}
+
+	void Reserve(size_t count)
+	{
+		positions.reserve(count);
+		previous.reserve(count);
+		axes.reserve(count);
+		colors.reserve(count);
+		instances.reserve(count);
+	}
+
+	void Clear()
+	{
+		positions.clear();
+		previous.clear();
+		axes.clear();
+		colors.clear();
+		instances.clear();
+	}
+
+	// Moves every instance along its axis for one simulation step of 'dt' seconds ending at 'time'.
+	// The positions before it are kept for Pack() to blend from.
+	void Step(float time, float dt)
+	{
+		previous = positions;
+		float offset = sin(time * 2.0f) * BobSpeed * dt;
+		for (size_t i = 0; i < positions.size(); i++)
+		{
+			positions[i].x += axes[i].x * offset;
+			positions[i].y += axes[i].y * offset;
+			positions[i].z += axes[i].z * offset;
+		}
+	}
+
+	// Writes Translation(pos) * Scaling(scale) and the color of each instance, with the position
+	// 'alpha' of the way from before the last step to after it.
+	// The matrix is built by hand since only the diagonal and last row are non-zero.
+	void Pack(float alpha = 1.0f)
+	{
+		boundsMin = { FLT_MAX, FLT_MAX, FLT_MAX };
+		boundsMax = { -FLT_MAX, -FLT_MAX, -FLT_MAX };
+		for (size_t i = 0; i < positions.size(); i++)
+		{
+			DirectX::XMFLOAT4 position = {
+				previous[i].x + (positions[i].x - previous[i].x) * alpha,
+				previous[i].y + (positions[i].y - previous[i].y) * alpha,
+				previous[i].z + (positions[i].z - previous[i].z) * alpha,
+				positions[i].w
+			};
+			DirectX::XMFLOAT4X4& m = instances[i].world;
+			m._11 = scale;	m._12 = 0.0f;	m._13 = 0.0f;	m._14 = 0.0f;
+			m._21 = 0.0f;	m._22 = scale;	m._23 = 0.0f;	m._24 = 0.0f;
+			m._31 = 0.0f;	m._32 = 0.0f;	m._33 = scale;	m._34 = 0.0f;
+			m._41 = position.x * scale;
+			m._42 = position.y * scale;
+			m._43 = position.z * scale;
+			m._44 = 1.0f;
+			instances[i].color = colors[i];
+
+			boundsMin.x = fminf(boundsMin.x, m._41); boundsMax.x = fmaxf(boundsMax.x, m._41);
+			boundsMin.y = fminf(boundsMin.y, m._42); boundsMax.y = fmaxf(boundsMax.y, m._42);
+			boundsMin.z = fminf(boundsMin.z, m._43); boundsMax.z = fmaxf(boundsMax.z, m._43);
+		}
+	}
+
+	DirectX::XMMATRIX GetWorld(size_t index) const { return DirectX::XMLoadFloat4x4(&instances[index].world); }
+	const DirectX::XMFLOAT4& GetPosition(size_t index) const { return positions[index]; }
+	// World-space box around every instance origin, valid after Pack.
+	const DirectX::XMFLOAT3& GetBoundsMin() const { return boundsMin; }
+	const DirectX::XMFLOAT3& GetBoundsMax() const { return boundsMax; }
+	const InstanceData* Data() const { return instances.data(); }
+	size_t Count() const { return instances.size(); }
+	size_t ByteSize() const { return instances.size() * sizeof(InstanceData); }
+
+	float scale = 0.3f;
+
+private:
+	std::vector<DirectX::XMFLOAT4> positions;
+	std::vector<DirectX::XMFLOAT4> previous;		// Positions before the last Step().
+	std::vector<DirectX::XMFLOAT3> axes;
+	std::vector<DirectX::XMFLOAT4> colors;
+	std::vector<InstanceData> instances;
+	DirectX::XMFLOAT3 boundsMin = { 0.0f, 0.0f, 0.0f };
+	DirectX::XMFLOAT3 boundsMax = { 0.0f, 0.0f, 0.0f };
+};
@@ -0,0 +1,551 @@
+#pragma once
+#include "defines.h"
+#include "Profiler.h"
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+class JobSystem;
+
+// Runs 'begin' to 'end' of whatever 'data' describes.
+typedef void (*JobFunction)(void* data, uint32_t begin, uint32_t end);
+
+struct Job
+{
+	JobFunction function;
+	void* data;
+	uint32_t begin, end;
+	class JobCounter* counter;
+	Job* next;			// Next job waiting on the same counter, or next free job.
+	uint32_t owner;		// Thread slot whose pool the job came from.
+};
+
+// Jobs of a group still to finish. Wait() on it, or Run() jobs that start once it reaches zero.
+// A counter can be reused once it reaches zero, and has to live until then.
+class JobCounter
+{
+public:
+	JobCounter() = default;
+	JobCounter(const JobCounter&) = delete;
+	JobCounter& operator=(const JobCounter&) = delete;
+
+	bool Done() const
+	{
+		// The thread finishing the last job still touches the counter after 'pending' reaches zero.
+		return pending.load() == 0 && finishing.load() == 0;
+	}
+
+private:
+	friend class JobSystem;
+
+	std::atomic<int64_t> pending{ 0 };
+	std::atomic<int32_t> finishing{ 0 };
+	std::mutex waiterLock;
+	Job* waiters = nullptr;
+};
+
+// Jobs run and stolen since the system was made.
+struct JobStats
+{
+	uint64_t executed = 0;
+	uint64_t stolen = 0;
+	uint64_t splits = 0;		// Ranges a ParallelFor split off for other threads.
+};
+
+// Work stealing job system.
+//
+// Every thread that runs jobs owns a Chase-Lev deque: it pushes and pops jobs at the bottom while
+// idle threads steal from the top, so a thread mostly works on what it made itself, newest first,
+// and only touches the others' deques when it runs out. Worker threads are made here; any other
+// thread that calls Run() or Wait() gets a deque of its own the first time, and Wait() runs jobs
+// rather than blocking, so the main thread helps until its work is done.
+//
+// Dependencies are counters: Run() adds a job to one, and can hold it back until another reaches
+// zero. ParallelFor() splits its range lazily, handing half the rest to the deque whenever the
+// thread has nothing queued, so pieces only get small when other threads are hungry for them.
+//
+// Workers are plain threads rather than GConcurrent jobs. They never return, which would hold a
+// thread of Gateware's shared pool forever.
+class JobSystem
+{
+public:
+	// Jobs each deque holds; past that a thread runs what it makes itself.
+	static const uint32_t DequeSize = 4096;
+	// Threads besides the workers that can Run() and Wait() at once; more than that run their jobs
+	// inline. A thread's slot is free again once it ends.
+	static const uint32_t MaxExternalThreads = 8;
+
+	// 'threads' counts the thread calling Wait() too, so 1 makes no workers. 0 uses every core.
+	explicit JobSystem(uint32_t _threads = 0)
+	{
+		static std::atomic<uint64_t> nextId{ 1 };
+		id = nextId.fetch_add(1, std::memory_order_relaxed);
+
+		uint32_t threads = _threads > 0 ? _threads : std::thread::hardware_concurrency();
+		workerCount = threads > 1 ? threads - 1 : 0;
+		slotCount = workerCount + MaxExternalThreads;
+		slots.reset(new Slot[slotCount]);
+		external = std::make_shared<ExternalSlots>();
+		external->firstSlot = workerCount;
+		for (uint32_t i = 0; i < workerCount; i++)
+			workers.emplace_back([this, i]() { WorkerLoop(i); });
+	}
+
+	~JobSystem()
+	{
+		// Jobs still queued are dropped; Wait() on their counters first.
+		running.store(false);
+		{
+			std::lock_guard<std::mutex> lock(sleepLock);
+			wake.notify_all();
+		}
+		for (std::thread& worker : workers)
+			worker.join();
+	}
+
+	JobSystem(const JobSystem&) = delete;
+	JobSystem& operator=(const JobSystem&) = delete;
+
+	// The system the engine's own work shares, on every core, made the first time it's asked for.
+	// Holders keep it alive, so one that is destroyed after main() returns can still wait on it.
+	static std::shared_ptr<JobSystem> Shared()
+	{
+		static std::shared_ptr<JobSystem> shared = std::make_shared<JobSystem>();
+		return shared;
+	}
+
+	uint32_t GetThreadCount() const { return workerCount + 1; }
+
+	// Queues function(data, begin, end) under 'counter'. With 'after', it's queued once that
+	// counter reaches zero instead.
+	void Run(JobFunction function, void* data, uint32_t begin, uint32_t end, JobCounter& counter, JobCounter* after = nullptr)
+	{
+		uint32_t slot = LocalSlot();
+		if (slot == NoSlot)
+		{
+			if (after)
+				Wait(*after);
+			function(data, begin, end);
+			return;
+		}
+
+		Job* job = Allocate(slot);
+		job->function = function;
+		job->data = data;
+		job->begin = begin;
+		job->end = end;
+		job->counter = &counter;
+		counter.pending.fetch_add(1);
+		if (after && Defer(*after, job))
+			return;
+		Submit(slot, job);
+	}
+
+	// Runs queued jobs, this thread's first, until 'counter' reaches zero.
+	void Wait(JobCounter& counter)
+	{
+		uint32_t slot = LocalSlot();
+		uint32_t idle = 0;
+		while (!counter.Done())
+		{
+			Job* job = FindJob(slot);
+			if (job)
+			{
+				Execute(slot, job);
+				idle = 0;
+			}
+			else if (++idle > SpinCount)
+				std::this_thread::yield();
+		}
+	}
+
+	// Calls body(begin, end) over pieces of [0, count) on every thread and waits for them all.
+	// A piece is at least 'grain' long unless it's the last; 0 picks one from the thread count.
+	template<class Body>
+	void ParallelFor(uint32_t count, uint32_t grain, const Body& body)
+	{
+		if (count == 0)
+			return;
+		grain = grain > 0 ? grain : count / (GetThreadCount() * 64);
+		grain = grain > 0 ? grain : 1;
+		if (count <= grain || workerCount == 0)
+		{
+			body(0u, count);
+			return;
+		}
+
+		JobCounter counter;
+		RangeContext<Body> context = { this, &body, &counter, grain };
+		Run(RangeJob<Body>, &context, 0, count, counter);
+		Wait(counter);
+	}
+
+	JobStats GetStats() const
+	{
+		JobStats stats;
+		for (uint32_t i = 0; i < slotCount; i++)
+		{
+			stats.executed += slots[i].executed.load(std::memory_order_relaxed);
+			stats.stolen += slots[i].stolen.load(std::memory_order_relaxed);
+			stats.splits += slots[i].splits.load(std::memory_order_relaxed);
+		}
+		return stats;
+	}
+
+private:
+	static const uint32_t NoSlot = UINT32_MAX;
+	static const uint32_t DequeMask = DequeSize - 1;
+	static const uint32_t JobBlockSize = 256;
+	static const uint32_t SpinCount = 64;
+
+	// Lê, Pop, Cohen and Zappa Nardelli's C11 version of the Chase-Lev deque, at a fixed size.
+	// Only the owner pushes and pops; anyone steals.
+	struct Deque
+	{
+		alignas(64) std::atomic<int64_t> top{ 0 };
+		alignas(64) std::atomic<int64_t> bottom{ 0 };
+		alignas(64) std::atomic<Job*> jobs[DequeSize] = {};
+
+		bool Push(Job* job)
+		{
+			int64_t b = bottom.load(std::memory_order_relaxed);
+			int64_t t = top.load(std::memory_order_acquire);
+			if (b - t >= static_cast<int64_t>(DequeSize))
+				return false;
+			// Release on the slot too: a thief may see 'bottom' as a later Pop() left it, which doesn't
+			// publish the job.
+			jobs[b & DequeMask].store(job, std::memory_order_release);
+			bottom.store(b + 1, std::memory_order_release);
+			return true;
+		}
+
+		Job* Pop()
+		{
+			int64_t b = bottom.load(std::memory_order_relaxed) - 1;
+			bottom.store(b, std::memory_order_relaxed);
+			std::atomic_thread_fence(std::memory_order_seq_cst);
+			int64_t t = top.load(std::memory_order_relaxed);
+			if (t > b)
+			{
+				bottom.store(b + 1, std::memory_order_relaxed);
+				return nullptr;
+			}
+			Job* job = jobs[b & DequeMask].load(std::memory_order_relaxed);
+			if (t == b)
+			{
+				// The last job, which a thief may be taking too.
+				if (!top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed))
+					job = nullptr;
+				bottom.store(b + 1, std::memory_order_relaxed);
+			}
+			return job;
+		}
+
+		Job* Steal()
+		{
+			int64_t t = top.load(std::memory_order_acquire);
+			std::atomic_thread_fence(std::memory_order_seq_cst);
+			int64_t b = bottom.load(std::memory_order_acquire);
+			if (t >= b)
+				return nullptr;
+			Job* job = jobs[t & DequeMask].load(std::memory_order_acquire);
+			if (!top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed))
+				return nullptr;
+			return job;
+		}
+
+		bool Empty() const { return bottom.load(std::memory_order_relaxed) <= top.load(std::memory_order_relaxed); }
+	};
+
+	// A thread's deque and job pool. Jobs finished on other threads go back to 'returned', which the
+	// owner takes whole when its own free list runs out.
+	struct alignas(64) Slot
+	{
+		Deque deque;
+		Job* freeJobs = nullptr;
+		std::vector<std::unique_ptr<Job[]>> blocks;
+		alignas(64) std::atomic<Job*> returned{ nullptr };
+		alignas(64) std::atomic<uint64_t> executed{ 0 }, stolen{ 0 }, splits{ 0 };
+	};
+
+	template<class Body>
+	struct RangeContext
+	{
+		JobSystem* system;
+		const Body* body;
+		JobCounter* counter;
+		uint32_t grain;
+	};
+
+	template<class Body>
+	static void RangeJob(void* data, uint32_t begin, uint32_t end)
+	{
+		RangeContext<Body>* context = static_cast<RangeContext<Body>*>(data);
+		JobSystem* system = context->system;
+		uint32_t grain = context->grain;
+		uint32_t slot = system->LocalSlot();
+		while (end - begin > grain)
+		{
+			// Only split while nothing of this thread's is left for thieves.
+			if (end - begin >= 2 * grain && slot != NoSlot && system->slots[slot].deque.Empty())
+			{
+				uint32_t middle = begin + (end - begin) / 2;
+				system->slots[slot].splits.fetch_add(1, std::memory_order_relaxed);
+				system->Run(RangeJob<Body>, data, middle, end, *context->counter);
+				end = middle;
+				continue;
+			}
+			(*context->body)(begin, begin + grain);
+			begin += grain;
+		}
+		(*context->body)(begin, end);
+	}
+
+	// Which external slots are taken. The threads holding them keep a weak pointer, so a thread that
+	// ends hands its slot back while the system runs on, and one that outlives the system can tell.
+	struct ExternalSlots
+	{
+		uint32_t firstSlot = 0;
+		std::atomic<bool> taken[MaxExternalThreads] = {};
+	};
+
+	// A slot this thread holds in a system.
+	struct Binding
+	{
+		uint64_t system;
+		uint32_t slot;
+		std::weak_ptr<ExternalSlots> external;
+	};
+
+	// Every system this thread holds a slot in. External slots go back when the thread ends.
+	struct ThreadBindings
+	{
+		std::vector<Binding> bindings;
+
+		~ThreadBindings()
+		{
+			for (const Binding& binding : bindings)
+			{
+				std::shared_ptr<ExternalSlots> external = binding.external.lock();
+				if (external && binding.slot >= external->firstSlot)
+					external->taken[binding.slot - external->firstSlot].store(false, std::memory_order_release);
+			}
+		}
+	};
+
+	static std::vector<Binding>& Bindings()
+	{
+		thread_local ThreadBindings bindings;
+		return bindings.bindings;
+	}
+
+	void Bind(uint32_t slot)
+	{
+		std::vector<Binding>& bindings = Bindings();
+		// Systems that are gone can't give slots back or be asked for them again.
+		for (size_t i = bindings.size(); i-- > 0;)
+		{
+			if (bindings[i].external.expired())
+				bindings.erase(bindings.begin() + i);
+		}
+		Binding binding = { id, slot, external };
+		bindings.push_back(binding);
+	}
+
+	// This thread's slot, taking a free external one the first time. With none free, NoSlot, and
+	// the thread runs its jobs inline until one is.
+	uint32_t LocalSlot()
+	{
+		for (const Binding& binding : Bindings())
+		{
+			if (binding.system == id)
+				return binding.slot;
+		}
+
+		for (uint32_t i = 0; i < MaxExternalThreads; i++)
+		{
+			bool taken = false;
+			if (external->taken[i].compare_exchange_strong(taken, true, std::memory_order_acquire, std::memory_order_relaxed))
+			{
+				Bind(workerCount + i);
+				return workerCount + i;
+			}
+		}
+		return NoSlot;
+	}
+
+	Job* Allocate(uint32_t slot)
+	{
+		Slot& local = slots[slot];
+		if (!local.freeJobs)
+			local.freeJobs = local.returned.exchange(nullptr, std::memory_order_acquire);
+		if (!local.freeJobs)
+		{
+			Job* block = new Job[JobBlockSize];
+			local.blocks.emplace_back(block);
+			for (uint32_t i = 0; i < JobBlockSize; i++)
+			{
+				block[i].owner = slot;
+				block[i].next = i + 1 < JobBlockSize ? &block[i + 1] : nullptr;
+			}
+			local.freeJobs = block;
+		}
+		Job* job = local.freeJobs;
+		local.freeJobs = job->next;
+		return job;
+	}
+
+	void Free(uint32_t slot, Job* job)
+	{
+		if (job->owner == slot)
+		{
+			job->next = slots[slot].freeJobs;
+			slots[slot].freeJobs = job;
+			return;
+		}
+		std::atomic<Job*>& returned = slots[job->owner].returned;
+		job->next = returned.load(std::memory_order_relaxed);
+		while (!returned.compare_exchange_weak(job->next, job, std::memory_order_release, std::memory_order_relaxed))
+		{
+		}
+	}
+
+	// Holds 'job' back until 'after' reaches zero; false if it already has.
+	bool Defer(JobCounter& after, Job* job)
+	{
+		{
+			std::lock_guard<std::mutex> lock(after.waiterLock);
+			if (after.pending.load() != 0)
+			{
+				job->next = after.waiters;
+				after.waiters = job;
+				return true;
+			}
+		}
+		// The thread that finished the last job may not have let go of 'after' yet, and once this job
+		// is done nothing else keeps it alive.
+		while (!after.Done())
+			std::this_thread::yield();
+		return false;
+	}
+
+	void Submit(uint32_t slot, Job* job)
+	{
+		if (slot == NoSlot || !slots[slot].deque.Push(job))
+		{
+			Execute(slot, job);
+			return;
+		}
+		if (sleepers.load(std::memory_order_relaxed) > 0)
+			wake.notify_one();
+	}
+
+	void Execute(uint32_t slot, Job* job)
+	{
+		job->function(job->data, job->begin, job->end);
+		JobCounter* counter = job->counter;
+		Free(slot, job);
+		if (slot != NoSlot)
+			slots[slot].executed.fetch_add(1, std::memory_order_relaxed);
+
+		Job* released = nullptr;
+		counter->finishing.fetch_add(1);
+		if (counter->pending.fetch_sub(1) == 1)
+		{
+			std::lock_guard<std::mutex> lock(counter->waiterLock);
+			// Someone may have added to the counter again since.
+			if (counter->pending.load() == 0)
+			{
+				released = counter->waiters;
+				counter->waiters = nullptr;
+			}
+		}
+		// Let go of the counter before its waiters can run; their own counter may be all that keeps it alive.
+		counter->finishing.fetch_sub(1);
+		while (released)
+		{
+			Job* next = released->next;
+			Submit(slot, released);
+			released = next;
+		}
+	}
+
+	// This thread's newest job, or the oldest of another thread's.
+	Job* FindJob(uint32_t slot)
+	{
+		if (slot != NoSlot)
+		{
+			Job* job = slots[slot].deque.Pop();
+			if (job)
+				return job;
+		}
+		uint32_t start = slot != NoSlot ? slot + 1 : 0;
+		for (uint32_t i = 0; i < slotCount; i++)
+		{
+			uint32_t victim = (start + i) % slotCount;
+			if (victim == slot)
+				continue;
+			Job* job = slots[victim].deque.Steal();
+			if (job)
+			{
+				if (slot != NoSlot)
+					slots[slot].stolen.fetch_add(1, std::memory_order_relaxed);
+				return job;
+			}
+		}
+		return nullptr;
+	}
+
+	bool AnyQueued() const
+	{
+		for (uint32_t i = 0; i < slotCount; i++)
+			if (!slots[i].deque.Empty())
+				return true;
+		return false;
+	}
+
+	void WorkerLoop(uint32_t slot)
+	{
+		Bind(slot);
+		Profiler::SetThreadName("job worker");
+		uint32_t idle = 0;
+		while (running.load(std::memory_order_relaxed))
+		{
+			Job* job = FindJob(slot);
+			if (job)
+			{
+				Execute(slot, job);
+				idle = 0;
+				continue;
+			}
+			if (++idle <= SpinCount)
+			{
+				std::this_thread::yield();
+				continue;
+			}
+			// Pushes only notify when someone sleeps; the timeout covers a push that just missed it.
+			std::unique_lock<std::mutex> lock(sleepLock);
+			sleepers.fetch_add(1);
+			if (running.load() && !AnyQueued())
+				wake.wait_for(lock, std::chrono::milliseconds(1));
+			sleepers.fetch_sub(1);
+			idle = 0;
+		}
+	}
+
+	uint64_t id = 0;
+	uint32_t workerCount = 0;
+	uint32_t slotCount = 0;
+	std::unique_ptr<Slot[]> slots;
+	std::shared_ptr<ExternalSlots> external;
+	std::vector<std::thread> workers;
+	std::atomic<bool> running{ true };
+	std::mutex sleepLock;
+	std::condition_variable wake;
+	std::atomic<uint32_t> sleepers{ 0 };
+};
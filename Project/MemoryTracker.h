@@ -0,0 +1,274 @@
+#pragma once
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <ostream>
+
+// Heap use by what it is for. main.cpp sends operator new and delete here. With MEMORY_TRACKING
+// set to 0 only over-aligned allocations take a detour and nothing is counted.
+#ifndef MEMORY_TRACKING
+#define MEMORY_TRACKING 1
+#endif
+
+// What heap memory is for. An allocation takes the tag of the innermost MemoryTagScope on its
+// thread.
+enum class MemoryTag : uint8_t
+{
+	General,	// Anything untagged.
+	Meshes,		// Vertex and index data, CPU copies and device buffers.
+	Textures,	// Texture files and the images made from them.
+	Transient,	// Frame arenas.
+	Loader,		// Scratch while reading files.
+	Count,
+};
+
+inline const char* MemoryTagName(MemoryTag tag)
+{
+	static const char* names[] = { "general", "meshes", "textures", "transient", "loader" };
+	static_assert(sizeof(names) / sizeof(names[0]) == static_cast<size_t>(MemoryTag::Count), "MemoryTagName out of date");
+	return tag < MemoryTag::Count ? names[static_cast<size_t>(tag)] : "unknown";
+}
+
+// Returns false for a name that isn't a tag.
+inline bool ParseMemoryTag(const char* name, MemoryTag& tag)
+{
+	for (uint32_t i = 0; i < static_cast<uint32_t>(MemoryTag::Count); i++)
+	{
+		if (strcmp(name, MemoryTagName(static_cast<MemoryTag>(i))) == 0)
+		{
+			tag = static_cast<MemoryTag>(i);
+			return true;
+		}
+	}
+	return false;
+}
+
+struct MemoryTagStats
+{
+	uint64_t liveBytes = 0;
+	uint64_t peakBytes = 0;
+	uint64_t allocations = 0;
+	uint64_t frees = 0;
+	uint64_t allocatedBytes = 0;			// Ever, freed or not.
+	double allocationsPerSecond = 0.0;		// Since the report passed to MemoryTracker::Report().
+	double bytesPerSecond = 0.0;
+	uint64_t budget = 0;					// Most peakBytes may reach, 0 for no limit.
+
+	bool OverBudget() const { return budget > 0 && peakBytes > budget; }
+};
+
+struct MemoryReport
+{
+	bool enabled = MEMORY_TRACKING != 0;
+	std::chrono::steady_clock::time_point time;
+	double seconds = 0.0;					// The rates are over this long.
+	MemoryTagStats tags[static_cast<size_t>(MemoryTag::Count)];
+	MemoryTagStats total;					// Its peak is of the sum, not the sum of peaks.
+
+	bool OverBudget() const
+	{
+		for (const MemoryTagStats& tag : tags)
+		{
+			if (tag.OverBudget())
+				return true;
+		}
+		return total.OverBudget();
+	}
+
+	void Print(std::ostream& out) const
+	{
+		if (!enabled)
+		{
+			out << "memory: not tracked, build with MEMORY_TRACKING 1\n";
+			return;
+		}
+		for (uint32_t i = 0; i <= static_cast<uint32_t>(MemoryTag::Count); i++)
+		{
+			bool isTotal = i == static_cast<uint32_t>(MemoryTag::Count);
+			const MemoryTagStats& tag = isTotal ? total : tags[i];
+			out << "memory " << (isTotal ? "total" : MemoryTagName(static_cast<MemoryTag>(i))) << ": " << tag.liveBytes / 1024
+				<< " KB live, " << tag.peakBytes / 1024 << " KB peak, " << tag.allocations << " allocations, "
+				<< tag.allocationsPerSecond << " allocations/s";
+			if (tag.budget > 0)
+				out << ", budget " << tag.budget / 1024 << " KB" << (tag.OverBudget() ? " EXCEEDED" : "");
+			out << "\n";
+		}
+	}
+
+	void WriteJson(std::ostream& out) const
+	{
+		out << "{\n\t\"enabled\": " << (enabled ? "true" : "false") << ",\n\t\"seconds\": " << seconds << ",\n\t\"tags\": {\n";
+		for (uint32_t i = 0; i < static_cast<uint32_t>(MemoryTag::Count); i++)
+		{
+			out << "\t\t\"" << MemoryTagName(static_cast<MemoryTag>(i)) << "\": ";
+			WriteJson(out, tags[i]);
+			out << (i + 1 < static_cast<uint32_t>(MemoryTag::Count) ? ",\n" : "\n");
+		}
+		out << "\t},\n\t\"total\": ";
+		WriteJson(out, total);
+		out << ",\n\t\"overBudget\": " << (OverBudget() ? "true" : "false") << "\n}\n";
+	}
+
+private:
+	static void WriteJson(std::ostream& out, const MemoryTagStats& tag)
+	{
+		out << "{ \"liveBytes\": " << tag.liveBytes << ", \"peakBytes\": " << tag.peakBytes << ", \"allocations\": " << tag.allocations
+			<< ", \"frees\": " << tag.frees << ", \"allocatedBytes\": " << tag.allocatedBytes
+			<< ", \"allocationsPerSecond\": " << tag.allocationsPerSecond << ", \"bytesPerSecond\": " << tag.bytesPerSecond
+			<< ", \"budget\": " << tag.budget << ", \"overBudget\": " << (tag.OverBudget() ? "true" : "false") << " }";
+	}
+};
+
+namespace MemoryTracker
+{
+	// Sits right before the memory handed out.
+	struct Header
+	{
+		void* block;			// What malloc returned.
+		uint64_t sizeAndTag;	// Requested size, tag in the top byte.
+	};
+	static_assert(sizeof(Header) % alignof(std::max_align_t) == 0, "Header must keep malloc's alignment");
+
+	struct Counters
+	{
+		std::atomic<uint64_t> live{ 0 }, peak{ 0 };
+		std::atomic<uint64_t> allocations{ 0 }, frees{ 0 }, allocatedBytes{ 0 };
+		std::atomic<uint64_t> budget{ 0 };
+	};
+
+	// One per tag, then the total.
+	inline Counters* GetCounters()
+	{
+		static Counters counters[static_cast<size_t>(MemoryTag::Count) + 1];
+		return counters;
+	}
+
+	inline const std::chrono::steady_clock::time_point started = std::chrono::steady_clock::now();
+
+	inline MemoryTag& CurrentTag()
+	{
+		static thread_local MemoryTag tag = MemoryTag::General;
+		return tag;
+	}
+
+	inline void Count(Counters& counters, uint64_t size)
+	{
+		uint64_t live = counters.live.fetch_add(size, std::memory_order_relaxed) + size;
+		uint64_t peak = counters.peak.load(std::memory_order_relaxed);
+		while (live > peak && !counters.peak.compare_exchange_weak(peak, live, std::memory_order_relaxed))
+		{
+		}
+		counters.allocations.fetch_add(1, std::memory_order_relaxed);
+		counters.allocatedBytes.fetch_add(size, std::memory_order_relaxed);
+	}
+
+	inline void Uncount(Counters& counters, uint64_t size)
+	{
+		counters.live.fetch_sub(size, std::memory_order_relaxed);
+		counters.frees.fetch_add(1, std::memory_order_relaxed);
+	}
+
+	// 'alignment' is 0 for malloc's own. Returns nullptr when out of memory.
+	inline void* Allocate(size_t size, size_t alignment = 0)
+	{
+#if !MEMORY_TRACKING
+		if (alignment == 0)
+			return malloc(size > 0 ? size : 1);
+#endif
+		size_t slack = alignment > alignof(std::max_align_t) ? alignment : 0;
+		void* block = malloc(sizeof(Header) + size + slack);
+		if (block == nullptr)
+			return nullptr;
+		uintptr_t memory = reinterpret_cast<uintptr_t>(block) + sizeof(Header);
+		if (slack > 0)
+			memory = (memory + alignment - 1) & ~static_cast<uintptr_t>(alignment - 1);
+		Header* header = reinterpret_cast<Header*>(memory) - 1;
+		header->block = block;
+#if MEMORY_TRACKING
+		MemoryTag tag = CurrentTag();
+		header->sizeAndTag = static_cast<uint64_t>(size) | (static_cast<uint64_t>(tag) << 56);
+		Count(GetCounters()[static_cast<size_t>(tag)], size);
+		Count(GetCounters()[static_cast<size_t>(MemoryTag::Count)], size);
+#endif
+		return reinterpret_cast<void*>(memory);
+	}
+
+	// 'aligned' when it came from Allocate() with an alignment.
+	inline void Free(void* memory, bool aligned = false)
+	{
+		if (memory == nullptr)
+			return;
+#if MEMORY_TRACKING
+		(void)aligned;		// Every block has a header while tracking.
+#else
+		if (!aligned)
+		{
+			free(memory);
+			return;
+		}
+#endif
+		Header* header = static_cast<Header*>(memory) - 1;
+#if MEMORY_TRACKING
+		uint64_t size = header->sizeAndTag & ((1ull << 56) - 1);
+		Uncount(GetCounters()[static_cast<size_t>(header->sizeAndTag >> 56)], size);
+		Uncount(GetCounters()[static_cast<size_t>(MemoryTag::Count)], size);
+#endif
+		free(header->block);
+	}
+
+	// Peak bytes over 'bytes' is reported as over budget; 0 removes the limit. MemoryTag::Count
+	// sets the budget of the total.
+	inline void SetBudget(MemoryTag tag, uint64_t bytes)
+	{
+		GetCounters()[static_cast<size_t>(tag)].budget.store(bytes, std::memory_order_relaxed);
+	}
+
+	// Rates are since 'previous', or since the program started without one.
+	inline MemoryReport Report(const MemoryReport* previous = nullptr)
+	{
+		MemoryReport report;
+		report.time = std::chrono::steady_clock::now();
+		report.seconds = std::chrono::duration<double>(report.time - (previous != nullptr ? previous->time : started)).count();
+		for (uint32_t i = 0; i <= static_cast<uint32_t>(MemoryTag::Count); i++)
+		{
+			const Counters& counters = GetCounters()[i];
+			MemoryTagStats& tag = i < static_cast<uint32_t>(MemoryTag::Count) ? report.tags[i] : report.total;
+			tag.liveBytes = counters.live.load(std::memory_order_relaxed);
+			tag.peakBytes = counters.peak.load(std::memory_order_relaxed);
+			tag.allocations = counters.allocations.load(std::memory_order_relaxed);
+			tag.frees = counters.frees.load(std::memory_order_relaxed);
+			tag.allocatedBytes = counters.allocatedBytes.load(std::memory_order_relaxed);
+			tag.budget = counters.budget.load(std::memory_order_relaxed);
+
+			const MemoryTagStats* before = previous == nullptr ? nullptr :
+				(i < static_cast<uint32_t>(MemoryTag::Count) ? &previous->tags[i] : &previous->total);
+			double seconds = report.seconds > 0.0 ? report.seconds : 1.0;
+			tag.allocationsPerSecond = (tag.allocations - (before != nullptr ? before->allocations : 0)) / seconds;
+			tag.bytesPerSecond = (tag.allocatedBytes - (before != nullptr ? before->allocatedBytes : 0)) / seconds;
+		}
+		return report;
+	}
+}
+
+// Tags the heap allocations this thread makes while it is open.
+class MemoryTagScope
+{
+public:
+#if MEMORY_TRACKING
+	explicit MemoryTagScope(MemoryTag tag) : previous(MemoryTracker::CurrentTag()) { MemoryTracker::CurrentTag() = tag; }
+	~MemoryTagScope() { MemoryTracker::CurrentTag() = previous; }
+#else
+	explicit MemoryTagScope(MemoryTag) {}
+#endif
+
+	MemoryTagScope(const MemoryTagScope&) = delete;
+	MemoryTagScope& operator=(const MemoryTagScope&) = delete;
+
+#if MEMORY_TRACKING
+private:
+	MemoryTag previous;
+#endif
+};
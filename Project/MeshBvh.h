@@ -0,0 +1,204 @@
+#pragma once
+#include "SceneBvh.h"
+
+// A ray for MeshBvh's batched queries.
+struct MeshRay
+{
+	XMFLOAT3 origin;
+	float maxDistance;
+	XMFLOAT3 direction;
+};
+
+// The nearest triangle along a ray. 'u' and 'v' weight the triangle's second and third corners.
+struct MeshHit
+{
+	uint32_t triangle = UINT32_MAX;		// Index of the triangle in the index list / 3.
+	float distance = FLT_MAX;
+	float u = 0.0f, v = 0.0f;
+};
+
+// Triangle BVH over one mesh, in the mesh's own space, for exact ray casts. It is built once with
+// SceneBvh's binned SAH build over the triangles' boxes; the triangles are then stored in leaf
+// order as a corner and two edges so a leaf reads them in sequence.
+//
+// Triangles are hit the way GCollision::IntersectRayToTriangleF hits them: Moller-Trumbore, both
+// faces count, and a ray whose determinant is under 1e-6 misses. Unlike it, hits behind the origin
+// don't count, and distances are the ray parameter rather than the length to the contact. The two
+// agree for a normalized direction, and the parameter survives moving the ray into the mesh's
+// space, so a world space ray's hit distance is still in world units.
+class MeshBvh
+{
+public:
+	void Build(const void* vertices, uint32_t vertexCount, uint32_t stride, const unsigned int* indices, uint32_t indexCount)
+	{
+		uint32_t count = indexCount / 3;
+		std::vector<XMFLOAT3> boundsMin(count), boundsMax(count);
+		std::vector<XMFLOAT3> corners(count * 3);
+		const uint8_t* base = static_cast<const uint8_t*>(vertices);
+		for (uint32_t t = 0; t < count; t++)
+		{
+			for (uint32_t c = 0; c < 3; c++)
+			{
+				uint32_t index = indices[t * 3 + c];
+				corners[t * 3 + c] = index < vertexCount ? *reinterpret_cast<const XMFLOAT3*>(base + index * stride) : XMFLOAT3(0.0f, 0.0f, 0.0f);
+			}
+			const XMFLOAT3& a = corners[t * 3], &b = corners[t * 3 + 1], &c = corners[t * 3 + 2];
+			boundsMin[t] = XMFLOAT3(MinF(a.x, MinF(b.x, c.x)), MinF(a.y, MinF(b.y, c.y)), MinF(a.z, MinF(b.z, c.z)));
+			boundsMax[t] = XMFLOAT3(MaxF(a.x, MaxF(b.x, c.x)), MaxF(a.y, MaxF(b.y, c.y)), MaxF(a.z, MaxF(b.z, c.z)));
+		}
+
+		uint32_t depth;
+		SceneBvh::BuildTree(boundsMin, boundsMax, nodes, triangleIds, depth);
+
+		triangles.resize(count);
+		for (uint32_t i = 0; i < count; i++)
+		{
+			const XMFLOAT3* corner = &corners[triangleIds[i] * 3];
+			MeshTriangle& triangle = triangles[i];
+			triangle.a = corner[0];
+			triangle.ab = XMFLOAT3(corner[1].x - corner[0].x, corner[1].y - corner[0].y, corner[1].z - corner[0].z);
+			triangle.ac = XMFLOAT3(corner[2].x - corner[0].x, corner[2].y - corner[0].y, corner[2].z - corner[0].z);
+		}
+	}
+
+	// Nearest hit before 'maxDistance', in units of 'direction'.
+	bool Intersect(const XMFLOAT3& origin, const XMFLOAT3& direction, float maxDistance, MeshHit& hit) const
+	{
+		hit = MeshHit();
+		return Traverse<false>(origin, direction, maxDistance, hit);
+	}
+
+	// Whether anything is hit before 'maxDistance'. Stops at the first hit, for line of sight.
+	bool Occluded(const XMFLOAT3& origin, const XMFLOAT3& direction, float maxDistance) const
+	{
+		MeshHit hit;
+		return Traverse<true>(origin, direction, maxDistance, hit);
+	}
+
+	// Intersect() for every ray. Returns how many hit.
+	uint32_t IntersectBatch(const MeshRay* rays, uint32_t count, MeshHit* hits) const
+	{
+		uint32_t hitCount = 0;
+		for (uint32_t i = 0; i < count; i++)
+			hitCount += Intersect(rays[i].origin, rays[i].direction, rays[i].maxDistance, hits[i]) ? 1 : 0;
+		return hitCount;
+	}
+
+	// Occluded() for every ray, one flag each. Returns how many are blocked.
+	uint32_t OccludedBatch(const MeshRay* rays, uint32_t count, uint8_t* occluded) const
+	{
+		uint32_t blocked = 0;
+		for (uint32_t i = 0; i < count; i++)
+		{
+			occluded[i] = Occluded(rays[i].origin, rays[i].direction, rays[i].maxDistance) ? 1 : 0;
+			blocked += occluded[i];
+		}
+		return blocked;
+	}
+
+	uint32_t TriangleCount() const { return static_cast<uint32_t>(triangles.size()); }
+	const std::vector<BvhNode>& GetNodes() const { return nodes; }
+
+	// Test of one triangle of the index list, with the same rules, for checking the tree.
+	static bool IntersectTriangle(const XMFLOAT3& origin, const XMFLOAT3& direction, const XMFLOAT3& a, const XMFLOAT3& b, const XMFLOAT3& c, float maxDistance, MeshHit& hit)
+	{
+		MeshTriangle triangle = { a, XMFLOAT3(b.x - a.x, b.y - a.y, b.z - a.z), XMFLOAT3(c.x - a.x, c.y - a.y, c.z - a.z) };
+		return HitTriangle(origin, direction, triangle, maxDistance, hit);
+	}
+
+private:
+	struct MeshTriangle
+	{
+		XMFLOAT3 a, ab, ac;
+	};
+
+	static float MinF(float a, float b) { return a < b ? a : b; }
+	static float MaxF(float a, float b) { return a > b ? a : b; }
+
+	// Moller-Trumbore. Fills 'hit' except the triangle index.
+	static bool HitTriangle(const XMFLOAT3& origin, const XMFLOAT3& direction, const MeshTriangle& triangle, float maxDistance, MeshHit& hit)
+	{
+		const XMFLOAT3& ab = triangle.ab, &ac = triangle.ac;
+		XMFLOAT3 q(direction.y * ac.z - direction.z * ac.y, direction.z * ac.x - direction.x * ac.z, direction.x * ac.y - direction.y * ac.x);
+		float det = ab.x * q.x + ab.y * q.y + ab.z * q.z;
+		// Parallel to the triangle.
+		if (det > -0.000001f && det < 0.000001f)
+			return false;
+		float inverse = 1.0f / det;
+		XMFLOAT3 s(origin.x - triangle.a.x, origin.y - triangle.a.y, origin.z - triangle.a.z);
+		float u = (s.x * q.x + s.y * q.y + s.z * q.z) * inverse;
+		if (u < 0.0f || u > 1.0f)
+			return false;
+		XMFLOAT3 r(s.y * ab.z - s.z * ab.y, s.z * ab.x - s.x * ab.z, s.x * ab.y - s.y * ab.x);
+		float v = (direction.x * r.x + direction.y * r.y + direction.z * r.z) * inverse;
+		if (v < 0.0f || u + v > 1.0f)
+			return false;
+		float t = (ac.x * r.x + ac.y * r.y + ac.z * r.z) * inverse;
+		if (t < 0.0f || t >= maxDistance)
+			return false;
+		hit.distance = t;
+		hit.u = u;
+		hit.v = v;
+		return true;
+	}
+
+	// Nearer children first. Entries carry where the ray enters their box, so ones beyond a hit
+	// found since they were pushed are dropped without touching the node.
+	template<bool AnyHit>
+	bool Traverse(const XMFLOAT3& origin, const XMFLOAT3& direction, float maxDistance, MeshHit& hit) const
+	{
+		if (nodes.empty())
+			return false;
+
+		XMFLOAT3 invDir(1.0f / direction.x, 1.0f / direction.y, 1.0f / direction.z);
+		struct Entry { uint32_t node; float enter; };
+		Entry stack[SceneBvh::StackSize];
+		uint32_t top = 0;
+		float tRoot;
+		if (SceneBvh::RayBox(origin, invDir, nodes[0].boundsMin, nodes[0].boundsMax, maxDistance, tRoot))
+			stack[top++] = { 0, tRoot };
+		bool found = false;
+		while (top > 0)
+		{
+			Entry entry = stack[--top];
+			if (entry.enter > maxDistance)
+				continue;
+			const BvhNode& node = nodes[entry.node];
+			if (node.count > 0)
+			{
+				for (uint32_t i = node.first; i < node.first + node.count; i++)
+				{
+					if (!HitTriangle(origin, direction, triangles[i], maxDistance, hit))
+						continue;
+					hit.triangle = triangleIds[i];
+					maxDistance = hit.distance;
+					found = true;
+					if (AnyHit)
+						return true;
+				}
+				continue;
+			}
+
+			float tLeft, tRight;
+			const BvhNode& left = nodes[node.first];
+			const BvhNode& right = nodes[node.first + 1];
+			bool hitLeft = SceneBvh::RayBox(origin, invDir, left.boundsMin, left.boundsMax, maxDistance, tLeft);
+			bool hitRight = SceneBvh::RayBox(origin, invDir, right.boundsMin, right.boundsMax, maxDistance, tRight);
+			if (hitLeft && hitRight)
+			{
+				bool leftFirst = tLeft <= tRight;
+				stack[top++] = leftFirst ? Entry{ node.first + 1, tRight } : Entry{ node.first, tLeft };
+				stack[top++] = leftFirst ? Entry{ node.first, tLeft } : Entry{ node.first + 1, tRight };
+			}
+			else if (hitLeft)
+				stack[top++] = { node.first, tLeft };
+			else if (hitRight)
+				stack[top++] = { node.first + 1, tRight };
+		}
+		return found;
+	}
+
+	std::vector<BvhNode> nodes;
+	std::vector<MeshTriangle> triangles;	// In leaf order.
+	std::vector<uint32_t> triangleIds;		// Index list triangle of each stored one.
+};
@@ -0,0 +1,416 @@
+#pragma once
+#include "defines.h"
+#include "RasterSimd.h"
+#include <chrono>
+#include <cfloat>
+#include <cmath>
+#include <cstdint>
+#include <vector>
+
+// CPU occlusion culling in the style of Intel's masked occlusion culling.
+//
+// Occluders are rasterized at low resolution into 8x4 pixel tiles that keep no per pixel depth.
+// A tile holds a conservative farthest depth for all of its pixels plus a layer being built in
+// front of it: a coverage mask and the farthest depth drawn into that mask. Once the mask is full
+// the layer becomes the tile depth.
+// The tile depths are reduced into a Hi-Z pyramid of farthest depths, and a box is hidden when
+// its nearest point is behind every texel under its screen rectangle. Depth is D3D's, 0 near 1 far.
+static const uint32_t OcclusionTileWidth = 8;
+static const uint32_t OcclusionTileHeight = 4;
+static_assert(OcclusionTileWidth * OcclusionTileHeight == 32, "A tile's coverage mask is one uint32_t");
+
+// Work done between Begin() and End().
+struct OcclusionStats
+{
+	uint32_t occluderTriangles = 0;	// Rasterized, after clipping and back face culling.
+	uint32_t tested = 0;
+	uint32_t culled = 0;
+	double ms = 0.0;
+
+	void Reset() { *this = OcclusionStats(); }
+};
+
+class OcclusionCuller
+{
+public:
+	// The depth buffer is '_width' x '_height' pixels, rounded up to whole tiles.
+	OcclusionCuller(uint32_t _width = 320, uint32_t _height = 192)
+	{
+		tilesX = (_width + OcclusionTileWidth - 1) / OcclusionTileWidth;
+		tilesY = (_height + OcclusionTileHeight - 1) / OcclusionTileHeight;
+		tilesX = tilesX == 0 ? 1 : tilesX;
+		tilesY = tilesY == 0 ? 1 : tilesY;
+		width = tilesX * OcclusionTileWidth;
+		height = tilesY * OcclusionTileHeight;
+		tiles.resize(tilesX * tilesY);
+
+		// Level 0 is one texel per tile, each level above halves it down to 1x1.
+		uint32_t levelWidth = tilesX, levelHeight = tilesY;
+		for (;;)
+		{
+			HiZLevel level;
+			level.width = levelWidth;
+			level.height = levelHeight;
+			level.depth.resize(levelWidth * levelHeight);
+			levels.push_back(level);
+			if (levelWidth == 1 && levelHeight == 1)
+				break;
+			levelWidth = (levelWidth + 1) / 2;
+			levelHeight = (levelHeight + 1) / 2;
+		}
+	}
+
+	// Clears the depth buffer for a new view. Row vector convention, like the shaders' inputs.
+	void Begin(FXMMATRIX _viewProjection)
+	{
+		start = std::chrono::steady_clock::now();
+		stats.Reset();
+		viewProjection = _viewProjection;
+		for (OcclusionTile& tile : tiles)
+		{
+			tile.zMax0 = 1.0f;
+			tile.zMax1 = 0.0f;
+			tile.mask = 0;
+		}
+	}
+
+	// Rasterizes an indexed triangle list. Each of the 'stride' byte vertices starts with its
+	// object space position.
+	void RenderOccluder(const void* vertices, uint32_t vertexCount, uint32_t stride, const uint32_t* indices, uint32_t indexCount, FXMMATRIX world)
+	{
+		XMMATRIX worldViewProjection = XMMatrixMultiply(world, viewProjection);
+		clipVertices.resize(vertexCount);
+		const uint8_t* vertex = static_cast<const uint8_t*>(vertices);
+		for (uint32_t i = 0; i < vertexCount; i++, vertex += stride)
+			XMStoreFloat4(&clipVertices[i], XMVector3Transform(XMLoadFloat3(reinterpret_cast<const XMFLOAT3*>(vertex)), worldViewProjection));
+
+		for (uint32_t i = 0; i + 2 < indexCount; i += 3)
+			SubmitTriangle(clipVertices[indices[i]], clipVertices[indices[i + 1]], clipVertices[indices[i + 2]]);
+	}
+
+	// Reduces the tile depths into the pyramid. Call after the occluders, before testing.
+	void BuildHiZ()
+	{
+		std::vector<float>& base = levels[0].depth;
+		for (size_t i = 0; i < tiles.size(); i++)
+			base[i] = tiles[i].zMax0;
+
+		for (size_t l = 1; l < levels.size(); l++)
+		{
+			const HiZLevel& src = levels[l - 1];
+			HiZLevel& dst = levels[l];
+			for (uint32_t y = 0; y < dst.height; y++)
+			{
+				uint32_t y0 = y * 2, y1 = y0 + 1 < src.height ? y0 + 1 : y0;
+				for (uint32_t x = 0; x < dst.width; x++)
+				{
+					uint32_t x0 = x * 2, x1 = x0 + 1 < src.width ? x0 + 1 : x0;
+					float a = src.depth[y0 * src.width + x0], b = src.depth[y0 * src.width + x1];
+					float c = src.depth[y1 * src.width + x0], d = src.depth[y1 * src.width + x1];
+					dst.depth[y * dst.width + x] = MaxF(MaxF(a, b), MaxF(c, d));
+				}
+			}
+		}
+	}
+
+	// False if the world space box is certainly hidden by the occluders.
+	// Boxes that cross the near plane or leave the screen are kept; frustum culling is separate.
+	bool TestAABB(const XMFLOAT3& boundsMin, const XMFLOAT3& boundsMax)
+	{
+		stats.tested++;
+
+		float minX = FLT_MAX, minY = FLT_MAX, maxX = -FLT_MAX, maxY = -FLT_MAX, zNear = FLT_MAX;
+		for (uint32_t i = 0; i < 8; i++)
+		{
+			XMVECTOR corner = XMVectorSet((i & 1) ? boundsMax.x : boundsMin.x, (i & 2) ? boundsMax.y : boundsMin.y, (i & 4) ? boundsMax.z : boundsMin.z, 1.0f);
+			XMFLOAT4 p;
+			XMStoreFloat4(&p, XMVector4Transform(corner, viewProjection));
+			if (p.z < 0.0f || p.w <= 0.0f)
+				return true;
+			float invW = 1.0f / p.w;
+			float sx = (p.x * invW * 0.5f + 0.5f) * width;
+			float sy = (0.5f - p.y * invW * 0.5f) * height;
+			minX = MinF(minX, sx);
+			maxX = MaxF(maxX, sx);
+			minY = MinF(minY, sy);
+			maxY = MaxF(maxY, sy);
+			zNear = MinF(zNear, p.z * invW);
+		}
+		if (maxX < 0.0f || maxY < 0.0f || minX >= static_cast<float>(width) || minY >= static_cast<float>(height))
+			return true;
+
+		int32_t tx0 = static_cast<int32_t>(MaxF(minX, 0.0f)) / static_cast<int32_t>(OcclusionTileWidth);
+		int32_t ty0 = static_cast<int32_t>(MaxF(minY, 0.0f)) / static_cast<int32_t>(OcclusionTileHeight);
+		int32_t tx1 = static_cast<int32_t>(MinF(maxX, width - 1.0f)) / static_cast<int32_t>(OcclusionTileWidth);
+		int32_t ty1 = static_cast<int32_t>(MinF(maxY, height - 1.0f)) / static_cast<int32_t>(OcclusionTileHeight);
+
+		// Go up the pyramid until the rectangle is at most 4x4 texels.
+		uint32_t l = 0;
+		while (l + 1 < levels.size() && ((tx1 >> l) - (tx0 >> l) >= 4 || (ty1 >> l) - (ty0 >> l) >= 4))
+			l++;
+		const HiZLevel& level = levels[l];
+		for (int32_t y = ty0 >> l; y <= (ty1 >> l); y++)
+		{
+			for (int32_t x = tx0 >> l; x <= (tx1 >> l); x++)
+			{
+				if (zNear <= level.depth[y * level.width + x])
+					return true;
+			}
+		}
+
+		stats.culled++;
+		return false;
+	}
+
+	// Ends the frame's culling and records its time.
+	void End()
+	{
+		stats.ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+	}
+
+	const OcclusionStats& GetStats() const { return stats; }
+	uint32_t GetWidth() const { return width; }
+	uint32_t GetHeight() const { return height; }
+
+private:
+	struct OcclusionTile
+	{
+		float zMax0;		// No pixel of the tile is farther.
+		float zMax1;		// No pixel under 'mask' is farther.
+		uint32_t mask;		// Bit y * 8 + x.
+	};
+
+	// Edge functions of a triangle and, per edge, how far below and above its value at a tile's
+	// first pixel it gets over the tile.
+	struct TileEdges
+	{
+		float stepX[3], stepY[3], bias[3];
+		float cornerMin[3], cornerMax[3];
+	};
+
+	struct HiZLevel
+	{
+		uint32_t width = 0, height = 0;
+		std::vector<float> depth;
+	};
+
+	// fminf/fmaxf are library calls without fast math.
+	static float MinF(float a, float b) { return a < b ? a : b; }
+	static float MaxF(float a, float b) { return a > b ? a : b; }
+
+	// The near plane and a guard band that keeps screen coordinates small enough for float edges.
+	static const uint32_t ClipPlaneCount = 5;
+	static constexpr float GuardBand = 2.0f;
+
+	static float ClipDistance(uint32_t plane, const XMFLOAT4& p)
+	{
+		switch (plane)
+		{
+		case 0: return p.z;
+		case 1: return GuardBand * p.w + p.x;
+		case 2: return GuardBand * p.w - p.x;
+		case 3: return GuardBand * p.w + p.y;
+		default: return GuardBand * p.w - p.y;
+		}
+	}
+
+	void SubmitTriangle(const XMFLOAT4& v0, const XMFLOAT4& v1, const XMFLOAT4& v2)
+	{
+		const XMFLOAT4* in[3] = { &v0, &v1, &v2 };
+
+		uint32_t outsideAll = ~0u, clipAny = 0;
+		for (uint32_t i = 0; i < 3; i++)
+		{
+			const XMFLOAT4& p = *in[i];
+			uint32_t code = (p.x < -p.w ? 1u : 0u) | (p.x > p.w ? 2u : 0u) | (p.y < -p.w ? 4u : 0u) |
+				(p.y > p.w ? 8u : 0u) | (p.z < 0.0f ? 16u : 0u);
+			outsideAll &= code;
+			for (uint32_t plane = 0; plane < ClipPlaneCount; plane++)
+				clipAny |= ClipDistance(plane, p) < 0.0f ? 1u << plane : 0u;
+		}
+		if (outsideAll != 0)
+			return;
+		if (clipAny == 0)
+		{
+			RasterizeTriangle(v0, v1, v2);
+			return;
+		}
+
+		XMFLOAT4 polygons[2][3 + ClipPlaneCount];
+		uint32_t count = 3;
+		for (uint32_t i = 0; i < 3; i++)
+			polygons[0][i] = *in[i];
+		uint32_t current = 0;
+		for (uint32_t plane = 0; plane < ClipPlaneCount && count >= 3; plane++)
+		{
+			if ((clipAny & (1u << plane)) == 0)
+				continue;
+			const XMFLOAT4* src = polygons[current];
+			XMFLOAT4* dst = polygons[current ^ 1];
+			uint32_t clippedCount = 0;
+			for (uint32_t i = 0; i < count; i++)
+			{
+				const XMFLOAT4& a = src[i];
+				const XMFLOAT4& b = src[(i + 1) % count];
+				float da = ClipDistance(plane, a), db = ClipDistance(plane, b);
+				if (da >= 0.0f)
+					dst[clippedCount++] = a;
+				if ((da >= 0.0f) != (db >= 0.0f))
+				{
+					float t = da / (da - db);
+					dst[clippedCount++] = XMFLOAT4(a.x + (b.x - a.x) * t, a.y + (b.y - a.y) * t, a.z + (b.z - a.z) * t, a.w + (b.w - a.w) * t);
+				}
+			}
+			count = clippedCount;
+			current ^= 1;
+		}
+		for (uint32_t i = 1; i + 1 < count; i++)
+			RasterizeTriangle(polygons[current][0], polygons[current][i], polygons[current][i + 1]);
+	}
+
+	void RasterizeTriangle(const XMFLOAT4& v0, const XMFLOAT4& v1, const XMFLOAT4& v2)
+	{
+		const XMFLOAT4* in[3] = { &v0, &v1, &v2 };
+		float x[3], y[3], z[3];
+		for (uint32_t i = 0; i < 3; i++)
+		{
+			float invW = 1.0f / in[i]->w;
+			x[i] = (in[i]->x * invW * 0.5f + 0.5f) * width;
+			y[i] = (0.5f - in[i]->y * invW * 0.5f) * height;
+			z[i] = in[i]->z * invW;
+		}
+
+		// Clockwise is front, like the GPU; the ground plane must not hide anything from below.
+		float area = (x[1] - x[0]) * (y[2] - y[0]) - (y[1] - y[0]) * (x[2] - x[0]);
+		if (!(area > 0.0f))
+			return;
+
+		int32_t minX = static_cast<int32_t>(floorf(MaxF(MinF(MinF(x[0], x[1]), x[2]), 0.0f)));
+		int32_t minY = static_cast<int32_t>(floorf(MaxF(MinF(MinF(y[0], y[1]), y[2]), 0.0f)));
+		int32_t maxX = static_cast<int32_t>(ceilf(MinF(MaxF(MaxF(x[0], x[1]), x[2]), static_cast<float>(width))));
+		int32_t maxY = static_cast<int32_t>(ceilf(MinF(MaxF(MaxF(y[0], y[1]), y[2]), static_cast<float>(height))));
+		if (minX >= maxX || minY >= maxY)
+			return;
+		stats.occluderTriangles++;
+
+		// Depth is planar in screen space. A tile's farthest point is at one of its corners,
+		// and never farther than the farthest vertex.
+		float dzdx = ((z[1] - z[0]) * (y[2] - y[0]) - (y[1] - y[0]) * (z[2] - z[0])) / area;
+		float dzdy = ((x[1] - x[0]) * (z[2] - z[0]) - (z[1] - z[0]) * (x[2] - x[0])) / area;
+		float zVertexMax = MinF(MaxF(MaxF(z[0], z[1]), z[2]), 1.0f);
+
+		// Edge i runs from vertex i + 1 to i + 2 and is positive inside; pixel centers are sampled.
+		// Edges are linear, so their extremes over a tile are at its corner pixels.
+		TileEdges edges;
+		const float lastX = OcclusionTileWidth - 1.0f, lastY = OcclusionTileHeight - 1.0f;
+		for (uint32_t i = 0; i < 3; i++)
+		{
+			uint32_t a = (i + 1) % 3, b = (i + 2) % 3;
+			edges.stepX[i] = -(y[b] - y[a]);
+			edges.stepY[i] = x[b] - x[a];
+			edges.bias[i] = -(edges.stepY[i] * y[a] + edges.stepX[i] * x[a]);
+			edges.cornerMin[i] = MinF(edges.stepX[i] * lastX, 0.0f) + MinF(edges.stepY[i] * lastY, 0.0f);
+			edges.cornerMax[i] = MaxF(edges.stepX[i] * lastX, 0.0f) + MaxF(edges.stepY[i] * lastY, 0.0f);
+		}
+
+		int32_t tileX0 = minX / static_cast<int32_t>(OcclusionTileWidth), tileX1 = (maxX - 1) / static_cast<int32_t>(OcclusionTileWidth);
+		int32_t tileY0 = minY / static_cast<int32_t>(OcclusionTileHeight), tileY1 = (maxY - 1) / static_cast<int32_t>(OcclusionTileHeight);
+		for (int32_t ty = tileY0; ty <= tileY1; ty++)
+		{
+			for (int32_t tx = tileX0; tx <= tileX1; tx++)
+			{
+				OcclusionTile& tile = tiles[ty * tilesX + tx];
+				float left = static_cast<float>(tx * OcclusionTileWidth), top = static_cast<float>(ty * OcclusionTileHeight);
+				float right = left + OcclusionTileWidth, bottom = top + OcclusionTileHeight;
+
+				float zTile = z[0] + dzdx * ((dzdx > 0.0f ? right : left) - x[0]) + dzdy * ((dzdy > 0.0f ? bottom : top) - y[0]);
+				zTile = MinF(zTile, zVertexMax);
+				if (zTile >= tile.zMax0)
+					continue;
+
+				uint32_t mask = CoverTile(edges, left + 0.5f, top + 0.5f);
+				if (mask != 0)
+					MergeTile(tile, mask, MaxF(zTile, 0.0f));
+			}
+		}
+	}
+
+	// Coverage of one tile, bit y * 8 + x; 'px'/'py' is its first pixel center.
+	static uint32_t CoverTile(const TileEdges& edges, float px, float py)
+	{
+		bool inside = true;
+		float e[3];
+		for (uint32_t i = 0; i < 3; i++)
+		{
+			e[i] = edges.bias[i] + edges.stepX[i] * px + edges.stepY[i] * py;
+			if (e[i] + edges.cornerMax[i] < 0.0f)
+				return 0;
+			inside = inside && e[i] + edges.cornerMin[i] >= 0.0f;
+		}
+		if (inside)
+			return ~0u;
+
+		uint32_t mask = 0;
+#if RASTER_SIMD
+		// Two registers per row of eight pixels.
+		const __m128 zero = _mm_setzero_ps();
+		const __m128 left = _mm_set_ps(3.0f, 2.0f, 1.0f, 0.0f), right = _mm_set_ps(7.0f, 6.0f, 5.0f, 4.0f);
+		__m128 stepLeft[3], stepRight[3];
+		for (uint32_t i = 0; i < 3; i++)
+		{
+			__m128 step = _mm_set1_ps(edges.stepX[i]);
+			stepLeft[i] = _mm_mul_ps(step, left);
+			stepRight[i] = _mm_mul_ps(step, right);
+		}
+		for (uint32_t y = 0; y < OcclusionTileHeight; y++)
+		{
+			__m128 inLeft = _mm_castsi128_ps(_mm_set1_epi32(-1)), inRight = inLeft;
+			for (uint32_t i = 0; i < 3; i++)
+			{
+				__m128 row = _mm_set1_ps(e[i] + edges.stepY[i] * y);
+				inLeft = _mm_and_ps(inLeft, _mm_cmpge_ps(_mm_add_ps(row, stepLeft[i]), zero));
+				inRight = _mm_and_ps(inRight, _mm_cmpge_ps(_mm_add_ps(row, stepRight[i]), zero));
+			}
+			uint32_t bits = static_cast<uint32_t>(_mm_movemask_ps(inLeft) | (_mm_movemask_ps(inRight) << 4));
+			mask |= bits << (y * OcclusionTileWidth);
+		}
+#else
+		for (uint32_t y = 0; y < OcclusionTileHeight; y++)
+		{
+			for (uint32_t x = 0; x < OcclusionTileWidth; x++)
+			{
+				float fx = static_cast<float>(x);
+				uint32_t covered = (e[0] + edges.stepX[0] * fx >= 0.0f) & (e[1] + edges.stepX[1] * fx >= 0.0f) & (e[2] + edges.stepX[2] * fx >= 0.0f);
+				mask |= covered << (y * OcclusionTileWidth + x);
+			}
+			e[0] += edges.stepY[0];
+			e[1] += edges.stepY[1];
+			e[2] += edges.stepY[2];
+		}
+#endif
+		return mask;
+	}
+
+	// Adds covered pixels at 'zTile' or nearer to the tile's working layer; a full layer replaces
+	// the tile depth.
+	static void MergeTile(OcclusionTile& tile, uint32_t mask, float zTile)
+	{
+		tile.mask |= mask;
+		tile.zMax1 = MaxF(tile.zMax1, zTile);
+		if (tile.mask == ~0u)
+		{
+			tile.zMax0 = tile.zMax1;
+			tile.zMax1 = 0.0f;
+			tile.mask = 0;
+		}
+	}
+
+	uint32_t width = 0, height = 0;
+	uint32_t tilesX = 0, tilesY = 0;
+	std::vector<OcclusionTile> tiles;
+	std::vector<HiZLevel> levels;
+	std::vector<XMFLOAT4> clipVertices;
+	XMMATRIX viewProjection;
+	OcclusionStats stats;
+	std::chrono::steady_clock::time_point start;
+};
@@ -0,0 +1,290 @@
+#pragma once
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <vector>
+#if defined(_M_X64) || defined(_M_IX86) || defined(__x86_64__) || defined(__i386__)
+#define PROFILER_TSC 1
+#ifdef _MSC_VER
+#include <intrin.h>
+#else
+#include <x86intrin.h>
+#endif
+#else
+#define PROFILER_TSC 0
+#endif
+
+// Hierarchical CPU scopes. PROFILE_SCOPE("name") times the rest of the enclosing block on the
+// calling thread while the profiler is enabled; names are string literals, only the pointer is
+// kept. Each thread writes finished scopes to its own ring, so recording takes no lock and never
+// waits on another thread. The rings keep the last Profiler::RingSize scopes per thread, which can
+// be written as a Chrome trace (chrome://tracing or ui.perfetto.dev) or summed by name. With
+// PROFILING set to 0 the scopes compile to nothing.
+#ifndef PROFILING
+#define PROFILING 1
+#endif
+
+struct ProfileEvent
+{
+	const char* name;
+	uint64_t begin, end;	// Profiler::Now() ticks.
+	uint32_t depth;			// Scopes open around it on its thread.
+};
+
+// The scopes of one name still in the rings.
+struct ProfileStat
+{
+	const char* name = nullptr;
+	uint64_t count = 0;
+	double totalMs = 0.0;
+	double maxMs = 0.0;
+};
+
+namespace Profiler
+{
+	static const uint32_t RingSize = 1 << 15;
+	static const uint32_t MaxThreads = 64;
+
+	// Written by its thread only; 'written' publishes the events before it.
+	struct ThreadRing
+	{
+		ProfileEvent events[RingSize];
+		std::atomic<uint64_t> written{ 0 };
+		std::atomic<const char*> name{ nullptr };
+		uint32_t depth = 0;
+		uint32_t index = 0;
+	};
+
+	// Rings live as long as the program, so a trace still has threads that have ended.
+	inline std::atomic<ThreadRing*> rings[MaxThreads];
+	inline std::atomic<uint32_t> ringCount{ 0 };
+	inline std::atomic<bool> enabled{ false };
+
+	// Where ticks start and how they map to time; see SetEnabled().
+	inline uint64_t startTicks = 0;
+	inline std::chrono::steady_clock::time_point startTime;
+
+	// The TSC where there is one, steady_clock nanoseconds otherwise.
+	inline uint64_t Now()
+	{
+#if PROFILER_TSC
+		return __rdtsc();
+#else
+		return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count());
+#endif
+	}
+
+	// Ticks per nanosecond, measured against steady_clock since the profiler was first enabled.
+	inline double TicksPerNs()
+	{
+#if PROFILER_TSC
+		double ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - startTime).count();
+		uint64_t ticks = Now() - startTicks;
+		return ns > 0.0 && ticks > 0 ? ticks / ns : 1.0;
+#else
+		return 1.0;
+#endif
+	}
+
+	// The first call sets where traces start.
+	inline void SetEnabled(bool on)
+	{
+		if (on && startTicks == 0)
+		{
+			startTime = std::chrono::steady_clock::now();
+			startTicks = Now();
+		}
+		enabled.store(on, std::memory_order_relaxed);
+	}
+
+	inline bool IsEnabled() { return enabled.load(std::memory_order_relaxed); }
+
+	// A new ring, named in traces if 'name' isn't nullptr. One thread writes it: its own, or the one
+	// that times something else, like the GPU. nullptr once MaxThreads have one.
+	inline ThreadRing* AddRing(const char* name = nullptr)
+	{
+		uint32_t index = ringCount.fetch_add(1, std::memory_order_relaxed);
+		if (index >= MaxThreads)
+			return nullptr;
+		ThreadRing* ring = new ThreadRing;
+		ring->index = index;
+		ring->name.store(name, std::memory_order_relaxed);
+		rings[index].store(ring, std::memory_order_release);
+		return ring;
+	}
+
+	// The calling thread's ring, made on its first scope.
+	inline ThreadRing* LocalRing()
+	{
+		static thread_local ThreadRing* ring = nullptr;
+		if (ring == nullptr)
+			ring = AddRing();
+		return ring;
+	}
+
+	// Names the calling thread in traces, if the profiler is enabled. 'name' has to outlive the
+	// profiler, like a literal.
+	inline void SetThreadName(const char* name)
+	{
+		ThreadRing* ring = IsEnabled() ? LocalRing() : nullptr;
+		if (ring != nullptr)
+			ring->name.store(name, std::memory_order_relaxed);
+	}
+
+	inline void Write(ThreadRing& ring, const char* name, uint64_t begin, uint64_t end, uint32_t depth)
+	{
+		uint64_t written = ring.written.load(std::memory_order_relaxed);
+		ProfileEvent& event = ring.events[written & (RingSize - 1)];
+		event.name = name;
+		event.begin = begin;
+		event.end = end;
+		event.depth = depth;
+		ring.written.store(written + 1, std::memory_order_release);
+	}
+
+	// Copies what 'ring' holds, oldest first. Events its thread overwrote while they were being
+	// copied are left out.
+	inline void CopyRing(const ThreadRing& ring, std::vector<ProfileEvent>& out)
+	{
+		out.clear();
+		uint64_t written = ring.written.load(std::memory_order_acquire);
+		uint64_t first = written > RingSize ? written - RingSize : 0;
+		for (uint64_t i = first; i < written; i++)
+			out.push_back(ring.events[i & (RingSize - 1)]);
+		uint64_t now = ring.written.load(std::memory_order_acquire);
+		uint64_t overwritten = now > RingSize ? now - RingSize : 0;
+		if (overwritten > first)
+			out.erase(out.begin(), out.begin() + static_cast<size_t>(overwritten - first < out.size() ? overwritten - first : out.size()));
+	}
+
+	// Forgets every recorded scope. Only while no thread is inside one.
+	inline void Clear()
+	{
+		uint32_t count = ringCount.load(std::memory_order_relaxed);
+		for (uint32_t i = 0; i < count && i < MaxThreads; i++)
+		{
+			ThreadRing* ring = rings[i].load(std::memory_order_acquire);
+			if (ring != nullptr)
+				ring->written.store(0, std::memory_order_release);
+		}
+	}
+
+	// Sums the scopes in the rings by name, in the order each name was first seen.
+	inline void CollectStats(std::vector<ProfileStat>& stats)
+	{
+		stats.clear();
+		double msPerTick = 1e-6 / TicksPerNs();
+		std::vector<ProfileEvent> events;
+		uint32_t count = ringCount.load(std::memory_order_relaxed);
+		for (uint32_t i = 0; i < count && i < MaxThreads; i++)
+		{
+			ThreadRing* ring = rings[i].load(std::memory_order_acquire);
+			if (ring == nullptr)
+				continue;
+			CopyRing(*ring, events);
+			for (const ProfileEvent& event : events)
+			{
+				ProfileStat* stat = nullptr;
+				for (ProfileStat& candidate : stats)
+				{
+					if (candidate.name == event.name || strcmp(candidate.name, event.name) == 0)
+					{
+						stat = &candidate;
+						break;
+					}
+				}
+				if (stat == nullptr)
+				{
+					stats.push_back(ProfileStat());
+					stat = &stats.back();
+					stat->name = event.name;
+				}
+				double ms = (event.end - event.begin) * msPerTick;
+				stat->count++;
+				stat->totalMs += ms;
+				stat->maxMs = ms > stat->maxMs ? ms : stat->maxMs;
+			}
+		}
+	}
+
+	// Writes the rings as Chrome Trace Event JSON: one complete event per scope, timed in
+	// microseconds from when the profiler was first enabled, and a name for every named thread.
+	inline bool WriteChromeTrace(const char* path)
+	{
+		std::ofstream out(path);
+		if (!out.is_open())
+			return false;
+		double usPerTick = 1e-3 / TicksPerNs();
+		out << "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[";
+		bool first = true;
+		std::vector<ProfileEvent> events;
+		uint32_t count = ringCount.load(std::memory_order_relaxed);
+		for (uint32_t i = 0; i < count && i < MaxThreads; i++)
+		{
+			ThreadRing* ring = rings[i].load(std::memory_order_acquire);
+			if (ring == nullptr)
+				continue;
+			const char* name = ring->name.load(std::memory_order_relaxed);
+			if (name != nullptr)
+			{
+				out << (first ? "\n" : ",\n") << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":" << i << ",\"args\":{\"name\":\"" << name << "\"}}";
+				first = false;
+			}
+			CopyRing(*ring, events);
+			for (const ProfileEvent& event : events)
+			{
+				// Scopes from before the start tick would come out negative.
+				if (event.begin < startTicks)
+					continue;
+				out << (first ? "\n" : ",\n") << "{\"name\":\"" << event.name << "\",\"cat\":\"cpu\",\"ph\":\"X\",\"pid\":1,\"tid\":" << i
+					<< ",\"ts\":" << (event.begin - startTicks) * usPerTick << ",\"dur\":" << (event.end - event.begin) * usPerTick
+					<< ",\"args\":{\"depth\":" << event.depth << "}}";
+				first = false;
+			}
+		}
+		out << "\n]}\n";
+		return out.good();
+	}
+}
+
+// Times its lifetime as one scope on the calling thread; see PROFILE_SCOPE.
+class ProfileScope
+{
+public:
+	explicit ProfileScope(const char* _name) : name(_name)
+	{
+		ring = Profiler::IsEnabled() ? Profiler::LocalRing() : nullptr;
+		if (ring == nullptr)
+			return;
+		depth = ring->depth++;
+		begin = Profiler::Now();
+	}
+
+	~ProfileScope()
+	{
+		if (ring == nullptr)
+			return;
+		uint64_t end = Profiler::Now();
+		ring->depth--;
+		Profiler::Write(*ring, name, begin, end, depth);
+	}
+
+	ProfileScope(const ProfileScope&) = delete;
+	ProfileScope& operator=(const ProfileScope&) = delete;
+
+private:
+	Profiler::ThreadRing* ring;
+	const char* name;
+	uint64_t begin = 0;
+	uint32_t depth = 0;
+};
+
+#define PROFILE_CONCAT_INNER(a, b) a##b
+#define PROFILE_CONCAT(a, b) PROFILE_CONCAT_INNER(a, b)
+#if PROFILING
+#define PROFILE_SCOPE(name) ProfileScope PROFILE_CONCAT(profileScope, __LINE__)(name)
+#else
+#define PROFILE_SCOPE(name)
+#endif
@@ -0,0 +1,149 @@
+#pragma once
+#include <cstdint>
+
+// SIMD register wrappers for SoftwareRasterizer's edge function kernels, and the kernel choice
+// shared with the other SIMD loops.
+//
+// Lanes are laid out as 2x2 quads: lane 4q+0/1 is the top row of quad q, 4q+2/3 the bottom
+// row, and quads sit side by side. RasterSimdSse2 is one quad, RasterSimdAvx2 two.
+// The AVX2 code is compiled with a target attribute instead of a compiler flag so the same
+// binary runs everywhere; RasterCpuHasAvx2() decides at run time whether to use it.
+#if defined(_M_X64) || defined(_M_IX86) || defined(__SSE2__)
+#define RASTER_SIMD 1
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#define RASTER_TARGET_AVX2
+#define RASTER_FORCE_INLINE __forceinline
+#else
+#define RASTER_TARGET_AVX2 __attribute__((target("avx2")))
+#define RASTER_FORCE_INLINE __attribute__((always_inline)) inline
+// GCC warns that 256 bit values change the ABI of functions built without AVX; none of
+// these cross a non-inlined call.
+#pragma GCC diagnostic ignored "-Wpsabi"
+#endif
+#else
+#define RASTER_SIMD 0
+#endif
+
+enum class RasterKernel : uint8_t
+{
+	Scalar,
+	Sse2,
+	Avx2,
+};
+
+inline const char* RasterKernelName(RasterKernel kernel)
+{
+	switch (kernel)
+	{
+	case RasterKernel::Sse2: return "sse2";
+	case RasterKernel::Avx2: return "avx2";
+	default: return "scalar";
+	}
+}
+
+#if RASTER_SIMD
+inline bool RasterCpuHasAvx2()
+{
+#ifdef _MSC_VER
+	int info[4];
+	__cpuid(info, 0);
+	if (info[0] < 7)
+		return false;
+	__cpuid(info, 1);
+	// OSXSAVE and AVX, then the OS must save the YMM registers.
+	if ((info[2] & (1 << 27)) == 0 || (info[2] & (1 << 28)) == 0 || (_xgetbv(0) & 6) != 6)
+		return false;
+	__cpuidex(info, 7, 0);
+	return (info[1] & (1 << 5)) != 0;
+#else
+	return __builtin_cpu_supports("avx2") != 0;
+#endif
+}
+
+struct RasterSimdSse2
+{
+	static const uint32_t Lanes = 4;
+	static const uint32_t Columns = 2;	// Pixels per row covered by one register.
+	typedef __m128i Int;
+	typedef __m128 Float;
+
+	static Int LoadInt(const int32_t* p) { return _mm_load_si128(reinterpret_cast<const Int*>(p)); }
+	static Int SetInt(int32_t value) { return _mm_set1_epi32(value); }
+	static Int AddInt(Int a, Int b) { return _mm_add_epi32(a, b); }
+	static Int And(Int a, Int b) { return _mm_and_si128(a, b); }
+	static Int CompareGreater(Int a, Int b) { return _mm_cmpgt_epi32(a, b); }
+	static Int AllLanes() { return _mm_set1_epi32(-1); }
+
+	static Float LoadFloat(const float* p) { return _mm_load_ps(p); }
+	static Float SetFloat(float value) { return _mm_set1_ps(value); }
+	static Float AddFloat(Float a, Float b) { return _mm_add_ps(a, b); }
+	static Float MulFloat(Float a, Float b) { return _mm_mul_ps(a, b); }
+	static Float DivFloat(Float a, Float b) { return _mm_div_ps(a, b); }
+	static Float ToFloat(Int a) { return _mm_cvtepi32_ps(a); }
+	static void StoreFloat(float* p, Float value) { _mm_store_ps(p, value); }
+	// Columns floats from each of two rows, in quad order.
+	static Float LoadQuads(const float* row0, const float* row1)
+	{
+		return _mm_castpd_ps(_mm_unpacklo_pd(_mm_load_sd(reinterpret_cast<const double*>(row0)), _mm_load_sd(reinterpret_cast<const double*>(row1))));
+	}
+	static Int InRange(Float z) { return _mm_castps_si128(_mm_and_ps(_mm_cmpge_ps(z, _mm_setzero_ps()), _mm_cmple_ps(z, _mm_set1_ps(1.0f)))); }
+	static Int Less(Float a, Float b) { return _mm_castps_si128(_mm_cmplt_ps(a, b)); }
+	static Int LessEqual(Float a, Float b) { return _mm_castps_si128(_mm_cmple_ps(a, b)); }
+	static uint32_t MoveMask(Int mask) { return static_cast<uint32_t>(_mm_movemask_ps(_mm_castsi128_ps(mask))); }
+};
+
+struct RasterSimdAvx2
+{
+	static const uint32_t Lanes = 8;
+	static const uint32_t Columns = 4;
+	typedef __m256i Int;
+	typedef __m256 Float;
+
+	RASTER_TARGET_AVX2 static Int LoadInt(const int32_t* p) { return _mm256_load_si256(reinterpret_cast<const Int*>(p)); }
+	RASTER_TARGET_AVX2 static Int SetInt(int32_t value) { return _mm256_set1_epi32(value); }
+	RASTER_TARGET_AVX2 static Int AddInt(Int a, Int b) { return _mm256_add_epi32(a, b); }
+	RASTER_TARGET_AVX2 static Int And(Int a, Int b) { return _mm256_and_si256(a, b); }
+	RASTER_TARGET_AVX2 static Int CompareGreater(Int a, Int b) { return _mm256_cmpgt_epi32(a, b); }
+	RASTER_TARGET_AVX2 static Int AllLanes() { return _mm256_set1_epi32(-1); }
+
+	RASTER_TARGET_AVX2 static Float LoadFloat(const float* p) { return _mm256_load_ps(p); }
+	RASTER_TARGET_AVX2 static Float SetFloat(float value) { return _mm256_set1_ps(value); }
+	RASTER_TARGET_AVX2 static Float AddFloat(Float a, Float b) { return _mm256_add_ps(a, b); }
+	RASTER_TARGET_AVX2 static Float MulFloat(Float a, Float b) { return _mm256_mul_ps(a, b); }
+	RASTER_TARGET_AVX2 static Float DivFloat(Float a, Float b) { return _mm256_div_ps(a, b); }
+	RASTER_TARGET_AVX2 static Float ToFloat(Int a) { return _mm256_cvtepi32_ps(a); }
+	RASTER_TARGET_AVX2 static void StoreFloat(float* p, Float value) { _mm256_store_ps(p, value); }
+	RASTER_TARGET_AVX2 static Float LoadQuads(const float* row0, const float* row1)
+	{
+		__m128d top = _mm_castps_pd(_mm_loadu_ps(row0)), bottom = _mm_castps_pd(_mm_loadu_ps(row1));
+		__m256d quads = _mm256_castpd128_pd256(_mm_unpacklo_pd(top, bottom));
+		return _mm256_castpd_ps(_mm256_insertf128_pd(quads, _mm_unpackhi_pd(top, bottom), 1));
+	}
+	RASTER_TARGET_AVX2 static Int InRange(Float z)
+	{
+		return _mm256_castps_si256(_mm256_and_ps(_mm256_cmp_ps(z, _mm256_setzero_ps(), _CMP_GE_OQ), _mm256_cmp_ps(z, _mm256_set1_ps(1.0f), _CMP_LE_OQ)));
+	}
+	RASTER_TARGET_AVX2 static Int Less(Float a, Float b) { return _mm256_castps_si256(_mm256_cmp_ps(a, b, _CMP_LT_OQ)); }
+	RASTER_TARGET_AVX2 static Int LessEqual(Float a, Float b) { return _mm256_castps_si256(_mm256_cmp_ps(a, b, _CMP_LE_OQ)); }
+	RASTER_TARGET_AVX2 static uint32_t MoveMask(Int mask) { return static_cast<uint32_t>(_mm256_movemask_ps(_mm256_castsi256_ps(mask))); }
+};
+#else
+inline bool RasterCpuHasAvx2() { return false; }
+#endif
+
+inline bool RasterKernelSupported(RasterKernel kernel)
+{
+	switch (kernel)
+	{
+	case RasterKernel::Sse2: return RASTER_SIMD != 0;
+	case RasterKernel::Avx2: return RasterCpuHasAvx2();
+	default: return true;
+	}
+}
+
+inline RasterKernel RasterBestKernel()
+{
+	return RasterKernelSupported(RasterKernel::Avx2) ? RasterKernel::Avx2 : (RasterKernelSupported(RasterKernel::Sse2) ? RasterKernel::Sse2 : RasterKernel::Scalar);
+}
@@ -0,0 +1,247 @@
+#pragma once
+#include <cstdint>
+
+// Thin interface between the frame logic and the graphics API.
+//
+// Resources are referred to by small integer handles; 0 is never a valid handle.
+// Implementations:
+//	D3D11RenderDevice		- RenderDeviceD3D11.h, the windowed Direct3D 11 path.
+//	RecordingRenderDevice	- RenderDeviceRecording.h, no GPU; logs every call into a binary stream.
+//	SoftwareRenderDevice	- RenderDeviceSoftware.h, no GPU; rasterizes on the CPU, windowed or offscreen.
+typedef uint32_t BufferHandle;
+typedef uint32_t TextureHandle;
+typedef uint32_t ShaderHandle;
+typedef uint32_t InputLayoutHandle;
+typedef uint32_t SamplerHandle;
+typedef uint32_t DepthStateHandle;
+
+static const uint32_t InvalidHandle = 0;
+
+enum class BufferBinding : uint8_t
+{
+	Vertex,
+	Index,
+	Constant,
+};
+
+enum class BufferUsage : uint8_t
+{
+	Default,	// Written with UpdateBuffer.
+	Dynamic,	// Written with MapBuffer every frame.
+};
+
+enum class MapMode : uint8_t
+{
+	WriteDiscard,
+	WriteNoOverwrite,
+};
+
+enum class ShaderStage : uint8_t
+{
+	Vertex,
+	Pixel,
+	Geometry,
+};
+
+enum class VertexFormat : uint8_t
+{
+	Float2,
+	Float3,
+	Float4,
+};
+
+enum class PrimitiveTopology : uint8_t
+{
+	TriangleList,
+	LineList,
+};
+
+enum class IndexFormat : uint8_t
+{
+	UInt32,
+};
+
+enum class CompareFunc : uint8_t
+{
+	Never,
+	Less,
+	LessEqual,
+	AlwaysPass,	// Not "Always", X11 defines that as a macro.
+};
+
+enum class SamplerFilter : uint8_t
+{
+	Point,
+	Linear,
+};
+
+enum class SamplerAddress : uint8_t
+{
+	Wrap,
+	Clamp,
+};
+
+struct BufferDesc
+{
+	BufferBinding binding = BufferBinding::Vertex;
+	BufferUsage usage = BufferUsage::Default;
+	uint32_t byteWidth = 0;
+	const void* initialData = nullptr;
+};
+
+struct ShaderDesc
+{
+	ShaderStage stage = ShaderStage::Vertex;
+	const wchar_t* file = nullptr;
+	const char* entryPoint = nullptr;
+	const char* profile = nullptr;	// vs_4_0, ps_4_0, ...
+};
+
+// Elements are packed in order within their slot.
+struct VertexElement
+{
+	const char* semantic;
+	uint32_t semanticIndex;
+	VertexFormat format;
+	uint32_t slot;
+	bool perInstance;
+};
+
+struct DepthStateDesc
+{
+	bool depthEnable = true;
+	bool depthWrite = true;
+	CompareFunc depthFunc = CompareFunc::Less;
+};
+
+struct SamplerDesc
+{
+	SamplerFilter filter = SamplerFilter::Linear;
+	SamplerAddress address = SamplerAddress::Wrap;
+};
+
+// Work submitted since the last BeginFrame.
+struct RenderStats
+{
+	uint32_t draws = 0;
+	uint32_t instances = 0;
+	uint64_t triangles = 0;
+	uint32_t stateCalls = 0;		// State setters called by the frame logic.
+	uint32_t stateCallsFiltered = 0;	// Of those, dropped as redundant by the backend.
+	uint32_t uploads = 0;
+	uint64_t bytesUploaded = 0;
+
+	void Reset() { *this = RenderStats(); }
+
+	void Add(const RenderStats& other)
+	{
+		draws += other.draws;
+		instances += other.instances;
+		triangles += other.triangles;
+		stateCalls += other.stateCalls;
+		stateCallsFiltered += other.stateCallsFiltered;
+		uploads += other.uploads;
+		bytesUploaded += other.bytesUploaded;
+	}
+};
+
+// Part 'index' of 'count' draws split into 'parts' contiguous ranges of nearly equal size.
+inline void RecordPartRange(uint32_t count, uint32_t parts, uint32_t index, uint32_t& begin, uint32_t& end)
+{
+	begin = static_cast<uint32_t>(static_cast<uint64_t>(count) * index / parts);
+	end = static_cast<uint32_t>(static_cast<uint64_t>(count) * (index + 1) / parts);
+}
+
+// What a frame's draws are recorded with: constants, state and draws. A RenderDevice records
+// straight to the backend; RenderDevice::RecordDraws() hands out others to record on in parallel.
+class RenderContext
+{
+public:
+	virtual ~RenderContext() {}
+
+	// Per-draw constants bound to 'slot' in every stage. Backends may sub-allocate them from a ring.
+	virtual void SetDynamicConstants(uint32_t slot, const void* data, uint32_t size) = 0;
+
+	// -STATE- //
+	virtual void SetPrimitiveTopology(PrimitiveTopology topology) = 0;
+	virtual void SetInputLayout(InputLayoutHandle layout) = 0;
+	virtual void SetVertexBuffers(uint32_t startSlot, uint32_t count, const BufferHandle* buffers, const uint32_t* strides, const uint32_t* offsets) = 0;
+	virtual void SetIndexBuffer(BufferHandle buffer, IndexFormat format, uint32_t offset) = 0;
+	// InvalidHandle unbinds the stage.
+	virtual void SetShader(ShaderStage stage, ShaderHandle shader) = 0;
+	// Constant buffers are bound to the vertex and pixel stages; samplers and textures to the pixel stage.
+	virtual void SetConstantBuffers(uint32_t startSlot, uint32_t count, const BufferHandle* buffers) = 0;
+	virtual void SetSamplers(uint32_t startSlot, uint32_t count, const SamplerHandle* samplers) = 0;
+	virtual void SetTextures(uint32_t startSlot, uint32_t count, const TextureHandle* textures) = 0;
+	// InvalidHandle restores the default depth state.
+	virtual void SetDepthState(DepthStateHandle state) = 0;
+
+	// -DRAWS- //
+	virtual void DrawIndexed(uint32_t indexCount, uint32_t startIndex, int32_t baseVertex) = 0;
+	virtual void DrawIndexedInstanced(uint32_t indexCount, uint32_t instanceCount, uint32_t startIndex, int32_t baseVertex, uint32_t startInstance) = 0;
+
+	// -TIMING- //
+	// Brackets a pass for backends that time passes on the GPU. Passes don't nest; the name has to
+	// outlive the device, like a literal.
+	virtual void BeginPass(const char*) {}
+	virtual void EndPass() {}
+
+	const RenderStats& GetStats() const { return stats; }
+
+protected:
+	void CountDraw(uint32_t indexCount, uint32_t instanceCount)
+	{
+		stats.draws++;
+		stats.instances += instanceCount;
+		stats.triangles += static_cast<uint64_t>(indexCount / 3) * instanceCount;
+	}
+
+	void CountUpload(uint64_t bytes)
+	{
+		stats.uploads++;
+		stats.bytesUploaded += bytes;
+	}
+
+	RenderStats stats;
+};
+
+// Records draws 'begin' to 'end' of a list on 'context'.
+typedef void (*RecordFunction)(RenderContext& context, uint32_t begin, uint32_t end, void* user);
+
+class RenderDevice : public RenderContext
+{
+public:
+	virtual void GetSize(unsigned int& width, unsigned int& height) const = 0;
+
+	// -RESOURCES- //
+	// Creation returns InvalidHandle on failure.
+	virtual BufferHandle CreateBuffer(const BufferDesc& desc) = 0;
+	virtual void DestroyBuffer(BufferHandle buffer) = 0;
+	virtual TextureHandle LoadTexture(const wchar_t* path) = 0;
+	virtual ShaderHandle CreateShader(const ShaderDesc& desc) = 0;
+	virtual InputLayoutHandle CreateInputLayout(ShaderHandle vertexShader, const VertexElement* elements, uint32_t count) = 0;
+	virtual SamplerHandle CreateSampler(const SamplerDesc& desc) = 0;
+	virtual DepthStateHandle CreateDepthState(const DepthStateDesc& desc) = 0;
+
+	// -FRAME- //
+	virtual void BeginFrame() = 0;
+	virtual void Clear(const float color[4], float depth) = 0;
+	virtual void EndFrame(bool vsync) = 0;	// Presents on windowed backends.
+
+	// -DATA- //
+	virtual void UpdateBuffer(BufferHandle buffer, const void* data, uint32_t size) = 0;
+	virtual void* MapBuffer(BufferHandle buffer, MapMode mode) = 0;
+	// 'bytesWritten' only feeds the upload stats.
+	virtual void UnmapBuffer(BufferHandle buffer, uint32_t bytesWritten) = 0;
+
+	// -PARALLEL RECORDING- //
+	// Calls record() over draws [0, count). Backends that record on several threads split them
+	// into contiguous parts, record each part on a context of its own and play the parts back in
+	// order; the others record them all on this device. A part's context starts with nothing
+	// bound, so record() binds all the state its draws use. Resources are created, updated and
+	// mapped before, on the device; contexts only set constants and state and draw.
+	virtual void RecordDraws(uint32_t count, RecordFunction record, void* user) { record(*this, 0, count, user); }
+	// Threads RecordDraws() splits across; backends that can't split stay at 1.
+	virtual void SetRecordThreads(uint32_t) {}
+	virtual uint32_t GetRecordThreads() const { return 1; }
+};
@@ -0,0 +1,880 @@
+#pragma once
+#include "defines.h"
+#include "RenderDevice.h"
+#include "DDSTextureLoader.h"
+#include "ConstantRing.h"
+#include "GpuTimer.h"
+#include "StateCache.h"
+#include "JobSystem.h"
+#include <wrl/client.h>
+#include <cstring>
+#include <deque>
+#include <memory>
+#include <vector>
+
+// ConstantRing backend over a D3D11 dynamic constant buffer, fenced with event queries.
+class D3D11RingBackend
+{
+public:
+	HRESULT Create(ID3D11Device* dev, ID3D11DeviceContext* con, UINT capacityBytes)
+	{
+		device = dev;
+		context = con;
+
+		D3D11_BUFFER_DESC bd = {};
+		bd.Usage = D3D11_USAGE_DYNAMIC;
+		bd.ByteWidth = capacityBytes;
+		bd.BindFlags = D3D11_BIND_CONSTANT_BUFFER;
+		bd.CPUAccessFlags = D3D11_CPU_ACCESS_WRITE;
+		return dev->CreateBuffer(&bd, nullptr, buffer.GetAddressOf());
+	}
+
+	void* Map(bool discard)
+	{
+		D3D11_MAPPED_SUBRESOURCE mapped = {};
+		if (FAILED(context->Map(buffer.Get(), 0, discard ? D3D11_MAP_WRITE_DISCARD : D3D11_MAP_WRITE_NO_OVERWRITE, 0, &mapped)))
+			return nullptr;
+		return mapped.pData;
+	}
+
+	void Unmap()
+	{
+		context->Unmap(buffer.Get(), 0);
+	}
+
+	uint64_t InsertFence()
+	{
+		Microsoft::WRL::ComPtr<ID3D11Query> query = nullptr;
+		if (!freeQueries.empty())
+		{
+			query = freeQueries.back();
+			freeQueries.pop_back();
+		}
+		else
+		{
+			D3D11_QUERY_DESC qd = {};
+			qd.Query = D3D11_QUERY_EVENT;
+			if (FAILED(device->CreateQuery(&qd, query.GetAddressOf())))
+			{
+				// A fence that never completes; the ring falls back to DISCARD once it fills.
+				return UINT64_MAX;
+			}
+		}
+
+		context->End(query.Get());
+		pending.push_back({ ++lastFence, query });
+		return lastFence;
+	}
+
+	bool IsFenceComplete(uint64_t fence)
+	{
+		// Event queries complete in order, so stop at the first one still in flight.
+		while (fence > completedFence && !pending.empty() &&
+			context->GetData(pending.front().query.Get(), nullptr, 0, D3D11_ASYNC_GETDATA_DONOTFLUSH) == S_OK)
+		{
+			completedFence = pending.front().fence;
+			freeQueries.push_back(pending.front().query);
+			pending.pop_front();
+		}
+		return fence <= completedFence;
+	}
+
+	ID3D11Buffer* GetBuffer() const { return buffer.Get(); }
+
+private:
+	struct PendingFence
+	{
+		uint64_t fence;
+		Microsoft::WRL::ComPtr<ID3D11Query> query;
+	};
+
+	ID3D11Device* device = nullptr;
+	ID3D11DeviceContext* context = nullptr;
+	Microsoft::WRL::ComPtr<ID3D11Buffer> buffer = nullptr;
+	std::deque<PendingFence> pending;
+	std::vector<Microsoft::WRL::ComPtr<ID3D11Query>> freeQueries;
+	uint64_t lastFence = 0;
+	uint64_t completedFence = 0;
+};
+
+// GpuTimer backend over D3D11 timestamp queries, made the first time a slot needs them.
+class D3D11TimerBackend
+{
+public:
+	void Create(ID3D11Device* dev, ID3D11DeviceContext* con)
+	{
+		device = dev;
+		context = con;
+	}
+
+	void BeginFrame(uint32_t slot)
+	{
+		ID3D11Query* disjoint = Get(Find(slot).disjoint, D3D11_QUERY_TIMESTAMP_DISJOINT);
+		if (disjoint != nullptr)
+			context->Begin(disjoint);
+	}
+
+	void Timestamp(uint32_t slot, uint32_t index)
+	{
+		Slot& queries = Find(slot);
+		if (queries.timestamps.size() <= index)
+			queries.timestamps.resize(index + 1);
+		ID3D11Query* timestamp = Get(queries.timestamps[index], D3D11_QUERY_TIMESTAMP);
+		if (timestamp != nullptr)
+			context->End(timestamp);
+	}
+
+	void EndFrame(uint32_t slot)
+	{
+		ID3D11Query* disjoint = Find(slot).disjoint.Get();
+		if (disjoint != nullptr)
+			context->End(disjoint);
+	}
+
+	bool ReadFrame(uint32_t slot, uint32_t count, uint64_t* ticks, uint64_t& frequency, bool& disjoint)
+	{
+		Slot& queries = Find(slot);
+		D3D11_QUERY_DATA_TIMESTAMP_DISJOINT clock = {};
+		if (queries.disjoint.Get() != nullptr &&
+			context->GetData(queries.disjoint.Get(), &clock, sizeof(clock), D3D11_ASYNC_GETDATA_DONOTFLUSH) != S_OK)
+			return false;
+		// Queries that couldn't be made leave the frame disjoint rather than wrong.
+		frequency = clock.Frequency;
+		disjoint = queries.disjoint.Get() == nullptr || clock.Disjoint != FALSE || queries.timestamps.size() < count;
+		for (uint32_t i = 0; i < count && !disjoint; i++)
+		{
+			ID3D11Query* timestamp = queries.timestamps[i].Get();
+			if (timestamp == nullptr)
+				disjoint = true;
+			else if (context->GetData(timestamp, &ticks[i], sizeof(uint64_t), D3D11_ASYNC_GETDATA_DONOTFLUSH) != S_OK)
+				return false;
+		}
+		return true;
+	}
+
+private:
+	struct Slot
+	{
+		Microsoft::WRL::ComPtr<ID3D11Query> disjoint;
+		std::vector<Microsoft::WRL::ComPtr<ID3D11Query>> timestamps;
+	};
+
+	Slot& Find(uint32_t slot)
+	{
+		if (slots.size() <= slot)
+			slots.resize(slot + 1);
+		return slots[slot];
+	}
+
+	ID3D11Query* Get(Microsoft::WRL::ComPtr<ID3D11Query>& query, D3D11_QUERY type)
+	{
+		if (query.Get() == nullptr && device != nullptr)
+		{
+			D3D11_QUERY_DESC qd = {};
+			qd.Query = type;
+			if (FAILED(device->CreateQuery(&qd, query.GetAddressOf())))
+				query = nullptr;
+		}
+		return query.Get();
+	}
+
+	ID3D11Device* device = nullptr;
+	ID3D11DeviceContext* context = nullptr;
+	std::vector<Slot> slots;
+};
+
+// Handle types the state cache tracks for the D3D11 context.
+struct D3D11StateTypes
+{
+	typedef D3D11_PRIMITIVE_TOPOLOGY	Topology;
+	typedef ID3D11InputLayout			InputLayout;
+	typedef ID3D11Buffer				Buffer;
+	typedef DXGI_FORMAT					Format;
+	typedef ID3D11VertexShader			VertexShader;
+	typedef ID3D11PixelShader			PixelShader;
+	typedef ID3D11GeometryShader		GeometryShader;
+	typedef ID3D11SamplerState			SamplerState;
+	typedef ID3D11ShaderResourceView	ShaderResourceView;
+	typedef ID3D11DepthStencilState		DepthStencilState;
+};
+typedef StateCache<ID3D11DeviceContext, D3D11StateTypes> D3D11StateCache;
+
+// RenderDevice over a Gateware D3D11 surface. State changes go through a StateCache and
+// dynamic constants through a ConstantRing when the runtime supports constant buffer offsets.
+//
+// With more than one record thread, RecordDraws() records each part on a deferred context and
+// executes the command lists in order on the immediate one. The deferred contexts are devices of
+// this class sharing its resources; their dynamic constants go to buffers of their own with
+// UpdateSubresource, since the ring's fences need the immediate context.
+//
+// While the profiler is enabled the GPU time of each frame and pass is measured with timestamp
+// queries and goes to its stats and traces. Passes recorded on deferred contexts are only counted
+// in the frame.
+class D3D11RenderDevice : public RenderDevice
+{
+public:
+	static const UINT RingCapacity = 256 * 1024;
+	static const UINT MaxDynamicSlots = 8;
+
+	D3D11RenderDevice(GW::GRAPHICS::GDirectX11Surface _d3d11, GW::SYSTEM::GWindow _win) : d3d11(_d3d11), win(_win)
+	{
+		+d3d11.GetDevice((void**)device.GetAddressOf());
+		+d3d11.GetImmediateContext((void**)context.GetAddressOf());
+		+d3d11.GetDepthStencilView((void**)depthView.GetAddressOf());
+		+d3d11.GetSwapchain((void**)swapchain.GetAddressOf());
+		if (device.Get() == nullptr || context.Get() == nullptr || swapchain.Get() == nullptr)
+		{
+			DebugBreak();
+			return;
+		}
+
+		// Back Buffer setup
+		{
+			// Create a render target view
+			ID3D11Texture2D* pBackBuffer = nullptr;
+			if (FAILED(swapchain->GetBuffer(0, __uuidof(ID3D11Texture2D), reinterpret_cast<void**>(&pBackBuffer))))
+				return;
+
+			if (FAILED(device->CreateRenderTargetView(pBackBuffer, nullptr, renderTargetView.GetAddressOf())))
+			{
+				pBackBuffer->Release();
+				return;
+			}
+			pBackBuffer->Release();
+
+			context->OMSetRenderTargets(1, renderTargetView.GetAddressOf(), depthView.Get());
+		}
+
+		state.SetContext(context.Get());
+		timerBackend.Create(device.Get(), context.Get());
+
+		// Use the constant ring when the runtime can bind constant buffers at an offset.
+		D3D11_FEATURE_DATA_D3D11_OPTIONS options = {};
+		if (SUCCEEDED(context->QueryInterface(__uuidof(ID3D11DeviceContext1), (void**)context1.GetAddressOf())) &&
+			SUCCEEDED(device->CheckFeatureSupport(D3D11_FEATURE_D3D11_OPTIONS, &options, sizeof(options))) &&
+			options.ConstantBufferOffsetting && options.MapNoOverwriteOnDynamicConstantBuffer &&
+			SUCCEEDED(ringBackend.Create(device.Get(), context.Get(), RingCapacity)))
+		{
+			ring.Reset(RingCapacity);
+			useRing = true;
+		}
+	}
+
+	D3D11RenderDevice(const D3D11RenderDevice&) = delete;
+	D3D11RenderDevice& operator=(const D3D11RenderDevice&) = delete;
+
+	// Used for compiling shaders
+	static HRESULT CompileShaderFromFile(const WCHAR* szFileName, LPCSTR szEntryPoint, LPCSTR szShaderModel, ID3DBlob** ppBlobOut)
+	{
+		HRESULT hr = S_OK;
+
+		DWORD dwShaderFlags = D3DCOMPILE_ENABLE_STRICTNESS;
+#ifdef _DEBUG
+		// Set the D3DCOMPILE_DEBUG flag to embed debug information in the shaders.
+		// Setting this flag improves the shader debugging experience, but still allows
+		// the shaders to be optimized and to run exactly the way they will run in
+		// the release configuration of this program.
+		dwShaderFlags |= D3DCOMPILE_DEBUG;
+
+		// Disable optimizations to further improve shader debugging
+		dwShaderFlags |= D3DCOMPILE_SKIP_OPTIMIZATION;
+#endif
+
+		ID3DBlob* pErrorBlob = nullptr;
+		hr = D3DCompileFromFile(szFileName, nullptr, nullptr, szEntryPoint, szShaderModel,
+			dwShaderFlags, 0, ppBlobOut, &pErrorBlob);
+		if (FAILED(hr))
+		{
+			if (pErrorBlob)
+			{
+				OutputDebugStringA(reinterpret_cast<const char*>(pErrorBlob->GetBufferPointer())); // Print to output window.
+				pErrorBlob->Release();
+			}
+			return hr;
+		}
+		if (pErrorBlob) pErrorBlob->Release();
+
+		return S_OK;
+	}
+
+	ID3D11Device* GetDevice() const { return device.Get(); }
+	ID3D11DeviceContext* GetContext() const { return context.Get(); }
+	bool UsesConstantRing() const { return useRing; }
+	const D3D11StateCache::Stats& GetStateStats() const { return state.GetStats(); }
+	const ConstantRing<D3D11RingBackend>::Stats& GetRingStats() const { return ring.GetStats(); }
+
+	// Call after anything binds state on the context directly.
+	void InvalidateState() { state.Invalidate(); }
+
+	void GetSize(unsigned int& width, unsigned int& height) const override
+	{
+		+win.GetWidth(width);
+		+win.GetHeight(height);
+	}
+
+	// Makes a deferred context per thread; 1 records on the immediate context only.
+	void SetRecordThreads(uint32_t threads) override
+	{
+		recorders.clear();
+		commandLists.clear();
+		recordJobs.reset();
+		if (threads <= 1)
+			return;
+
+		for (uint32_t i = 0; i < threads; i++)
+		{
+			Microsoft::WRL::ComPtr<ID3D11DeviceContext> deferred = nullptr;
+			if (FAILED(device->CreateDeferredContext(0, deferred.GetAddressOf())))
+			{
+				recorders.clear();
+				DebugBreak();
+				return;
+			}
+			recorders.emplace_back(new D3D11RenderDevice(*this, deferred.Get()));
+		}
+		commandLists.resize(threads);
+		recordJobs.reset(new JobSystem(threads));
+	}
+
+	uint32_t GetRecordThreads() const override { return recorders.empty() ? 1 : static_cast<uint32_t>(recorders.size()); }
+
+	void RecordDraws(uint32_t count, RecordFunction record, void* user) override
+	{
+		uint32_t parts = recorders.size() < count ? static_cast<uint32_t>(recorders.size()) : count;
+		if (parts <= 1)
+		{
+			record(*this, 0, count, user);
+			return;
+		}
+
+		// Deferred contexts start without a render target or viewport either.
+		D3D11_VIEWPORT viewport = {};
+		UINT viewportCount = 1;
+		context->RSGetViewports(&viewportCount, &viewport);
+		Microsoft::WRL::ComPtr<ID3D11RasterizerState> rasterizer = nullptr;
+		context->RSGetState(rasterizer.GetAddressOf());
+
+		recordJobs->ParallelFor(parts, 1, [&](uint32_t first, uint32_t last)
+		{
+			for (uint32_t p = first; p < last; p++)
+			{
+				D3D11RenderDevice& recorder = *recorders[p];
+				recorder.stats.Reset();
+				recorder.state.Invalidate();
+				recorder.state.ResetStats();
+				recorder.BindTarget(renderTargetView.Get(), depthView.Get(), viewport, rasterizer.Get());
+				uint32_t begin, end;
+				RecordPartRange(count, parts, p, begin, end);
+				record(recorder, begin, end, user);
+				if (FAILED(recorder.context->FinishCommandList(FALSE, commandLists[p].ReleaseAndGetAddressOf())))
+					commandLists[p] = nullptr;
+			}
+		});
+
+		for (uint32_t p = 0; p < parts; p++)
+		{
+			if (commandLists[p].Get() != nullptr)
+				context->ExecuteCommandList(commandLists[p].Get(), FALSE);
+			commandLists[p] = nullptr;
+			stats.Add(recorders[p]->stats);
+		}
+
+		// Executing a command list leaves the immediate context with nothing bound.
+		state.Invalidate();
+		BindTarget(renderTargetView.Get(), depthView.Get(), viewport, rasterizer.Get());
+	}
+
+	// -RESOURCES- //
+	BufferHandle CreateBuffer(const BufferDesc& desc) override
+	{
+		D3D11_BUFFER_DESC bd = {};
+		bd.ByteWidth = desc.byteWidth;
+		bd.Usage = desc.usage == BufferUsage::Dynamic ? D3D11_USAGE_DYNAMIC : D3D11_USAGE_DEFAULT;
+		bd.CPUAccessFlags = desc.usage == BufferUsage::Dynamic ? D3D11_CPU_ACCESS_WRITE : 0;
+		switch (desc.binding)
+		{
+		case BufferBinding::Vertex:		bd.BindFlags = D3D11_BIND_VERTEX_BUFFER; break;
+		case BufferBinding::Index:		bd.BindFlags = D3D11_BIND_INDEX_BUFFER; break;
+		case BufferBinding::Constant:	bd.BindFlags = D3D11_BIND_CONSTANT_BUFFER; break;
+		}
+
+		D3D11_SUBRESOURCE_DATA InitData = {};
+		InitData.pSysMem = desc.initialData;
+
+		BufferRecord record;
+		record.usage = desc.usage;
+		if (FAILED(device->CreateBuffer(&bd, desc.initialData ? &InitData : nullptr, record.buffer.GetAddressOf())))
+			return InvalidHandle;
+		resources->buffers.push_back(record);
+		return static_cast<BufferHandle>(resources->buffers.size());
+	}
+
+	// Handles are not reused; the slot just drops its buffer.
+	void DestroyBuffer(BufferHandle buffer) override
+	{
+		BufferRecord* record = Find(resources->buffers, buffer);
+		if (record != nullptr)
+			record->buffer = nullptr;
+	}
+
+	TextureHandle LoadTexture(const wchar_t* path) override
+	{
+		Microsoft::WRL::ComPtr<ID3D11ShaderResourceView> view = nullptr;
+		if (FAILED(CreateDDSTextureFromFile(device.Get(), path, nullptr, view.GetAddressOf())))
+			return InvalidHandle;
+		resources->textures.push_back(view);
+		return static_cast<TextureHandle>(resources->textures.size());
+	}
+
+	ShaderHandle CreateShader(const ShaderDesc& desc) override
+	{
+		ShaderRecord record;
+		record.stage = desc.stage;
+		if (FAILED(CompileShaderFromFile(desc.file, desc.entryPoint, desc.profile, record.blob.GetAddressOf())))
+		{
+			MessageBox(nullptr,
+				L"The FX file cannot be compiled.  Please run this executable from the directory that contains the FX file.", L"Error", MB_OK);
+			return InvalidHandle;
+		}
+
+		const void* code = record.blob->GetBufferPointer();
+		SIZE_T size = record.blob->GetBufferSize();
+		HRESULT hr = E_FAIL;
+		switch (desc.stage)
+		{
+		case ShaderStage::Vertex:	hr = device->CreateVertexShader(code, size, nullptr, record.vs.GetAddressOf()); break;
+		case ShaderStage::Pixel:	hr = device->CreatePixelShader(code, size, nullptr, record.ps.GetAddressOf()); break;
+		case ShaderStage::Geometry:	hr = device->CreateGeometryShader(code, size, nullptr, record.gs.GetAddressOf()); break;
+		}
+		if (FAILED(hr))
+			return InvalidHandle;
+
+		// Only vertex shaders need their bytecode later, for input layouts.
+		if (desc.stage != ShaderStage::Vertex)
+			record.blob = nullptr;
+		resources->shaders.push_back(record);
+		return static_cast<ShaderHandle>(resources->shaders.size());
+	}
+
+	InputLayoutHandle CreateInputLayout(ShaderHandle vertexShader, const VertexElement* elements, uint32_t count) override
+	{
+		const ShaderRecord* shader = Find(resources->shaders, vertexShader);
+		if (shader == nullptr || shader->stage != ShaderStage::Vertex)
+			return InvalidHandle;
+
+		std::vector<D3D11_INPUT_ELEMENT_DESC> layout(count);
+		for (uint32_t i = 0; i < count; i++)
+		{
+			layout[i].SemanticName = elements[i].semantic;
+			layout[i].SemanticIndex = elements[i].semanticIndex;
+			layout[i].Format = ToDXGI(elements[i].format);
+			layout[i].InputSlot = elements[i].slot;
+			layout[i].AlignedByteOffset = D3D11_APPEND_ALIGNED_ELEMENT;
+			layout[i].InputSlotClass = elements[i].perInstance ? D3D11_INPUT_PER_INSTANCE_DATA : D3D11_INPUT_PER_VERTEX_DATA;
+			layout[i].InstanceDataStepRate = elements[i].perInstance ? 1 : 0;
+		}
+
+		Microsoft::WRL::ComPtr<ID3D11InputLayout> inputLayout = nullptr;
+		if (FAILED(device->CreateInputLayout(layout.data(), count, shader->blob->GetBufferPointer(), shader->blob->GetBufferSize(), inputLayout.GetAddressOf())))
+			return InvalidHandle;
+		resources->inputLayouts.push_back(inputLayout);
+		return static_cast<InputLayoutHandle>(resources->inputLayouts.size());
+	}
+
+	SamplerHandle CreateSampler(const SamplerDesc& desc) override
+	{
+		D3D11_TEXTURE_ADDRESS_MODE address = desc.address == SamplerAddress::Wrap ? D3D11_TEXTURE_ADDRESS_WRAP : D3D11_TEXTURE_ADDRESS_CLAMP;
+		D3D11_SAMPLER_DESC sampDesc = {};
+		sampDesc.Filter = desc.filter == SamplerFilter::Linear ? D3D11_FILTER_MIN_MAG_MIP_LINEAR : D3D11_FILTER_MIN_MAG_MIP_POINT;
+		sampDesc.AddressU = address;
+		sampDesc.AddressV = address;
+		sampDesc.AddressW = address;
+		sampDesc.ComparisonFunc = D3D11_COMPARISON_NEVER;
+		sampDesc.MinLOD = 0;
+		sampDesc.MaxLOD = D3D11_FLOAT32_MAX;
+
+		Microsoft::WRL::ComPtr<ID3D11SamplerState> sampler = nullptr;
+		if (FAILED(device->CreateSamplerState(&sampDesc, sampler.GetAddressOf())))
+			return InvalidHandle;
+		resources->samplers.push_back(sampler);
+		return static_cast<SamplerHandle>(resources->samplers.size());
+	}
+
+	DepthStateHandle CreateDepthState(const DepthStateDesc& desc) override
+	{
+		D3D11_DEPTH_STENCIL_DESC dsDesc;
+		ZeroMemory(&dsDesc, sizeof(D3D11_DEPTH_STENCIL_DESC));
+		dsDesc.DepthEnable = desc.depthEnable;
+		dsDesc.DepthWriteMask = desc.depthWrite ? D3D11_DEPTH_WRITE_MASK_ALL : D3D11_DEPTH_WRITE_MASK_ZERO;
+		dsDesc.DepthFunc = ToD3D(desc.depthFunc);
+
+		Microsoft::WRL::ComPtr<ID3D11DepthStencilState> depthState = nullptr;
+		if (FAILED(device->CreateDepthStencilState(&dsDesc, depthState.GetAddressOf())))
+			return InvalidHandle;
+		resources->depthStates.push_back(depthState);
+		return static_cast<DepthStateHandle>(resources->depthStates.size());
+	}
+
+	// -FRAME- //
+	void BeginFrame() override
+	{
+		stats.Reset();
+		state.SetContext(context.Get());
+		state.ResetStats();
+		if (useRing)
+			ring.Retire();
+		timingFrame = Profiler::IsEnabled();
+		if (timingFrame)
+			gpuTimer.BeginFrame();
+	}
+
+	void Clear(const float color[4], float depth) override
+	{
+		context->ClearRenderTargetView(renderTargetView.Get(), color);
+		context->ClearDepthStencilView(depthView.Get(), D3D11_CLEAR_DEPTH, depth, 0);
+	}
+
+	void EndFrame(bool vsync) override
+	{
+		// Fence this frame's dynamic constants.
+		if (useRing)
+			ring.EndFrame();
+		if (timingFrame)
+			gpuTimer.EndFrame();
+		swapchain->Present(vsync ? 1 : 0, 0);
+	}
+
+	void BeginPass(const char* name) override { gpuTimer.BeginPass(name); }
+	void EndPass() override { gpuTimer.EndPass(); }
+
+	const GpuTimer<D3D11TimerBackend>& GetGpuTimer() const { return gpuTimer; }
+
+	// -DATA- //
+	void UpdateBuffer(BufferHandle buffer, const void* data, uint32_t size) override
+	{
+		BufferRecord* record = Find(resources->buffers, buffer);
+		if (record == nullptr)
+			return;
+
+		if (record->usage == BufferUsage::Dynamic)
+		{
+			void* mapped = MapBuffer(buffer, MapMode::WriteDiscard);
+			if (mapped == nullptr)
+				return;
+			memcpy(mapped, data, size);
+			UnmapBuffer(buffer, size);
+			return;
+		}
+
+		context->UpdateSubresource(record->buffer.Get(), 0, nullptr, data, 0, 0);
+		CountUpload(size);
+	}
+
+	void* MapBuffer(BufferHandle buffer, MapMode mode) override
+	{
+		BufferRecord* record = Find(resources->buffers, buffer);
+		if (record == nullptr)
+			return nullptr;
+
+		D3D11_MAPPED_SUBRESOURCE mapped = {};
+		if (FAILED(context->Map(record->buffer.Get(), 0, mode == MapMode::WriteDiscard ? D3D11_MAP_WRITE_DISCARD : D3D11_MAP_WRITE_NO_OVERWRITE, 0, &mapped)))
+			return nullptr;
+		return mapped.pData;
+	}
+
+	void UnmapBuffer(BufferHandle buffer, uint32_t bytesWritten) override
+	{
+		BufferRecord* record = Find(resources->buffers, buffer);
+		if (record == nullptr)
+			return;
+		context->Unmap(record->buffer.Get(), 0);
+		CountUpload(bytesWritten);
+	}
+
+	void SetDynamicConstants(uint32_t slot, const void* data, uint32_t size) override
+	{
+		if (useRing && BindRingConstants(slot, data, size))
+			return;
+		BindFallbackConstants(slot, data, size);
+	}
+
+	// -STATE- //
+	void SetPrimitiveTopology(PrimitiveTopology topology) override
+	{
+		stats.stateCalls++;
+		state.IASetPrimitiveTopology(topology == PrimitiveTopology::LineList ? D3D11_PRIMITIVE_TOPOLOGY_LINELIST : D3D11_PRIMITIVE_TOPOLOGY_TRIANGLELIST);
+		SyncFiltered();
+	}
+
+	void SetInputLayout(InputLayoutHandle layout) override
+	{
+		stats.stateCalls++;
+		state.IASetInputLayout(Get(resources->inputLayouts, layout));
+		SyncFiltered();
+	}
+
+	void SetVertexBuffers(uint32_t startSlot, uint32_t count, const BufferHandle* handles, const uint32_t* strides, const uint32_t* offsets) override
+	{
+		ID3D11Buffer* buffs[D3D11StateCache::MaxVertexBuffers] = {};
+		if (count > D3D11StateCache::MaxVertexBuffers)
+			return;
+		for (uint32_t i = 0; i < count; i++)
+			buffs[i] = GetBuffer(handles[i]);
+
+		stats.stateCalls++;
+		state.IASetVertexBuffers(startSlot, count, buffs, strides, offsets);
+		SyncFiltered();
+	}
+
+	void SetIndexBuffer(BufferHandle buffer, IndexFormat, uint32_t offset) override
+	{
+		stats.stateCalls++;
+		state.IASetIndexBuffer(GetBuffer(buffer), DXGI_FORMAT_R32_UINT, offset);
+		SyncFiltered();
+	}
+
+	void SetShader(ShaderStage stage, ShaderHandle shader) override
+	{
+		const ShaderRecord* record = Find(resources->shaders, shader);
+		stats.stateCalls++;
+		switch (stage)
+		{
+		case ShaderStage::Vertex:	state.VSSetShader(record ? record->vs.Get() : nullptr); break;
+		case ShaderStage::Pixel:	state.PSSetShader(record ? record->ps.Get() : nullptr); break;
+		case ShaderStage::Geometry:	state.GSSetShader(record ? record->gs.Get() : nullptr); break;
+		}
+		SyncFiltered();
+	}
+
+	void SetConstantBuffers(uint32_t startSlot, uint32_t count, const BufferHandle* handles) override
+	{
+		ID3D11Buffer* buffs[D3D11StateCache::MaxConstantBuffers] = {};
+		if (count > D3D11StateCache::MaxConstantBuffers)
+			return;
+		for (uint32_t i = 0; i < count; i++)
+			buffs[i] = GetBuffer(handles[i]);
+
+		stats.stateCalls++;
+		state.VSSetConstantBuffers(startSlot, count, buffs);
+		state.PSSetConstantBuffers(startSlot, count, buffs);
+		SyncFiltered();
+	}
+
+	void SetSamplers(uint32_t startSlot, uint32_t count, const SamplerHandle* handles) override
+	{
+		ID3D11SamplerState* states[D3D11StateCache::MaxSamplers] = {};
+		if (count > D3D11StateCache::MaxSamplers)
+			return;
+		for (uint32_t i = 0; i < count; i++)
+			states[i] = Get(resources->samplers, handles[i]);
+
+		stats.stateCalls++;
+		state.PSSetSamplers(startSlot, count, states);
+		SyncFiltered();
+	}
+
+	void SetTextures(uint32_t startSlot, uint32_t count, const TextureHandle* handles) override
+	{
+		ID3D11ShaderResourceView* views[D3D11StateCache::MaxShaderResources] = {};
+		if (count > D3D11StateCache::MaxShaderResources)
+			return;
+		for (uint32_t i = 0; i < count; i++)
+			views[i] = Get(resources->textures, handles[i]);
+
+		stats.stateCalls++;
+		state.PSSetShaderResources(startSlot, count, views);
+		SyncFiltered();
+	}
+
+	void SetDepthState(DepthStateHandle depthState) override
+	{
+		stats.stateCalls++;
+		state.OMSetDepthStencilState(Get(resources->depthStates, depthState), 0);
+		SyncFiltered();
+	}
+
+	// -DRAWS- //
+	void DrawIndexed(uint32_t indexCount, uint32_t startIndex, int32_t baseVertex) override
+	{
+		context->DrawIndexed(indexCount, startIndex, baseVertex);
+		CountDraw(indexCount, 1);
+	}
+
+	void DrawIndexedInstanced(uint32_t indexCount, uint32_t instanceCount, uint32_t startIndex, int32_t baseVertex, uint32_t startInstance) override
+	{
+		context->DrawIndexedInstanced(indexCount, instanceCount, startIndex, baseVertex, startInstance);
+		CountDraw(indexCount, instanceCount);
+	}
+
+private:
+	struct BufferRecord
+	{
+		Microsoft::WRL::ComPtr<ID3D11Buffer> buffer = nullptr;
+		BufferUsage usage = BufferUsage::Default;
+	};
+
+	struct ShaderRecord
+	{
+		ShaderStage stage = ShaderStage::Vertex;
+		Microsoft::WRL::ComPtr<ID3D11VertexShader> vs = nullptr;
+		Microsoft::WRL::ComPtr<ID3D11PixelShader> ps = nullptr;
+		Microsoft::WRL::ComPtr<ID3D11GeometryShader> gs = nullptr;
+		Microsoft::WRL::ComPtr<ID3DBlob> blob = nullptr;
+	};
+
+	// Constants for one slot when the ring can't be used; only uploaded when they change.
+	struct FallbackConstants
+	{
+		Microsoft::WRL::ComPtr<ID3D11Buffer> buffer = nullptr;
+		std::vector<uint8_t> shadow;
+	};
+
+	struct Resources
+	{
+		std::vector<BufferRecord>											buffers;
+		std::vector<Microsoft::WRL::ComPtr<ID3D11ShaderResourceView>>		textures;
+		std::vector<ShaderRecord>											shaders;
+		std::vector<Microsoft::WRL::ComPtr<ID3D11InputLayout>>				inputLayouts;
+		std::vector<Microsoft::WRL::ComPtr<ID3D11SamplerState>>				samplers;
+		std::vector<Microsoft::WRL::ComPtr<ID3D11DepthStencilState>>		depthStates;
+	};
+
+	template<typename T>
+	static T* Find(std::vector<T>& table, uint32_t handle)
+	{
+		return handle != InvalidHandle && handle <= table.size() ? &table[handle - 1] : nullptr;
+	}
+
+	template<typename T>
+	static T* Get(const std::vector<Microsoft::WRL::ComPtr<T>>& table, uint32_t handle)
+	{
+		return handle != InvalidHandle && handle <= table.size() ? table[handle - 1].Get() : nullptr;
+	}
+
+	ID3D11Buffer* GetBuffer(BufferHandle handle)
+	{
+		BufferRecord* record = Find(resources->buffers, handle);
+		return record ? record->buffer.Get() : nullptr;
+	}
+
+	static DXGI_FORMAT ToDXGI(VertexFormat format)
+	{
+		switch (format)
+		{
+		case VertexFormat::Float2: return DXGI_FORMAT_R32G32_FLOAT;
+		case VertexFormat::Float3: return DXGI_FORMAT_R32G32B32_FLOAT;
+		case VertexFormat::Float4: return DXGI_FORMAT_R32G32B32A32_FLOAT;
+		}
+		return DXGI_FORMAT_UNKNOWN;
+	}
+
+	static D3D11_COMPARISON_FUNC ToD3D(CompareFunc func)
+	{
+		switch (func)
+		{
+		case CompareFunc::Never:		return D3D11_COMPARISON_NEVER;
+		case CompareFunc::Less:			return D3D11_COMPARISON_LESS;
+		case CompareFunc::LessEqual:	return D3D11_COMPARISON_LESS_EQUAL;
+		case CompareFunc::AlwaysPass:	return D3D11_COMPARISON_ALWAYS;
+		}
+		return D3D11_COMPARISON_LESS;
+	}
+
+	// A recording context for RecordDraws().
+	D3D11RenderDevice(D3D11RenderDevice& parent, ID3D11DeviceContext* deferred) : d3d11(parent.d3d11), win(parent.win)
+	{
+		device = parent.device;
+		context = deferred;
+		resources = parent.resources;
+		state.SetContext(context.Get());
+	}
+
+	void BindTarget(ID3D11RenderTargetView* target, ID3D11DepthStencilView* depth, const D3D11_VIEWPORT& viewport, ID3D11RasterizerState* rasterizer)
+	{
+		context->OMSetRenderTargets(1, &target, depth);
+		context->RSSetViewports(1, &viewport);
+		context->RSSetState(rasterizer);
+	}
+
+	void SyncFiltered() { stats.stateCallsFiltered = state.GetStats().TotalFiltered(); }
+
+	// Writes the constants into the ring and points 'slot' at them.
+	bool BindRingConstants(uint32_t slot, const void* data, uint32_t size)
+	{
+		ConstantRing<D3D11RingBackend>::Allocation alloc = ring.Write(data, size);
+		if (!alloc.valid)
+			return false;
+
+		// Offsets and sizes are in 16-byte constants.
+		UINT firstConstant = alloc.offset / 16;
+		UINT numConstants = alloc.size / 16;
+		ID3D11Buffer* const buffs[] = { ringBackend.GetBuffer() };
+		state.VSSetConstantBuffers1(context1.Get(), slot, 1, buffs, &firstConstant, &numConstants);
+		state.PSSetConstantBuffers1(context1.Get(), slot, 1, buffs, &firstConstant, &numConstants);
+		CountUpload(size);
+		return true;
+	}
+
+	void BindFallbackConstants(uint32_t slot, const void* data, uint32_t size)
+	{
+		if (slot >= MaxDynamicSlots)
+			return;
+
+		FallbackConstants& constants = fallback[slot];
+		bool changed = false;
+		if (constants.buffer.Get() == nullptr || constants.shadow.size() < size)
+		{
+			D3D11_BUFFER_DESC bd = {};
+			bd.Usage = D3D11_USAGE_DEFAULT;
+			bd.ByteWidth = (size + 15) & ~15u;
+			bd.BindFlags = D3D11_BIND_CONSTANT_BUFFER;
+			constants.buffer = nullptr;
+			if (FAILED(device->CreateBuffer(&bd, nullptr, constants.buffer.GetAddressOf())))
+			{
+				DebugBreak();
+				return;
+			}
+			constants.shadow.assign(bd.ByteWidth, 0);
+			changed = true;
+		}
+
+		if (changed || memcmp(constants.shadow.data(), data, size) != 0)
+		{
+			memcpy(constants.shadow.data(), data, size);
+			context->UpdateSubresource(constants.buffer.Get(), 0, nullptr, constants.shadow.data(), 0, 0);
+			CountUpload(size);
+		}
+
+		ID3D11Buffer* const buffs[] = { constants.buffer.Get() };
+		state.VSSetConstantBuffers(slot, 1, buffs);
+		state.PSSetConstantBuffers(slot, 1, buffs);
+	}
+
+	GW::GRAPHICS::GDirectX11Surface d3d11;
+	GW::SYSTEM::GWindow win;
+	Microsoft::WRL::ComPtr<ID3D11Device>				device = nullptr;
+	Microsoft::WRL::ComPtr<ID3D11DeviceContext>			context = nullptr;
+	Microsoft::WRL::ComPtr<ID3D11DeviceContext1>		context1 = nullptr;
+	Microsoft::WRL::ComPtr<IDXGISwapChain>				swapchain = nullptr;
+	Microsoft::WRL::ComPtr<ID3D11RenderTargetView>		renderTargetView = nullptr;
+	Microsoft::WRL::ComPtr<ID3D11DepthStencilView>		depthView = nullptr;
+	D3D11StateCache										state;
+	// Per-draw constants sub-allocated from one dynamic buffer (D3D11.1 offsets only).
+	D3D11RingBackend									ringBackend;
+	ConstantRing<D3D11RingBackend>						ring{ ringBackend };
+	bool												useRing = false;
+	FallbackConstants									fallback[MaxDynamicSlots];
+	// Frame and pass timestamps; see GpuTimer. Recording contexts never start a frame on theirs.
+	D3D11TimerBackend									timerBackend;
+	GpuTimer<D3D11TimerBackend>							gpuTimer{ timerBackend };
+	bool												timingFrame = false;
+
+	// Recording contexts point at their device's tables and only read them.
+	Resources											ownResources;
+	Resources*											resources = &ownResources;
+
+	// Deferred contexts for RecordDraws(), one per part, and their command lists.
+	std::vector<std::unique_ptr<D3D11RenderDevice>>						recorders;
+	std::vector<Microsoft::WRL::ComPtr<ID3D11CommandList>>				commandLists;
+	std::unique_ptr<JobSystem>											recordJobs;
+};
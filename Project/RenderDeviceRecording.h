@@ -0,0 +1,687 @@
+#pragma once
+#include "RenderDevice.h"
+#include "JobSystem.h"
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <map>
+#include <memory>
+#include <vector>
+
+// Commands in a recorded stream. Values are part of the file format, append only.
+enum class RecordOp : uint8_t
+{
+	CreateBuffer = 1,
+	LoadTexture,
+	CreateShader,
+	CreateInputLayout,
+	CreateSampler,
+	CreateDepthState,
+	BeginFrame,
+	Clear,
+	EndFrame,
+	UpdateBuffer,
+	MapBuffer,
+	UnmapBuffer,
+	SetDynamicConstants,
+	SetPrimitiveTopology,
+	SetInputLayout,
+	SetVertexBuffers,
+	SetIndexBuffer,
+	SetShader,
+	SetConstantBuffers,
+	SetSamplers,
+	SetTextures,
+	SetDepthState,
+	DrawIndexed,
+	DrawIndexedInstanced,
+	DestroyBuffer,
+	ExecuteCommandList,
+	Count
+};
+
+inline const char* RecordOpName(RecordOp op)
+{
+	static const char* names[] =
+	{
+		"Invalid", "CreateBuffer", "LoadTexture", "CreateShader", "CreateInputLayout", "CreateSampler",
+		"CreateDepthState", "BeginFrame", "Clear", "EndFrame", "UpdateBuffer", "MapBuffer", "UnmapBuffer",
+		"SetDynamicConstants", "SetPrimitiveTopology", "SetInputLayout", "SetVertexBuffers", "SetIndexBuffer",
+		"SetShader", "SetConstantBuffers", "SetSamplers", "SetTextures", "SetDepthState", "DrawIndexed",
+		"DrawIndexedInstanced", "DestroyBuffer", "ExecuteCommandList",
+	};
+	static_assert(sizeof(names) / sizeof(names[0]) == static_cast<size_t>(RecordOp::Count), "RecordOpName out of date");
+	return op < RecordOp::Count ? names[static_cast<size_t>(op)] : "Invalid";
+}
+
+// Render device without a GPU. Every call is appended to a binary command stream:
+//	[op : u8][payload size : LEB128][payload]
+// Payload fields are little-endian u32s (u8 for enums), in argument order. Buffer contents
+// are only stored when payload recording is on; otherwise just their sizes are.
+// Mapped buffers get CPU storage so callers can write to them as usual.
+//
+// With more than one record thread, RecordDraws() records each part into a stream of its own on a
+// job system and appends the parts in order as ExecuteCommandList commands, the way D3D11 plays
+// back deferred contexts. Payload: [part : u32][size : u32][part's commands].
+class RecordingRenderDevice : public RenderDevice
+{
+public:
+	static const uint32_t FileMagic = 0x53445252; // "RRDS"
+	static const uint32_t FileVersion = 1;
+
+	RecordingRenderDevice(unsigned int _width, unsigned int _height) : width(_width), height(_height) {}
+
+	// Store the bytes of buffer updates and dynamic constants in the stream.
+	void SetRecordPayloads(bool record) { recordPayloads = record; }
+
+	const std::vector<uint8_t>& GetStream() const { return stream; }
+	void ClearStream() { stream.clear(); }
+	uint32_t GetFrameCount() const { return frames; }
+
+	void SetRecordThreads(uint32_t threads) override
+	{
+		recorders.clear();
+		recordJobs.reset();
+		if (threads <= 1)
+			return;
+		recordJobs.reset(new JobSystem(threads));
+		for (uint32_t i = 0; i < threads; i++)
+			recorders.emplace_back(new RecordingRenderDevice(width, height));
+	}
+
+	uint32_t GetRecordThreads() const override { return recorders.empty() ? 1 : static_cast<uint32_t>(recorders.size()); }
+
+	void RecordDraws(uint32_t count, RecordFunction record, void* user) override
+	{
+		uint32_t parts = recorders.size() < count ? static_cast<uint32_t>(recorders.size()) : count;
+		if (parts <= 1)
+		{
+			record(*this, 0, count, user);
+			return;
+		}
+
+		recordJobs->ParallelFor(parts, 1, [&](uint32_t first, uint32_t last)
+		{
+			for (uint32_t p = first; p < last; p++)
+			{
+				RecordingRenderDevice& recorder = *recorders[p];
+				recorder.stream.clear();
+				recorder.stats.Reset();
+				recorder.recordPayloads = recordPayloads;
+				uint32_t begin, end;
+				RecordPartRange(count, parts, p, begin, end);
+				record(recorder, begin, end, user);
+			}
+		});
+
+		for (uint32_t p = 0; p < parts; p++)
+		{
+			const RecordingRenderDevice& recorder = *recorders[p];
+			Put32(p);
+			PutPayload(recorder.stream.data(), static_cast<uint32_t>(recorder.stream.size()));
+			Emit(RecordOp::ExecuteCommandList);
+			stats.Add(recorder.stats);
+		}
+	}
+
+	// Writes the magic, the version and the stream.
+	bool SaveStream(const char* path) const
+	{
+		std::ofstream out(path, std::ios::binary);
+		if (!out.is_open())
+			return false;
+		uint32_t header[2] = { FileMagic, FileVersion };
+		out.write(reinterpret_cast<const char*>(header), sizeof(header));
+		out.write(reinterpret_cast<const char*>(stream.data()), stream.size());
+		return out.good();
+	}
+
+	void GetSize(unsigned int& _width, unsigned int& _height) const override
+	{
+		_width = width;
+		_height = height;
+	}
+
+	// -RESOURCES- //
+	BufferHandle CreateBuffer(const BufferDesc& desc) override
+	{
+		BufferRecord record;
+		record.desc = desc;
+		record.desc.initialData = nullptr;
+		if (desc.usage == BufferUsage::Dynamic)
+			record.storage.resize(desc.byteWidth);
+		buffers.push_back(record);
+
+		BufferHandle handle = static_cast<BufferHandle>(buffers.size());
+		Put32(handle);
+		Put8(static_cast<uint8_t>(desc.binding));
+		Put8(static_cast<uint8_t>(desc.usage));
+		Put32(desc.byteWidth);
+		if (desc.initialData != nullptr)
+			PutPayload(desc.initialData, desc.byteWidth);
+		Emit(RecordOp::CreateBuffer);
+		return handle;
+	}
+
+	void DestroyBuffer(BufferHandle buffer) override
+	{
+		BufferRecord* record = Find(buffer);
+		if (record != nullptr)
+			record->storage = std::vector<uint8_t>();
+		Put32(buffer);
+		Emit(RecordOp::DestroyBuffer);
+	}
+
+	TextureHandle LoadTexture(const wchar_t* path) override
+	{
+		TextureHandle handle = ++textureCount;
+		Put32(handle);
+		PutString(path);
+		Emit(RecordOp::LoadTexture);
+		return handle;
+	}
+
+	ShaderHandle CreateShader(const ShaderDesc& desc) override
+	{
+		ShaderHandle handle = ++shaderCount;
+		Put32(handle);
+		Put8(static_cast<uint8_t>(desc.stage));
+		PutString(desc.file);
+		PutString(desc.entryPoint);
+		PutString(desc.profile);
+		Emit(RecordOp::CreateShader);
+		return handle;
+	}
+
+	InputLayoutHandle CreateInputLayout(ShaderHandle vertexShader, const VertexElement* elements, uint32_t count) override
+	{
+		InputLayoutHandle handle = ++inputLayoutCount;
+		Put32(handle);
+		Put32(vertexShader);
+		Put32(count);
+		for (uint32_t i = 0; i < count; i++)
+		{
+			PutString(elements[i].semantic);
+			Put32(elements[i].semanticIndex);
+			Put8(static_cast<uint8_t>(elements[i].format));
+			Put32(elements[i].slot);
+			Put8(elements[i].perInstance ? 1 : 0);
+		}
+		Emit(RecordOp::CreateInputLayout);
+		return handle;
+	}
+
+	SamplerHandle CreateSampler(const SamplerDesc& desc) override
+	{
+		SamplerHandle handle = ++samplerCount;
+		Put32(handle);
+		Put8(static_cast<uint8_t>(desc.filter));
+		Put8(static_cast<uint8_t>(desc.address));
+		Emit(RecordOp::CreateSampler);
+		return handle;
+	}
+
+	DepthStateHandle CreateDepthState(const DepthStateDesc& desc) override
+	{
+		DepthStateHandle handle = ++depthStateCount;
+		Put32(handle);
+		Put8(desc.depthEnable ? 1 : 0);
+		Put8(desc.depthWrite ? 1 : 0);
+		Put8(static_cast<uint8_t>(desc.depthFunc));
+		Emit(RecordOp::CreateDepthState);
+		return handle;
+	}
+
+	// -FRAME- //
+	void BeginFrame() override
+	{
+		stats.Reset();
+		Put32(frames);
+		Emit(RecordOp::BeginFrame);
+	}
+
+	void Clear(const float color[4], float depth) override
+	{
+		for (int i = 0; i < 4; i++)
+			PutFloat(color[i]);
+		PutFloat(depth);
+		Emit(RecordOp::Clear);
+	}
+
+	void EndFrame(bool vsync) override
+	{
+		Put32(frames++);
+		Put8(vsync ? 1 : 0);
+		Emit(RecordOp::EndFrame);
+	}
+
+	// -DATA- //
+	void UpdateBuffer(BufferHandle buffer, const void* data, uint32_t size) override
+	{
+		Put32(buffer);
+		Put32(size);
+		if (recordPayloads)
+			PutPayload(data, size);
+		Emit(RecordOp::UpdateBuffer);
+		CountUpload(size);
+	}
+
+	void* MapBuffer(BufferHandle buffer, MapMode mode) override
+	{
+		BufferRecord* record = Find(buffer);
+		Put32(buffer);
+		Put8(static_cast<uint8_t>(mode));
+		Emit(RecordOp::MapBuffer);
+		if (record == nullptr || record->storage.empty())
+			return nullptr;
+		return record->storage.data();
+	}
+
+	void UnmapBuffer(BufferHandle buffer, uint32_t bytesWritten) override
+	{
+		BufferRecord* record = Find(buffer);
+		Put32(buffer);
+		Put32(bytesWritten);
+		if (recordPayloads && record != nullptr && bytesWritten <= record->storage.size())
+			PutPayload(record->storage.data(), bytesWritten);
+		Emit(RecordOp::UnmapBuffer);
+		CountUpload(bytesWritten);
+	}
+
+	void SetDynamicConstants(uint32_t slot, const void* data, uint32_t size) override
+	{
+		Put32(slot);
+		Put32(size);
+		if (recordPayloads)
+			PutPayload(data, size);
+		Emit(RecordOp::SetDynamicConstants);
+		CountUpload(size);
+	}
+
+	// -STATE- //
+	void SetPrimitiveTopology(PrimitiveTopology topology) override
+	{
+		Put8(static_cast<uint8_t>(topology));
+		EmitState(RecordOp::SetPrimitiveTopology);
+	}
+
+	void SetInputLayout(InputLayoutHandle layout) override
+	{
+		Put32(layout);
+		EmitState(RecordOp::SetInputLayout);
+	}
+
+	void SetVertexBuffers(uint32_t startSlot, uint32_t count, const BufferHandle* buffers, const uint32_t* strides, const uint32_t* offsets) override
+	{
+		Put32(startSlot);
+		Put32(count);
+		for (uint32_t i = 0; i < count; i++)
+		{
+			Put32(buffers[i]);
+			Put32(strides[i]);
+			Put32(offsets[i]);
+		}
+		EmitState(RecordOp::SetVertexBuffers);
+	}
+
+	void SetIndexBuffer(BufferHandle buffer, IndexFormat format, uint32_t offset) override
+	{
+		Put32(buffer);
+		Put8(static_cast<uint8_t>(format));
+		Put32(offset);
+		EmitState(RecordOp::SetIndexBuffer);
+	}
+
+	void SetShader(ShaderStage stage, ShaderHandle shader) override
+	{
+		Put8(static_cast<uint8_t>(stage));
+		Put32(shader);
+		EmitState(RecordOp::SetShader);
+	}
+
+	void SetConstantBuffers(uint32_t startSlot, uint32_t count, const BufferHandle* buffers) override
+	{
+		PutRange(startSlot, count, buffers);
+		EmitState(RecordOp::SetConstantBuffers);
+	}
+
+	void SetSamplers(uint32_t startSlot, uint32_t count, const SamplerHandle* samplers) override
+	{
+		PutRange(startSlot, count, samplers);
+		EmitState(RecordOp::SetSamplers);
+	}
+
+	void SetTextures(uint32_t startSlot, uint32_t count, const TextureHandle* textures) override
+	{
+		PutRange(startSlot, count, textures);
+		EmitState(RecordOp::SetTextures);
+	}
+
+	void SetDepthState(DepthStateHandle state) override
+	{
+		Put32(state);
+		EmitState(RecordOp::SetDepthState);
+	}
+
+	// -DRAWS- //
+	void DrawIndexed(uint32_t indexCount, uint32_t startIndex, int32_t baseVertex) override
+	{
+		Put32(indexCount);
+		Put32(startIndex);
+		Put32(static_cast<uint32_t>(baseVertex));
+		Emit(RecordOp::DrawIndexed);
+		CountDraw(indexCount, 1);
+	}
+
+	void DrawIndexedInstanced(uint32_t indexCount, uint32_t instanceCount, uint32_t startIndex, int32_t baseVertex, uint32_t startInstance) override
+	{
+		Put32(indexCount);
+		Put32(instanceCount);
+		Put32(startIndex);
+		Put32(static_cast<uint32_t>(baseVertex));
+		Put32(startInstance);
+		Emit(RecordOp::DrawIndexedInstanced);
+		CountDraw(indexCount, instanceCount);
+	}
+
+private:
+	struct BufferRecord
+	{
+		BufferDesc desc;
+		std::vector<uint8_t> storage; // Only for dynamic buffers.
+	};
+
+	BufferRecord* Find(BufferHandle buffer)
+	{
+		if (buffer == InvalidHandle || buffer > buffers.size())
+			return nullptr;
+		return &buffers[buffer - 1];
+	}
+
+	void Put8(uint8_t value) { payload.push_back(value); }
+
+	void Put32(uint32_t value)
+	{
+		for (int i = 0; i < 4; i++)
+			payload.push_back(static_cast<uint8_t>(value >> (i * 8)));
+	}
+
+	void PutFloat(float value)
+	{
+		uint32_t bits;
+		memcpy(&bits, &value, sizeof(bits));
+		Put32(bits);
+	}
+
+	// Length-prefixed bytes.
+	void PutPayload(const void* data, uint32_t size)
+	{
+		Put32(size);
+		const uint8_t* bytes = static_cast<const uint8_t*>(data);
+		payload.insert(payload.end(), bytes, bytes + size);
+	}
+
+	// Length-prefixed, one byte per character.
+	template<typename Char>
+	void PutString(const Char* text)
+	{
+		uint32_t length = 0;
+		while (text != nullptr && text[length] != 0)
+			length++;
+		Put32(length);
+		for (uint32_t i = 0; i < length; i++)
+			Put8(static_cast<uint8_t>(text[i]));
+	}
+
+	void PutRange(uint32_t startSlot, uint32_t count, const uint32_t* handles)
+	{
+		Put32(startSlot);
+		Put32(count);
+		for (uint32_t i = 0; i < count; i++)
+			Put32(handles[i]);
+	}
+
+	// Appends the pending payload to the stream as one command.
+	void Emit(RecordOp op)
+	{
+		stream.push_back(static_cast<uint8_t>(op));
+		size_t size = payload.size();
+		do
+		{
+			uint8_t byte = size & 0x7F;
+			size >>= 7;
+			stream.push_back(size != 0 ? byte | 0x80 : byte);
+		} while (size != 0);
+		stream.insert(stream.end(), payload.begin(), payload.end());
+		payload.clear();
+	}
+
+	void EmitState(RecordOp op)
+	{
+		Emit(op);
+		stats.stateCalls++;
+	}
+
+	unsigned int width, height;
+	bool recordPayloads = false;
+	uint32_t frames = 0;
+	std::vector<uint8_t> stream;
+	std::vector<uint8_t> payload;
+	std::vector<BufferRecord> buffers;
+	uint32_t textureCount = 0, shaderCount = 0, inputLayoutCount = 0, samplerCount = 0, depthStateCount = 0;
+	// Contexts the parts of RecordDraws() are recorded on.
+	std::vector<std::unique_ptr<RecordingRenderDevice>> recorders;
+	std::unique_ptr<JobSystem> recordJobs;
+};
+
+// Walks a stream written by RecordingRenderDevice (without the file header).
+class RecordingReader
+{
+public:
+	struct Command
+	{
+		RecordOp op;
+		const uint8_t* payload;
+		uint32_t size;
+	};
+
+	RecordingReader(const uint8_t* _data, size_t _size) : data(_data), size(_size) {}
+
+	// Returns false at the end of the stream or on a truncated command.
+	bool Next(Command& command)
+	{
+		if (position >= size)
+			return false;
+
+		command.op = static_cast<RecordOp>(data[position++]);
+		uint64_t length = 0;
+		int shift = 0;
+		for (;;)
+		{
+			if (position >= size || shift > 28)
+				return false;
+			uint8_t byte = data[position++];
+			length |= static_cast<uint64_t>(byte & 0x7F) << shift;
+			shift += 7;
+			if ((byte & 0x80) == 0)
+				break;
+		}
+		if (length > size - position)
+			return false;
+
+		command.payload = data + position;
+		command.size = static_cast<uint32_t>(length);
+		position += static_cast<size_t>(length);
+		return true;
+	}
+
+	bool AtEnd() const { return position >= size; }
+
+	static uint32_t ReadU32(const uint8_t* p)
+	{
+		return static_cast<uint32_t>(p[0]) | (static_cast<uint32_t>(p[1]) << 8) |
+			(static_cast<uint32_t>(p[2]) << 16) | (static_cast<uint32_t>(p[3]) << 24);
+	}
+
+private:
+	const uint8_t* data;
+	size_t size;
+	size_t position = 0;
+};
+
+// Replays a stream into the state every draw ran with, so recordings that set state differently can
+// be compared by what they draw. Each draw becomes an event holding the draw and everything bound;
+// other commands that aren't state stay events as they are. State is cleared where a frame starts,
+// and where a command list starts and ends, as D3D11 clears it, so a draw that leans on state from
+// an earlier frame or another part shows up as a difference. Dynamic constants are per draw and
+// only last until the next one.
+class RecordingResolver
+{
+public:
+	typedef std::vector<uint8_t> Event;
+
+	// Appends the stream's events; false if it is truncated or a command is malformed.
+	bool Resolve(const uint8_t* data, size_t size, std::vector<Event>& events)
+	{
+		RecordingReader reader(data, size);
+		RecordingReader::Command command;
+		while (reader.Next(command))
+		{
+			if (!Apply(command, events))
+				return false;
+		}
+		return reader.AtEnd();
+	}
+
+private:
+	// What a binding is (its setter) and which slot or stage.
+	typedef std::pair<uint32_t, uint32_t> Binding;
+
+	bool Apply(const RecordingReader::Command& command, std::vector<Event>& events)
+	{
+		const uint8_t* p = command.payload;
+		uint32_t size = command.size;
+		uint32_t op = static_cast<uint32_t>(command.op);
+		switch (command.op)
+		{
+		case RecordOp::SetPrimitiveTopology:
+			if (size < 1)
+				return false;
+			Bind(Binding(op, 0), p, size, true);
+			return true;
+
+		case RecordOp::SetInputLayout:
+		case RecordOp::SetIndexBuffer:
+		case RecordOp::SetDepthState:
+			if (size < 4)
+				return false;
+			Bind(Binding(op, 0), p, size, RecordingReader::ReadU32(p) != InvalidHandle);
+			return true;
+
+		case RecordOp::SetShader:
+			if (size < 5)
+				return false;
+			Bind(Binding(op, p[0]), p, size, RecordingReader::ReadU32(p + 1) != InvalidHandle);
+			return true;
+
+		case RecordOp::SetVertexBuffers:
+			return BindRange(op, p, size, 12);
+
+		case RecordOp::SetConstantBuffers:
+		case RecordOp::SetSamplers:
+		case RecordOp::SetTextures:
+			return BindRange(op, p, size, 4);
+
+		case RecordOp::SetDynamicConstants:
+			// Shares the constant buffer slot with SetConstantBuffers.
+			if (size < 4)
+				return false;
+			Bind(Binding(static_cast<uint32_t>(RecordOp::SetConstantBuffers), RecordingReader::ReadU32(p)), p, size, true, op);
+			return true;
+
+		case RecordOp::DrawIndexed:
+		case RecordOp::DrawIndexedInstanced:
+		{
+			Event event;
+			Append(event, op, p, size);
+			for (const std::pair<const Binding, Event>& binding : bound)
+			{
+				Append(event, binding.first.first, nullptr, 0);
+				Append(event, binding.first.second, binding.second.data(), static_cast<uint32_t>(binding.second.size()));
+			}
+			events.push_back(event);
+			// Per draw constants are used up.
+			for (std::map<Binding, Event>::iterator i = bound.begin(); i != bound.end();)
+				i = !i->second.empty() && i->second[0] == static_cast<uint8_t>(RecordOp::SetDynamicConstants) ? bound.erase(i) : std::next(i);
+			return true;
+		}
+
+		case RecordOp::ExecuteCommandList:
+		{
+			if (size < 8 || RecordingReader::ReadU32(p + 4) > size - 8)
+				return false;
+			bound.clear();
+			bool valid = Resolve(p + 8, RecordingReader::ReadU32(p + 4), events);
+			bound.clear();
+			return valid;
+		}
+
+		case RecordOp::BeginFrame:
+			bound.clear();
+			break;
+
+		default:
+			break;
+		}
+
+		Event event;
+		Append(event, op, p, size);
+		events.push_back(event);
+		return true;
+	}
+
+	// Slot by slot, for the setters that take a start slot, a count and 'stride' bytes per slot
+	// starting with a handle.
+	bool BindRange(uint32_t op, const uint8_t* p, uint32_t size, uint32_t stride)
+	{
+		if (size < 8)
+			return false;
+		uint32_t start = RecordingReader::ReadU32(p);
+		uint32_t count = RecordingReader::ReadU32(p + 4);
+		if (count > (size - 8) / stride)
+			return false;
+		for (uint32_t i = 0; i < count; i++)
+		{
+			const uint8_t* slot = p + 8 + i * stride;
+			Bind(Binding(op, start + i), slot, stride, RecordingReader::ReadU32(slot) != InvalidHandle);
+		}
+		return true;
+	}
+
+	// Values start with the setter, which tells dynamic constants from a constant buffer.
+	void Bind(const Binding& binding, const uint8_t* p, uint32_t size, bool set, uint32_t setter = 0)
+	{
+		if (!set)
+		{
+			bound.erase(binding);
+			return;
+		}
+		Event& value = bound[binding];
+		value.clear();
+		value.push_back(static_cast<uint8_t>(setter != 0 ? setter : binding.first));
+		value.insert(value.end(), p, p + size);
+	}
+
+	static void Append(Event& event, uint32_t value, const uint8_t* bytes, uint32_t size)
+	{
+		for (int i = 0; i < 4; i++)
+			event.push_back(static_cast<uint8_t>(value >> (i * 8)));
+		if (bytes == nullptr)
+			return;
+		for (int i = 0; i < 4; i++)
+			event.push_back(static_cast<uint8_t>(size >> (i * 8)));
+		event.insert(event.end(), bytes, bytes + size);
+	}
+
+	std::map<Binding, Event> bound;
+};
@@ -0,0 +1,515 @@
+#pragma once
+#include "defines.h"
+#include "RenderDevice.h"
+#include "SoftwareRasterizer.h"
+#include "SoftwareShaders.h"
+#include "SoftwareTexture.h"
+#include <cstring>
+#include <deque>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <vector>
+
+// Render device that draws on the CPU with SoftwareRasterizer; no GPU or graphics API needed.
+//
+// Shaders resolve to the C++ ports in SoftwareShaders.h by entry point. Vertices are shaded when
+// the draw is issued, pixels when the frame is flushed. EndFrame presents to a GRasterSurface
+// if one was given, otherwise the frame stays in memory for SaveCapture.
+// Only triangle lists are rasterized.
+class SoftwareRenderDevice : public RenderDevice
+{
+public:
+	SoftwareRenderDevice(unsigned int _width, unsigned int _height) : width(_width), height(_height)
+	{
+		rasterizer.Resize(width, height);
+	}
+
+	// Presents every frame to 'surface'; its window must be at least as big as the device.
+	void SetPresentSurface(GW::GRAPHICS::GRasterSurface _surface)
+	{
+		surface = _surface;
+		present = true;
+	}
+
+	SoftwareRasterizer& GetRasterizer() { return rasterizer; }
+	const RasterStats& GetRasterStats() const { return rasterizer.GetStats(); }
+
+	// Writes the last finished frame as an uncompressed 32-bit TGA.
+	bool SaveCapture(const char* path) const
+	{
+		std::ofstream out(path, std::ios::binary);
+		if (!out.is_open())
+			return false;
+		uint8_t header[18] = {};
+		header[2] = 2;	// Uncompressed true color
+		header[12] = static_cast<uint8_t>(width & 255);
+		header[13] = static_cast<uint8_t>(width >> 8);
+		header[14] = static_cast<uint8_t>(height & 255);
+		header[15] = static_cast<uint8_t>(height >> 8);
+		header[16] = 32;
+		header[17] = 0x28;	// 8 alpha bits, top-left origin
+		out.write(reinterpret_cast<const char*>(header), sizeof(header));
+		// 0xAARRGGBB in little-endian memory is TGA's B, G, R, A order.
+		out.write(reinterpret_cast<const char*>(rasterizer.GetPixels()), static_cast<std::streamsize>(width) * height * 4);
+		return out.good();
+	}
+
+	void GetSize(unsigned int& _width, unsigned int& _height) const override
+	{
+		_width = width;
+		_height = height;
+	}
+
+	// -RESOURCES- //
+	BufferHandle CreateBuffer(const BufferDesc& desc) override
+	{
+		Buffer buffer;
+		buffer.desc = desc;
+		buffer.desc.initialData = nullptr;
+		buffer.data.resize(desc.byteWidth);
+		if (desc.initialData != nullptr)
+			memcpy(buffer.data.data(), desc.initialData, desc.byteWidth);
+		buffers.push_back(buffer);
+		return static_cast<BufferHandle>(buffers.size());
+	}
+
+	void DestroyBuffer(BufferHandle buffer) override
+	{
+		Buffer* record = FindBuffer(buffer);
+		if (record != nullptr)
+			record->data = std::vector<uint8_t>();
+	}
+
+	// Missing files get a flat grey texture so the scene still renders; the skybox isn't in the repository.
+	TextureHandle LoadTexture(const wchar_t* path) override
+	{
+		std::unique_ptr<SoftwareTexture> texture(new SoftwareTexture());
+		if (!texture->LoadDDS(path))
+		{
+			// Narrow output only, wcout would switch stdout to wide characters for the rest of the run.
+			std::string name;
+			for (const wchar_t* c = path; *c != 0; c++)
+				name.push_back(static_cast<char>(*c));
+			std::cout << "Could not load " << name << ", using a placeholder\n";
+			texture->CreateSolid(0xff808080);
+		}
+		textures.push_back(std::move(texture));
+		return static_cast<TextureHandle>(textures.size());
+	}
+
+	ShaderHandle CreateShader(const ShaderDesc& desc) override
+	{
+		const SoftwareShaderProgram* program = desc.entryPoint != nullptr ? FindSoftwareShader(desc.stage, desc.entryPoint) : nullptr;
+		if (program == nullptr)
+		{
+			std::cout << "No software version of shader " << (desc.entryPoint != nullptr ? desc.entryPoint : "(null)") << "\n";
+			return InvalidHandle;
+		}
+		shaders.push_back(program);
+		return static_cast<ShaderHandle>(shaders.size());
+	}
+
+	// Elements are matched to the shader's inputs by semantic, like D3D's input signature check.
+	InputLayoutHandle CreateInputLayout(ShaderHandle vertexShader, const VertexElement* elements, uint32_t count) override
+	{
+		const SoftwareShaderProgram* program = FindShader(vertexShader);
+		if (program == nullptr || program->stage != ShaderStage::Vertex)
+			return InvalidHandle;
+
+		// Offsets of each element within its slot.
+		std::vector<uint32_t> offsets(count);
+		uint32_t slotOffsets[MaxVertexStreams] = {};
+		for (uint32_t i = 0; i < count; i++)
+		{
+			if (elements[i].slot >= MaxVertexStreams)
+				return InvalidHandle;
+			offsets[i] = slotOffsets[elements[i].slot];
+			slotOffsets[elements[i].slot] += FormatSize(elements[i].format);
+		}
+
+		InputLayout layout;
+		for (uint32_t input = 0; input < program->inputCount; input++)
+		{
+			const SoftwareShaderInput& wanted = program->inputs[input];
+			uint32_t found = count;
+			for (uint32_t i = 0; i < count && found == count; i++)
+			{
+				if (elements[i].semanticIndex == wanted.semanticIndex && strcmp(elements[i].semantic, wanted.semantic) == 0)
+					found = i;
+			}
+			if (found == count)
+				return InvalidHandle;
+
+			LayoutElement element;
+			element.slot = elements[found].slot;
+			element.offset = offsets[found];
+			element.format = elements[found].format;
+			element.perInstance = elements[found].perInstance;
+			element.input = input;
+			layout.elements.push_back(element);
+		}
+		layout.inputCount = program->inputCount;
+		layouts.push_back(layout);
+		return static_cast<InputLayoutHandle>(layouts.size());
+	}
+
+	SamplerHandle CreateSampler(const SamplerDesc& desc) override
+	{
+		samplers.push_back(desc);
+		return static_cast<SamplerHandle>(samplers.size());
+	}
+
+	DepthStateHandle CreateDepthState(const DepthStateDesc& desc) override
+	{
+		depthStates.push_back(desc);
+		return static_cast<DepthStateHandle>(depthStates.size());
+	}
+
+	// -FRAME- //
+	void BeginFrame() override
+	{
+		stats.Reset();
+		rasterizer.ResetStats();
+	}
+
+	void Clear(const float color[4], float depth) override
+	{
+		Flush();
+		rasterizer.Clear(PackClearColor(color), depth);
+	}
+
+	// Rasterizes the frame; vsync has no meaning here.
+	void EndFrame(bool) override
+	{
+		Flush();
+		if (present)
+			surface.UpdateSurface(rasterizer.GetPixels(), width * height);
+	}
+
+	// -DATA- //
+	void UpdateBuffer(BufferHandle buffer, const void* data, uint32_t size) override
+	{
+		Buffer* record = FindBuffer(buffer);
+		if (record == nullptr)
+			return;
+		memcpy(record->data.data(), data, size < record->data.size() ? size : record->data.size());
+		CountUpload(size);
+	}
+
+	void* MapBuffer(BufferHandle buffer, MapMode) override
+	{
+		Buffer* record = FindBuffer(buffer);
+		return record != nullptr && !record->data.empty() ? record->data.data() : nullptr;
+	}
+
+	void UnmapBuffer(BufferHandle, uint32_t bytesWritten) override
+	{
+		CountUpload(bytesWritten);
+	}
+
+	void SetDynamicConstants(uint32_t slot, const void* data, uint32_t size) override
+	{
+		if (slot >= CB_COUNT)
+			return;
+		dynamicConstants[slot].assign(static_cast<const uint8_t*>(data), static_cast<const uint8_t*>(data) + size);
+		dynamicBound[slot] = true;
+		CountUpload(size);
+	}
+
+	// -STATE- //
+	void SetPrimitiveTopology(PrimitiveTopology _topology) override
+	{
+		stats.stateCalls++;
+		topology = _topology;
+	}
+
+	void SetInputLayout(InputLayoutHandle layout) override
+	{
+		stats.stateCalls++;
+		inputLayout = layout;
+	}
+
+	void SetVertexBuffers(uint32_t startSlot, uint32_t count, const BufferHandle* buffers, const uint32_t* strides, const uint32_t* offsets) override
+	{
+		stats.stateCalls++;
+		for (uint32_t i = 0; i < count && startSlot + i < MaxVertexStreams; i++)
+		{
+			vertexStreams[startSlot + i].buffer = buffers[i];
+			vertexStreams[startSlot + i].stride = strides[i];
+			vertexStreams[startSlot + i].offset = offsets[i];
+		}
+	}
+
+	void SetIndexBuffer(BufferHandle buffer, IndexFormat, uint32_t offset) override
+	{
+		stats.stateCalls++;
+		indexBuffer = buffer;
+		indexOffset = offset;
+	}
+
+	void SetShader(ShaderStage stage, ShaderHandle shader) override
+	{
+		stats.stateCalls++;
+		if (stage == ShaderStage::Vertex)
+			vertexShader = shader;
+		else if (stage == ShaderStage::Pixel)
+			pixelShader = shader;
+	}
+
+	void SetConstantBuffers(uint32_t startSlot, uint32_t count, const BufferHandle* buffers) override
+	{
+		stats.stateCalls++;
+		for (uint32_t i = 0; i < count && startSlot + i < CB_COUNT; i++)
+		{
+			constantBuffers[startSlot + i] = buffers[i];
+			dynamicBound[startSlot + i] = false;
+		}
+	}
+
+	void SetSamplers(uint32_t startSlot, uint32_t count, const SamplerHandle* _samplers) override
+	{
+		stats.stateCalls++;
+		for (uint32_t i = 0; i < count && startSlot + i < MaxSamplers; i++)
+			boundSamplers[startSlot + i] = _samplers[i];
+	}
+
+	void SetTextures(uint32_t startSlot, uint32_t count, const TextureHandle* _textures) override
+	{
+		stats.stateCalls++;
+		for (uint32_t i = 0; i < count && startSlot + i < RasterMaxTextures; i++)
+			boundTextures[startSlot + i] = _textures[i];
+	}
+
+	void SetDepthState(DepthStateHandle state) override
+	{
+		stats.stateCalls++;
+		depthState = state;
+	}
+
+	// -DRAWS- //
+	void DrawIndexed(uint32_t indexCount, uint32_t startIndex, int32_t baseVertex) override
+	{
+		CountDraw(indexCount, 1);
+		Draw(indexCount, 1, startIndex, baseVertex, 0);
+	}
+
+	void DrawIndexedInstanced(uint32_t indexCount, uint32_t instanceCount, uint32_t startIndex, int32_t baseVertex, uint32_t startInstance) override
+	{
+		CountDraw(indexCount, instanceCount);
+		Draw(indexCount, instanceCount, startIndex, baseVertex, startInstance);
+	}
+
+private:
+	static const uint32_t MaxVertexStreams = 8;
+	static const uint32_t MaxSamplers = 4;
+
+	struct Buffer
+	{
+		BufferDesc desc;
+		std::vector<uint8_t> data;
+	};
+
+	struct LayoutElement
+	{
+		uint32_t slot;
+		uint32_t offset;
+		VertexFormat format;
+		bool perInstance;
+		uint32_t input;	// Index into the vertex shader's inputs.
+	};
+
+	struct InputLayout
+	{
+		std::vector<LayoutElement> elements;
+		uint32_t inputCount = 0;
+	};
+
+	struct VertexStream
+	{
+		BufferHandle buffer = InvalidHandle;
+		uint32_t stride = 0;
+		uint32_t offset = 0;
+	};
+
+	unsigned int width, height;
+	SoftwareRasterizer rasterizer;
+	GW::GRAPHICS::GRasterSurface surface;
+	bool present = false;
+
+	std::vector<Buffer> buffers;
+	std::vector<std::unique_ptr<SoftwareTexture>> textures;
+	std::vector<const SoftwareShaderProgram*> shaders;
+	std::vector<InputLayout> layouts;
+	std::vector<SamplerDesc> samplers;
+	std::vector<DepthStateDesc> depthStates;
+
+	PrimitiveTopology topology = PrimitiveTopology::TriangleList;
+	InputLayoutHandle inputLayout = InvalidHandle;
+	VertexStream vertexStreams[MaxVertexStreams];
+	BufferHandle indexBuffer = InvalidHandle;
+	uint32_t indexOffset = 0;
+	ShaderHandle vertexShader = InvalidHandle;
+	ShaderHandle pixelShader = InvalidHandle;
+	BufferHandle constantBuffers[CB_COUNT] = {};
+	std::vector<uint8_t> dynamicConstants[CB_COUNT];
+	bool dynamicBound[CB_COUNT] = {};
+	SamplerHandle boundSamplers[MaxSamplers] = {};
+	TextureHandle boundTextures[RasterMaxTextures] = {};
+	DepthStateHandle depthState = InvalidHandle;
+
+	// Uniforms of the draws waiting in the rasterizer; a deque so their addresses stay put.
+	std::deque<SoftwareUniforms> drawUniforms;
+	std::vector<RasterVertex> shadedVertices;
+
+	template<typename T>
+	static T* FindIn(std::vector<T>& items, uint32_t handle)
+	{
+		return handle != InvalidHandle && handle <= items.size() ? &items[handle - 1] : nullptr;
+	}
+
+	Buffer* FindBuffer(BufferHandle handle) { return FindIn(buffers, handle); }
+
+	const SoftwareShaderProgram* FindShader(ShaderHandle handle)
+	{
+		const SoftwareShaderProgram** program = FindIn(shaders, handle);
+		return program != nullptr ? *program : nullptr;
+	}
+
+	const SoftwareTexture* FindTexture(TextureHandle handle)
+	{
+		std::unique_ptr<SoftwareTexture>* texture = FindIn(textures, handle);
+		return texture != nullptr ? texture->get() : nullptr;
+	}
+
+	static uint32_t FormatSize(VertexFormat format)
+	{
+		switch (format)
+		{
+		case VertexFormat::Float2: return 8;
+		case VertexFormat::Float3: return 12;
+		default: return 16;
+		}
+	}
+
+	static uint32_t PackClearColor(const float color[4])
+	{
+		uint32_t channels[4];
+		for (uint32_t i = 0; i < 4; i++)
+		{
+			float c = color[i] < 0.0f ? 0.0f : (color[i] > 1.0f ? 1.0f : color[i]);
+			channels[i] = static_cast<uint32_t>(c * 255.0f + 0.5f);
+		}
+		return (channels[3] << 24) | (channels[0] << 16) | (channels[1] << 8) | channels[2];
+	}
+
+	void Flush()
+	{
+		rasterizer.Flush();
+		drawUniforms.clear();
+	}
+
+	// Reads one vertex's shader inputs. Reads past the end of a buffer return zero, like D3D.
+	void FetchVertex(const InputLayout& layout, int64_t vertex, uint32_t instance, XMVECTOR* inputs)
+	{
+		for (uint32_t i = 0; i < layout.inputCount; i++)
+			inputs[i] = XMVectorSet(0.0f, 0.0f, 0.0f, 1.0f);
+
+		for (const LayoutElement& element : layout.elements)
+		{
+			const VertexStream& stream = vertexStreams[element.slot];
+			Buffer* buffer = FindBuffer(stream.buffer);
+			int64_t index = element.perInstance ? static_cast<int64_t>(instance) : vertex;
+			int64_t start = static_cast<int64_t>(stream.offset) + index * stream.stride + element.offset;
+			uint32_t size = FormatSize(element.format);
+			if (buffer == nullptr || start < 0 || static_cast<uint64_t>(start) + size > buffer->data.size())
+			{
+				inputs[element.input] = XMVectorZero();
+				continue;
+			}
+
+			XMFLOAT4 value = { 0.0f, 0.0f, 0.0f, 1.0f };
+			memcpy(&value, buffer->data.data() + start, size);
+			inputs[element.input] = XMLoadFloat4(&value);
+		}
+	}
+
+	void Draw(uint32_t indexCount, uint32_t instanceCount, uint32_t startIndex, int32_t baseVertex, uint32_t startInstance)
+	{
+		const SoftwareShaderProgram* vs = FindShader(vertexShader);
+		const SoftwareShaderProgram* ps = FindShader(pixelShader);
+		InputLayout* layout = FindIn(layouts, inputLayout);
+		Buffer* indices = FindBuffer(indexBuffer);
+		if (topology != PrimitiveTopology::TriangleList || vs == nullptr || vs->vertexShader == nullptr ||
+			ps == nullptr || ps->pixelShader == nullptr || layout == nullptr || indices == nullptr || indexCount < 3)
+			return;
+
+		size_t first = indexOffset / sizeof(uint32_t) + startIndex;
+		if ((first + indexCount) * sizeof(uint32_t) > indices->data.size())
+			return;
+		const uint32_t* index = reinterpret_cast<const uint32_t*>(indices->data.data()) + first;
+
+		// Shade only the vertices the indices reach.
+		uint32_t minIndex = index[0], maxIndex = index[0];
+		for (uint32_t i = 1; i < indexCount; i++)
+		{
+			minIndex = index[i] < minIndex ? index[i] : minIndex;
+			maxIndex = index[i] > maxIndex ? index[i] : maxIndex;
+		}
+
+		// Snapshot the constants as the draw sees them.
+		const void* constants[CB_COUNT];
+		uint32_t sizes[CB_COUNT];
+		for (uint32_t slot = 0; slot < CB_COUNT; slot++)
+		{
+			const std::vector<uint8_t>* data = &dynamicConstants[slot];
+			if (!dynamicBound[slot])
+			{
+				Buffer* buffer = FindBuffer(constantBuffers[slot]);
+				data = buffer != nullptr ? &buffer->data : nullptr;
+			}
+			constants[slot] = data != nullptr && !data->empty() ? data->data() : nullptr;
+			sizes[slot] = data != nullptr ? static_cast<uint32_t>(data->size()) : 0;
+		}
+		drawUniforms.emplace_back();
+		SoftwareUniforms& uniforms = drawUniforms.back();
+		PrepareSoftwareUniforms(constants, sizes, uniforms);
+
+		RasterDraw draw;
+		draw.pixelShader = ps->pixelShader;
+		draw.quadShader = ps->quadShader;
+		draw.uniforms = &uniforms;
+		for (uint32_t i = 0; i < RasterMaxTextures; i++)
+			draw.textures[i] = FindTexture(boundTextures[i]);
+		// Without a sampler D3D samples linear and clamped.
+		SamplerDesc* sampler = FindIn(samplers, boundSamplers[0]);
+		if (sampler != nullptr)
+			draw.sampler = *sampler;
+		else
+			draw.sampler.address = SamplerAddress::Clamp;
+		DepthStateDesc* depth = FindIn(depthStates, depthState);
+		if (depth != nullptr)
+			draw.depth = *depth;
+		draw.varyingCount = vs->varyingCount;
+		draw.derivatives = ps->derivatives;
+		uint32_t drawIndex = rasterizer.AddDraw(draw);
+
+		XMVECTOR inputs[SoftwareMaxShaderInputs];
+		shadedVertices.resize(static_cast<size_t>(maxIndex) - minIndex + 1);
+		for (uint32_t instance = 0; instance < instanceCount; instance++)
+		{
+			for (uint32_t i = 0; i < shadedVertices.size(); i++)
+			{
+				FetchVertex(*layout, static_cast<int64_t>(minIndex) + i + baseVertex, startInstance + instance, inputs);
+				vs->vertexShader(uniforms, inputs, shadedVertices[i]);
+			}
+
+			for (uint32_t i = 0; i + 2 < indexCount; i += 3)
+			{
+				rasterizer.SubmitTriangle(drawIndex, shadedVertices[index[i] - minIndex],
+					shadedVertices[index[i + 1] - minIndex], shadedVertices[index[i + 2] - minIndex]);
+			}
+		}
+	}
+};
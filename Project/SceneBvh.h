@@ -0,0 +1,579 @@
+#pragma once
+#include "defines.h"
+#include "FrustumCuller.h"
+#include "JobSystem.h"
+#include <cfloat>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+// Bounding volume hierarchy over the scene's object boxes.
+//
+// Build() splits nodes with a binned surface area heuristic. Objects that move are updated with
+// Set() and the tree is refit bottom up by Refit(), which keeps the topology and only grows or
+// shrinks boxes. Refitting degrades the tree as objects drift apart, so Refit() tracks the SAH cost
+// against the cost right after the build and, past RebuildThreshold, rebuilds from a snapshot as a
+// job on the shared JobSystem. The next Refit() after that build finishes swaps the new tree in and refits it to
+// wherever the objects are by then.
+//
+// Queries return object ids, the index Add() gave out.
+struct BvhNode
+{
+	XMFLOAT3 boundsMin;
+	uint32_t first;		// Left child (the right one follows it), or the first object of a leaf.
+	XMFLOAT3 boundsMax;
+	uint32_t count;		// Objects in a leaf, 0 for an inner node.
+};
+
+// Work done by the last Build() or Refit().
+struct BvhStats
+{
+	uint32_t nodes = 0;
+	uint32_t depth = 0;
+	float cost = 0.0f;			// SAH cost relative to the root's area.
+	float builtCost = 0.0f;		// The cost right after the tree was built.
+	uint32_t rebuilds = 0;		// Background rebuilds swapped in so far.
+	double buildMs = 0.0;
+	double refitMs = 0.0;
+};
+
+class SceneBvh
+{
+public:
+	static const uint32_t MaxLeafSize = 4;
+	static const uint32_t BinCount = 16;
+	static constexpr float RebuildThreshold = 1.3f;
+	// Deeper nodes become leaves, which bounds the traversal stacks.
+	static const uint32_t MaxDepth = 62;
+	static const uint32_t StackSize = MaxDepth + 2;
+
+	// The rebuild job writes the pending tree.
+	~SceneBvh() { WaitForRebuild(); }
+
+	uint32_t Add(const XMFLOAT3& boundsMin, const XMFLOAT3& boundsMax)
+	{
+		objectMin.push_back(boundsMin);
+		objectMax.push_back(boundsMax);
+		return static_cast<uint32_t>(objectMin.size() - 1);
+	}
+
+	void Set(uint32_t id, const XMFLOAT3& boundsMin, const XMFLOAT3& boundsMax)
+	{
+		objectMin[id] = boundsMin;
+		objectMax[id] = boundsMax;
+	}
+
+	void Reserve(size_t count)
+	{
+		objectMin.reserve(count);
+		objectMax.reserve(count);
+	}
+
+	void Clear()
+	{
+		WaitForRebuild();
+		objectMin.clear();
+		objectMax.clear();
+		nodes.clear();
+		indices.clear();
+	}
+
+	// New objects start empty; the next Refit() rebuilds for the new count.
+	void Resize(size_t count)
+	{
+		objectMin.resize(count, XMFLOAT3(0.0f, 0.0f, 0.0f));
+		objectMax.resize(count, XMFLOAT3(0.0f, 0.0f, 0.0f));
+	}
+
+	size_t Count() const { return objectMin.size(); }
+
+	void Build()
+	{
+		WaitForRebuild();
+		std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+		BuildTree(objectMin, objectMax, nodes, indices, stats.depth);
+		stats.nodes = static_cast<uint32_t>(nodes.size());
+		stats.cost = stats.builtCost = Cost(nodes);
+		stats.buildMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+	}
+
+	// Moves the boxes to the objects' current bounds. Builds the tree if objects were added since
+	// the last build, and swaps in a finished background rebuild.
+	void Refit()
+	{
+		if (rebuilding && rebuildCounter.Done())
+		{
+			rebuilding = false;
+			if (pendingIndices.size() == objectMin.size())
+			{
+				nodes.swap(pendingNodes);
+				indices.swap(pendingIndices);
+				stats.nodes = static_cast<uint32_t>(nodes.size());
+				stats.depth = pendingDepth;
+				stats.builtCost = pendingCost;
+				stats.rebuilds++;
+			}
+		}
+		if (indices.size() != objectMin.size())
+		{
+			Build();
+			return;
+		}
+
+		std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+		// Children always come after their parent, so one backwards pass refits every node.
+		for (size_t n = nodes.size(); n-- > 0;)
+		{
+			BvhNode& node = nodes[n];
+			if (node.count > 0)
+			{
+				node.boundsMin = XMFLOAT3(FLT_MAX, FLT_MAX, FLT_MAX);
+				node.boundsMax = XMFLOAT3(-FLT_MAX, -FLT_MAX, -FLT_MAX);
+				for (uint32_t i = node.first; i < node.first + node.count; i++)
+					Grow(node.boundsMin, node.boundsMax, objectMin[indices[i]], objectMax[indices[i]]);
+			}
+			else
+			{
+				const BvhNode& left = nodes[node.first];
+				const BvhNode& right = nodes[node.first + 1];
+				node.boundsMin = left.boundsMin;
+				node.boundsMax = left.boundsMax;
+				Grow(node.boundsMin, node.boundsMax, right.boundsMin, right.boundsMax);
+			}
+		}
+		stats.cost = Cost(nodes);
+		stats.refitMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+
+		if (stats.cost > stats.builtCost * RebuildThreshold && !rebuilding)
+			StartRebuild();
+	}
+
+	// Ids of the objects whose boxes are not entirely outside one of the frustum's planes.
+	void QueryFrustum(const Frustum& frustum, std::vector<uint32_t>& out) const
+	{
+		out.clear();
+		if (nodes.empty())
+			return;
+
+		// Planes a node is entirely inside of are skipped for its children.
+		struct Entry { uint32_t node; uint32_t planes; };
+		Entry stack[StackSize];
+		uint32_t top = 0;
+		stack[top++] = { 0, 0x3f };
+		while (top > 0)
+		{
+			Entry entry = stack[--top];
+			const BvhNode& node = nodes[entry.node];
+			uint32_t planes = entry.planes;
+			bool outside = false;
+			for (uint32_t p = 0; p < 6 && !outside; p++)
+			{
+				if ((planes & (1u << p)) == 0)
+					continue;
+				const XMFLOAT4& plane = frustum.planes[p];
+				// The corners farthest along and against the normal.
+				float nearX = plane.x >= 0.0f ? node.boundsMax.x : node.boundsMin.x, farX = plane.x >= 0.0f ? node.boundsMin.x : node.boundsMax.x;
+				float nearY = plane.y >= 0.0f ? node.boundsMax.y : node.boundsMin.y, farY = plane.y >= 0.0f ? node.boundsMin.y : node.boundsMax.y;
+				float nearZ = plane.z >= 0.0f ? node.boundsMax.z : node.boundsMin.z, farZ = plane.z >= 0.0f ? node.boundsMin.z : node.boundsMax.z;
+				if (plane.x * nearX + plane.y * nearY + plane.z * nearZ + plane.w < 0.0f)
+					outside = true;
+				else if (plane.x * farX + plane.y * farY + plane.z * farZ + plane.w >= 0.0f)
+					planes &= ~(1u << p);
+			}
+			if (outside)
+				continue;
+
+			if (planes == 0 || node.count > 0)
+			{
+				if (node.count > 0 && planes != 0)
+				{
+					// A leaf that crosses a plane tests its objects.
+					for (uint32_t i = node.first; i < node.first + node.count; i++)
+					{
+						uint32_t id = indices[i];
+						if (BoxInFrustum(frustum, planes, objectMin[id], objectMax[id]))
+							out.push_back(id);
+					}
+				}
+				else
+					AppendSubtree(entry.node, out);
+				continue;
+			}
+			stack[top++] = { node.first, planes };
+			stack[top++] = { node.first + 1, planes };
+		}
+	}
+
+	// Calls 'visit(id, enter, maxDistance)' for every object whose box the ray enters, at 'enter',
+	// before 'maxDistance'; nearer children first. The visitor can shorten 'maxDistance' (a float&)
+	// to prune the rest, e.g. after an exact hit. 'direction' doesn't need to be normalized;
+	// distances are in its units.
+	template<typename Visitor>
+	void QueryRay(const XMFLOAT3& origin, const XMFLOAT3& direction, float maxDistance, Visitor visit) const
+	{
+		if (nodes.empty())
+			return;
+
+		XMFLOAT3 invDir(1.0f / direction.x, 1.0f / direction.y, 1.0f / direction.z);
+		uint32_t stack[StackSize];
+		uint32_t top = 0;
+		float tRoot;
+		if (RayBox(origin, invDir, nodes[0].boundsMin, nodes[0].boundsMax, maxDistance, tRoot))
+			stack[top++] = 0;
+		while (top > 0)
+		{
+			const BvhNode& node = nodes[stack[--top]];
+			if (node.count > 0)
+			{
+				for (uint32_t i = node.first; i < node.first + node.count; i++)
+				{
+					uint32_t id = indices[i];
+					float tEnter;
+					if (RayBox(origin, invDir, objectMin[id], objectMax[id], maxDistance, tEnter))
+						visit(id, tEnter, maxDistance);
+				}
+				continue;
+			}
+
+			float tLeft, tRight;
+			const BvhNode& left = nodes[node.first];
+			const BvhNode& right = nodes[node.first + 1];
+			bool hitLeft = RayBox(origin, invDir, left.boundsMin, left.boundsMax, maxDistance, tLeft);
+			bool hitRight = RayBox(origin, invDir, right.boundsMin, right.boundsMax, maxDistance, tRight);
+			// Push the farther child first so the nearer one is visited first.
+			if (hitLeft && hitRight)
+			{
+				bool leftFirst = tLeft <= tRight;
+				stack[top++] = leftFirst ? node.first + 1 : node.first;
+				stack[top++] = leftFirst ? node.first : node.first + 1;
+			}
+			else if (hitLeft)
+				stack[top++] = node.first;
+			else if (hitRight)
+				stack[top++] = node.first + 1;
+		}
+	}
+
+	// Ids of the objects whose boxes overlap the box, touching counts.
+	void QueryOverlap(const XMFLOAT3& boundsMin, const XMFLOAT3& boundsMax, std::vector<uint32_t>& out) const
+	{
+		out.clear();
+		if (nodes.empty())
+			return;
+
+		uint32_t stack[StackSize];
+		uint32_t top = 0;
+		stack[top++] = 0;
+		while (top > 0)
+		{
+			const BvhNode& node = nodes[stack[--top]];
+			if (!Overlaps(node.boundsMin, node.boundsMax, boundsMin, boundsMax))
+				continue;
+			if (node.count > 0)
+			{
+				for (uint32_t i = node.first; i < node.first + node.count; i++)
+				{
+					if (Overlaps(objectMin[indices[i]], objectMax[indices[i]], boundsMin, boundsMax))
+						out.push_back(indices[i]);
+				}
+				continue;
+			}
+			stack[top++] = node.first;
+			stack[top++] = node.first + 1;
+		}
+	}
+
+	// Slab test; 'tEnter' is where the ray enters the box, 0 if it starts inside.
+	static bool RayBox(const XMFLOAT3& origin, const XMFLOAT3& invDir, const XMFLOAT3& boundsMin, const XMFLOAT3& boundsMax, float maxDistance, float& tEnter)
+	{
+		float tx0 = (boundsMin.x - origin.x) * invDir.x, tx1 = (boundsMax.x - origin.x) * invDir.x;
+		float ty0 = (boundsMin.y - origin.y) * invDir.y, ty1 = (boundsMax.y - origin.y) * invDir.y;
+		float tz0 = (boundsMin.z - origin.z) * invDir.z, tz1 = (boundsMax.z - origin.z) * invDir.z;
+		float tMin = tx0 < tx1 ? tx0 : tx1, tMax = tx0 < tx1 ? tx1 : tx0;
+		float yMin = ty0 < ty1 ? ty0 : ty1, yMax = ty0 < ty1 ? ty1 : ty0;
+		float zMin = tz0 < tz1 ? tz0 : tz1, zMax = tz0 < tz1 ? tz1 : tz0;
+		tMin = yMin > tMin ? yMin : tMin;
+		tMin = zMin > tMin ? zMin : tMin;
+		tMax = yMax < tMax ? yMax : tMax;
+		tMax = zMax < tMax ? zMax : tMax;
+		tMin = tMin > 0.0f ? tMin : 0.0f;
+		tEnter = tMin;
+		return tMin <= tMax && tMin <= maxDistance;
+	}
+
+	// Binned SAH build over 'boundsMin'/'boundsMax' into 'outNodes' and 'outIndices'. Static so
+	// the background rebuild can run it on a snapshot, and MeshBvh builds over triangle boxes with it.
+	static void BuildTree(const std::vector<XMFLOAT3>& boundsMin, const std::vector<XMFLOAT3>& boundsMax,
+		std::vector<BvhNode>& outNodes, std::vector<uint32_t>& outIndices, uint32_t& outDepth)
+	{
+		uint32_t count = static_cast<uint32_t>(boundsMin.size());
+		outNodes.clear();
+		outIndices.resize(count);
+		outDepth = 0;
+		if (count == 0)
+			return;
+
+		std::vector<BuildRef> refs(count);
+		XMFLOAT3 rootMin(FLT_MAX, FLT_MAX, FLT_MAX), rootMax(-FLT_MAX, -FLT_MAX, -FLT_MAX);
+		for (uint32_t i = 0; i < count; i++)
+		{
+			refs[i].boundsMin = boundsMin[i];
+			refs[i].boundsMax = boundsMax[i];
+			refs[i].centroid = XMFLOAT3(boundsMin[i].x + boundsMax[i].x, boundsMin[i].y + boundsMax[i].y, boundsMin[i].z + boundsMax[i].z);
+			refs[i].id = i;
+			Grow(rootMin, rootMax, boundsMin[i], boundsMax[i]);
+		}
+
+		outNodes.reserve(count / MaxLeafSize * 2 + 1);
+		outNodes.push_back({ rootMin, 0, rootMax, count });
+
+		// A node's bounds are known when it is pushed; the split that made it measured them.
+		struct Entry { uint32_t node; uint32_t depth; };
+		Entry stack[StackSize];
+		uint32_t top = 0;
+		stack[top++] = { 0, 1 };
+		while (top > 0)
+		{
+			Entry entry = stack[--top];
+			uint32_t first = outNodes[entry.node].first, objects = outNodes[entry.node].count;
+			outDepth = entry.depth > outDepth ? entry.depth : outDepth;
+			if (objects <= MaxLeafSize || entry.depth >= MaxDepth)
+				continue;
+
+			XMFLOAT3 centerMin(FLT_MAX, FLT_MAX, FLT_MAX), centerMax(-FLT_MAX, -FLT_MAX, -FLT_MAX);
+			for (uint32_t i = first; i < first + objects; i++)
+				Grow(centerMin, centerMax, refs[i].centroid, refs[i].centroid);
+
+			// Bin the centroids along all three axes in one pass. A flat axis puts everything in
+			// its first bin and never finds a split.
+			float low[3] = { centerMin.x, centerMin.y, centerMin.z };
+			float extent[3] = { centerMax.x - centerMin.x, centerMax.y - centerMin.y, centerMax.z - centerMin.z };
+			float scale[3];
+			BvhBin bins[3][BinCount];
+			for (uint32_t axis = 0; axis < 3; axis++)
+			{
+				scale[axis] = extent[axis] > 0.0f ? BinCount / extent[axis] : 0.0f;
+				for (BvhBin& bin : bins[axis])
+					bin = { XMFLOAT3(FLT_MAX, FLT_MAX, FLT_MAX), XMFLOAT3(-FLT_MAX, -FLT_MAX, -FLT_MAX), 0 };
+			}
+			for (uint32_t i = first; i < first + objects; i++)
+			{
+				const BuildRef& ref = refs[i];
+				const float* centroid = &ref.centroid.x;
+				for (uint32_t axis = 0; axis < 3; axis++)
+				{
+					BvhBin& bin = bins[axis][BinOf(centroid[axis], low[axis], scale[axis])];
+					bin.count++;
+					Grow(bin.boundsMin, bin.boundsMax, ref.boundsMin, ref.boundsMax);
+				}
+			}
+
+			// Sweep from the right for the bounds of every suffix, then from the left for the
+			// prefixes, and keep the cheapest split between two bins.
+			float bestCost = FLT_MAX;
+			uint32_t bestAxis = 0, bestSplit = 0;
+			XMFLOAT3 bestLeftMin, bestLeftMax, bestRightMin, bestRightMax;
+			for (uint32_t axis = 0; axis < 3; axis++)
+			{
+				const BvhBin* axisBins = bins[axis];
+				XMFLOAT3 suffixMin[BinCount], suffixMax[BinCount];
+				uint32_t suffixObjects[BinCount];
+				XMFLOAT3 sweepMin(FLT_MAX, FLT_MAX, FLT_MAX), sweepMax(-FLT_MAX, -FLT_MAX, -FLT_MAX);
+				uint32_t sweepObjects = 0;
+				for (uint32_t b = BinCount; b-- > 1;)
+				{
+					sweepObjects += axisBins[b].count;
+					if (axisBins[b].count > 0)
+						Grow(sweepMin, sweepMax, axisBins[b].boundsMin, axisBins[b].boundsMax);
+					suffixMin[b] = sweepMin;
+					suffixMax[b] = sweepMax;
+					suffixObjects[b] = sweepObjects;
+				}
+				sweepMin = XMFLOAT3(FLT_MAX, FLT_MAX, FLT_MAX);
+				sweepMax = XMFLOAT3(-FLT_MAX, -FLT_MAX, -FLT_MAX);
+				sweepObjects = 0;
+				for (uint32_t b = 0; b + 1 < BinCount; b++)
+				{
+					sweepObjects += axisBins[b].count;
+					if (axisBins[b].count > 0)
+						Grow(sweepMin, sweepMax, axisBins[b].boundsMin, axisBins[b].boundsMax);
+					if (sweepObjects == 0 || suffixObjects[b + 1] == 0)
+						continue;
+					float cost = HalfArea(sweepMin, sweepMax) * sweepObjects + HalfArea(suffixMin[b + 1], suffixMax[b + 1]) * suffixObjects[b + 1];
+					if (cost < bestCost)
+					{
+						bestCost = cost;
+						bestAxis = axis;
+						bestSplit = b + 1;
+						bestLeftMin = sweepMin;
+						bestLeftMax = sweepMax;
+						bestRightMin = suffixMin[b + 1];
+						bestRightMax = suffixMax[b + 1];
+					}
+				}
+			}
+			// Every centroid in one spot: nothing to split on.
+			if (bestCost == FLT_MAX)
+				continue;
+
+			uint32_t middle = first, last = first + objects;
+			while (middle < last)
+			{
+				if (BinOf((&refs[middle].centroid.x)[bestAxis], low[bestAxis], scale[bestAxis]) < bestSplit)
+					middle++;
+				else
+					std::swap(refs[middle], refs[--last]);
+			}
+
+			uint32_t left = static_cast<uint32_t>(outNodes.size());
+			outNodes[entry.node].first = left;
+			outNodes[entry.node].count = 0;
+			outNodes.push_back({ bestLeftMin, first, bestLeftMax, middle - first });
+			outNodes.push_back({ bestRightMin, middle, bestRightMax, first + objects - middle });
+			stack[top++] = { left + 1, entry.depth + 1 };
+			stack[top++] = { left, entry.depth + 1 };
+		}
+
+		for (uint32_t i = 0; i < count; i++)
+			outIndices[i] = refs[i].id;
+	}
+
+	const BvhStats& GetStats() const { return stats; }
+	const std::vector<BvhNode>& GetNodes() const { return nodes; }
+	bool IsRebuilding() const { return rebuilding; }
+
+	// Waits for a background rebuild and throws its result away.
+	void WaitForRebuild()
+	{
+		if (!rebuilding)
+			return;
+		jobs->Wait(rebuildCounter);
+		rebuilding = false;
+	}
+
+private:
+	static void Grow(XMFLOAT3& boundsMin, XMFLOAT3& boundsMax, const XMFLOAT3& otherMin, const XMFLOAT3& otherMax)
+	{
+		boundsMin.x = otherMin.x < boundsMin.x ? otherMin.x : boundsMin.x;
+		boundsMin.y = otherMin.y < boundsMin.y ? otherMin.y : boundsMin.y;
+		boundsMin.z = otherMin.z < boundsMin.z ? otherMin.z : boundsMin.z;
+		boundsMax.x = otherMax.x > boundsMax.x ? otherMax.x : boundsMax.x;
+		boundsMax.y = otherMax.y > boundsMax.y ? otherMax.y : boundsMax.y;
+		boundsMax.z = otherMax.z > boundsMax.z ? otherMax.z : boundsMax.z;
+	}
+
+	static float HalfArea(const XMFLOAT3& boundsMin, const XMFLOAT3& boundsMax)
+	{
+		float x = boundsMax.x - boundsMin.x, y = boundsMax.y - boundsMin.y, z = boundsMax.z - boundsMin.z;
+		return x >= 0.0f && y >= 0.0f && z >= 0.0f ? x * y + y * z + z * x : 0.0f;
+	}
+
+	static bool Overlaps(const XMFLOAT3& aMin, const XMFLOAT3& aMax, const XMFLOAT3& bMin, const XMFLOAT3& bMax)
+	{
+		return aMin.x <= bMax.x && aMax.x >= bMin.x && aMin.y <= bMax.y && aMax.y >= bMin.y && aMin.z <= bMax.z && aMax.z >= bMin.z;
+	}
+
+	static bool BoxInFrustum(const Frustum& frustum, uint32_t planes, const XMFLOAT3& boundsMin, const XMFLOAT3& boundsMax)
+	{
+		for (uint32_t p = 0; p < 6; p++)
+		{
+			if ((planes & (1u << p)) == 0)
+				continue;
+			const XMFLOAT4& plane = frustum.planes[p];
+			float x = plane.x >= 0.0f ? boundsMax.x : boundsMin.x;
+			float y = plane.y >= 0.0f ? boundsMax.y : boundsMin.y;
+			float z = plane.z >= 0.0f ? boundsMax.z : boundsMin.z;
+			if (plane.x * x + plane.y * y + plane.z * z + plane.w < 0.0f)
+				return false;
+		}
+		return true;
+	}
+
+	void AppendSubtree(uint32_t root, std::vector<uint32_t>& out) const
+	{
+		uint32_t stack[StackSize];
+		uint32_t top = 0;
+		stack[top++] = root;
+		while (top > 0)
+		{
+			const BvhNode& node = nodes[stack[--top]];
+			if (node.count > 0)
+			{
+				out.insert(out.end(), indices.begin() + node.first, indices.begin() + node.first + node.count);
+				continue;
+			}
+			stack[top++] = node.first;
+			stack[top++] = node.first + 1;
+		}
+	}
+
+	// Sum of inner node areas (one traversal step each) and leaf areas times their objects,
+	// relative to the root's area.
+	static float Cost(const std::vector<BvhNode>& tree)
+	{
+		if (tree.empty())
+			return 0.0f;
+		double cost = 0.0;
+		for (const BvhNode& node : tree)
+			cost += HalfArea(node.boundsMin, node.boundsMax) * (node.count > 0 ? node.count : 1);
+		float rootArea = HalfArea(tree[0].boundsMin, tree[0].boundsMax);
+		return rootArea > 0.0f ? static_cast<float>(cost / rootArea) : 0.0f;
+	}
+
+	struct BvhBin
+	{
+		XMFLOAT3 boundsMin, boundsMax;
+		uint32_t count;
+	};
+
+	// An object as the build sees it. These are partitioned instead of ids so every pass over a
+	// node reads memory in order.
+	struct BuildRef
+	{
+		XMFLOAT3 boundsMin, boundsMax;
+		XMFLOAT3 centroid;		// Doubled, min + max, since only the order matters.
+		uint32_t id;
+	};
+
+	static uint32_t BinOf(float centroid, float low, float scale)
+	{
+		int32_t bin = static_cast<int32_t>((centroid - low) * scale);
+		return static_cast<uint32_t>(bin < 0 ? 0 : (bin >= static_cast<int32_t>(BinCount) ? BinCount - 1 : bin));
+	}
+
+	void StartRebuild()
+	{
+		pendingMin = objectMin;
+		pendingMax = objectMax;
+		rebuilding = true;
+		// Without workers nothing takes the job until someone waits; rebuild here instead.
+		if (jobs->GetThreadCount() > 1)
+			jobs->Run(RebuildJob, this, 0, 1, rebuildCounter);
+		else
+			RebuildJob(this, 0, 1);
+	}
+
+	static void RebuildJob(void* data, uint32_t, uint32_t)
+	{
+		SceneBvh* bvh = static_cast<SceneBvh*>(data);
+		BuildTree(bvh->pendingMin, bvh->pendingMax, bvh->pendingNodes, bvh->pendingIndices, bvh->pendingDepth);
+		bvh->pendingCost = Cost(bvh->pendingNodes);
+	}
+
+	std::vector<XMFLOAT3> objectMin, objectMax;
+	std::vector<BvhNode> nodes;
+	std::vector<uint32_t> indices;	// Object ids in leaf order.
+	BvhStats stats;
+
+	// Owned by the rebuild job until its counter is done.
+	std::shared_ptr<JobSystem> jobs = JobSystem::Shared();
+	JobCounter rebuildCounter;
+	bool rebuilding = false;
+	std::vector<XMFLOAT3> pendingMin, pendingMax;
+	std::vector<BvhNode> pendingNodes;
+	std::vector<uint32_t> pendingIndices;
+	uint32_t pendingDepth = 0;
+	float pendingCost = 0.0f;
+};
@@ -5,17 +5,25 @@ Texture2D crosshairTX : register(t3); // Crosshair Texture
 SamplerState samLinear : register(s0); // s for samplers
 TextureCube skybox : register(t2);
 
-cbuffer ConstantBuffer : register(b0) // b for constant buffers
+// Constant buffers are split by update frequency, see ConstantBuffers.h
+cbuffer PerFrame : register(b0) // b for constant buffers
 {
-    matrix World;
     matrix View;
     matrix Projection;
     float4 vLightDir;
     float4 vLightColor;
-    float4 vOutputColor;
-    bool popped[3];
     float time;
 }
+
+cbuffer PerMaterial : register(b1)
+{
+    float4 vOutputColor;
+}
+
+cbuffer PerObject : register(b2)
+{
+    matrix World;
+}
 //--------------------------------------------------------------------------------------
 
 struct VS_INPUT
@@ -34,6 +42,28 @@ struct PS_INPUT
     float4 Color : COLOR;
 };
 
+struct VS_INSTANCED_INPUT
+{
+    float4 Pos : POSITION;
+    float3 Norm : NORMAL;
+    float2 Tex : TEXCOORD0;
+    float4 World0 : INSTANCEWORLD0; // Per-instance world matrix rows
+    float4 World1 : INSTANCEWORLD1;
+    float4 World2 : INSTANCEWORLD2;
+    float4 World3 : INSTANCEWORLD3;
+    float4 Color : INSTANCECOLOR;
+};
+
+struct PS_INSTANCED_INPUT
+{
+    float4 Pos : SV_POSITION;
+    float4 worldPos : POSITION;
+    float3 Norm : NORMAL;
+    float2 Tex : TEXCOORD1;
+    float4 Color : COLOR;
+    float4 wvpRow : TEXCOORD2; // Row 3 of World * View * Projection for the specular term
+};
+
 struct SKYBOX_VS_INPUT
 {
     float4 Pos : SV_POSITION;
@@ -67,6 +97,20 @@ PS_INPUT VSWave(VS_INPUT input)
     return output;
 }
 
+PS_INSTANCED_INPUT VS_Instanced(VS_INSTANCED_INPUT input)
+{
+    PS_INSTANCED_INPUT output = (PS_INSTANCED_INPUT) 0;
+    matrix instWorld = matrix(input.World0, input.World1, input.World2, input.World3);
+    output.worldPos = mul(input.Pos, instWorld);
+    output.Pos = mul(output.worldPos, View);
+    output.Pos = mul(output.Pos, Projection);
+    output.Norm = mul(input.Norm, (float3x3) instWorld);
+    output.Tex = input.Tex;
+    output.Color = input.Color;
+    output.wvpRow = mul(mul(input.World3, View), Projection);
+    return output;
+}
+
 SKYBOX_VS_INPUT SKYBOX_VS(SKYBOX_VS_INPUT input)
 {
     SKYBOX_VS_INPUT output = (SKYBOX_VS_INPUT) 0;
@@ -106,23 +150,22 @@ float4 PS(PS_INPUT input) : SV_Target
     //return txDiffuse.Sample(samLinear, input.Tex) * vOutputColor;
 }
 
-float4 PS_Specular(PS_INPUT input) : SV_Target
+float4 SpecularLighting(float3 norm, float4 worldPos, float4 wvpRow, float4 baseColor)
 {
-    input.Norm = normalize(input.Norm);
+    norm = normalize(norm);
     // Ambient Light
     float4 ambientColor = { 0.5f, 0.5f, 0.5f, 1.0f };
-    float4 color = vOutputColor * ambientColor;
-    matrix WVP = mul(mul(World, View), Projection);
+    float4 color = baseColor * ambientColor;
     // Directional Light
-    color += saturate(dot((float3) -vLightDir, input.Norm)) * vLightColor * vOutputColor;
+    color += saturate(dot((float3) -vLightDir, norm)) * vLightColor * baseColor;
 
     // Specular
     float specularPower = 25.0f, specularIntensity = 0.75f;
-    float4 viewDir = normalize((WVP)[3] - mul(input.worldPos, View));
+    float4 viewDir = normalize(wvpRow - mul(worldPos, View));
     
     float3 halfvector = normalize((-vLightDir) + viewDir);
     
-    float intensity = max(pow(saturate(dot(input.Norm, halfvector)), specularPower), 0);
+    float intensity = max(pow(saturate(dot(norm, halfvector)), specularPower), 0);
     
     float4 reflectedcolor = vLightColor * specularIntensity * intensity;
     
@@ -131,6 +174,17 @@ float4 PS_Specular(PS_INPUT input) : SV_Target
     return color;
 }
 
+float4 PS_Specular(PS_INPUT input) : SV_Target
+{
+    matrix WVP = mul(mul(World, View), Projection);
+    return SpecularLighting(input.Norm, input.worldPos, WVP[3], vOutputColor);
+}
+
+float4 PS_SpecularInstanced(PS_INSTANCED_INPUT input) : SV_Target
+{
+    return SpecularLighting(input.Norm, input.worldPos, input.wvpRow, input.Color);
+}
+
 float4 PS_SolidTexture(PS_INPUT input) : SV_Target
 {    
     float4 color = txDiffuse.Sample(samLinear, input.Tex);
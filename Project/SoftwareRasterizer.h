@@ -0,0 +1,816 @@
+#pragma once
+#include "defines.h"
+#include "RenderDevice.h"
+#include "RasterSimd.h"
+#include "SoftwareTexture.h"
+#include "JobSystem.h"
+#include <chrono>
+#include <cmath>
+#include <vector>
+
+// Tiled triangle rasterizer behind SoftwareRenderDevice.
+//
+// Triangles are clipped, set up and binned into screen tiles as they are submitted.
+// Flush() then rasterizes the tiles in a ParallelFor on the shared JobSystem; a tile owns its
+// pixels and walks its triangles in submission order, so the result matches a single threaded run.
+// Coverage and depth are tested with the SSE2 or AVX2 kernels in RasterSimd.h when the CPU has
+// them, and those kernels interpolate and shade whole 2x2 quads. Triangles too small to fill a
+// block go through the scalar kernel, which shades per pixel.
+static const uint32_t RasterTileSize = 64;
+static const uint32_t RasterMaxVaryings = 18;
+static const uint32_t RasterMaxTextures = 4;
+
+// A vertex after the vertex shader: clip space position plus the values to interpolate.
+struct RasterVertex
+{
+	XMFLOAT4 position;
+	float varyings[RasterMaxVaryings];
+};
+
+// What the pixel shader gets. 'ddx'/'ddy' are the screen space derivatives of varyings[0] and
+// varyings[1], the texture coordinate, and are only filled in for draws that ask for them.
+struct RasterPixel
+{
+	const float* varyings;
+	float ddx[2];
+	float ddy[2];
+};
+
+// What a quad shader gets: RasterPixel for a 2x2 quad, one pixel per lane in the order top left,
+// top right, bottom left, bottom right. Lanes outside 'mask' hold vertex 0's values.
+struct RasterQuad
+{
+	XMVECTOR varyings[RasterMaxVaryings];
+	XMVECTOR ddx[2];
+	XMVECTOR ddy[2];
+	uint32_t mask;
+};
+
+struct RasterDraw;
+// Returns false to discard the pixel.
+typedef bool (*RasterPixelShader)(const RasterDraw& draw, const RasterPixel& pixel, XMVECTOR& color);
+// Writes red, green, blue and alpha across the lanes of 'color'; returns the lanes of quad.mask to keep.
+typedef uint32_t (*RasterQuadShader)(const RasterDraw& draw, const RasterQuad& quad, XMVECTOR color[4]);
+
+// State shared by the triangles of one draw call. Must stay valid until the next Flush().
+struct RasterDraw
+{
+	RasterPixelShader pixelShader = nullptr;
+	RasterQuadShader quadShader = nullptr;	// Optional, the same shader for the SIMD kernels.
+	const void* uniforms = nullptr;
+	const SoftwareTexture* textures[RasterMaxTextures] = {};
+	SamplerDesc sampler;
+	DepthStateDesc depth;
+	uint32_t varyingCount = 0;
+	bool derivatives = false;
+};
+
+// Work done since the last ResetStats().
+struct RasterStats
+{
+	uint32_t trianglesSubmitted = 0;
+	uint32_t trianglesClipped = 0;		// Crossed the near plane and were split.
+	uint32_t trianglesCulled = 0;		// Back facing, off screen or too small to cover a pixel center.
+	uint32_t tileBins = 0;				// Triangle references across all tiles.
+	uint64_t pixelsTested = 0;			// Inside a triangle and the depth range.
+	uint64_t pixelsShaded = 0;			// Passed the depth test.
+	uint64_t pixelsWritten = 0;			// Not discarded.
+	double rasterMs = 0.0;				// Wall time spent in Flush().
+
+	void Reset() { *this = RasterStats(); }
+};
+
+class SoftwareRasterizer
+{
+public:
+	SoftwareRasterizer()
+	{
+		kernel = BestKernel();
+	}
+
+	void Resize(uint32_t _width, uint32_t _height)
+	{
+		width = _width;
+		height = _height;
+		color.assign(static_cast<size_t>(width) * height, 0);
+		depth.assign(static_cast<size_t>(width) * height, 1.0f);
+
+		tilesX = (width + RasterTileSize - 1) / RasterTileSize;
+		tilesY = (height + RasterTileSize - 1) / RasterTileSize;
+		tiles.assign(static_cast<size_t>(tilesX) * tilesY, RasterTile());
+		for (uint32_t ty = 0; ty < tilesY; ty++)
+		{
+			for (uint32_t tx = 0; tx < tilesX; tx++)
+			{
+				RasterTile& tile = tiles[ty * tilesX + tx];
+				tile.minX = tx * RasterTileSize;
+				tile.minY = ty * RasterTileSize;
+				tile.maxX = tile.minX + RasterTileSize < width ? tile.minX + RasterTileSize : width;
+				tile.maxY = tile.minY + RasterTileSize < height ? tile.minY + RasterTileSize : height;
+			}
+		}
+	}
+
+	// Off runs every tile on the calling thread.
+	void SetMultithreaded(bool enabled) { multithreaded = enabled; }
+
+	// The best supported kernel is picked at construction; returns false if 'kernel' can't run here.
+	bool SetKernel(RasterKernel _kernel)
+	{
+		if (!IsKernelSupported(_kernel))
+			return false;
+		kernel = _kernel;
+		return true;
+	}
+	RasterKernel GetKernel() const { return kernel; }
+
+	static RasterKernel BestKernel() { return RasterBestKernel(); }
+	static bool IsKernelSupported(RasterKernel kernel) { return RasterKernelSupported(kernel); }
+
+	// Applied by the tiles at the start of the next Flush().
+	void Clear(uint32_t argb, float _depth)
+	{
+		if (!triangles.empty())
+			Flush();
+		clearPending = true;
+		clearColor = argb;
+		clearDepth = _depth;
+	}
+
+	uint32_t AddDraw(const RasterDraw& draw)
+	{
+		draws.push_back(draw);
+		return static_cast<uint32_t>(draws.size() - 1);
+	}
+
+	// Clips against the near plane and the guard band, culls back faces (clockwise is front, like
+	// D3D's default rasterizer state) and bins what is left.
+	void SubmitTriangle(uint32_t drawIndex, const RasterVertex& v0, const RasterVertex& v1, const RasterVertex& v2)
+	{
+		stats.trianglesSubmitted++;
+		const RasterVertex* in[3] = { &v0, &v1, &v2 };
+
+		// Reject triangles entirely outside one side of the view volume.
+		uint32_t outsideAll = ~0u, clipAny = 0;
+		for (uint32_t i = 0; i < 3; i++)
+		{
+			const XMFLOAT4& p = in[i]->position;
+			uint32_t code = (p.x < -p.w ? 1u : 0u) | (p.x > p.w ? 2u : 0u) | (p.y < -p.w ? 4u : 0u) |
+				(p.y > p.w ? 8u : 0u) | (p.z < 0.0f ? 16u : 0u) | (p.z > p.w ? 32u : 0u);
+			outsideAll &= code;
+			for (uint32_t plane = 0; plane < ClipPlaneCount; plane++)
+				clipAny |= ClipDistance(plane, p) < 0.0f ? 1u << plane : 0u;
+		}
+		if (outsideAll != 0)
+		{
+			stats.trianglesCulled++;
+			return;
+		}
+		if (clipAny == 0)
+		{
+			SetupTriangle(drawIndex, v0, v1, v2);
+			return;
+		}
+
+		// Each plane adds at most one vertex.
+		stats.trianglesClipped++;
+		uint32_t varyingCount = draws[drawIndex].varyingCount;
+		RasterVertex polygons[2][3 + ClipPlaneCount];
+		uint32_t count = 3;
+		for (uint32_t i = 0; i < 3; i++)
+			polygons[0][i] = *in[i];
+		uint32_t current = 0;
+		for (uint32_t plane = 0; plane < ClipPlaneCount && count >= 3; plane++)
+		{
+			if ((clipAny & (1u << plane)) == 0)
+				continue;
+			const RasterVertex* src = polygons[current];
+			RasterVertex* dst = polygons[current ^ 1];
+			uint32_t clippedCount = 0;
+			for (uint32_t i = 0; i < count; i++)
+			{
+				const RasterVertex& a = src[i];
+				const RasterVertex& b = src[(i + 1) % count];
+				float da = ClipDistance(plane, a.position), db = ClipDistance(plane, b.position);
+				if (da >= 0.0f)
+					dst[clippedCount++] = a;
+				if ((da >= 0.0f) != (db >= 0.0f))
+					LerpVertex(a, b, da / (da - db), varyingCount, dst[clippedCount++]);
+			}
+			count = clippedCount;
+			current ^= 1;
+		}
+		for (uint32_t i = 1; i + 1 < count; i++)
+			SetupTriangle(drawIndex, polygons[current][0], polygons[current][i], polygons[current][i + 1]);
+	}
+
+	// Rasterizes everything submitted since the last flush.
+	void Flush()
+	{
+		if (!clearPending && triangles.empty())
+			return;
+
+		std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+		// A tile at a time, so idle threads steal tiles from one held up by a busy one and the caller
+		// works instead of only waiting.
+		uint32_t tileCount = static_cast<uint32_t>(tiles.size());
+		if (multithreaded && tileCount > 1)
+			jobs->ParallelFor(tileCount, 1, [this](uint32_t begin, uint32_t end) { RasterizeTiles(begin, end); });
+		else
+			RasterizeTiles(0, tileCount);
+
+		for (RasterTile& tile : tiles)
+		{
+			stats.pixelsTested += tile.pixelsTested;
+			stats.pixelsShaded += tile.pixelsShaded;
+			stats.pixelsWritten += tile.pixelsWritten;
+			tile.pixelsTested = tile.pixelsShaded = tile.pixelsWritten = 0;
+			tile.triangles.clear();
+		}
+		triangles.clear();
+		draws.clear();
+		clearPending = false;
+
+		stats.rasterMs += std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+	}
+
+	// 0xAARRGGBB, row major; what GRasterSurface expects.
+	const uint32_t* GetPixels() const { return color.data(); }
+	uint32_t GetWidth() const { return width; }
+	uint32_t GetHeight() const { return height; }
+
+	const RasterStats& GetStats() const { return stats; }
+	void ResetStats() { stats.Reset(); }
+
+private:
+	// Near plane, w > 0 (sky vertices sit at z == w) and a guard band that keeps snapped
+	// coordinates well inside int64 edge math. Only triangles that cross one get clipped.
+	static const uint32_t ClipPlaneCount = 6;
+	static constexpr float ClipMinW = 1e-5f;
+	static constexpr float GuardBand = 8.0f;
+	static const int64_t SubpixelBits = 8;
+	static const int64_t SubpixelOne = 1 << SubpixelBits;
+	// Pixels per side of the blocks the SIMD kernels accept or reject whole.
+	static const int32_t BlockSize = 8;
+	// Triangles whose bounds are at most this many pixels on a side use the scalar kernel.
+	static const int32_t SmallTriangleSize = 6;
+
+	// Setup for one screen space triangle.
+	struct RasterTriangle
+	{
+		uint32_t draw;
+		int32_t minX, minY, maxX, maxY;	// Pixel bounds, max exclusive.
+		// Edge i is opposite vertex i: E(x, y) = e + x * stepX + y * stepY in subpixel^2 units at
+		// pixel (minX, minY)'s center. A pixel is inside when every E - bias is >= 0.
+		int64_t e[3];
+		int64_t stepX[3];
+		int64_t stepY[3];
+		int64_t bias[3];	// 1 for edges that are not top or left, so ties go to one triangle only.
+		float invArea;
+		float zOrigin, zdx, zdy;	// z/w at (minX, minY)'s center and its screen space slopes.
+		float invW[3];
+		// Perspective divide helpers for the derivatives: d(l_i / w_i)/dx and /dy.
+		float dqdx[3];
+		float dqdy[3];
+		// varyings[0] is vertex 0's values, [1] and [2] the differences to vertex 1 and 2.
+		float varyings[3][RasterMaxVaryings];
+	};
+
+	struct RasterTile
+	{
+		uint32_t minX = 0, minY = 0, maxX = 0, maxY = 0;
+		std::vector<uint32_t> triangles;
+		uint64_t pixelsTested = 0;
+		uint64_t pixelsShaded = 0;
+		uint64_t pixelsWritten = 0;
+	};
+
+	uint32_t width = 0, height = 0;
+	uint32_t tilesX = 0, tilesY = 0;
+	std::vector<uint32_t> color;
+	std::vector<float> depth;
+	std::vector<RasterTile> tiles;
+	std::vector<RasterDraw> draws;
+	std::vector<RasterTriangle> triangles;
+	bool clearPending = false;
+	uint32_t clearColor = 0;
+	float clearDepth = 1.0f;
+	bool multithreaded = true;
+	RasterKernel kernel = RasterKernel::Scalar;
+	std::shared_ptr<JobSystem> jobs = JobSystem::Shared();
+	RasterStats stats;
+
+	static float ClipDistance(uint32_t plane, const XMFLOAT4& p)
+	{
+		switch (plane)
+		{
+		case 0: return p.z;
+		case 1: return p.w - ClipMinW;
+		case 2: return GuardBand * p.w + p.x;
+		case 3: return GuardBand * p.w - p.x;
+		case 4: return GuardBand * p.w + p.y;
+		default: return GuardBand * p.w - p.y;
+		}
+	}
+
+	static void LerpVertex(const RasterVertex& a, const RasterVertex& b, float t, uint32_t varyingCount, RasterVertex& out)
+	{
+		out.position.x = a.position.x + (b.position.x - a.position.x) * t;
+		out.position.y = a.position.y + (b.position.y - a.position.y) * t;
+		out.position.z = a.position.z + (b.position.z - a.position.z) * t;
+		out.position.w = a.position.w + (b.position.w - a.position.w) * t;
+		for (uint32_t i = 0; i < varyingCount; i++)
+			out.varyings[i] = a.varyings[i] + (b.varyings[i] - a.varyings[i]) * t;
+	}
+
+	void SetupTriangle(uint32_t drawIndex, const RasterVertex& v0, const RasterVertex& v1, const RasterVertex& v2)
+	{
+		const RasterVertex* in[3] = { &v0, &v1, &v2 };
+		int64_t x[3], y[3];
+		float z[3], invW[3];
+		for (uint32_t i = 0; i < 3; i++)
+		{
+			const XMFLOAT4& p = in[i]->position;
+			invW[i] = 1.0f / p.w;
+			// Snap to 1/256th of a pixel, like D3D's 8 bits of subpixel precision.
+			double sx = (p.x * invW[i] * 0.5 + 0.5) * width;
+			double sy = (0.5 - p.y * invW[i] * 0.5) * height;
+			x[i] = static_cast<int64_t>(floor(sx * SubpixelOne + 0.5));
+			y[i] = static_cast<int64_t>(floor(sy * SubpixelOne + 0.5));
+			z[i] = p.z * invW[i];
+		}
+
+		// Positive area is clockwise on screen.
+		int64_t area = (x[1] - x[0]) * (y[2] - y[0]) - (y[1] - y[0]) * (x[2] - x[0]);
+		if (area <= 0)
+		{
+			stats.trianglesCulled++;
+			return;
+		}
+
+		int64_t minXs = x[0] < x[1] ? (x[0] < x[2] ? x[0] : x[2]) : (x[1] < x[2] ? x[1] : x[2]);
+		int64_t maxXs = x[0] > x[1] ? (x[0] > x[2] ? x[0] : x[2]) : (x[1] > x[2] ? x[1] : x[2]);
+		int64_t minYs = y[0] < y[1] ? (y[0] < y[2] ? y[0] : y[2]) : (y[1] < y[2] ? y[1] : y[2]);
+		int64_t maxYs = y[0] > y[1] ? (y[0] > y[2] ? y[0] : y[2]) : (y[1] > y[2] ? y[1] : y[2]);
+		int64_t minX = minXs >> SubpixelBits, maxX = (maxXs >> SubpixelBits) + 1;
+		int64_t minY = minYs >> SubpixelBits, maxY = (maxYs >> SubpixelBits) + 1;
+		if (minX < 0) minX = 0;
+		if (minY < 0) minY = 0;
+		if (maxX > width) maxX = width;
+		if (maxY > height) maxY = height;
+		if (minX >= maxX || minY >= maxY)
+		{
+			stats.trianglesCulled++;
+			return;
+		}
+
+		const RasterDraw& draw = draws[drawIndex];
+		RasterTriangle tri;
+		tri.draw = drawIndex;
+		tri.minX = static_cast<int32_t>(minX);
+		tri.minY = static_cast<int32_t>(minY);
+		tri.maxX = static_cast<int32_t>(maxX);
+		tri.maxY = static_cast<int32_t>(maxY);
+
+		int64_t px = minX * SubpixelOne + SubpixelOne / 2;
+		int64_t py = minY * SubpixelOne + SubpixelOne / 2;
+		float invArea = 1.0f / static_cast<float>(area);
+		for (uint32_t i = 0; i < 3; i++)
+		{
+			uint32_t a = (i + 1) % 3, b = (i + 2) % 3;
+			int64_t dx = x[b] - x[a], dy = y[b] - y[a];
+			tri.e[i] = dx * (py - y[a]) - dy * (px - x[a]);
+			tri.stepX[i] = -dy * SubpixelOne;
+			tri.stepY[i] = dx * SubpixelOne;
+			tri.bias[i] = (dy < 0 || (dy == 0 && dx > 0)) ? 0 : 1;
+			tri.invW[i] = invW[i];
+			tri.dqdx[i] = static_cast<float>(tri.stepX[i]) * invArea * invW[i];
+			tri.dqdy[i] = static_cast<float>(tri.stepY[i]) * invArea * invW[i];
+		}
+		tri.invArea = invArea;
+		float dz1 = z[1] - z[0], dz2 = z[2] - z[0];
+		tri.zOrigin = z[0] + (static_cast<float>(tri.e[1]) * dz1 + static_cast<float>(tri.e[2]) * dz2) * invArea;
+		tri.zdx = (static_cast<float>(tri.stepX[1]) * dz1 + static_cast<float>(tri.stepX[2]) * dz2) * invArea;
+		tri.zdy = (static_cast<float>(tri.stepY[1]) * dz1 + static_cast<float>(tri.stepY[2]) * dz2) * invArea;
+		for (uint32_t i = 0; i < draw.varyingCount; i++)
+		{
+			tri.varyings[0][i] = v0.varyings[i];
+			tri.varyings[1][i] = v1.varyings[i] - v0.varyings[i];
+			tri.varyings[2][i] = v2.varyings[i] - v0.varyings[i];
+		}
+
+		uint32_t index = static_cast<uint32_t>(triangles.size());
+		triangles.push_back(tri);
+
+		uint32_t tileMinX = tri.minX / RasterTileSize, tileMaxX = (tri.maxX - 1) / RasterTileSize;
+		uint32_t tileMinY = tri.minY / RasterTileSize, tileMaxY = (tri.maxY - 1) / RasterTileSize;
+		for (uint32_t ty = tileMinY; ty <= tileMaxY; ty++)
+		{
+			for (uint32_t tx = tileMinX; tx <= tileMaxX; tx++)
+			{
+				tiles[ty * tilesX + tx].triangles.push_back(index);
+				stats.tileBins++;
+			}
+		}
+	}
+
+	void RasterizeTiles(uint32_t begin, uint32_t end)
+	{
+		for (uint32_t i = begin; i < end; i++)
+			RasterizeTile(tiles[i]);
+	}
+
+	void RasterizeTile(RasterTile& tile)
+	{
+		if (clearPending)
+		{
+			for (uint32_t y = tile.minY; y < tile.maxY; y++)
+			{
+				size_t row = static_cast<size_t>(y) * width;
+				for (uint32_t x = tile.minX; x < tile.maxX; x++)
+				{
+					color[row + x] = clearColor;
+					depth[row + x] = clearDepth;
+				}
+			}
+		}
+
+		for (uint32_t index : tile.triangles)
+		{
+			const RasterTriangle& tri = triangles[index];
+			bool small = tri.maxX - tri.minX <= SmallTriangleSize && tri.maxY - tri.minY <= SmallTriangleSize;
+			switch (small ? RasterKernel::Scalar : kernel)
+			{
+#if RASTER_SIMD
+			case RasterKernel::Sse2: RasterizeTriangleSse2(tile, tri); break;
+			case RasterKernel::Avx2: RasterizeTriangleAvx2(tile, tri); break;
+#endif
+			default: RasterizeTriangle(tile, tri); break;
+			}
+		}
+	}
+
+	static bool DepthTest(CompareFunc func, float z, float stored)
+	{
+		switch (func)
+		{
+		case CompareFunc::Never: return false;
+		case CompareFunc::Less: return z < stored;
+		case CompareFunc::LessEqual: return z <= stored;
+		default: return true;
+		}
+	}
+
+	static uint32_t PackColor(FXMVECTOR value)
+	{
+		XMFLOAT4 c;
+		XMStoreFloat4(&c, XMVectorSaturate(value));
+		uint32_t r = static_cast<uint32_t>(c.x * 255.0f + 0.5f);
+		uint32_t g = static_cast<uint32_t>(c.y * 255.0f + 0.5f);
+		uint32_t b = static_cast<uint32_t>(c.z * 255.0f + 0.5f);
+		uint32_t a = static_cast<uint32_t>(c.w * 255.0f + 0.5f);
+		return (a << 24) | (r << 16) | (g << 8) | b;
+	}
+
+	// Interpolates, shades and writes a pixel that passed the depth test. 'e' are its edge values.
+	void ShadePixel(RasterTile& tile, const RasterTriangle& tri, const RasterDraw& draw, size_t index, const int64_t e[3], float z, RasterPixel& pixel, float* values)
+	{
+		// Perspective correct barycentrics.
+		float l0 = static_cast<float>(e[0]) * tri.invArea;
+		float l1 = static_cast<float>(e[1]) * tri.invArea;
+		float l2 = static_cast<float>(e[2]) * tri.invArea;
+		float q0 = l0 * tri.invW[0], q1 = l1 * tri.invW[1], q2 = l2 * tri.invW[2];
+		float invSum = 1.0f / (q0 + q1 + q2);
+		ShadePixel(tile, tri, draw, index, q1 * invSum, q2 * invSum, invSum, z, pixel, values);
+	}
+
+	// The same from vertex 1's and 2's barycentrics and 1 / sum(l_i / w_i).
+	void ShadePixel(RasterTile& tile, const RasterTriangle& tri, const RasterDraw& draw, size_t index, float b1, float b2, float invSum, float z, RasterPixel& pixel, float* values)
+	{
+		tile.pixelsShaded++;
+		for (uint32_t i = 0; i < draw.varyingCount; i++)
+			values[i] = tri.varyings[0][i] + b1 * tri.varyings[1][i] + b2 * tri.varyings[2][i];
+
+		if (draw.derivatives)
+		{
+			float dsdx = tri.dqdx[0] + tri.dqdx[1] + tri.dqdx[2];
+			float dsdy = tri.dqdy[0] + tri.dqdy[1] + tri.dqdy[2];
+			float db1dx = (tri.dqdx[1] - b1 * dsdx) * invSum, db2dx = (tri.dqdx[2] - b2 * dsdx) * invSum;
+			float db1dy = (tri.dqdy[1] - b1 * dsdy) * invSum, db2dy = (tri.dqdy[2] - b2 * dsdy) * invSum;
+			for (uint32_t i = 0; i < 2; i++)
+			{
+				pixel.ddx[i] = db1dx * tri.varyings[1][i] + db2dx * tri.varyings[2][i];
+				pixel.ddy[i] = db1dy * tri.varyings[1][i] + db2dy * tri.varyings[2][i];
+			}
+		}
+
+		XMVECTOR shaded;
+		if (!draw.pixelShader(draw, pixel, shaded))
+			return;
+		tile.pixelsWritten++;
+
+		color[index] = PackColor(shaded);
+		if (draw.depth.depthEnable && draw.depth.depthWrite)
+			depth[index] = z;
+	}
+
+	// Tests pixels one at a time; the scalar kernel, and the SIMD kernels' blocks that overhang the screen.
+	void RasterizePixels(RasterTile& tile, const RasterTriangle& tri, int32_t x0, int32_t x1, int32_t y0, int32_t y1, RasterPixel& pixel, float* values)
+	{
+		const RasterDraw& draw = draws[tri.draw];
+		for (int32_t y = y0; y < y1; y++)
+		{
+			int64_t rowE[3];
+			for (uint32_t i = 0; i < 3; i++)
+				rowE[i] = tri.e[i] + (y - tri.minY) * tri.stepY[i] + (x0 - tri.minX) * tri.stepX[i];
+
+			size_t row = static_cast<size_t>(y) * width;
+			for (int32_t x = x0; x < x1; x++, rowE[0] += tri.stepX[0], rowE[1] += tri.stepX[1], rowE[2] += tri.stepX[2])
+			{
+				if ((rowE[0] - tri.bias[0]) < 0 || (rowE[1] - tri.bias[1]) < 0 || (rowE[2] - tri.bias[2]) < 0)
+					continue;
+
+				float z = tri.zOrigin + static_cast<float>(x - tri.minX) * tri.zdx + static_cast<float>(y - tri.minY) * tri.zdy;
+				if (z < 0.0f || z > 1.0f)
+					continue;
+				tile.pixelsTested++;
+
+				if (draw.depth.depthEnable && !DepthTest(draw.depth.depthFunc, z, depth[row + x]))
+					continue;
+				ShadePixel(tile, tri, draw, row + x, rowE, z, pixel, values);
+			}
+		}
+	}
+
+	// Clamps the triangle's bounds to the tile; false if nothing is left.
+	static bool ClipToTile(const RasterTile& tile, const RasterTriangle& tri, int32_t& x0, int32_t& x1, int32_t& y0, int32_t& y1)
+	{
+		x0 = tri.minX > static_cast<int32_t>(tile.minX) ? tri.minX : static_cast<int32_t>(tile.minX);
+		x1 = tri.maxX < static_cast<int32_t>(tile.maxX) ? tri.maxX : static_cast<int32_t>(tile.maxX);
+		y0 = tri.minY > static_cast<int32_t>(tile.minY) ? tri.minY : static_cast<int32_t>(tile.minY);
+		y1 = tri.maxY < static_cast<int32_t>(tile.maxY) ? tri.maxY : static_cast<int32_t>(tile.maxY);
+		return x0 < x1 && y0 < y1;
+	}
+
+	void RasterizeTriangle(RasterTile& tile, const RasterTriangle& tri)
+	{
+		int32_t x0, x1, y0, y1;
+		if (!ClipToTile(tile, tri, x0, x1, y0, y1))
+			return;
+
+		float values[RasterMaxVaryings];
+		RasterPixel pixel;
+		pixel.varyings = values;
+		pixel.ddx[0] = pixel.ddx[1] = pixel.ddy[0] = pixel.ddy[1] = 0.0f;
+		RasterizePixels(tile, tri, x0, x1, y0, y1, pixel, values);
+	}
+
+#if RASTER_SIMD
+	static uint32_t CountBits(uint32_t bits)
+	{
+		bits = bits - ((bits >> 1) & 0x55555555u);
+		bits = (bits & 0x33333333u) + ((bits >> 2) & 0x33333333u);
+		return (((bits + (bits >> 4)) & 0x0f0f0f0fu) * 0x01010101u) >> 24;
+	}
+
+	// Interpolates, shades and writes the 2x2 quad whose top left pixel is (x, y). 'mask' holds the
+	// lanes that passed the depth test; the lane arrays are their barycentrics, 1 / sum(l_i / w_i) and z.
+	void ShadeQuad(RasterTile& tile, const RasterTriangle& tri, const RasterDraw& draw, int32_t x, int32_t y, uint32_t mask,
+		const float* b1, const float* b2, const float* invSum, const float* z, RasterPixel& pixel, float* values)
+	{
+		size_t index = static_cast<size_t>(y) * width + x;
+		const size_t laneIndex[4] = { index, index + 1, index + width, index + width + 1 };
+		if (draw.quadShader == nullptr)
+		{
+			for (uint32_t lane = 0; lane < 4; lane++)
+			{
+				if ((mask & (1u << lane)) != 0)
+					ShadePixel(tile, tri, draw, laneIndex[lane], b1[lane], b2[lane], invSum[lane], z[lane], pixel, values);
+			}
+			return;
+		}
+		tile.pixelsShaded += CountBits(mask);
+
+		// Lanes outside the mask may be outside the triangle, zeroing their barycentrics keeps them finite.
+		XMVECTOR covered = XMVectorSelectControl(mask & 1, (mask >> 1) & 1, (mask >> 2) & 1, (mask >> 3) & 1);
+		XMVECTOR quadB1 = XMVectorSelect(XMVectorZero(), XMLoadFloat4(reinterpret_cast<const XMFLOAT4*>(b1)), covered);
+		XMVECTOR quadB2 = XMVectorSelect(XMVectorZero(), XMLoadFloat4(reinterpret_cast<const XMFLOAT4*>(b2)), covered);
+		RasterQuad quad;
+		quad.mask = mask;
+		for (uint32_t i = 0; i < draw.varyingCount; i++)
+		{
+			quad.varyings[i] = XMVectorMultiplyAdd(quadB2, XMVectorReplicate(tri.varyings[2][i]),
+				XMVectorMultiplyAdd(quadB1, XMVectorReplicate(tri.varyings[1][i]), XMVectorReplicate(tri.varyings[0][i])));
+		}
+
+		quad.ddx[0] = quad.ddx[1] = quad.ddy[0] = quad.ddy[1] = XMVectorZero();
+		if (draw.derivatives)
+		{
+			XMVECTOR quadInvSum = XMVectorSelect(XMVectorZero(), XMLoadFloat4(reinterpret_cast<const XMFLOAT4*>(invSum)), covered);
+			XMVECTOR dsdx = XMVectorReplicate(tri.dqdx[0] + tri.dqdx[1] + tri.dqdx[2]);
+			XMVECTOR dsdy = XMVectorReplicate(tri.dqdy[0] + tri.dqdy[1] + tri.dqdy[2]);
+			XMVECTOR db1dx = (XMVectorReplicate(tri.dqdx[1]) - quadB1 * dsdx) * quadInvSum, db2dx = (XMVectorReplicate(tri.dqdx[2]) - quadB2 * dsdx) * quadInvSum;
+			XMVECTOR db1dy = (XMVectorReplicate(tri.dqdy[1]) - quadB1 * dsdy) * quadInvSum, db2dy = (XMVectorReplicate(tri.dqdy[2]) - quadB2 * dsdy) * quadInvSum;
+			for (uint32_t i = 0; i < 2; i++)
+			{
+				quad.ddx[i] = db1dx * XMVectorReplicate(tri.varyings[1][i]) + db2dx * XMVectorReplicate(tri.varyings[2][i]);
+				quad.ddy[i] = db1dy * XMVectorReplicate(tri.varyings[1][i]) + db2dy * XMVectorReplicate(tri.varyings[2][i]);
+			}
+		}
+
+		XMVECTOR shaded[4];
+		uint32_t written = draw.quadShader(draw, quad, shaded) & mask;
+		if (written == 0)
+			return;
+		tile.pixelsWritten += CountBits(written);
+
+		// PackColor across the lanes.
+		XMFLOAT4 channels[4];
+		for (uint32_t c = 0; c < 4; c++)
+			XMStoreFloat4(&channels[c], XMVectorMultiplyAdd(XMVectorSaturate(shaded[c]), XMVectorReplicate(255.0f), XMVectorReplicate(0.5f)));
+		const float* r = &channels[0].x;
+		const float* g = &channels[1].x;
+		const float* b = &channels[2].x;
+		const float* a = &channels[3].x;
+		bool writeDepth = draw.depth.depthEnable && draw.depth.depthWrite;
+		for (uint32_t lane = 0; lane < 4; lane++)
+		{
+			if ((written & (1u << lane)) == 0)
+				continue;
+			color[laneIndex[lane]] = (static_cast<uint32_t>(a[lane]) << 24) | (static_cast<uint32_t>(r[lane]) << 16) |
+				(static_cast<uint32_t>(g[lane]) << 8) | static_cast<uint32_t>(b[lane]);
+			if (writeDepth)
+				depth[laneIndex[lane]] = z[lane];
+		}
+	}
+
+	// Walks the triangle in BlockSize blocks. A block outside an edge is skipped and one inside
+	// every edge skips the edge tests; the rest test Simd::Lanes pixels, as 2x2 quads, at a time.
+	// The barycentrics of the lanes that pass are computed together and each quad is shaded whole.
+	//
+	// The edge steps are multiples of SubpixelOne, so with E = origin + SubpixelOne * L the test
+	// E - bias >= 0 becomes L >= ceil((bias - origin) / SubpixelOne). L stays small enough for
+	// 32 bit lanes and gives exactly the scalar kernel's coverage.
+	template<typename Simd>
+	RASTER_FORCE_INLINE void RasterizeTriangleSimd(RasterTile& tile, const RasterTriangle& tri)
+	{
+		int32_t x0, x1, y0, y1;
+		if (!ClipToTile(tile, tri, x0, x1, y0, y1))
+			return;
+
+		const RasterDraw& draw = draws[tri.draw];
+		float values[RasterMaxVaryings];
+		RasterPixel pixel;
+		pixel.varyings = values;
+		pixel.ddx[0] = pixel.ddx[1] = pixel.ddy[0] = pixel.ddy[1] = 0.0f;
+
+		// Per lane offsets from the quad row's first pixel.
+		int32_t stepX[3], stepY[3];
+		alignas(32) int32_t laneEdges[3][Simd::Lanes];
+		alignas(32) float laneZ[Simd::Lanes];
+		alignas(32) float laneB1[Simd::Lanes];
+		alignas(32) float laneB2[Simd::Lanes];
+		alignas(32) float laneInvSum[Simd::Lanes];
+		for (uint32_t i = 0; i < 3; i++)
+		{
+			stepX[i] = static_cast<int32_t>(tri.stepX[i] / SubpixelOne);
+			stepY[i] = static_cast<int32_t>(tri.stepY[i] / SubpixelOne);
+			for (uint32_t lane = 0; lane < Simd::Lanes; lane++)
+				laneEdges[i][lane] = stepX[i] * LaneColumn(lane) + stepY[i] * LaneRow(lane);
+		}
+		for (uint32_t lane = 0; lane < Simd::Lanes; lane++)
+			laneZ[lane] = static_cast<float>(LaneColumn(lane)) * tri.zdx + static_cast<float>(LaneRow(lane)) * tri.zdy;
+		typename Simd::Int edgeOffsets[3], edgeColumnSteps[3], thresholds[3];
+		for (uint32_t i = 0; i < 3; i++)
+		{
+			edgeOffsets[i] = Simd::LoadInt(laneEdges[i]);
+			edgeColumnSteps[i] = Simd::SetInt(stepX[i] * static_cast<int32_t>(Simd::Columns));
+		}
+		typename Simd::Float zOffsets = Simd::LoadFloat(laneZ);
+		typename Simd::Float zColumnStep = Simd::SetFloat(tri.zdx * Simd::Columns);
+		typename Simd::Float invArea = Simd::SetFloat(tri.invArea), subpixel = Simd::SetFloat(static_cast<float>(SubpixelOne)), one = Simd::SetFloat(1.0f);
+		typename Simd::Float invW[3] = { Simd::SetFloat(tri.invW[0]), Simd::SetFloat(tri.invW[1]), Simd::SetFloat(tri.invW[2]) };
+
+		for (int32_t by = y0 & ~(BlockSize - 1); by < y1; by += BlockSize)
+		{
+			for (int32_t bx = x0 & ~(BlockSize - 1); bx < x1; bx += BlockSize)
+			{
+				if (bx + BlockSize > static_cast<int32_t>(tile.maxX) || by + BlockSize > static_cast<int32_t>(tile.maxY))
+				{
+					RasterizePixels(tile, tri, bx > x0 ? bx : x0, bx + BlockSize < x1 ? bx + BlockSize : x1,
+						by > y0 ? by : y0, by + BlockSize < y1 ? by + BlockSize : y1, pixel, values);
+					continue;
+				}
+
+				// Edge values at the block's first pixel, then their range over the block's corners.
+				int64_t origin[3];
+				bool outside = false, inside = true;
+				for (uint32_t i = 0; i < 3; i++)
+				{
+					origin[i] = tri.e[i] + (bx - tri.minX) * tri.stepX[i] + (by - tri.minY) * tri.stepY[i];
+					int64_t acrossX = (BlockSize - 1) * tri.stepX[i], acrossY = (BlockSize - 1) * tri.stepY[i];
+					int64_t low = origin[i] + (acrossX < 0 ? acrossX : 0) + (acrossY < 0 ? acrossY : 0);
+					int64_t high = origin[i] + (acrossX > 0 ? acrossX : 0) + (acrossY > 0 ? acrossY : 0);
+					outside |= high - tri.bias[i] < 0;
+					inside &= low - tri.bias[i] >= 0;
+				}
+				if (outside)
+					continue;
+				typename Simd::Float blockEdges[3];
+				for (uint32_t i = 0; i < 3; i++)
+					blockEdges[i] = Simd::SetFloat(static_cast<float>(origin[i]));
+				for (uint32_t i = 0; i < 3 && !inside; i++)
+				{
+					// L > threshold, clamped well past anything L reaches inside a block.
+					int64_t threshold = ((tri.bias[i] - origin[i] + SubpixelOne - 1) >> SubpixelBits) - 1;
+					threshold = threshold < -(1 << 30) ? -(1 << 30) : (threshold > (1 << 30) ? (1 << 30) : threshold);
+					thresholds[i] = Simd::SetInt(static_cast<int32_t>(threshold));
+				}
+
+				// Only the quads that overlap the triangle's bounds.
+				int32_t qx0 = x0 > bx ? (x0 - bx) & ~static_cast<int32_t>(Simd::Columns - 1) : 0;
+				int32_t qx1 = x1 - bx < BlockSize ? x1 - bx : BlockSize;
+				int32_t qy0 = y0 > by ? (y0 - by) & ~1 : 0;
+				int32_t qy1 = y1 - by < BlockSize ? y1 - by : BlockSize;
+
+				float zBlock = tri.zOrigin + static_cast<float>(bx - tri.minX) * tri.zdx + static_cast<float>(by - tri.minY) * tri.zdy;
+				for (int32_t qy = qy0; qy < qy1; qy += 2)
+				{
+					typename Simd::Int edges[3];
+					for (uint32_t i = 0; i < 3; i++)
+						edges[i] = Simd::AddInt(edgeOffsets[i], Simd::SetInt(stepX[i] * qx0 + stepY[i] * qy));
+					typename Simd::Float z = Simd::AddFloat(zOffsets, Simd::SetFloat(zBlock + static_cast<float>(qx0) * tri.zdx + static_cast<float>(qy) * tri.zdy));
+					size_t row = static_cast<size_t>(by + qy) * width + bx;
+
+					for (int32_t qx = qx0; qx < qx1; qx += Simd::Columns)
+					{
+						typename Simd::Int covered = Simd::AllLanes();
+						if (!inside)
+						{
+							covered = Simd::And(Simd::And(Simd::CompareGreater(edges[0], thresholds[0]), Simd::CompareGreater(edges[1], thresholds[1])),
+								Simd::CompareGreater(edges[2], thresholds[2]));
+						}
+						typename Simd::Float quadZ = z;
+						typename Simd::Int quadEdges[3];
+						for (uint32_t i = 0; i < 3; i++)
+						{
+							quadEdges[i] = edges[i];
+							edges[i] = Simd::AddInt(edges[i], edgeColumnSteps[i]);
+						}
+						z = Simd::AddFloat(z, zColumnStep);
+
+						covered = Simd::And(covered, Simd::InRange(quadZ));
+						uint32_t mask = Simd::MoveMask(covered);
+						if (mask == 0)
+							continue;
+						tile.pixelsTested += CountBits(mask);
+
+						if (draw.depth.depthEnable)
+						{
+							typename Simd::Float stored = Simd::LoadQuads(&depth[row + qx], &depth[row + width + qx]);
+							switch (draw.depth.depthFunc)
+							{
+							case CompareFunc::Never: mask = 0; break;
+							case CompareFunc::Less: mask &= Simd::MoveMask(Simd::Less(quadZ, stored)); break;
+							case CompareFunc::LessEqual: mask &= Simd::MoveMask(Simd::LessEqual(quadZ, stored)); break;
+							default: break;
+							}
+							if (mask == 0)
+								continue;
+						}
+
+						// ShadePixel's perspective correct barycentrics, with E = origin + SubpixelOne * L.
+						typename Simd::Float q[3];
+						for (uint32_t i = 0; i < 3; i++)
+						{
+							typename Simd::Float l = Simd::MulFloat(Simd::AddFloat(blockEdges[i], Simd::MulFloat(Simd::ToFloat(quadEdges[i]), subpixel)), invArea);
+							q[i] = Simd::MulFloat(l, invW[i]);
+						}
+						typename Simd::Float invSum = Simd::DivFloat(one, Simd::AddFloat(Simd::AddFloat(q[0], q[1]), q[2]));
+						Simd::StoreFloat(laneB1, Simd::MulFloat(q[1], invSum));
+						Simd::StoreFloat(laneB2, Simd::MulFloat(q[2], invSum));
+						Simd::StoreFloat(laneInvSum, invSum);
+						Simd::StoreFloat(laneZ, quadZ);
+						for (uint32_t quad = 0; quad < Simd::Lanes / 4; quad++)
+						{
+							uint32_t quadMask = (mask >> (quad * 4)) & 15;
+							if (quadMask != 0)
+							{
+								ShadeQuad(tile, tri, draw, bx + qx + static_cast<int32_t>(quad) * 2, by + qy, quadMask,
+									laneB1 + quad * 4, laneB2 + quad * 4, laneInvSum + quad * 4, laneZ + quad * 4, pixel, values);
+							}
+						}
+					}
+				}
+			}
+		}
+	}
+
+	static int32_t LaneColumn(uint32_t lane) { return static_cast<int32_t>((lane >> 2) * 2 + (lane & 1)); }
+	static int32_t LaneRow(uint32_t lane) { return static_cast<int32_t>((lane >> 1) & 1); }
+
+	void RasterizeTriangleSse2(RasterTile& tile, const RasterTriangle& tri) { RasterizeTriangleSimd<RasterSimdSse2>(tile, tri); }
+	RASTER_TARGET_AVX2 void RasterizeTriangleAvx2(RasterTile& tile, const RasterTriangle& tri) { RasterizeTriangleSimd<RasterSimdAvx2>(tile, tri); }
+#endif
+};
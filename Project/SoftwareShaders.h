@@ -0,0 +1,474 @@
+#pragma once
+#include "defines.h"
+#include "ConstantBuffers.h"
+#include "SoftwareRasterizer.h"
+#include <cmath>
+#include <cstddef>
+#include <cstring>
+
+// C++ versions of the shaders in Shaders/shaders.fx for the software rasterizer.
+// Keep them in step with the HLSL; CreateShader looks them up by entry point.
+
+// b0-b2 unpacked once per draw. The buffers hold transposed matrices for HLSL.
+struct SoftwareUniforms
+{
+	XMMATRIX world;
+	XMMATRIX view;
+	XMMATRIX projection;
+	XMMATRIX viewProjection;
+	XMMATRIX worldViewProjection;
+	XMVECTOR lightDir;
+	XMVECTOR lightColor;
+	XMVECTOR outputColor;
+	float time;
+};
+
+// PS_INPUT, PS_INSTANCED_INPUT and SKYBOX_VS_INPUT in one layout the rasterizer interpolates as floats.
+// The texture coordinate comes first, the rasterizer takes its derivatives for mip selection.
+struct SoftwareVaryings
+{
+	float tex[3];	// Only the skybox uses the third component.
+	float norm[3];
+	float worldPos[4];
+	float color[4];
+	float wvpRow[4];
+};
+static_assert(sizeof(SoftwareVaryings) == sizeof(float) * RasterMaxVaryings, "SoftwareVaryings must fill RasterVertex::varyings");
+
+// How many leading floats of SoftwareVaryings each vertex shader writes.
+static const uint32_t SoftwareVaryingsTexture = 3;
+static const uint32_t SoftwareVaryingsLit = offsetof(SoftwareVaryings, color) / sizeof(float);
+static const uint32_t SoftwareVaryingsInstanced = RasterMaxVaryings;
+
+// Vertex shader inputs arrive in the order of the program's 'inputs'; missing components read as (0, 0, 0, 1).
+typedef void (*SoftwareVertexShader)(const SoftwareUniforms& u, const XMVECTOR* inputs, RasterVertex& out);
+
+struct SoftwareShaderInput
+{
+	const char* semantic;
+	uint32_t semanticIndex;
+};
+
+struct SoftwareShaderProgram
+{
+	const char* entryPoint;
+	ShaderStage stage;
+	SoftwareVertexShader vertexShader;
+	RasterPixelShader pixelShader;
+	RasterQuadShader quadShader;	// The pixel shader four pixels at a time.
+	const SoftwareShaderInput* inputs;
+	uint32_t inputCount;
+	uint32_t varyingCount;	// Vertex shaders.
+	bool derivatives;		// Pixel shaders that sample with mips.
+};
+
+static const uint32_t SoftwareMaxShaderInputs = 8;
+
+// Texture registers, see the top of shaders.fx.
+enum SoftwareTextureSlot : uint32_t
+{
+	TX_DIFFUSE = 0,
+	TX_MESH_DIFFUSE = 1,
+	TX_SKYBOX = 2,
+	TX_CROSSHAIR = 3,
+};
+
+inline void PrepareSoftwareUniforms(const void* const constants[CB_COUNT], const uint32_t sizes[CB_COUNT], SoftwareUniforms& u)
+{
+	PerFrameConstants frame;
+	PerMaterialConstants material;
+	PerObjectConstants object;
+	memset(&frame, 0, sizeof(frame));
+	memset(&material, 0, sizeof(material));
+	memset(&object, 0, sizeof(object));
+	if (constants[CB_PER_FRAME] != nullptr)
+		memcpy(&frame, constants[CB_PER_FRAME], sizes[CB_PER_FRAME] < sizeof(frame) ? sizes[CB_PER_FRAME] : sizeof(frame));
+	if (constants[CB_PER_MATERIAL] != nullptr)
+		memcpy(&material, constants[CB_PER_MATERIAL], sizes[CB_PER_MATERIAL] < sizeof(material) ? sizes[CB_PER_MATERIAL] : sizeof(material));
+	if (constants[CB_PER_OBJECT] != nullptr)
+		memcpy(&object, constants[CB_PER_OBJECT], sizes[CB_PER_OBJECT] < sizeof(object) ? sizes[CB_PER_OBJECT] : sizeof(object));
+
+	u.world = XMMatrixTranspose(object.mWorld);
+	u.view = XMMatrixTranspose(frame.mView);
+	u.projection = XMMatrixTranspose(frame.mProjection);
+	u.viewProjection = XMMatrixMultiply(u.view, u.projection);
+	u.worldViewProjection = XMMatrixMultiply(u.world, u.viewProjection);
+	u.lightDir = XMLoadFloat4(&frame.lightDir);
+	u.lightColor = XMLoadFloat4(&frame.lightClr);
+	u.outputColor = XMLoadFloat4(&material.vOutputColor);
+	u.time = frame.time;
+}
+
+inline void StoreVarying(float* dst, FXMVECTOR value, uint32_t count)
+{
+	XMFLOAT4 v;
+	XMStoreFloat4(&v, value);
+	const float* src = &v.x;
+	for (uint32_t i = 0; i < count; i++)
+		dst[i] = src[i];
+}
+
+inline XMVECTOR LoadVarying(const float* src, uint32_t count)
+{
+	XMFLOAT4 v = { 0.0f, 0.0f, 0.0f, 0.0f };
+	float* dst = &v.x;
+	for (uint32_t i = 0; i < count; i++)
+		dst[i] = src[i];
+	return XMLoadFloat4(&v);
+}
+
+inline SoftwareVaryings& Varyings(RasterVertex& vertex)
+{
+	return *reinterpret_cast<SoftwareVaryings*>(vertex.varyings);
+}
+
+inline const SoftwareVaryings& Varyings(const RasterPixel& pixel)
+{
+	return *reinterpret_cast<const SoftwareVaryings*>(pixel.varyings);
+}
+
+inline const SoftwareUniforms& Uniforms(const RasterDraw& draw)
+{
+	return *static_cast<const SoftwareUniforms*>(draw.uniforms);
+}
+
+// Texture2D.Sample at the pixel's texture coordinate; the mip comes from its derivatives.
+inline XMVECTOR SampleTexture(const RasterDraw& draw, uint32_t slot, const RasterPixel& pixel)
+{
+	const SoftwareTexture* texture = draw.textures[slot];
+	if (texture == nullptr)
+		return XMVectorZero();
+
+	const SoftwareVaryings& v = Varyings(pixel);
+	float lod = 0.0f;
+	if (draw.derivatives)
+	{
+		float w = static_cast<float>(texture->GetWidth()), h = static_cast<float>(texture->GetHeight());
+		float dx = (pixel.ddx[0] * w) * (pixel.ddx[0] * w) + (pixel.ddx[1] * h) * (pixel.ddx[1] * h);
+		float dy = (pixel.ddy[0] * w) * (pixel.ddy[0] * w) + (pixel.ddy[1] * h) * (pixel.ddy[1] * h);
+		float rho = dx > dy ? dx : dy;
+		// log2 of the footprint; halved because rho is squared.
+		lod = rho > 0.0f ? 0.5f * log2f(rho) : 0.0f;
+	}
+	return texture->Sample(draw.sampler, v.tex[0], v.tex[1], lod);
+}
+
+// The quad shaders' varyings from SoftwareVaryings member 'offset' on, one XMVECTOR per component.
+inline const XMVECTOR* QuadVaryings(const RasterQuad& quad, size_t offset)
+{
+	return quad.varyings + offset / sizeof(float);
+}
+
+// A uniform's components, each across the four lanes.
+inline void SplatQuad(FXMVECTOR value, XMVECTOR out[4])
+{
+	out[0] = XMVectorSplatX(value);
+	out[1] = XMVectorSplatY(value);
+	out[2] = XMVectorSplatZ(value);
+	out[3] = XMVectorSplatW(value);
+}
+
+inline XMVECTOR DotQuad(const XMVECTOR* a, const XMVECTOR* b, uint32_t count)
+{
+	XMVECTOR dot = a[0] * b[0];
+	for (uint32_t i = 1; i < count; i++)
+		dot = XMVectorMultiplyAdd(a[i], b[i], dot);
+	return dot;
+}
+
+// XMVector3Normalize or XMVector4Normalize for each lane; zero length stays zero.
+inline void NormalizeQuad(const XMVECTOR* in, XMVECTOR* out, uint32_t count)
+{
+	XMVECTOR lengthSq = DotQuad(in, in, count);
+	XMVECTOR scale = XMVectorSelect(XMVectorZero(), XMVectorReciprocal(XMVectorSqrt(lengthSq)), XMVectorGreater(lengthSq, XMVectorZero()));
+	for (uint32_t i = 0; i < count; i++)
+		out[i] = in[i] * scale;
+}
+
+// SampleTexture for the quad's covered lanes, returned as red, green, blue and alpha across the lanes.
+inline void SampleTextureQuad(const RasterDraw& draw, uint32_t slot, const RasterQuad& quad, XMVECTOR color[4])
+{
+	XMMATRIX texels;
+	for (uint32_t lane = 0; lane < 4; lane++)
+		texels.r[lane] = XMVectorZero();
+	const SoftwareTexture* texture = draw.textures[slot];
+	if (texture != nullptr)
+	{
+		XMFLOAT4 u, v, rho = { 0.0f, 0.0f, 0.0f, 0.0f };
+		XMStoreFloat4(&u, quad.varyings[0]);
+		XMStoreFloat4(&v, quad.varyings[1]);
+		if (draw.derivatives)
+		{
+			XMVECTOR w = XMVectorReplicate(static_cast<float>(texture->GetWidth())), h = XMVectorReplicate(static_cast<float>(texture->GetHeight()));
+			XMVECTOR dxu = quad.ddx[0] * w, dxv = quad.ddx[1] * h, dyu = quad.ddy[0] * w, dyv = quad.ddy[1] * h;
+			XMStoreFloat4(&rho, XMVectorMax(dxu * dxu + dxv * dxv, dyu * dyu + dyv * dyv));
+		}
+		for (uint32_t lane = 0; lane < 4; lane++)
+		{
+			float footprint = (&rho.x)[lane];
+			if ((quad.mask & (1u << lane)) != 0)
+				texels.r[lane] = texture->Sample(draw.sampler, (&u.x)[lane], (&v.x)[lane], footprint > 0.0f ? 0.5f * log2f(footprint) : 0.0f);
+		}
+	}
+	texels = XMMatrixTranspose(texels);
+	for (uint32_t i = 0; i < 4; i++)
+		color[i] = texels.r[i];
+}
+
+// -VERTEX SHADERS- //
+inline void SoftwareVS(const SoftwareUniforms& u, const XMVECTOR* in, RasterVertex& out)
+{
+	SoftwareVaryings& v = Varyings(out);
+	XMVECTOR worldPos = XMVector4Transform(in[0], u.world);
+	XMStoreFloat4(&out.position, XMVector4Transform(worldPos, u.viewProjection));
+	StoreVarying(v.worldPos, worldPos, 4);
+	StoreVarying(v.norm, XMVector3TransformNormal(in[1], u.world), 3);
+	StoreVarying(v.tex, in[2], 2);
+	v.tex[2] = 0.0f;
+}
+
+// Skips the view matrix, so the crosshair stays on screen.
+inline void SoftwareVSWave(const SoftwareUniforms& u, const XMVECTOR* in, RasterVertex& out)
+{
+	SoftwareVaryings& v = Varyings(out);
+	XMVECTOR worldPos = XMVector4Transform(in[0], u.world);
+	XMStoreFloat4(&out.position, XMVector4Transform(worldPos, u.projection));
+	StoreVarying(v.worldPos, worldPos, 4);
+	StoreVarying(v.norm, XMVector3Transform(in[1], u.world), 3);
+	StoreVarying(v.tex, in[2], 2);
+	v.tex[2] = 0.0f;
+}
+
+inline void SoftwareVSInstanced(const SoftwareUniforms& u, const XMVECTOR* in, RasterVertex& out)
+{
+	SoftwareVaryings& v = Varyings(out);
+	XMMATRIX instWorld;
+	instWorld.r[0] = in[3];
+	instWorld.r[1] = in[4];
+	instWorld.r[2] = in[5];
+	instWorld.r[3] = in[6];
+	XMVECTOR worldPos = XMVector4Transform(in[0], instWorld);
+	XMStoreFloat4(&out.position, XMVector4Transform(worldPos, u.viewProjection));
+	StoreVarying(v.worldPos, worldPos, 4);
+	StoreVarying(v.norm, XMVector3TransformNormal(in[1], instWorld), 3);
+	StoreVarying(v.tex, in[2], 2);
+	v.tex[2] = 0.0f;
+	StoreVarying(v.color, in[7], 4);
+	StoreVarying(v.wvpRow, XMVector4Transform(in[6], u.viewProjection), 4);
+}
+
+// Pins the sky to the far plane (.xyww) and looks it up by object space direction.
+inline void SoftwareSkyboxVS(const SoftwareUniforms& u, const XMVECTOR* in, RasterVertex& out)
+{
+	SoftwareVaryings& v = Varyings(out);
+	XMVECTOR pos = XMVector4Transform(XMVectorSetW(in[0], 1.0f), u.worldViewProjection);
+	XMStoreFloat4(&out.position, XMVectorSetZ(pos, XMVectorGetW(pos)));
+	StoreVarying(v.tex, in[0], 3);
+}
+// -END OF VERTEX SHADERS- //
+
+// -PIXEL SHADERS- //
+inline bool SoftwarePS(const RasterDraw& draw, const RasterPixel& pixel, XMVECTOR& color)
+{
+	const SoftwareUniforms& u = Uniforms(draw);
+	XMVECTOR norm = XMVector3Normalize(LoadVarying(Varyings(pixel).norm, 3));
+	// Ambient Light
+	XMVECTOR ambientColor = XMVectorSet(0.5f, 0.5f, 0.5f, 1.0f);
+	XMVECTOR diffuse = SampleTexture(draw, TX_MESH_DIFFUSE, pixel);
+	color = diffuse * ambientColor;
+	// Directional Light
+	color += XMVectorSaturate(XMVector3Dot(-u.lightDir, norm)) * u.lightColor * diffuse;
+	color = XMVectorSetW(color, 1.0f);
+	return true;
+}
+
+inline XMVECTOR SoftwareSpecularLighting(const SoftwareUniforms& u, FXMVECTOR normIn, FXMVECTOR worldPos, FXMVECTOR wvpRow, GXMVECTOR baseColor)
+{
+	XMVECTOR norm = XMVector3Normalize(normIn);
+	// Ambient Light
+	XMVECTOR ambientColor = XMVectorSet(0.5f, 0.5f, 0.5f, 1.0f);
+	XMVECTOR color = baseColor * ambientColor;
+	// Directional Light
+	color += XMVectorSaturate(XMVector3Dot(-u.lightDir, norm)) * u.lightColor * baseColor;
+
+	// Specular; like the HLSL, the view and half vectors are normalized as float4s.
+	const float specularPower = 25.0f, specularIntensity = 0.75f;
+	XMVECTOR viewDir = XMVector4Normalize(wvpRow - XMVector4Transform(worldPos, u.view));
+	XMVECTOR halfvector = XMVector4Normalize(-u.lightDir + viewDir);
+	float nDotH = XMVectorGetX(XMVectorSaturate(XMVector3Dot(norm, halfvector)));
+	float intensity = powf(nDotH, specularPower);
+
+	color += u.lightColor * (specularIntensity * intensity);
+	return XMVectorSetW(color, 1.0f);
+}
+
+inline void SoftwareSpecularLightingQuad(const SoftwareUniforms& u, const XMVECTOR normIn[3], const XMVECTOR worldPos[4], const XMVECTOR wvpRow[4], const XMVECTOR baseColor[4], XMVECTOR color[4])
+{
+	XMVECTOR norm[3], toLight[4], lightColor[4], view[4][4];
+	NormalizeQuad(normIn, norm, 3);
+	SplatQuad(-u.lightDir, toLight);
+	SplatQuad(u.lightColor, lightColor);
+	for (uint32_t row = 0; row < 4; row++)
+		SplatQuad(u.view.r[row], view[row]);
+	XMVECTOR nDotL = XMVectorSaturate(DotQuad(toLight, norm, 3));
+
+	XMVECTOR viewDir[4], halfvector[4];
+	for (uint32_t i = 0; i < 4; i++)
+	{
+		XMVECTOR viewPos = worldPos[0] * view[0][i] + worldPos[1] * view[1][i] + worldPos[2] * view[2][i] + worldPos[3] * view[3][i];
+		viewDir[i] = wvpRow[i] - viewPos;
+	}
+	NormalizeQuad(viewDir, viewDir, 4);
+	for (uint32_t i = 0; i < 4; i++)
+		halfvector[i] = toLight[i] + viewDir[i];
+	NormalizeQuad(halfvector, halfvector, 4);
+	XMVECTOR intensity = XMVectorPow(XMVectorSaturate(DotQuad(norm, halfvector, 3)), XMVectorReplicate(25.0f)) * 0.75f;
+
+	for (uint32_t i = 0; i < 3; i++)
+		color[i] = baseColor[i] * 0.5f + nDotL * lightColor[i] * baseColor[i] + lightColor[i] * intensity;
+	color[3] = XMVectorReplicate(1.0f);
+}
+
+inline bool SoftwarePSSpecular(const RasterDraw& draw, const RasterPixel& pixel, XMVECTOR& color)
+{
+	const SoftwareUniforms& u = Uniforms(draw);
+	const SoftwareVaryings& v = Varyings(pixel);
+	color = SoftwareSpecularLighting(u, LoadVarying(v.norm, 3), LoadVarying(v.worldPos, 4), u.worldViewProjection.r[3], u.outputColor);
+	return true;
+}
+
+inline bool SoftwarePSSpecularInstanced(const RasterDraw& draw, const RasterPixel& pixel, XMVECTOR& color)
+{
+	const SoftwareVaryings& v = Varyings(pixel);
+	color = SoftwareSpecularLighting(Uniforms(draw), LoadVarying(v.norm, 3), LoadVarying(v.worldPos, 4), LoadVarying(v.wvpRow, 4), LoadVarying(v.color, 4));
+	return true;
+}
+
+inline uint32_t SoftwarePSQuad(const RasterDraw& draw, const RasterQuad& quad, XMVECTOR color[4])
+{
+	const SoftwareUniforms& u = Uniforms(draw);
+	XMVECTOR norm[3], toLight[4], lightColor[4], diffuse[4];
+	NormalizeQuad(QuadVaryings(quad, offsetof(SoftwareVaryings, norm)), norm, 3);
+	SplatQuad(-u.lightDir, toLight);
+	SplatQuad(u.lightColor, lightColor);
+	SampleTextureQuad(draw, TX_MESH_DIFFUSE, quad, diffuse);
+	// Ambient plus directional light.
+	XMVECTOR nDotL = XMVectorSaturate(DotQuad(toLight, norm, 3));
+	for (uint32_t i = 0; i < 3; i++)
+		color[i] = diffuse[i] * 0.5f + nDotL * lightColor[i] * diffuse[i];
+	color[3] = XMVectorReplicate(1.0f);
+	return quad.mask;
+}
+
+inline uint32_t SoftwarePSSpecularQuad(const RasterDraw& draw, const RasterQuad& quad, XMVECTOR color[4])
+{
+	const SoftwareUniforms& u = Uniforms(draw);
+	XMVECTOR wvpRow[4], baseColor[4];
+	SplatQuad(u.worldViewProjection.r[3], wvpRow);
+	SplatQuad(u.outputColor, baseColor);
+	SoftwareSpecularLightingQuad(u, QuadVaryings(quad, offsetof(SoftwareVaryings, norm)), QuadVaryings(quad, offsetof(SoftwareVaryings, worldPos)), wvpRow, baseColor, color);
+	return quad.mask;
+}
+
+inline uint32_t SoftwarePSSpecularInstancedQuad(const RasterDraw& draw, const RasterQuad& quad, XMVECTOR color[4])
+{
+	SoftwareSpecularLightingQuad(Uniforms(draw), QuadVaryings(quad, offsetof(SoftwareVaryings, norm)), QuadVaryings(quad, offsetof(SoftwareVaryings, worldPos)),
+		QuadVaryings(quad, offsetof(SoftwareVaryings, wvpRow)), QuadVaryings(quad, offsetof(SoftwareVaryings, color)), color);
+	return quad.mask;
+}
+
+inline bool SoftwarePSSolidTexture(const RasterDraw& draw, const RasterPixel& pixel, XMVECTOR& color)
+{
+	color = SampleTexture(draw, TX_DIFFUSE, pixel);
+	return true;
+}
+
+inline uint32_t SoftwarePSSolidTextureQuad(const RasterDraw& draw, const RasterQuad& quad, XMVECTOR color[4])
+{
+	SampleTextureQuad(draw, TX_DIFFUSE, quad, color);
+	return quad.mask;
+}
+
+inline bool SoftwarePSCrosshair(const RasterDraw& draw, const RasterPixel& pixel, XMVECTOR& color)
+{
+	color = SampleTexture(draw, TX_CROSSHAIR, pixel);
+	return XMVectorGetW(color) >= 0.5f;
+}
+
+inline bool SoftwareSkyboxPS(const RasterDraw& draw, const RasterPixel& pixel, XMVECTOR& color)
+{
+	const SoftwareTexture* skybox = draw.textures[TX_SKYBOX];
+	color = skybox != nullptr ? skybox->SampleCube(draw.sampler, LoadVarying(Varyings(pixel).tex, 3)) : XMVectorZero();
+	return true;
+}
+inline uint32_t SoftwarePSCrosshairQuad(const RasterDraw& draw, const RasterQuad& quad, XMVECTOR color[4])
+{
+	SampleTextureQuad(draw, TX_CROSSHAIR, quad, color);
+	XMFLOAT4 alpha;
+	XMStoreFloat4(&alpha, color[3]);
+	uint32_t mask = 0;
+	for (uint32_t lane = 0; lane < 4; lane++)
+		mask |= (&alpha.x)[lane] >= 0.5f ? 1u << lane : 0;
+	return quad.mask & mask;
+}
+
+inline uint32_t SoftwareSkyboxPSQuad(const RasterDraw& draw, const RasterQuad& quad, XMVECTOR color[4])
+{
+	XMMATRIX texels;
+	for (uint32_t lane = 0; lane < 4; lane++)
+		texels.r[lane] = XMVectorZero();
+	const SoftwareTexture* skybox = draw.textures[TX_SKYBOX];
+	if (skybox != nullptr)
+	{
+		XMFLOAT4 x, y, z;
+		XMStoreFloat4(&x, quad.varyings[0]);
+		XMStoreFloat4(&y, quad.varyings[1]);
+		XMStoreFloat4(&z, quad.varyings[2]);
+		for (uint32_t lane = 0; lane < 4; lane++)
+		{
+			if ((quad.mask & (1u << lane)) != 0)
+				texels.r[lane] = skybox->SampleCube(draw.sampler, XMVectorSet((&x.x)[lane], (&y.x)[lane], (&z.x)[lane], 0.0f));
+		}
+	}
+	texels = XMMatrixTranspose(texels);
+	for (uint32_t i = 0; i < 4; i++)
+		color[i] = texels.r[i];
+	return quad.mask;
+}
+// -END OF PIXEL SHADERS- //
+
+// Returns nullptr when shaders.fx has no software version of 'entryPoint' for 'stage'.
+inline const SoftwareShaderProgram* FindSoftwareShader(ShaderStage stage, const char* entryPoint)
+{
+	static const SoftwareShaderInput meshInputs[] = { { "POSITION", 0 }, { "NORMAL", 0 }, { "TEXCOORD", 0 } };
+	static const SoftwareShaderInput instancedInputs[] =
+	{
+		{ "POSITION", 0 }, { "NORMAL", 0 }, { "TEXCOORD", 0 },
+		{ "INSTANCEWORLD", 0 }, { "INSTANCEWORLD", 1 }, { "INSTANCEWORLD", 2 }, { "INSTANCEWORLD", 3 },
+		{ "INSTANCECOLOR", 0 },
+	};
+	static const SoftwareShaderInput skyboxInputs[] = { { "SV_POSITION", 0 }, { "NORMAL", 0 }, { "TEXCOORD", 2 } };
+
+	static const SoftwareShaderProgram programs[] =
+	{
+		{ "VS", ShaderStage::Vertex, SoftwareVS, nullptr, nullptr, meshInputs, ARRAYSIZE(meshInputs), SoftwareVaryingsLit, false },
+		{ "VSWave", ShaderStage::Vertex, SoftwareVSWave, nullptr, nullptr, meshInputs, ARRAYSIZE(meshInputs), SoftwareVaryingsLit, false },
+		{ "VS_Instanced", ShaderStage::Vertex, SoftwareVSInstanced, nullptr, nullptr, instancedInputs, ARRAYSIZE(instancedInputs), SoftwareVaryingsInstanced, false },
+		{ "SKYBOX_VS", ShaderStage::Vertex, SoftwareSkyboxVS, nullptr, nullptr, skyboxInputs, ARRAYSIZE(skyboxInputs), SoftwareVaryingsTexture, false },
+		// The pass through GS never changes the triangles, so it only needs to exist.
+		{ "GS", ShaderStage::Geometry, nullptr, nullptr, nullptr, nullptr, 0, 0, false },
+		{ "PS", ShaderStage::Pixel, nullptr, SoftwarePS, SoftwarePSQuad, nullptr, 0, 0, true },
+		{ "PS_Specular", ShaderStage::Pixel, nullptr, SoftwarePSSpecular, SoftwarePSSpecularQuad, nullptr, 0, 0, false },
+		{ "PS_SpecularInstanced", ShaderStage::Pixel, nullptr, SoftwarePSSpecularInstanced, SoftwarePSSpecularInstancedQuad, nullptr, 0, 0, false },
+		{ "PS_SolidTexture", ShaderStage::Pixel, nullptr, SoftwarePSSolidTexture, SoftwarePSSolidTextureQuad, nullptr, 0, 0, true },
+		{ "PS_Crosshair", ShaderStage::Pixel, nullptr, SoftwarePSCrosshair, SoftwarePSCrosshairQuad, nullptr, 0, 0, true },
+		{ "SKYBOX_PS", ShaderStage::Pixel, nullptr, SoftwareSkyboxPS, SoftwareSkyboxPSQuad, nullptr, 0, 0, false },
+	};
+
+	for (const SoftwareShaderProgram& program : programs)
+	{
+		if (program.stage == stage && strcmp(program.entryPoint, entryPoint) == 0)
+			return &program;
+	}
+	return nullptr;
+}
@@ -0,0 +1,394 @@
+#pragma once
+#include "defines.h"
+#include "RenderDevice.h"
+#include <cmath>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <string>
+#include <vector>
+
+// CPU copy of a DDS texture for the software rasterizer.
+// Every format is decoded to RGBA8 up front; cube maps keep their six faces.
+class SoftwareTexture
+{
+public:
+	struct Level
+	{
+		uint32_t width;
+		uint32_t height;
+		size_t offset;	// Into 'texels'.
+	};
+
+	// Supports DXT1/3/5 (BC1-3), 32-bit RGBA/BGRA and 24-bit RGB, 2D or cube, with or without a DX10 header.
+	bool LoadDDS(const wchar_t* path)
+	{
+		// The project only uses ASCII paths.
+		std::string narrow;
+		for (const wchar_t* c = path; *c != 0; c++)
+			narrow.push_back(static_cast<char>(*c));
+
+		std::ifstream in(narrow, std::ios::binary);
+		if (!in)
+			return false;
+		std::vector<uint8_t> file((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+		if (file.size() < 128 || memcmp(file.data(), "DDS ", 4) != 0)
+			return false;
+
+		const uint8_t* header = file.data() + 4;
+		uint32_t height = ReadU32(header + 8);
+		uint32_t width = ReadU32(header + 12);
+		uint32_t mips = ReadU32(header + 24);
+		uint32_t formatFlags = ReadU32(header + 76);
+		uint32_t fourCC = ReadU32(header + 80);
+		uint32_t bitCount = ReadU32(header + 84);
+		uint32_t masks[4] = { ReadU32(header + 88), ReadU32(header + 92), ReadU32(header + 96), ReadU32(header + 100) };
+		uint32_t caps2 = ReadU32(header + 108);
+		size_t dataOffset = 128;
+
+		Format format = Format::Unknown;
+		uint32_t faceCount = (caps2 & 0x200) ? 6 : 1;
+		if ((formatFlags & 0x4) != 0)
+		{
+			if (fourCC == FourCC("DXT1"))
+				format = Format::BC1;
+			else if (fourCC == FourCC("DXT2") || fourCC == FourCC("DXT3"))
+				format = Format::BC2;
+			else if (fourCC == FourCC("DXT4") || fourCC == FourCC("DXT5"))
+				format = Format::BC3;
+			else if (fourCC == FourCC("DX10") && file.size() >= 148)
+			{
+				format = FormatFromDXGI(ReadU32(file.data() + 128), masks);
+				faceCount = (ReadU32(file.data() + 136) & 0x4) ? 6 : 1;
+				dataOffset = 148;
+			}
+		}
+		else if ((formatFlags & 0x40) != 0 && (bitCount == 32 || bitCount == 24))
+			format = bitCount == 32 ? Format::Masked32 : Format::Masked24;
+
+		if (format == Format::Unknown || width == 0 || height == 0)
+			return false;
+
+		faces = faceCount;
+		mipLevels = mips == 0 ? 1 : mips;
+		levels.clear();
+		texels.clear();
+
+		// Faces are stored one after another, each with its full mip chain.
+		const uint8_t* src = file.data() + dataOffset;
+		const uint8_t* end = file.data() + file.size();
+		for (uint32_t face = 0; face < faces; face++)
+		{
+			uint32_t w = width, h = height;
+			for (uint32_t mip = 0; mip < mipLevels; mip++)
+			{
+				size_t size = SurfaceSize(format, w, h);
+				if (src + size > end)
+					return false;
+
+				Level level = { w, h, texels.size() };
+				texels.resize(texels.size() + static_cast<size_t>(w) * h);
+				Decode(format, src, w, h, masks, texels.data() + level.offset);
+				levels.push_back(level);
+
+				src += size;
+				w = w > 1 ? w / 2 : 1;
+				h = h > 1 ? h / 2 : 1;
+			}
+		}
+		return true;
+	}
+
+	// A single texel, for resources that could not be loaded.
+	void CreateSolid(uint32_t rgba)
+	{
+		faces = 1;
+		mipLevels = 1;
+		levels.assign(1, Level{ 1, 1, 0 });
+		texels.assign(1, rgba);
+	}
+
+	// Filtered lookup at 'lod' mip levels below the top one.
+	XMVECTOR Sample(const SamplerDesc& sampler, float u, float v, float lod, uint32_t face = 0) const
+	{
+		if (texels.empty())
+			return XMVectorZero();
+
+		float maxLod = static_cast<float>(mipLevels - 1);
+		lod = lod < 0.0f ? 0.0f : (lod > maxLod ? maxLod : lod);
+
+		if (sampler.filter == SamplerFilter::Point)
+			return SamplePoint(GetLevel(face, static_cast<uint32_t>(lod + 0.5f)), sampler.address, u, v);
+
+		// Trilinear: blend the two nearest mips.
+		uint32_t mip = static_cast<uint32_t>(lod);
+		float blend = lod - static_cast<float>(mip);
+		XMVECTOR color = SampleBilinear(GetLevel(face, mip), sampler.address, u, v);
+		if (blend > 0.0f && mip + 1 < mipLevels)
+			color = XMVectorLerp(color, SampleBilinear(GetLevel(face, mip + 1), sampler.address, u, v), blend);
+		return color;
+	}
+
+	// Cube map lookup along 'direction'. Only the top mip is used.
+	XMVECTOR SampleCube(const SamplerDesc& sampler, FXMVECTOR direction) const
+	{
+		float x = XMVectorGetX(direction), y = XMVectorGetY(direction), z = XMVectorGetZ(direction);
+		float ax = fabsf(x), ay = fabsf(y), az = fabsf(z);
+
+		// Face order and orientation follow D3D: +X, -X, +Y, -Y, +Z, -Z.
+		uint32_t face;
+		float sc, tc, ma;
+		if (ax >= ay && ax >= az)
+		{
+			face = x >= 0.0f ? 0 : 1;
+			sc = x >= 0.0f ? -z : z;
+			tc = -y;
+			ma = ax;
+		}
+		else if (ay >= az)
+		{
+			face = y >= 0.0f ? 2 : 3;
+			sc = x;
+			tc = y >= 0.0f ? z : -z;
+			ma = ay;
+		}
+		else
+		{
+			face = z >= 0.0f ? 4 : 5;
+			sc = z >= 0.0f ? x : -x;
+			tc = -y;
+			ma = az;
+		}
+		if (ma <= 0.0f)
+			return XMVectorZero();
+		if (face >= faces)
+			face = 0;
+
+		SamplerDesc faceSampler = sampler;
+		faceSampler.address = SamplerAddress::Clamp;
+		float invMa = 0.5f / ma;
+		return Sample(faceSampler, sc * invMa + 0.5f, tc * invMa + 0.5f, 0.0f, face);
+	}
+
+	uint32_t GetWidth() const { return levels.empty() ? 0 : levels[0].width; }
+	uint32_t GetHeight() const { return levels.empty() ? 0 : levels[0].height; }
+	uint32_t GetMipLevels() const { return mipLevels; }
+	bool IsCube() const { return faces == 6; }
+
+private:
+	enum class Format
+	{
+		Unknown,
+		BC1,
+		BC2,
+		BC3,
+		Masked32,
+		Masked24,
+	};
+
+	uint32_t faces = 0;
+	uint32_t mipLevels = 0;
+	std::vector<Level> levels;	// Face-major, like the file.
+	std::vector<uint32_t> texels;	// R | G << 8 | B << 16 | A << 24
+
+	static uint32_t ReadU32(const uint8_t* p)
+	{
+		return static_cast<uint32_t>(p[0]) | (static_cast<uint32_t>(p[1]) << 8) | (static_cast<uint32_t>(p[2]) << 16) | (static_cast<uint32_t>(p[3]) << 24);
+	}
+
+	static uint32_t FourCC(const char* code)
+	{
+		return ReadU32(reinterpret_cast<const uint8_t*>(code));
+	}
+
+	// The DXGI formats DirectXTex commonly writes; 'masks' is filled in for the uncompressed ones.
+	static Format FormatFromDXGI(uint32_t dxgiFormat, uint32_t masks[4])
+	{
+		switch (dxgiFormat)
+		{
+		case 70: case 71: case 72: return Format::BC1;
+		case 73: case 74: case 75: return Format::BC2;
+		case 76: case 77: case 78: return Format::BC3;
+		case 27: case 28: case 29:	// R8G8B8A8
+			masks[0] = 0x000000ff; masks[1] = 0x0000ff00; masks[2] = 0x00ff0000; masks[3] = 0xff000000;
+			return Format::Masked32;
+		case 87: case 90: case 91:	// B8G8R8A8
+			masks[0] = 0x00ff0000; masks[1] = 0x0000ff00; masks[2] = 0x000000ff; masks[3] = 0xff000000;
+			return Format::Masked32;
+		case 88: case 92: case 93:	// B8G8R8X8
+			masks[0] = 0x00ff0000; masks[1] = 0x0000ff00; masks[2] = 0x000000ff; masks[3] = 0;
+			return Format::Masked32;
+		default:
+			return Format::Unknown;
+		}
+	}
+
+	static size_t SurfaceSize(Format format, uint32_t width, uint32_t height)
+	{
+		size_t blocks = static_cast<size_t>((width + 3) / 4) * ((height + 3) / 4);
+		switch (format)
+		{
+		case Format::BC1: return blocks * 8;
+		case Format::BC2:
+		case Format::BC3: return blocks * 16;
+		case Format::Masked32: return static_cast<size_t>(width) * height * 4;
+		case Format::Masked24: return static_cast<size_t>(width) * height * 3;
+		default: return 0;
+		}
+	}
+
+	// Expands 'value & mask' to 8 bits. An empty mask reads as opaque.
+	static uint32_t ExtractChannel(uint32_t value, uint32_t mask)
+	{
+		if (mask == 0)
+			return 255;
+		uint32_t shift = 0;
+		while (((mask >> shift) & 1) == 0)
+			shift++;
+		uint32_t bits = (value & mask) >> shift;
+		uint32_t max = mask >> shift;
+		return (bits * 255 + max / 2) / max;
+	}
+
+	static uint32_t Pack(uint32_t r, uint32_t g, uint32_t b, uint32_t a)
+	{
+		return r | (g << 8) | (b << 16) | (a << 24);
+	}
+
+	static void Decode(Format format, const uint8_t* src, uint32_t width, uint32_t height, const uint32_t masks[4], uint32_t* dst)
+	{
+		if (format == Format::Masked32 || format == Format::Masked24)
+		{
+			uint32_t bytes = format == Format::Masked32 ? 4 : 3;
+			for (size_t i = 0; i < static_cast<size_t>(width) * height; i++, src += bytes)
+			{
+				uint32_t value = src[0] | (src[1] << 8) | (src[2] << 16) | (bytes == 4 ? (static_cast<uint32_t>(src[3]) << 24) : 0);
+				dst[i] = Pack(ExtractChannel(value, masks[0]), ExtractChannel(value, masks[1]), ExtractChannel(value, masks[2]), ExtractChannel(value, bytes == 4 ? masks[3] : 0));
+			}
+			return;
+		}
+
+		size_t blockSize = format == Format::BC1 ? 8 : 16;
+		for (uint32_t by = 0; by < height; by += 4)
+		{
+			for (uint32_t bx = 0; bx < width; bx += 4, src += blockSize)
+			{
+				uint32_t block[16];
+				const uint8_t* colorBlock = format == Format::BC1 ? src : src + 8;
+				DecodeColorBlock(colorBlock, format == Format::BC1, block);
+				if (format == Format::BC2)
+					DecodeExplicitAlpha(src, block);
+				else if (format == Format::BC3)
+					DecodeInterpolatedAlpha(src, block);
+
+				for (uint32_t y = 0; y < 4 && by + y < height; y++)
+					for (uint32_t x = 0; x < 4 && bx + x < width; x++)
+						dst[static_cast<size_t>(by + y) * width + bx + x] = block[y * 4 + x];
+			}
+		}
+	}
+
+	static void DecodeColorBlock(const uint8_t* src, bool allowTransparent, uint32_t out[16])
+	{
+		uint32_t c0 = src[0] | (src[1] << 8);
+		uint32_t c1 = src[2] | (src[3] << 8);
+		uint32_t r[4], g[4], b[4], a[4] = { 255, 255, 255, 255 };
+		r[0] = ((c0 >> 11) & 31) * 255 / 31; g[0] = ((c0 >> 5) & 63) * 255 / 63; b[0] = (c0 & 31) * 255 / 31;
+		r[1] = ((c1 >> 11) & 31) * 255 / 31; g[1] = ((c1 >> 5) & 63) * 255 / 63; b[1] = (c1 & 31) * 255 / 31;
+		if (c0 > c1 || !allowTransparent)
+		{
+			r[2] = (2 * r[0] + r[1]) / 3; g[2] = (2 * g[0] + g[1]) / 3; b[2] = (2 * b[0] + b[1]) / 3;
+			r[3] = (r[0] + 2 * r[1]) / 3; g[3] = (g[0] + 2 * g[1]) / 3; b[3] = (b[0] + 2 * b[1]) / 3;
+		}
+		else
+		{
+			r[2] = (r[0] + r[1]) / 2; g[2] = (g[0] + g[1]) / 2; b[2] = (b[0] + b[1]) / 2;
+			r[3] = g[3] = b[3] = a[3] = 0;
+		}
+
+		uint32_t indices = ReadU32(src + 4);
+		for (uint32_t i = 0; i < 16; i++)
+		{
+			uint32_t index = (indices >> (i * 2)) & 3;
+			out[i] = Pack(r[index], g[index], b[index], a[index]);
+		}
+	}
+
+	static void DecodeExplicitAlpha(const uint8_t* src, uint32_t block[16])
+	{
+		for (uint32_t i = 0; i < 16; i++)
+		{
+			uint32_t alpha = (src[i / 2] >> ((i & 1) * 4)) & 15;
+			block[i] = (block[i] & 0x00ffffff) | ((alpha * 17) << 24);
+		}
+	}
+
+	static void DecodeInterpolatedAlpha(const uint8_t* src, uint32_t block[16])
+	{
+		uint32_t a[8];
+		a[0] = src[0];
+		a[1] = src[1];
+		if (a[0] > a[1])
+		{
+			for (uint32_t i = 1; i < 7; i++)
+				a[i + 1] = ((7 - i) * a[0] + i * a[1]) / 7;
+		}
+		else
+		{
+			for (uint32_t i = 1; i < 5; i++)
+				a[i + 1] = ((5 - i) * a[0] + i * a[1]) / 5;
+			a[6] = 0;
+			a[7] = 255;
+		}
+
+		uint64_t indices = 0;
+		for (uint32_t i = 0; i < 6; i++)
+			indices |= static_cast<uint64_t>(src[2 + i]) << (i * 8);
+		for (uint32_t i = 0; i < 16; i++)
+			block[i] = (block[i] & 0x00ffffff) | (a[(indices >> (i * 3)) & 7] << 24);
+	}
+
+	const Level& GetLevel(uint32_t face, uint32_t mip) const
+	{
+		return levels[face * mipLevels + mip];
+	}
+
+	static int32_t Address(int32_t i, int32_t size, SamplerAddress address)
+	{
+		if (address == SamplerAddress::Clamp)
+			return i < 0 ? 0 : (i >= size ? size - 1 : i);
+		i %= size;
+		return i < 0 ? i + size : i;
+	}
+
+	static XMVECTOR Unpack(uint32_t texel)
+	{
+		const float scale = 1.0f / 255.0f;
+		return XMVectorSet((texel & 255) * scale, ((texel >> 8) & 255) * scale, ((texel >> 16) & 255) * scale, (texel >> 24) * scale);
+	}
+
+	XMVECTOR SamplePoint(const Level& level, SamplerAddress address, float u, float v) const
+	{
+		int32_t w = static_cast<int32_t>(level.width), h = static_cast<int32_t>(level.height);
+		int32_t x = Address(static_cast<int32_t>(floorf(u * w)), w, address);
+		int32_t y = Address(static_cast<int32_t>(floorf(v * h)), h, address);
+		return Unpack(texels[level.offset + static_cast<size_t>(y) * level.width + x]);
+	}
+
+	XMVECTOR SampleBilinear(const Level& level, SamplerAddress address, float u, float v) const
+	{
+		int32_t w = static_cast<int32_t>(level.width), h = static_cast<int32_t>(level.height);
+		// Texel centers are at half coordinates.
+		float fx = u * w - 0.5f, fy = v * h - 0.5f;
+		float x0f = floorf(fx), y0f = floorf(fy);
+		float tx = fx - x0f, ty = fy - y0f;
+		int32_t x0 = Address(static_cast<int32_t>(x0f), w, address), x1 = Address(static_cast<int32_t>(x0f) + 1, w, address);
+		int32_t y0 = Address(static_cast<int32_t>(y0f), h, address), y1 = Address(static_cast<int32_t>(y0f) + 1, h, address);
+
+		const uint32_t* row0 = texels.data() + level.offset + static_cast<size_t>(y0) * level.width;
+		const uint32_t* row1 = texels.data() + level.offset + static_cast<size_t>(y1) * level.width;
+		XMVECTOR top = XMVectorLerp(Unpack(row0[x0]), Unpack(row0[x1]), tx);
+		XMVECTOR bottom = XMVectorLerp(Unpack(row1[x0]), Unpack(row1[x1]), tx);
+		return XMVectorLerp(top, bottom, ty);
+	}
+};
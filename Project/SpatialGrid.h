@@ -0,0 +1,397 @@
+#pragma once
+#include "defines.h"
+#include "RasterSimd.h"
+#include "JobSystem.h"
+#include <algorithm>
+#include <cfloat>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <vector>
+
+// An object as the grid stores it, sorted so each slot's objects sit next to each other.
+struct GridEntry
+{
+	XMFLOAT3 center;
+	float radius;
+	uint32_t id;
+	int32_t cellX, cellY, cellZ;	// Cell of the center, which rows wrapped onto the same slots tell apart by.
+};
+
+// Work done by the last Build().
+struct GridStats
+{
+	uint32_t objects = 0;
+	uint32_t slots = 0;
+	uint32_t chunks = 0;		// Pieces the objects were split into for the sort.
+	double buildMs = 0.0;
+};
+
+// Uniform grid over moving spheres, rebuilt from scratch every frame.
+//
+// Cells are cubes of the cell size, wrapped into a power of two box of slots, so the grid has no
+// bounds and its memory follows the object count. Build() counting sorts the objects by slot:
+// every chunk of objects counts its slots, the counts are turned into each chunk's write offsets
+// slot by slot, and every chunk copies its objects out. Each step is a ParallelFor over the chunks
+// on the shared JobSystem, and the sort is stable, so a slot lists its objects in id order however the work
+// was split.
+//
+// Objects are filed under the cell of their center. Queries widen their range by the largest
+// radius, then test the spheres in the range's cells themselves.
+class SpatialGrid
+{
+public:
+	// Objects per chunk of the sort; fewer objects than this stay on one thread.
+	static const uint32_t ChunkSize = 8192;
+	static const uint32_t MaxChunks = 16;
+
+	explicit SpatialGrid(float _cellSize = 2.0f)
+	{
+		SetCellSize(_cellSize);
+	}
+
+	// Takes effect at the next Build().
+	void SetCellSize(float _cellSize)
+	{
+		cellSize = _cellSize > 0.0f ? _cellSize : 1.0f;
+	}
+	float GetCellSize() const { return cellSize; }
+
+	void SetMultithreaded(bool enabled) { multithreaded = enabled; }
+
+	// New objects are points at the origin.
+	void Resize(size_t count)
+	{
+		centerX.resize(count, 0.0f); centerY.resize(count, 0.0f); centerZ.resize(count, 0.0f);
+		radius.resize(count, 0.0f);
+	}
+
+	uint32_t Add(const XMFLOAT3& center, float _radius)
+	{
+		Resize(centerX.size() + 1);
+		uint32_t id = static_cast<uint32_t>(centerX.size() - 1);
+		Set(id, center, _radius);
+		return id;
+	}
+
+	void Set(uint32_t id, const XMFLOAT3& center, float _radius)
+	{
+		centerX[id] = center.x; centerY[id] = center.y; centerZ[id] = center.z;
+		radius[id] = _radius;
+	}
+
+	void Clear()
+	{
+		Resize(0);
+		objectCount = 0;
+		entries.clear();
+		slotStart.assign(2, 0);
+		slotMask = 0;
+	}
+
+	size_t Count() const { return centerX.size(); }
+
+	// Sorts the objects into their slots.
+	void Build()
+	{
+		std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+		objectCount = static_cast<uint32_t>(centerX.size());
+		invCellSize = 1.0f / cellSize;
+		// About two objects per slot keeps the per chunk counts small.
+		uint32_t slotBits = 6;
+		while ((1u << slotBits) * 2 < objectCount)
+			slotBits++;
+		uint32_t slots = 1u << slotBits;
+		slotMask = slots - 1;
+		// Split the bits between the axes, x first.
+		bitsX = (slotBits + 2) / 3;
+		bitsY = (slotBits + 1) / 3;
+		maskX = (1u << bitsX) - 1;
+		maskY = (1u << bitsY) - 1;
+		maskZ = (1u << (slotBits - bitsX - bitsY)) - 1;
+		// More chunks than threads only makes more counts to scan.
+		uint32_t threads = multithreaded ? jobs->GetThreadCount() : 1;
+		uint32_t maxChunks = threads < 1 ? 1 : (threads > MaxChunks ? MaxChunks : threads);
+		chunkCount = (objectCount + ChunkSize - 1) / ChunkSize;
+		chunkCount = chunkCount < 1 ? 1 : (chunkCount > maxChunks ? maxChunks : chunkCount);
+		// Slots are scanned in as many ranges as there are chunks.
+		rangeSize = slots / chunkCount;
+
+		// Rows a power of two apart would all map to the same cache sets in the scan; pad them.
+		countStride = slots + 16;
+		counts.resize(static_cast<size_t>(chunkCount) * countStride);
+		chunkMaxRadius.resize(chunkCount);
+		rangeTotals.resize(chunkCount);
+		objectCells.resize(objectCount);
+		slotStart.resize(static_cast<size_t>(slots) + 1);
+		entries.resize(objectCount);
+
+		RunPhase(PhaseCount);
+		RunPhase(PhaseScan);
+		uint32_t total = 0;
+		for (uint32_t r = 0; r < chunkCount; r++)
+		{
+			uint32_t rangeTotal = rangeTotals[r];
+			rangeTotals[r] = total;
+			total += rangeTotal;
+		}
+		slotStart[slots] = total;
+		RunPhase(PhaseStart);
+		RunPhase(PhaseScatter);
+
+		maxRadius = 0.0f;
+		for (uint32_t c = 0; c < chunkCount; c++)
+			maxRadius = chunkMaxRadius[c] > maxRadius ? chunkMaxRadius[c] : maxRadius;
+
+		stats.objects = objectCount;
+		stats.slots = slots;
+		stats.chunks = chunkCount;
+		stats.buildMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+	}
+
+	// Ids of the objects whose spheres overlap the sphere, touching counts, as of the last Build().
+	void QueryRadius(const XMFLOAT3& center, float queryRadius, std::vector<uint32_t>& out) const
+	{
+		out.clear();
+		float reach = queryRadius + maxRadius;
+		XMFLOAT3 boundsMin(center.x - reach, center.y - reach, center.z - reach);
+		XMFLOAT3 boundsMax(center.x + reach, center.y + reach, center.z + reach);
+		ForEachCandidate(boundsMin, boundsMax, [&](const GridEntry& entry)
+		{
+			float dx = entry.center.x - center.x, dy = entry.center.y - center.y, dz = entry.center.z - center.z;
+			float limit = queryRadius + entry.radius;
+			if (dx * dx + dy * dy + dz * dz <= limit * limit)
+				out.push_back(entry.id);
+		});
+	}
+
+	// Ids of the objects whose spheres overlap the box, touching counts, as of the last Build().
+	void QueryBox(const XMFLOAT3& boundsMin, const XMFLOAT3& boundsMax, std::vector<uint32_t>& out) const
+	{
+		out.clear();
+		XMFLOAT3 reachMin(boundsMin.x - maxRadius, boundsMin.y - maxRadius, boundsMin.z - maxRadius);
+		XMFLOAT3 reachMax(boundsMax.x + maxRadius, boundsMax.y + maxRadius, boundsMax.z + maxRadius);
+		ForEachCandidate(reachMin, reachMax, [&](const GridEntry& entry)
+		{
+			// Distance from the center to the box.
+			float dx = entry.center.x < boundsMin.x ? boundsMin.x - entry.center.x : (entry.center.x > boundsMax.x ? entry.center.x - boundsMax.x : 0.0f);
+			float dy = entry.center.y < boundsMin.y ? boundsMin.y - entry.center.y : (entry.center.y > boundsMax.y ? entry.center.y - boundsMax.y : 0.0f);
+			float dz = entry.center.z < boundsMin.z ? boundsMin.z - entry.center.z : (entry.center.z > boundsMax.z ? entry.center.z - boundsMax.z : 0.0f);
+			if (dx * dx + dy * dy + dz * dz <= entry.radius * entry.radius)
+				out.push_back(entry.id);
+		});
+	}
+
+	const GridStats& GetStats() const { return stats; }
+	const std::vector<GridEntry>& GetEntries() const { return entries; }
+
+private:
+	struct GridCell
+	{
+		int32_t x, y, z;
+	};
+
+	enum Phase : uint32_t
+	{
+		PhaseCount,		// Per chunk: find each object's slot and count the chunk's objects per slot.
+		PhaseScan,		// Per slot range: turn counts into offsets within the slot, total the range.
+		PhaseStart,		// Per slot range: where each slot starts.
+		PhaseScatter,	// Per chunk: copy the objects to their slots.
+	};
+
+	// Rounds down without floorf, which is a library call before SSE4.1.
+	int32_t CellOf(float value) const
+	{
+		float scaled = value * invCellSize;
+		int32_t cell = static_cast<int32_t>(scaled);
+		return cell - (scaled < static_cast<float>(cell) ? 1 : 0);
+	}
+
+	// Cells wrap around a box of slots, so a run of cells along x is a run of slots.
+	uint32_t SlotOf(int32_t x, int32_t y, int32_t z) const
+	{
+		return (static_cast<uint32_t>(x) & maskX) | (static_cast<uint32_t>(y) & maskY) << bitsX | (static_cast<uint32_t>(z) & maskZ) << (bitsX + bitsY);
+	}
+
+	// Calls 'visit' for every object whose center is in a cell overlapping the box. Rows of cells
+	// that wrap onto the same slots each keep only their own objects.
+	template<typename Visitor>
+	void ForEachCandidate(const XMFLOAT3& boundsMin, const XMFLOAT3& boundsMax, Visitor visit) const
+	{
+		if (objectCount == 0)
+			return;
+
+		int32_t x0 = CellOf(boundsMin.x), y0 = CellOf(boundsMin.y), z0 = CellOf(boundsMin.z);
+		int32_t x1 = CellOf(boundsMax.x), y1 = CellOf(boundsMax.y), z1 = CellOf(boundsMax.z);
+		uint64_t cells = static_cast<uint64_t>(x1 - x0 + 1) * static_cast<uint64_t>(y1 - y0 + 1) * static_cast<uint64_t>(z1 - z0 + 1);
+		// Past one cell per object, walking every object is cheaper.
+		if (cells > objectCount)
+		{
+			for (const GridEntry& entry : entries)
+				visit(entry);
+			return;
+		}
+
+		// Each row of cells along x is one run of slots, two if it wraps, or every slot of the row
+		// if it is as long as the box.
+		uint32_t runs[2][2];
+		uint32_t runCount;
+		if (static_cast<uint32_t>(x1 - x0) >= maskX)
+		{
+			runs[0][0] = 0; runs[0][1] = maskX;
+			runCount = 1;
+		}
+		else
+		{
+			uint32_t first = static_cast<uint32_t>(x0) & maskX, last = static_cast<uint32_t>(x1) & maskX;
+			runs[0][0] = first; runs[0][1] = first <= last ? last : maskX;
+			runs[1][0] = 0; runs[1][1] = last;
+			runCount = first <= last ? 1 : 2;
+		}
+		uint32_t width = static_cast<uint32_t>(x1 - x0);
+		for (int32_t z = z0; z <= z1; z++)
+		{
+			for (int32_t y = y0; y <= y1; y++)
+			{
+				uint32_t row = SlotOf(0, y, z);
+				for (uint32_t r = 0; r < runCount; r++)
+				{
+					for (uint32_t i = slotStart[row + runs[r][0]]; i < slotStart[row + runs[r][1] + 1]; i++)
+					{
+						// Without branches; wrapped rows make the outcome hard to predict.
+						const GridEntry& entry = entries[i];
+						if ((static_cast<uint32_t>(entry.cellX - x0) <= width) & (entry.cellY == y) & (entry.cellZ == z))
+							visit(entry);
+					}
+				}
+			}
+		}
+	}
+
+	// Runs 'phase' over every chunk, or range of slots, which is as many.
+	void RunPhase(Phase phase)
+	{
+		if (multithreaded && chunkCount > 1)
+			jobs->ParallelFor(chunkCount, 1, [this, phase](uint32_t begin, uint32_t end) { RunChunks(phase, begin, end); });
+		else
+			RunChunks(phase, 0, chunkCount);
+	}
+
+	void RunChunks(Phase phase, uint32_t begin, uint32_t end)
+	{
+		for (uint32_t c = begin; c < end; c++)
+		{
+			switch (phase)
+			{
+			case PhaseCount: CountChunk(c); break;
+			case PhaseScan: ScanRange(c); break;
+			case PhaseStart: StartRange(c); break;
+			case PhaseScatter: ScatterChunk(c); break;
+			}
+		}
+	}
+
+	// Chunk c holds objects [c * n / chunks, (c + 1) * n / chunks).
+	uint32_t ChunkBegin(uint32_t c) const { return static_cast<uint32_t>(static_cast<uint64_t>(c) * objectCount / chunkCount); }
+	// Range r holds slots [r * rangeSize, (r + 1) * rangeSize); the last one takes the rest.
+	uint32_t RangeEnd(uint32_t r) const { return r + 1 == chunkCount ? slotMask + 1 : (r + 1) * rangeSize; }
+
+	void CountChunk(uint32_t c)
+	{
+		uint32_t* chunkCounts = &counts[static_cast<size_t>(c) * countStride];
+		std::fill(chunkCounts, chunkCounts + slotMask + 1, 0u);
+		float largest = 0.0f;
+		for (uint32_t i = ChunkBegin(c), end = ChunkBegin(c + 1); i < end; i++)
+		{
+			GridCell cell = { CellOf(centerX[i]), CellOf(centerY[i]), CellOf(centerZ[i]) };
+			objectCells[i] = cell;
+			chunkCounts[SlotOf(cell.x, cell.y, cell.z)]++;
+			largest = radius[i] > largest ? radius[i] : largest;
+		}
+		chunkMaxRadius[c] = largest;
+	}
+
+	// Replaces each chunk's count with the objects of earlier chunks in the slot, and keeps the
+	// slot's total in slotStart for StartRange(). Walks the rows one after another rather than
+	// every row for each slot.
+	void ScanRange(uint32_t r)
+	{
+		uint32_t first = r * rangeSize, end = RangeEnd(r);
+		std::fill(slotStart.begin() + first, slotStart.begin() + end, 0u);
+		for (uint32_t c = 0; c < chunkCount; c++)
+		{
+			uint32_t* row = &counts[static_cast<size_t>(c) * countStride];
+			for (uint32_t s = first; s < end; s++)
+			{
+				uint32_t chunkObjects = row[s];
+				row[s] = slotStart[s];
+				slotStart[s] += chunkObjects;
+			}
+		}
+		uint32_t rangeTotal = 0;
+		for (uint32_t s = first; s < end; s++)
+			rangeTotal += slotStart[s];
+		rangeTotals[r] = rangeTotal;
+	}
+
+	// rangeTotals holds where each range starts by now.
+	void StartRange(uint32_t r)
+	{
+		uint32_t offset = rangeTotals[r];
+		for (uint32_t s = r * rangeSize, end = RangeEnd(r); s < end; s++)
+		{
+			uint32_t inSlot = slotStart[s];
+			slotStart[s] = offset;
+			offset += inSlot;
+		}
+	}
+
+	void ScatterChunk(uint32_t c)
+	{
+		uint32_t* chunkOffsets = &counts[static_cast<size_t>(c) * countStride];
+		for (uint32_t i = ChunkBegin(c), end = ChunkBegin(c + 1); i < end; i++)
+		{
+#if RASTER_SIMD
+			// Writes land all over the entries; fetch the line a few objects ahead.
+			if (i + 16 < end)
+			{
+				const GridCell& cell = objectCells[i + 16];
+				uint32_t ahead = SlotOf(cell.x, cell.y, cell.z);
+				_mm_prefetch(reinterpret_cast<const char*>(&entries[slotStart[ahead] + chunkOffsets[ahead]]), _MM_HINT_T0);
+			}
+#endif
+			const GridCell& cell = objectCells[i];
+			uint32_t slot = SlotOf(cell.x, cell.y, cell.z);
+			GridEntry& entry = entries[slotStart[slot] + chunkOffsets[slot]++];
+			entry.center = XMFLOAT3(centerX[i], centerY[i], centerZ[i]);
+			entry.radius = radius[i];
+			entry.id = i;
+			entry.cellX = cell.x; entry.cellY = cell.y; entry.cellZ = cell.z;
+		}
+	}
+
+	float cellSize = 1.0f;
+	bool multithreaded = true;
+
+	std::vector<float> centerX, centerY, centerZ, radius;
+
+	// Built by Build().
+	uint32_t objectCount = 0;
+	uint32_t slotMask = 0;
+	uint32_t bitsX = 0, bitsY = 0, maskX = 0, maskY = 0, maskZ = 0;
+	float invCellSize = 1.0f;
+	float maxRadius = 0.0f;
+	std::vector<uint32_t> slotStart = std::vector<uint32_t>(2, 0);	// Slot s holds entries [slotStart[s], slotStart[s + 1]).
+	std::vector<GridEntry> entries;
+	GridStats stats;
+
+	// Sort scratch.
+	uint32_t chunkCount = 1, rangeSize = 1, countStride = 0;
+	std::vector<uint32_t> counts;			// Chunk major, a row of countStride per chunk.
+	std::vector<GridCell> objectCells;
+	std::vector<uint32_t> rangeTotals;
+	std::vector<float> chunkMaxRadius;
+
+	std::shared_ptr<JobSystem> jobs = JobSystem::Shared();
+};
@@ -0,0 +1,243 @@
+#pragma once
+#include <cstdint>
+
+// Sits in front of a device context and drops calls that would rebind what is already bound.
+//
+// Only the state setters are wrapped; draws, maps and updates still go straight to the context.
+// The cache is templated on the context and on a 'Types' struct naming its handle types
+// (Topology, InputLayout, Buffer, Format, VertexShader, PixelShader, GeometryShader,
+// SamplerState, ShaderResourceView, DepthStencilState), so it can front ID3D11DeviceContext
+// or a recording fake with its own handle types.
+// Anything changed behind the cache's back must be followed by Invalidate().
+template<typename Context, typename Types>
+class StateCache
+{
+public:
+	enum Category
+	{
+		CAT_TOPOLOGY,
+		CAT_INPUT_LAYOUT,
+		CAT_VERTEX_BUFFERS,
+		CAT_INDEX_BUFFER,
+		CAT_SHADERS,
+		CAT_CONSTANT_BUFFERS,
+		CAT_SAMPLERS,
+		CAT_SHADER_RESOURCES,
+		CAT_DEPTH_STENCIL,
+		CAT_COUNT
+	};
+
+	struct Stats
+	{
+		uint32_t issued[CAT_COUNT] = {};
+		uint32_t filtered[CAT_COUNT] = {};
+
+		uint32_t TotalIssued() const { uint32_t t = 0; for (int i = 0; i < CAT_COUNT; i++) t += issued[i]; return t; }
+		uint32_t TotalFiltered() const { uint32_t t = 0; for (int i = 0; i < CAT_COUNT; i++) t += filtered[i]; return t; }
+	};
+
+	static const unsigned MaxVertexBuffers = 4;
+	static const unsigned MaxConstantBuffers = 8;
+	static const unsigned MaxSamplers = 4;
+	static const unsigned MaxShaderResources = 8;
+
+	StateCache() { Invalidate(); }
+
+	// Points the cache at a context. Forgets everything if it is a different one.
+	void SetContext(Context* _context)
+	{
+		if (context != _context)
+			Invalidate();
+		context = _context;
+	}
+
+	Context* GetContext() const { return context; }
+
+	// Forget all tracked state; the next call of every kind is issued.
+	void Invalidate()
+	{
+		topology = Entry();
+		inputLayout = Entry();
+		indexBuffer = Entry();
+		depthStencil = Entry();
+		vs = Entry();
+		ps = Entry();
+		gs = Entry();
+		for (unsigned i = 0; i < MaxVertexBuffers; i++)
+			vertexBuffers[i] = Entry();
+		for (unsigned i = 0; i < MaxConstantBuffers; i++)
+			vsConstants[i] = psConstants[i] = Entry();
+		for (unsigned i = 0; i < MaxSamplers; i++)
+			psSamplers[i] = Entry();
+		for (unsigned i = 0; i < MaxShaderResources; i++)
+			psResources[i] = Entry();
+	}
+
+	// Call at the start of each frame.
+	void ResetStats() { stats = Stats(); }
+	const Stats& GetStats() const { return stats; }
+
+	void IASetPrimitiveTopology(typename Types::Topology value)
+	{
+		if (Apply(CAT_TOPOLOGY, topology, static_cast<uintptr_t>(value)))
+			context->IASetPrimitiveTopology(value);
+	}
+
+	void IASetInputLayout(typename Types::InputLayout* layout)
+	{
+		if (Apply(CAT_INPUT_LAYOUT, inputLayout, Key(layout)))
+			context->IASetInputLayout(layout);
+	}
+
+	void IASetVertexBuffers(unsigned startSlot, unsigned count, typename Types::Buffer* const* buffers, const unsigned* strides, const unsigned* offsets)
+	{
+		if (Changed(CAT_VERTEX_BUFFERS, vertexBuffers, MaxVertexBuffers, startSlot, count, buffers, strides, offsets))
+			context->IASetVertexBuffers(startSlot, count, buffers, strides, offsets);
+	}
+
+	void IASetIndexBuffer(typename Types::Buffer* buffer, typename Types::Format format, unsigned offset)
+	{
+		if (Apply(CAT_INDEX_BUFFER, indexBuffer, Key(buffer), static_cast<uintptr_t>(format), offset))
+			context->IASetIndexBuffer(buffer, format, offset);
+	}
+
+	void VSSetShader(typename Types::VertexShader* shader)
+	{
+		if (Apply(CAT_SHADERS, vs, Key(shader)))
+			context->VSSetShader(shader, nullptr, 0);
+	}
+
+	void PSSetShader(typename Types::PixelShader* shader)
+	{
+		if (Apply(CAT_SHADERS, ps, Key(shader)))
+			context->PSSetShader(shader, nullptr, 0);
+	}
+
+	void GSSetShader(typename Types::GeometryShader* shader)
+	{
+		if (Apply(CAT_SHADERS, gs, Key(shader)))
+			context->GSSetShader(shader, nullptr, 0);
+	}
+
+	void VSSetConstantBuffers(unsigned startSlot, unsigned count, typename Types::Buffer* const* buffers)
+	{
+		if (Changed(CAT_CONSTANT_BUFFERS, vsConstants, MaxConstantBuffers, startSlot, count, buffers, nullptr, nullptr))
+			context->VSSetConstantBuffers(startSlot, count, buffers);
+	}
+
+	void PSSetConstantBuffers(unsigned startSlot, unsigned count, typename Types::Buffer* const* buffers)
+	{
+		if (Changed(CAT_CONSTANT_BUFFERS, psConstants, MaxConstantBuffers, startSlot, count, buffers, nullptr, nullptr))
+			context->PSSetConstantBuffers(startSlot, count, buffers);
+	}
+
+	// Offset binds go through the D3D11.1 interface, which may be a different object than 'context'.
+	template<typename Context1>
+	void VSSetConstantBuffers1(Context1* context1, unsigned startSlot, unsigned count, typename Types::Buffer* const* buffers, const unsigned* firstConstant, const unsigned* numConstants)
+	{
+		if (Changed(CAT_CONSTANT_BUFFERS, vsConstants, MaxConstantBuffers, startSlot, count, buffers, firstConstant, numConstants))
+			context1->VSSetConstantBuffers1(startSlot, count, buffers, firstConstant, numConstants);
+	}
+
+	template<typename Context1>
+	void PSSetConstantBuffers1(Context1* context1, unsigned startSlot, unsigned count, typename Types::Buffer* const* buffers, const unsigned* firstConstant, const unsigned* numConstants)
+	{
+		if (Changed(CAT_CONSTANT_BUFFERS, psConstants, MaxConstantBuffers, startSlot, count, buffers, firstConstant, numConstants))
+			context1->PSSetConstantBuffers1(startSlot, count, buffers, firstConstant, numConstants);
+	}
+
+	void PSSetSamplers(unsigned startSlot, unsigned count, typename Types::SamplerState* const* samplers)
+	{
+		if (Changed(CAT_SAMPLERS, psSamplers, MaxSamplers, startSlot, count, samplers, nullptr, nullptr))
+			context->PSSetSamplers(startSlot, count, samplers);
+	}
+
+	void PSSetShaderResources(unsigned startSlot, unsigned count, typename Types::ShaderResourceView* const* views)
+	{
+		if (Changed(CAT_SHADER_RESOURCES, psResources, MaxShaderResources, startSlot, count, views, nullptr, nullptr))
+			context->PSSetShaderResources(startSlot, count, views);
+	}
+
+	void OMSetDepthStencilState(typename Types::DepthStencilState* state, unsigned stencilRef)
+	{
+		if (Apply(CAT_DEPTH_STENCIL, depthStencil, Key(state), stencilRef))
+			context->OMSetDepthStencilState(state, stencilRef);
+	}
+
+private:
+	// One bound value plus up to two qualifiers (stride/offset, format/offset, ...).
+	struct Entry
+	{
+		uintptr_t value = 0;
+		uintptr_t a = 0;
+		uintptr_t b = 0;
+		bool known = false;
+	};
+
+	template<typename T>
+	static uintptr_t Key(T* pointer) { return reinterpret_cast<uintptr_t>(pointer); }
+
+	// Updates one entry. Returns true if the call has to be issued.
+	bool Apply(Category category, Entry& entry, uintptr_t value, uintptr_t a = 0, uintptr_t b = 0)
+	{
+		if (entry.known && entry.value == value && entry.a == a && entry.b == b)
+		{
+			stats.filtered[category]++;
+			return false;
+		}
+		entry.value = value;
+		entry.a = a;
+		entry.b = b;
+		entry.known = true;
+		stats.issued[category]++;
+		return true;
+	}
+
+	// Updates a range of slots. Returns true if any slot changed; ranges past the
+	// tracked slot count are always issued and leave the tracked state unknown.
+	template<typename Resource>
+	bool Changed(Category category, Entry* entries, unsigned maxSlots, unsigned startSlot, unsigned count,
+		Resource* const* resources, const unsigned* a, const unsigned* b)
+	{
+		if (startSlot + count > maxSlots)
+		{
+			for (unsigned i = startSlot; i < maxSlots; i++)
+				entries[i].known = false;
+			stats.issued[category]++;
+			return true;
+		}
+
+		bool changed = false;
+		for (unsigned i = 0; i < count; i++)
+		{
+			Entry& entry = entries[startSlot + i];
+			uintptr_t value = resources ? Key(resources[i]) : 0;
+			uintptr_t qa = a ? a[i] : 0;
+			uintptr_t qb = b ? b[i] : 0;
+			if (!entry.known || entry.value != value || entry.a != qa || entry.b != qb)
+			{
+				entry.value = value;
+				entry.a = qa;
+				entry.b = qb;
+				entry.known = true;
+				changed = true;
+			}
+		}
+
+		if (changed)
+			stats.issued[category]++;
+		else
+			stats.filtered[category]++;
+		return changed;
+	}
+
+	Context* context = nullptr;
+	Entry topology, inputLayout, indexBuffer, depthStencil;
+	Entry vs, ps, gs;
+	Entry vertexBuffers[MaxVertexBuffers];
+	Entry vsConstants[MaxConstantBuffers];
+	Entry psConstants[MaxConstantBuffers];
+	Entry psSamplers[MaxSamplers];
+	Entry psResources[MaxShaderResources];
+	Stats stats;
+};
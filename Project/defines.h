@@ -6,15 +6,25 @@
 #define GATEWARE_ENABLE_CORE
 #define GATEWARE_ENABLE_SYSTEM
 #define GATEWARE_ENABLE_GRAPHICS 
+#define GATEWARE_ENABLE_INPUT
 // Ignore some GRAPHICS libraries we aren't going to use
 #define GATEWARE_DISABLE_GDIRECTX12SURFACE 
-#define GATEWARE_DISABLE_GRASTERSURFACE
 #define GATEWARE_DISABLE_GOPENGLSURFACE
 #define GATEWARE_DISABLE_GVULKANSURFACE 
 
 #include "../Gateware/Gateware.h"
 #include <DirectXMath.h>
+#ifdef _WIN32
 #include <d3dcompiler.h>
+#else
+// The few Windows names the frame logic uses, for headless builds without the Windows SDK.
+#include <csignal>
+#include <cstdint>
+typedef unsigned int UINT;
+typedef float FLOAT;
+#define ARRAYSIZE(a) (sizeof(a) / sizeof(a[0]))
+#define DebugBreak() raise(SIGTRAP)
+#endif
 #include <vector>
 
 using namespace DirectX;
\ No newline at end of file
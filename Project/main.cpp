@@ -1,21 +1,76 @@
 #include "defines.h"
 
 #include "DrawClass.h"
+#include "Benchmarks.h"
+#include "FrameArena.h"
+#include "MemoryTracker.h"
+#include "Profiler.h"
+#include "FrameTimer.h"
+#include "RenderDeviceRecording.h"
+#include "RenderDeviceSoftware.h"
+#ifdef _WIN32
+#include "RenderDeviceD3D11.h"
+#endif
 
 #include <iostream>
 #include <fstream>
 #include <sstream>
 #include <string>
+#include <chrono>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <cstdio>
+#include <new>
 
 using namespace GW;
 using namespace CORE;
 using namespace SYSTEM;
 using namespace GRAPHICS;
 
+// Heap allocations are counted per thread so the frame path can be checked to stay off the heap,
+// and tracked by tag; see FrameHeap and MemoryTracker. The nothrow forms call these.
+void* operator new(size_t size)
+{
+	FrameHeap::OnAllocate();
+	void* memory = MemoryTracker::Allocate(size);
+	if (memory == nullptr)
+		throw std::bad_alloc();
+	return memory;
+}
+
+void* operator new(size_t size, std::align_val_t alignment)
+{
+	FrameHeap::OnAllocate();
+	void* memory = MemoryTracker::Allocate(size, static_cast<size_t>(alignment));
+	if (memory == nullptr)
+		throw std::bad_alloc();
+	return memory;
+}
+
+void operator delete(void* memory) noexcept { MemoryTracker::Free(memory); }
+void operator delete(void* memory, size_t) noexcept { MemoryTracker::Free(memory); }
+void operator delete(void* memory, std::align_val_t) noexcept { MemoryTracker::Free(memory, true); }
+void operator delete(void* memory, size_t, std::align_val_t) noexcept { MemoryTracker::Free(memory, true); }
+void* operator new[](size_t size) { return operator new(size); }
+void* operator new[](size_t size, std::align_val_t alignment) { return operator new(size, alignment); }
+void operator delete[](void* memory) noexcept { MemoryTracker::Free(memory); }
+void operator delete[](void* memory, size_t) noexcept { MemoryTracker::Free(memory); }
+void operator delete[](void* memory, std::align_val_t) noexcept { MemoryTracker::Free(memory, true); }
+void operator delete[](void* memory, size_t, std::align_val_t) noexcept { MemoryTracker::Free(memory, true); }
+
 //Globals//
 unsigned int width, height;
 
 GWindow win;
+const char* const windowTitle = "Joseph_McIntyre_DEV4_FinalWOBJLoader";
+const char* memoryJsonPath = nullptr;	// --memory-json
+const char* profilePath = nullptr;		// --profile
+const char* frameTimesPath = nullptr;	// --frame-times
+double p99BudgetMs = 0.0;				// --p99-budget, 0 for none
+const char* inputRecordPath = nullptr;	// --record-input
+InputLog inputRecording;
+InputLog inputReplay;					// --replay-input, empty without
 GEventReceiver msgs;
 GDirectX11Surface d3d11;
 
@@ -26,19 +81,14 @@ struct OBJVert
 	UINT normI;
 };
 
-void ReadOBJFaceVert(std::string a, OBJVert& v)
+// Reads "pos/uv/normal" in place.
+void ReadOBJFaceVert(const char* a, OBJVert& v)
 {
-	std::string::size_type sz;
-
-	v.posI = std::stoi(a, &sz);
-	std::string::size_type rem = a.find("/");
-	for (std::string::size_type i = 0; i <= rem; i++)
-		a.replace(0, 1, "");
-	v.uvI = std::stoi(a, &sz);
-	rem = a.find("/");
-	for (std::string::size_type i = 0; i <= rem; i++)
-		a.replace(0, 1, "");
-	v.normI = std::stoi(a, &sz);
+	char* next = nullptr;
+
+	v.posI = (UINT)strtol(a, &next, 10);
+	v.uvI = (UINT)strtol(next + 1, &next, 10);
+	v.normI = (UINT)strtol(next + 1, &next, 10);
 
 	// Subtract by 1 since obj starts at 1 instead of 0
 	v.posI -= 1;
@@ -48,22 +98,31 @@ void ReadOBJFaceVert(std::string a, OBJVert& v)
 
 void ReadModel(std::string pathToModel, Mesh::SimpleMesh& mesh)
 {	
-	// Vector to push back verts being read in.
+	PROFILE_SCOPE("ReadModel");
+	MemoryTagScope tag(MemoryTag::Meshes);
+
+	// Vector to push back verts being read in. They and the line strings are only needed while
+	// reading, so they come from one arena freed at the end.
 	std::ifstream in(pathToModel);
-	std::vector<XMFLOAT4> tempPOSVec;
-	std::vector<XMFLOAT3> tempNORMVec;
-	std::vector<XMFLOAT2> tempUVVec;
+	LinearArena scratch(1024 * 1024, MemoryTag::Loader);
+	ArenaVector<XMFLOAT4> tempPOSVec(&scratch);
+	ArenaVector<XMFLOAT3> tempNORMVec(&scratch);
+	ArenaVector<XMFLOAT2> tempUVVec(&scratch);
+	ArenaString str(&scratch), val(&scratch), a(&scratch), b(&scratch), c(&scratch), d(&scratch);
+	ArenaStringStream line{ ArenaString(&scratch) };
 
 	UINT indice = 0;
 
 	// Read OBJ file in.
 	if (in.is_open())
 	{
-		for (std::string str; std::getline(in, str);)   //read stream line by line
+		while (std::getline(in, str))   //read stream line by line
 		{
-			std::istringstream in(str);
+			line.str(str);
+			line.clear();
+			std::istream& in = line;
 
-			std::string val;
+			val.clear();
 			in >> val;
 
 			// Vertex
@@ -93,17 +152,20 @@ void ReadModel(std::string pathToModel, Mesh::SimpleMesh& mesh)
 			// Face
 			else if (val == "f")
 			{
-				std::string a, b, c, d;
+				a.clear();
+				b.clear();
+				c.clear();
+				d.clear();
 				in >> d >> c >> b >> a; // Read in backwards to convert to left handed
 
 				// If it's a quad, break it into two triangles
 				if (!a.empty())
 				{
 					OBJVert av, bv, cv, dv;
-					ReadOBJFaceVert(a, av);
-					ReadOBJFaceVert(b, bv);
-					ReadOBJFaceVert(c, cv);
-					ReadOBJFaceVert(d, dv);
+					ReadOBJFaceVert(a.c_str(), av);
+					ReadOBJFaceVert(b.c_str(), bv);
+					ReadOBJFaceVert(c.c_str(), cv);
+					ReadOBJFaceVert(d.c_str(), dv);
 
 					Mesh::SimpleVertex v = {
 						{tempPOSVec[av.posI]},
@@ -205,9 +267,9 @@ void ReadModel(std::string pathToModel, Mesh::SimpleMesh& mesh)
 				else
 				{
 					OBJVert bv, cv, dv;
-					ReadOBJFaceVert(b, bv);
-					ReadOBJFaceVert(c, cv);
-					ReadOBJFaceVert(d, dv);
+					ReadOBJFaceVert(b.c_str(), bv);
+					ReadOBJFaceVert(c.c_str(), cv);
+					ReadOBJFaceVert(d.c_str(), dv);
 
 					Mesh::SimpleVertex v = {
 						{tempPOSVec[dv.posI]},
@@ -273,12 +335,594 @@ void ReadModel(std::string pathToModel, Mesh::SimpleMesh& mesh)
 	char* e = strerror(errno);
 }
 
+bool LoadModels(Mesh::SimpleMesh& crossbowMesh, Mesh::SimpleMesh& balloonMesh)
+{
+	ReadModel("Models/crossbow.obj", crossbowMesh);
+	ReadModel("Models/balloon.obj", balloonMesh);
+	if (crossbowMesh.indicesList.empty() || balloonMesh.indicesList.empty())
+	{
+		std::cout << "Models could not be loaded, run from the directory that contains Models/\n";
+		return false;
+	}
+	return true;
+}
+
+// Prints the simulation side of a run: steps per frame and their cost, and where the first
+// balloon ended up, which matches between display rates for the same simulated time.
+void PrintSimulation(const Mesh& mainScene, double frames, double displayHz, double simMs, unsigned long long steps)
+{
+	std::cout << "sim: " << steps / frames << " steps/frame at " << displayHz << " Hz, " << simMs / frames << " ms/frame\n";
+	XMFLOAT4 camera = mainScene.GetCameraPosition();
+	std::cout << "sim state after " << mainScene.GetTimestep().GetStepCount() << " steps: ";
+	if (mainScene.GetBalloonCount() > 0)
+	{
+		XMFLOAT4 balloon = mainScene.GetBalloonPosition(0);
+		std::cout << "balloon 0 at " << balloon.x << ", " << balloon.y << ", " << balloon.z;
+	}
+	else
+		std::cout << "every balloon popped";
+	std::cout << ", camera at " << camera.x << ", " << camera.y << ", " << camera.z << "\n";
+}
+
+// Replays --replay-input into the scene and records its input for --record-input.
+void AttachInput(Mesh& mainScene)
+{
+	if (inputReplay.GetFrameCount() > 0)
+		mainScene.SetInputReplay(&inputReplay);
+	if (inputRecordPath != nullptr)
+		mainScene.SetInputRecording(&inputRecording);
+}
+
+// Writes --record-input. Only once the simulation has stopped.
+bool SaveInput()
+{
+	if (inputRecordPath == nullptr || inputRecording.Save(inputRecordPath))
+		return true;
+	std::cout << "Could not write " << inputRecordPath << "\n";
+	return false;
+}
+
+// Prints heap use by tag, with allocation rates since 'since', and writes it to --memory-json.
+// Returns false when a tag went over its --memory-budget.
+bool ReportMemory(const MemoryReport* since, bool print)
+{
+	MemoryReport report = MemoryTracker::Report(since);
+	if (print)
+		report.Print(std::cout);
+	if (memoryJsonPath != nullptr)
+	{
+		std::ofstream out(memoryJsonPath);
+		report.WriteJson(out);
+		if (!out)
+			std::cout << "Could not write " << memoryJsonPath << "\n";
+	}
+	if (report.OverBudget())
+		std::cout << "Memory budget exceeded\n";
+	return !report.OverBudget();
+}
+
+// Prints the time spent in each profiled scope per frame and writes the scopes to --profile as
+// a Chrome trace. Does nothing without --profile.
+void ReportProfile(double frames, bool print)
+{
+	if (profilePath == nullptr)
+		return;
+	if (print)
+	{
+		std::vector<ProfileStat> stats;
+		Profiler::CollectStats(stats);
+		for (const ProfileStat& stat : stats)
+			std::cout << "profile " << stat.name << ": " << stat.count / frames << " calls/frame, " << stat.totalMs / frames << " ms/frame (worst " << stat.maxMs << ")\n";
+	}
+	if (!Profiler::WriteChromeTrace(profilePath))
+		std::cout << "Could not write " << profilePath << "\n";
+}
+
+// Prints the distribution of a run's frame times and writes every frame to --frame-times. Returns
+// false when the 99th percentile went over --p99-budget.
+bool ReportFrameTimes(const FrameTimer& timer, bool print)
+{
+	FrameTimeStats stats = timer.GetRunStats();
+	if (print)
+	{
+		std::cout << "frame ms: mean " << stats.meanMs << ", p50 " << stats.p50Ms << ", p95 " << stats.p95Ms << ", p99 " << stats.p99Ms
+			<< ", max " << stats.maxMs << ", " << stats.stutters << " stutters";
+		if (p99BudgetMs > 0.0)
+			std::cout << ", p99 budget " << p99BudgetMs << (stats.p99Ms > p99BudgetMs ? " EXCEEDED" : "");
+		std::cout << "\n";
+	}
+	if (frameTimesPath != nullptr && !timer.Write(frameTimesPath))
+		std::cout << "Could not write " << frameTimesPath << "\n";
+	return p99BudgetMs <= 0.0 || stats.p99Ms <= p99BudgetMs;
+}
+
+// Shows the frame time in the window's title bar.
+void ShowFrameTimes(double frameMs, const FrameTimeStats& rolling, void*)
+{
+	char title[160];
+	snprintf(title, sizeof(title), "%s - %.2f ms (p99 %.2f ms, %u stutters)", windowTitle, frameMs, rolling.p99Ms, rolling.stutters);
+	win.SetWindowName(title);
+}
+
+// Sums the per stage timings of a run's frames.
+struct PipelineTotals
+{
+	PipelineStats sum;
+	double worstLatencyMs = 0.0;
+
+	void Add(const PipelineStats& frame)
+	{
+		sum.simMs += frame.simMs;
+		sum.simWaitMs += frame.simWaitMs;
+		sum.queueMs += frame.queueMs;
+		sum.renderWaitMs += frame.renderWaitMs;
+		sum.renderMs += frame.renderMs;
+		sum.latencyMs += frame.latencyMs;
+		worstLatencyMs = frame.latencyMs > worstLatencyMs ? frame.latencyMs : worstLatencyMs;
+	}
+
+	void Print(double frames, bool pipelined) const
+	{
+		std::cout << (pipelined ? "pipelined" : "serial") << " ms/frame: sim " << sum.simMs / frames << " (waited " << sum.simWaitMs / frames
+			<< "), queued " << sum.queueMs / frames << ", render " << sum.renderMs / frames << " (waited " << sum.renderWaitMs / frames << ")\n";
+		std::cout << "latency ms: " << sum.latencyMs / frames << " (worst " << worstLatencyMs << ")\n";
+	}
+};
+
+// Runs the frame logic against the recording device and reports CPU cost, draws and upload volume.
+// Frames are 1 / 'displayHz' seconds apart, so the simulation runs the same whatever the CPU cost.
+// 'pipelined' simulates on a second thread while this one renders. 'recordThreads' splits recording
+// the draws across that many threads.
+int RunHeadless(unsigned int frameCount, const char* recordPath, double displayHz, bool pipelined, uint32_t recordThreads)
+{
+	Mesh::SimpleMesh crossbowMesh;
+	Mesh::SimpleMesh balloonMesh;
+	if (!LoadModels(crossbowMesh, balloonMesh))
+		return 1;
+
+	RecordingRenderDevice device(1280, 768);
+	device.SetRecordPayloads(recordPath != nullptr);
+	device.SetRecordThreads(recordThreads);
+	Mesh mainScene(device, win, &crossbowMesh, &balloonMesh, L"Textures/LongMattedGrass.dds", L"Textures/lowpoly_crossbow.dds");
+	AttachInput(mainScene);
+
+	float clr[] = { 0.2f, 0.2f, 0.4f, 1 };
+	double totalMs = 0.0, worstMs = 0.0, simMs = 0.0, occlusionMs = 0.0, frustumMs = 0.0;
+	unsigned long long steps = 0, frustumTested = 0, frustumCulled = 0, occlusionTested = 0, occlusionCulled = 0;
+	unsigned long long draws = 0, triangles = 0, stateCalls = 0, uploads = 0, bytesUploaded = 0, streamBytes = 0;
+	unsigned long long arenaAllocations = 0, arenaBytes = 0, frameHeapAllocations = 0;
+	size_t arenaHighWater = 0;
+	PipelineTotals pipeline;
+	FrameTimer frameTimer;
+	frameTimer.SetRecording(true, frameCount);
+	MemoryReport memoryStart = MemoryTracker::Report();
+	if (pipelined)
+		mainScene.StartPipeline(1.0 / displayHz, frameCount);
+	for (unsigned int i = 0; i < frameCount; i++)
+	{
+		PROFILE_SCOPE("Frame");
+		size_t streamStart = device.GetStream().size();
+		std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+		if (!pipelined)
+			mainScene.Update(1.0 / displayHz);
+		device.BeginFrame();
+		device.Clear(clr, 1.0f);
+		if (pipelined)
+			mainScene.RenderPipelined();
+		else
+			mainScene.Render();
+		device.EndFrame(false);
+		mainScene.FramePresented();
+
+		double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+		totalMs += ms;
+		if (ms > worstMs)
+			worstMs = ms;
+		frameTimer.AddFrame(ms);
+		simMs += mainScene.GetSimStats().ms;
+		steps += mainScene.GetSimStats().steps;
+		pipeline.Add(mainScene.GetPipelineStats());
+
+		const RenderStats& stats = device.GetStats();
+		draws += stats.draws;
+		triangles += stats.triangles;
+		stateCalls += stats.stateCalls;
+		uploads += stats.uploads;
+		bytesUploaded += stats.bytesUploaded;
+		streamBytes += device.GetStream().size() - streamStart;
+
+		const FrustumStats& frustum = mainScene.GetFrustumStats();
+		frustumTested += frustum.tested;
+		frustumCulled += frustum.culled;
+		frustumMs += frustum.ms;
+		const OcclusionStats& occlusion = mainScene.GetOcclusionStats();
+		occlusionTested += occlusion.tested;
+		occlusionCulled += occlusion.culled;
+		occlusionMs += occlusion.ms;
+		const ArenaStats& arena = mainScene.GetArenaStats();
+		arenaAllocations += arena.allocations;
+		arenaBytes += arena.bytes;
+		arenaHighWater = arena.highWater > arenaHighWater ? arena.highWater : arenaHighWater;
+		frameHeapAllocations += mainScene.GetFrameHeapAllocations();
+
+		// Only keep the stream around when it is going to be saved.
+		if (recordPath == nullptr)
+			device.ClearStream();
+	}
+	mainScene.StopPipeline();
+
+	if (!SaveInput())
+		return 1;
+	if (recordPath != nullptr && !device.SaveStream(recordPath))
+	{
+		std::cout << "Could not write " << recordPath << "\n";
+		return 1;
+	}
+
+	double frames = frameCount > 0 ? (double)frameCount : 1.0;
+	std::cout << "frames: " << frameCount << "\n";
+	std::cout << "cpu ms/frame: " << totalMs / frames << " (worst " << worstMs << ")\n";
+	bool paced = ReportFrameTimes(frameTimer, true);
+	PrintSimulation(mainScene, frames, displayHz, simMs, steps);
+	pipeline.Print(frames, pipelined);
+	std::cout << "draws/frame: " << draws / frames << "\n";
+	std::cout << "triangles/frame: " << triangles / frames << "\n";
+	std::cout << "state calls/frame: " << stateCalls / frames << "\n";
+	std::cout << "uploads/frame: " << uploads / frames << " (" << bytesUploaded / frames << " bytes)\n";
+	std::cout << "stream bytes/frame: " << streamBytes / frames << "\n";
+	std::cout << "frustum/frame: " << frustumCulled / frames << " of " << frustumTested / frames << " culled, " << frustumMs / frames << " ms\n";
+	std::cout << "occlusion/frame: " << occlusionCulled / frames << " of " << occlusionTested / frames << " culled, " << occlusionMs / frames << " ms\n";
+	std::cout << "frame arena/frame: " << arenaAllocations / frames << " allocations, " << arenaBytes / frames << " bytes (high water " << arenaHighWater << ")\n";
+	std::cout << "frame heap allocations/frame: " << frameHeapAllocations / frames << "\n";
+	ReportProfile(frames, true);
+	return ReportMemory(&memoryStart, true) && paced ? 0 : 1;
+}
+
+// Runs the frame logic on the software rasterizer. Windowed it presents through GRasterSurface
+// until the window closes; headless it draws 'frameCount' frames 1 / 'displayHz' seconds apart and
+// reports the raster cost. 'capturePath' receives the last frame as a TGA. 'pipelined' simulates on
+// a second thread while this one renders.
+int RunSoftware(bool windowed, unsigned int frameCount, const char* capturePath, bool multithreaded, RasterKernel kernel, double displayHz, bool pipelined)
+{
+	Mesh::SimpleMesh crossbowMesh;
+	Mesh::SimpleMesh balloonMesh;
+	if (!LoadModels(crossbowMesh, balloonMesh))
+		return 1;
+
+	unsigned int deviceWidth = 1280, deviceHeight = 768;
+	GRasterSurface surface;
+	if (windowed)
+	{
+		if (-win.Create(0, 0, 1280, 768, GWindowStyle::WINDOWEDBORDERED) || -surface.Create(win))
+		{
+			std::cout << "Could not open a window, try --headless\n";
+			return 1;
+		}
+		win.SetWindowName(windowTitle);
+		+win.GetClientWidth(deviceWidth);
+		+win.GetClientHeight(deviceHeight);
+	}
+
+	SoftwareRenderDevice device(deviceWidth, deviceHeight);
+	device.GetRasterizer().SetMultithreaded(multithreaded);
+	device.GetRasterizer().SetKernel(kernel);
+	if (windowed)
+		device.SetPresentSurface(surface);
+	Mesh mainScene(device, win, &crossbowMesh, &balloonMesh, L"Textures/LongMattedGrass.dds", L"Textures/lowpoly_crossbow.dds");
+	AttachInput(mainScene);
+
+	float clr[] = { 0.2f, 0.2f, 0.4f, 1 };
+	double totalMs = 0.0, worstMs = 0.0, simMs = 0.0, rasterMs = 0.0, occlusionMs = 0.0, frustumMs = 0.0;
+	unsigned long long steps = 0, frustumTested = 0, frustumCulled = 0, occlusionTested = 0, occlusionCulled = 0;
+	unsigned long long trianglesSubmitted = 0, trianglesCulled = 0, pixelsShaded = 0, pixelsWritten = 0;
+	PipelineTotals pipeline;
+	FrameTimer frameTimer;
+	frameTimer.SetRecording(true, windowed ? 0 : frameCount);
+	if (windowed)
+		frameTimer.SetOverlay(ShowFrameTimes, nullptr);
+	MemoryReport memoryStart = MemoryTracker::Report();
+	unsigned int frame = 0;
+	std::chrono::steady_clock::time_point last = std::chrono::steady_clock::now();
+	if (pipelined)
+		mainScene.StartPipeline(windowed ? 0.0 : 1.0 / displayHz, windowed ? UINT64_MAX : frameCount);
+	for (; windowed ? +win.ProcessWindowEvents() : frame < frameCount; frame++)
+	{
+		PROFILE_SCOPE("Frame");
+		std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+		double frameSeconds = windowed ? std::chrono::duration<double>(start - last).count() : 1.0 / displayHz;
+		last = start;
+
+		device.BeginFrame();
+		device.Clear(clr, 1.0f);
+		if (windowed)
+		{
+			bool isFocused;
+			+win.IsFocus(isFocused);
+			if (isFocused)
+				mainScene.UserInput();
+		}
+		if (pipelined)
+			mainScene.RenderPipelined();
+		else
+		{
+			mainScene.Update(frameSeconds);
+			mainScene.Render();
+		}
+		device.EndFrame(false);
+		mainScene.FramePresented();
+
+		double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+		totalMs += ms;
+		if (ms > worstMs)
+			worstMs = ms;
+		// Windowed, a frame lasts from one present to the next; headless there is nothing to wait for.
+		if (windowed)
+			frameTimer.Tick();
+		else
+			frameTimer.AddFrame(ms);
+		simMs += mainScene.GetSimStats().ms;
+		steps += mainScene.GetSimStats().steps;
+		pipeline.Add(mainScene.GetPipelineStats());
+
+		const RasterStats& stats = device.GetRasterStats();
+		rasterMs += stats.rasterMs;
+		trianglesSubmitted += stats.trianglesSubmitted;
+		trianglesCulled += stats.trianglesCulled;
+		pixelsShaded += stats.pixelsShaded;
+		pixelsWritten += stats.pixelsWritten;
+
+		const FrustumStats& frustum = mainScene.GetFrustumStats();
+		frustumTested += frustum.tested;
+		frustumCulled += frustum.culled;
+		frustumMs += frustum.ms;
+		const OcclusionStats& occlusion = mainScene.GetOcclusionStats();
+		occlusionTested += occlusion.tested;
+		occlusionCulled += occlusion.culled;
+		occlusionMs += occlusion.ms;
+	}
+	mainScene.StopPipeline();
+
+	if (!SaveInput())
+		return 1;
+	if (capturePath != nullptr && !device.SaveCapture(capturePath))
+	{
+		std::cout << "Could not write " << capturePath << "\n";
+		return 1;
+	}
+	if (windowed)
+	{
+		ReportProfile(frame > 0 ? (double)frame : 1.0, false);
+		bool paced = ReportFrameTimes(frameTimer, false);
+		return ReportMemory(&memoryStart, false) && paced ? 0 : 1;
+	}
+
+	double frames = frame > 0 ? (double)frame : 1.0;
+	std::cout << "frames: " << frame << " (" << deviceWidth << "x" << deviceHeight << ", " << RasterKernelName(device.GetRasterizer().GetKernel())
+		<< (multithreaded ? ", tiles in parallel" : ", one thread") << ")\n";
+	std::cout << "cpu ms/frame: " << totalMs / frames << " (worst " << worstMs << ")\n";
+	bool paced = ReportFrameTimes(frameTimer, true);
+	PrintSimulation(mainScene, frames, displayHz, simMs, steps);
+	pipeline.Print(frames, pipelined);
+	std::cout << "raster ms/frame: " << rasterMs / frames << "\n";
+	std::cout << "triangles/frame: " << trianglesSubmitted / frames << " (" << trianglesCulled / frames << " culled)\n";
+	std::cout << "pixels shaded/frame: " << pixelsShaded / frames << " (" << pixelsWritten / frames << " written)\n";
+	std::cout << "frustum/frame: " << frustumCulled / frames << " of " << frustumTested / frames << " culled, " << frustumMs / frames << " ms\n";
+	std::cout << "occlusion/frame: " << occlusionCulled / frames << " of " << occlusionTested / frames << " culled, " << occlusionMs / frames << " ms\n";
+	ReportProfile(frames, true);
+	return ReportMemory(&memoryStart, true) && paced ? 0 : 1;
+}
+
 // lets pop a window and use D3D11 to clear to a green screen
-int main()
+// --headless [--frames N] [--hz N] [--record file] runs without a window or GPU instead, with frames 1 / N seconds apart.
+// --serial simulates and renders on one thread instead of simulating a frame ahead on a second one.
+// --record-threads N records the draws on N threads, with D3D11 deferred contexts or into the headless stream.
+// --profile trace.json times loading, input, simulation, culling and submission and writes a Chrome trace.
+// --memory-json file writes heap use by tag when the run ends; --memory-budget tag=MB fails the run if
+// the tag's peak goes over, 'total' for all of them.
+// --frame-times file.csv|file.json writes every frame's time with its percentiles and stutters;
+// --p99-budget ms fails the run if the 99th percentile goes over.
+// --record-input file logs every simulated frame's input and frame time; --replay-input file runs
+// the simulation on a log instead of the mouse and keyboard, for the log's frames without --frames.
+// --software [--capture file.tga] [--single-thread] [--kernel scalar|sse2|avx2] draws on the CPU, in a window or with --headless.
+// --bench-pack measures stepping and packing balloon instances against building each one's matrix.
+// --bench-constant-ring checks the constant ring's wrapping, fencing and DISCARD fallback against a fake GPU.
+// --bench-state-cache checks which state calls the state cache drops against a recording fake context.
+// --bench-sort times the draw queue's radix sort against std::sort on ten thousand and a million packets.
+// --bench-raster [--single-thread] measures the software rasterizer's kernels.
+// --bench-cull measures frustum culling of a million boxes.
+// --bench-bvh measures building, refitting and querying the scene BVH.
+// --bench-pick measures ray casts against the balloon's triangle BVH.
+// --bench-collision measures batched ray against sphere and box tests.
+// --bench-grid measures rebuilding and querying the spatial grid over 100k moving objects.
+// --bench-jobs measures the job system's scaling from one thread to every core.
+// --bench-profiler measures what a profiled scope costs; each has to take under 50 ns.
+// --bench-gpu-timer checks GPU pass timing against a fake GPU and measures what it costs.
+// --bench-record measures recording draws on several threads and checks they draw what one thread does.
+// --bench-record-stream checks a known frame's recorded stream byte for byte and replays variants of it.
+int main(int argc, char** argv)
 {
+	bool headless = false;
+	bool software = false;
+	bool multithreaded = true;
+	bool pipelined = true;
+	bool benchPack = false;
+	bool benchConstantRing = false;
+	bool benchStateCache = false;
+	bool benchSort = false;
+	bool benchRaster = false;
+	bool benchCull = false;
+	bool benchBvh = false;
+	bool benchPick = false;
+	bool benchCollision = false;
+	bool benchGrid = false;
+	bool benchJobs = false;
+	bool benchRecord = false;
+	bool benchRecordStream = false;
+	bool benchProfiler = false;
+	bool benchGpuTimer = false;
+	uint32_t recordThreads = 1;
+	RasterKernel kernel = SoftwareRasterizer::BestKernel();
+	unsigned int frameCount = 600;
+	bool framesGiven = false;
+	const char* replayPath = nullptr;
+	double displayHz = 60.0;
+	const char* recordPath = nullptr;
+	const char* capturePath = nullptr;
+	for (int i = 1; i < argc; i++)
+	{
+		if (strcmp(argv[i], "--headless") == 0)
+			headless = true;
+		else if (strcmp(argv[i], "--software") == 0)
+			software = true;
+		else if (strcmp(argv[i], "--single-thread") == 0)
+			multithreaded = false;
+		else if (strcmp(argv[i], "--serial") == 0)
+			pipelined = false;
+		else if (strcmp(argv[i], "--bench-pack") == 0)
+			benchPack = true;
+		else if (strcmp(argv[i], "--bench-constant-ring") == 0)
+			benchConstantRing = true;
+		else if (strcmp(argv[i], "--bench-state-cache") == 0)
+			benchStateCache = true;
+		else if (strcmp(argv[i], "--bench-sort") == 0)
+			benchSort = true;
+		else if (strcmp(argv[i], "--bench-raster") == 0)
+			benchRaster = true;
+		else if (strcmp(argv[i], "--bench-cull") == 0)
+			benchCull = true;
+		else if (strcmp(argv[i], "--bench-bvh") == 0)
+			benchBvh = true;
+		else if (strcmp(argv[i], "--bench-pick") == 0)
+			benchPick = true;
+		else if (strcmp(argv[i], "--bench-collision") == 0)
+			benchCollision = true;
+		else if (strcmp(argv[i], "--bench-grid") == 0)
+			benchGrid = true;
+		else if (strcmp(argv[i], "--bench-jobs") == 0)
+			benchJobs = true;
+		else if (strcmp(argv[i], "--bench-record") == 0)
+			benchRecord = true;
+		else if (strcmp(argv[i], "--bench-record-stream") == 0)
+			benchRecordStream = true;
+		else if (strcmp(argv[i], "--bench-profiler") == 0)
+			benchProfiler = true;
+		else if (strcmp(argv[i], "--bench-gpu-timer") == 0)
+			benchGpuTimer = true;
+		else if (strcmp(argv[i], "--profile") == 0 && i + 1 < argc)
+			profilePath = argv[++i];
+		else if (strcmp(argv[i], "--record-threads") == 0 && i + 1 < argc)
+			recordThreads = (uint32_t)strtoul(argv[++i], nullptr, 10);
+		else if (strcmp(argv[i], "--frame-times") == 0 && i + 1 < argc)
+			frameTimesPath = argv[++i];
+		else if (strcmp(argv[i], "--p99-budget") == 0 && i + 1 < argc)
+			p99BudgetMs = strtod(argv[++i], nullptr);
+		else if (strcmp(argv[i], "--memory-json") == 0 && i + 1 < argc)
+			memoryJsonPath = argv[++i];
+		else if (strcmp(argv[i], "--memory-budget") == 0 && i + 1 < argc)
+		{
+			i++;
+			const char* equals = strchr(argv[i], '=');
+			std::string name(argv[i], equals != nullptr ? equals - argv[i] : strlen(argv[i]));
+			MemoryTag tag = MemoryTag::Count;
+			if (equals == nullptr || (name != "total" && !ParseMemoryTag(name.c_str(), tag)))
+			{
+				std::cout << "--memory-budget takes tag=MB, the tag being total or one of general, meshes, textures, transient, loader\n";
+				return 1;
+			}
+			MemoryTracker::SetBudget(tag, (uint64_t)(strtod(equals + 1, nullptr) * 1024.0 * 1024.0));
+		}
+		else if (strcmp(argv[i], "--kernel") == 0 && i + 1 < argc)
+		{
+			i++;
+			kernel = strcmp(argv[i], "scalar") == 0 ? RasterKernel::Scalar : (strcmp(argv[i], "sse2") == 0 ? RasterKernel::Sse2 : RasterKernel::Avx2);
+			if (!SoftwareRasterizer::IsKernelSupported(kernel))
+			{
+				std::cout << "The " << argv[i] << " kernel isn't supported on this CPU\n";
+				return 1;
+			}
+		}
+		else if (strcmp(argv[i], "--frames") == 0 && i + 1 < argc)
+		{
+			frameCount = (unsigned int)strtoul(argv[++i], nullptr, 10);
+			framesGiven = true;
+		}
+		else if (strcmp(argv[i], "--record-input") == 0 && i + 1 < argc)
+			inputRecordPath = argv[++i];
+		else if (strcmp(argv[i], "--replay-input") == 0 && i + 1 < argc)
+			replayPath = argv[++i];
+		else if (strcmp(argv[i], "--hz") == 0 && i + 1 < argc)
+		{
+			displayHz = strtod(argv[++i], nullptr);
+			displayHz = displayHz > 0.0 ? displayHz : 60.0;
+		}
+		else if (strcmp(argv[i], "--record") == 0 && i + 1 < argc)
+			recordPath = argv[++i];
+		else if (strcmp(argv[i], "--capture") == 0 && i + 1 < argc)
+			capturePath = argv[++i];
+	}
+
+	if (benchPack)
+		return RunPackBenchmark();
+	if (benchConstantRing)
+		return RunConstantRingBenchmark();
+	if (benchStateCache)
+		return RunStateCacheBenchmark();
+	if (benchSort)
+		return RunSortBenchmark();
+	if (benchRaster)
+		return RunRasterBenchmark(multithreaded);
+	if (benchCull)
+		return RunCullBenchmark();
+	if (benchBvh)
+		return RunBvhBenchmark();
+	if (benchPick)
+		return RunPickBenchmark();
+	if (benchCollision)
+		return RunCollisionBenchmark();
+	if (benchGrid)
+		return RunGridBenchmark();
+	if (benchJobs)
+		return RunJobBenchmark();
+	if (benchRecord)
+		return RunRecordBenchmark();
+	if (benchRecordStream)
+		return RunRecordStreamBenchmark();
+	if (benchProfiler)
+		return RunProfilerBenchmark();
+	if (benchGpuTimer)
+		return RunGpuTimerBenchmark();
+
+	if (replayPath != nullptr)
+	{
+		if (!inputReplay.Load(replayPath))
+		{
+			std::cout << "Could not read an input log from " << replayPath << "\n";
+			return 1;
+		}
+		frameCount = framesGiven ? frameCount : inputReplay.GetFrameCount();
+	}
+
+	if (profilePath != nullptr)
+	{
+		Profiler::SetEnabled(true);
+		Profiler::SetThreadName("main");
+	}
+
+#ifndef _WIN32
+	// There's no D3D11 off Windows, the window is always drawn in software.
+	if (!headless)
+		software = true;
+#endif
+	if (software)
+		return RunSoftware(!headless, frameCount, capturePath, multithreaded, kernel, displayHz, pipelined);
+	if (headless)
+		return RunHeadless(frameCount, recordPath, displayHz, pipelined, recordThreads);
+
+#ifdef _WIN32
 	if (+win.Create(0, 0, 1280, 768, GWindowStyle::WINDOWEDBORDERED))
 	{
-		win.SetWindowName("Joseph_McIntyre_DEV4_FinalWOBJLoader");
+		win.SetWindowName(windowTitle);
 
 		+win.GetWidth(width);
 		+win.GetHeight(height);
@@ -297,45 +941,63 @@ int main()
 		{
 			Mesh::SimpleMesh crossbowMesh;
 			Mesh::SimpleMesh balloonMesh;
-			ReadModel(".\\Models\\crossbow.obj", crossbowMesh);
-			ReadModel(".\\Models\\balloon.obj", balloonMesh);
-
-			Mesh mainScene(d3d11, win, &crossbowMesh, &balloonMesh, L"Textures\\LongMattedGrass.dds", L"Textures\\lowpoly_crossbow.dds");
-
+			ReadModel("Models/crossbow.obj", crossbowMesh);
+			ReadModel("Models/balloon.obj", balloonMesh);
+
+			D3D11RenderDevice device(d3d11, win);
+			device.SetRecordThreads(recordThreads);
+			Mesh mainScene(device, win, &crossbowMesh, &balloonMesh, L"Textures/LongMattedGrass.dds", L"Textures/lowpoly_crossbow.dds");
+			AttachInput(mainScene);
+
+			// The simulation runs a frame ahead on its own thread unless --serial.
+			MemoryReport memoryStart = MemoryTracker::Report();
+			FrameTimer frameTimer;
+			frameTimer.SetRecording(true);
+			frameTimer.SetOverlay(ShowFrameTimes, nullptr);
+			std::chrono::steady_clock::time_point last = std::chrono::steady_clock::now();
+			if (pipelined)
+				mainScene.StartPipeline();
 			while (+win.ProcessWindowEvents())
 			{
-				IDXGISwapChain* swap = nullptr;
-				ID3D11DeviceContext* con = nullptr;
-				ID3D11RenderTargetView* view = nullptr;
-				ID3D11DepthStencilView* depthview = nullptr;
-
-				if (+d3d11.GetImmediateContext((void**)&con) &&
-					+d3d11.GetRenderTargetView((void**)&view) &&
-					+d3d11.GetSwapchain((void**)&swap) &&
-					+d3d11.GetDepthStencilView((void**)&depthview))
+				PROFILE_SCOPE("Frame");
+				// Simulate the time since the last frame in fixed steps.
+				std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+				double frameSeconds = std::chrono::duration<double>(now - last).count();
+				last = now;
+
+				device.BeginFrame();
+
+				// Clear the render target and depth stencil views.
+				device.Clear(clr, 1.0f);
+
+				// Check if window is in focus for user input.
+				bool isFocused;
+				+win.IsFocus(isFocused);
+				if(isFocused)
+					mainScene.UserInput();
+
+				// Render the scene out.
+				if (pipelined)
+					mainScene.RenderPipelined();
+				else
 				{
-					// Clear the render target view.
-					con->ClearRenderTargetView(view, clr);
-					// Clear the depth stencil view.
-					con->ClearDepthStencilView(depthview, D3D11_CLEAR_DEPTH, 1.0f, 0);
-
-					// Check if window is in focus for user input.
-					bool isFocused;
-					+win.IsFocus(isFocused);
-					if(isFocused)
-						mainScene.UserInput();
-
-					// Render the scene out.
+					mainScene.Update(frameSeconds);
 					mainScene.Render();
-					
-					swap->Present(1, 0);
-					con->Release();
-					view->Release();
-					depthview->Release();
-					swap->Release();
 				}
+
+				device.EndFrame(true);
+				mainScene.FramePresented();
+				frameTimer.Tick();
 			}
+			mainScene.StopPipeline();
+			if (!SaveInput())
+				return 1;
+			ReportProfile(1.0, false);
+			bool paced = ReportFrameTimes(frameTimer, false);
+			if (!ReportMemory(&memoryStart, false) || !paced)
+				return 1;
 		}
 	}
+#endif
 	return 0;
-}
\ No newline at end of file
+}